@@ -5,12 +5,20 @@
 
 #include <vector>
 #include <map>
+#include <ostream>
 
 #include "Object.h"
 #include "Material.h"
+#include "MaterialTable.h"
 #include "Camera.h"
 #include "Controls.h"
+#include "JobSystem.h"
+#include "LightGrid.h"
 #include "Texture.h"
+#include "SceneGraph.h"
+#include "SceneLoader.h"
+#include "StaticBatcher.h"
+#include "VoxelBrickPager.h"
 #include "Application.h"
 
 class Application {
@@ -21,7 +29,60 @@ public:
 	int getWindowWidth();
 	int getWindowHeight();
 	GLFWwindow* getWindow();
+	// Framebuffer draw() renders the frame into instead of the window, 0 for the window.
+	// Needs a color and a depth attachment of the window size.
+	void setOutputFramebuffer(GLuint framebuffer);
 	Camera* getCamera();
+	Controls* getControls();
+	JobSystem* getJobSystem();
+	bool isLoading();
+
+	// Shadow settings, must be set before initialize()
+	void setShadowMapSize(int size);
+	void setShadowCascades(int numCascades);
+	// Marks the shadow map and the voxel texture for an update before the next frame
+	void setLightDirection(glm::vec3 direction);
+	// Voxelize with compute shaders instead of the geometry shader, must be set before initialize()
+	void setComputeVoxelization(bool enable);
+	// Cone trace paged bricks from a file instead of voxelizing, must be set before initialize()
+	void setBrickPool(std::string filename, size_t budgetBytes);
+	// Write the voxelized scene as a brick file once it is fully loaded
+	void setBakeBricks(std::string filename);
+	// Diffuse bounce from a grid of size^3 irradiance probes instead of diffuse cones,
+	// 0 to disable. Must be set before initialize().
+	void setProbeGridSize(int size);
+	// Cull meshlets on the GPU before the shadow map, voxelization and main passes, must be set before initialize()
+	void setClusterCulling(bool enable);
+	// Depth prepass before the shading pass, which then runs with GL_EQUAL. With cluster
+	// culling the prepass also drives Hi-Z occlusion culling. Must be set before initialize().
+	void setDepthPrepass(bool enable);
+	// Keep all materials in one shader storage buffer so draws switch materials with a
+	// uniform instead of texture binds. Needs GL 4.3, uses bindless textures when the
+	// driver has them and bindless is true, texture arrays otherwise. Must be set before initialize().
+	void setMaterialTable(bool enable, bool bindless);
+	// Merge the objects sharing a material into batches of at most maxBatchVertices once the
+	// scene is loaded, and all objects into position only batches for the shadow maps. Keeps
+	// the CPU copies of the meshes until then. Must be set before initialize().
+	void setStaticBatching(bool enable, unsigned int maxBatchVertices);
+	// Point and spot lights from a file, see LightGrid::load(), and numRandomLights more
+	// scattered through the voxel grid. Needs GL 4.3. Must be set before initialize().
+	void setLights(std::string filename, int numRandomLights);
+	// Simplify the meshes into coarser levels of detail while loading. The shadow maps draw
+	// the coarsest level whose error stays below a texel and the voxelization the coarsest
+	// below a voxel. Must be set before initialize().
+	void setMeshLODs(bool enable);
+	// Show the occupied voxels of a mip level instead of the scene, toggled with 5
+	void setVoxelView(bool show, int level);
+	// Keep revoxelizing the scene in slices costing about this much GPU time per frame,
+	// 0 to disable. Must be set before initialize().
+	void setRevoxelizationBudget(float milliseconds);
+	// Clusters drawn out of the clusters tested by each pass so far
+	void printClusterStats(std::ostream& out);
+	// Shades the current view again with the CPU cone tracer, from a G-buffer and the voxel
+	// texture read back from the GPU. Writes it and the frame in the back buffer to
+	// <prefix>-cpu.ppm and <prefix>-gpu.ppm and prints how far apart they are. Call
+	// between draw() and the buffer swap.
+	bool renderCPUReference(std::string prefix);
 
 	bool initialize();
 	void update(float deltaTime);
@@ -30,29 +91,98 @@ public:
 
 protected:
 	bool loadObject(std::string path, std::string name, glm::vec3 pos = glm::vec3(0.0f), float scale = 1.0f);
+	// Jobs for loading a model without streaming. Uploads are main thread jobs and
+	// the returned job adds the objects to objects_ once everything is resident.
+	JobSystem::Job* addLoadObjectJobs(std::string path, std::string name, glm::vec3 pos = glm::vec3(0.0f), float scale = 1.0f);
+	void streamAssets();
+	void printVertexMemoryReport();
+	// Replaces objects_ by the static batches, once everything is loaded
+	void batchStaticObjects();
 	void drawTextureQuad(GLuint textureID);
-	void drawVoxels();
-	void drawDepthTexture();
-	void voxelizeScene();
+	void drawVoxels(glm::mat4& viewMatrix, glm::mat4& projectionMatrix);
+	void compactVoxels();
+	// Objects before firstObject are assumed to already be in the shadow map / voxel texture
+	void drawDepthTexture(size_t firstObject = 0);
+	void voxelizeScene(size_t firstObject = 0);
+	// Voxelizes the objects into level 0 of texture, without clearing it or building mips
+	void voxelizeSceneRaster(GLuint texture, const std::vector<Object*>& objects);
+	void voxelizeSceneCompute(GLuint texture, const std::vector<Object*>& objects);
+	void updateRevoxelization();
+	// Rebuilds the mips of texture above the voxels from regionMin to regionMax (exclusive)
+	void downsampleVoxels(GLuint texture, glm::ivec3 regionMin, glm::ivec3 regionMax);
+	// Error of the mesh levels of detail the voxelization can't tell apart, 0 without them
+	float getVoxelLODError();
+	void getShadowBounds(glm::vec3& boundsMin, glm::vec3& boundsMax);
+	glm::mat4 getLightViewMatrix();
+	void fitShadowMap();
+	void fitCascades();
+	void drawCascades();
+	void updateProbes();
+	enum ClusterPass { MAIN_PASS, SHADOW_PASS, VOXEL_PASS, DEPTH_PREPASS, NUM_CLUSTER_PASSES };
+	// Culls the clusters of the objects against viewProjection, the objects are then
+	// drawn with culledClusters set. Occlusion culling uses the last Hi-Z pyramid.
+	// maxError selects the level of detail the objects are drawn with, see Object::selectLOD().
+	void cullClusters(ClusterPass pass, const glm::mat4& viewProjection, const std::vector<Object*>& objects, bool occlusionCulling = false, float maxError = 0.0f);
+	void drawDepthPrepass(glm::mat4& viewMatrix, glm::mat4& projectionMatrix);
+	// Bookkeeping after the last pass of every frame, the voxel view's too
+	void endFrame();
+	void buildHiZ(const glm::mat4& viewProjection);
 	
 	int width_, height_;
 	Camera* camera_;
 	Controls* controls_;
 	GLFWwindow* window_;
+	GLuint outputFramebuffer_ = 0;
 
 	std::vector<Object*> objects_;
 	std::map<int, Material*> materials_;
+	// Transforms of the objects, with the node hierarchy of the loaded files
+	SceneGraph sceneGraph_;
 
 	GLuint voxelTraceShader_;
 
 	const float sponzaScale_ = 0.05f;
+
+	// Vertex format
+	bool quantizePositions_ = true;
+	bool keepMeshCPUCopies_ = false;
+	bool meshLODs_ = false;
+
+	// Static batching, done once the scene is loaded. NULL when disabled and before then.
+	bool staticBatching_ = false;
+	unsigned int maxBatchVertices_ = 65536;
+	StaticBatcher* staticBatcher_ = NULL;
+
+	// Background loading. Objects are voxelized as they arrive and the whole
+	// scene is voxelized again once everything is loaded.
+	SceneLoader* sceneLoader_;
+	bool streamScene_ = true;
+	// Runs the CPU side of initialize() and of the loading on all cores
+	JobSystem* jobSystem_;
+	const double uploadBudgetSeconds_ = 0.004;
 	glm::vec3 lightDirection_ = glm::vec3(-0.3, 0.9, -0.25);
 
-	// Stuff for shadow mapping
+	// Stuff for shadow mapping. The light frustum is fitted to the voxel grid while
+	// streaming and to the scene bounds once loaded. It is only redrawn when dirty.
 	GLuint depthFramebuffer_;
 	Texture2D depthTexture_;
 	GLuint shadowShader_;
 	glm::mat4 depthViewProjectionMatrix_;
+	int shadowMapSize_ = 2048;
+	bool shadowDirty_ = true;
+
+	// Optional cascades fitted to the camera frustum for the direct light. The scene
+	// wide shadow map is still used for voxelization and beyond the last cascade.
+	enum { MAX_CASCADES = 4 };
+	int numCascades_ = 0;
+	int cascadeSize_ = 1024;
+	bool cascadesDirty_ = true;
+	const float cascadeDistance_ = 100.0f;
+	GLuint cascadeFramebuffer_;
+	GLuint cascadeTexture_;
+	glm::mat4 cascadeViewProjection_[MAX_CASCADES];
+	float cascadeSplits_[MAX_CASCADES];
+	glm::mat4 cascadeCameraMatrix_; // Camera view projection the cascades were fitted for
 
 	// Voxelization
     GLuint voxelizationShader_;
@@ -61,9 +191,96 @@ protected:
     const float voxelGridWorldSize_ = 150.0f;
     glm::mat4 projX_, projY_, projZ_;
 
-	// Render voxels
+	// Compute voxelization, used instead of the geometry shader path if enabled and supported.
+	// Large triangles are split into tile jobs collected in tileJobBuffer_.
+	bool computeVoxelization_ = false;
+	GLuint voxelizationComputeShader_;
+	GLuint tileJobBuffer_;
+	GLuint maxTileJobs_;
+
+	// Time-sliced revoxelization. Every frame the next few objects, in spatial order, are
+	// voxelized into backVoxelTexture_ and the mips of the region they cover are rebuilt.
+	// Once all objects are done the two volumes are swapped and a new pass starts with a
+	// clear. The triangles per frame follow the GPU time measured for earlier slices,
+	// which is read back a few frames later. Needs GL 4.3, backVoxelTexture_ is 0 otherwise.
+	enum { NUM_REVOXELIZATION_QUERIES = 4 };
+	float revoxelizationBudgetMs_ = 0.0f;
+	GLuint backVoxelTexture_;
+	GLuint voxelClearShader_;
+	GLuint voxelMipmapShader_;
+	std::vector<Object*> revoxelizationOrder_;
+	size_t revoxelizationNext_;      // Next object in revoxelizationOrder_, 0 starts a new pass
+	double revoxelizationTriangles_; // Per frame
+	GLuint revoxelizationQueries_[NUM_REVOXELIZATION_QUERIES];
+	size_t revoxelizationQueryTriangles_[NUM_REVOXELIZATION_QUERIES]; // 0 if the query isn't in flight
+	int revoxelizationFrame_;
+
+	// Out of core voxels. With a brick pool the dense voxel texture isn't created and the
+	// GPU memory for cone tracing is a fixed budget.
+	VoxelBrickPager* brickPager_;
+	std::string brickPoolFile_;
+	size_t brickBudgetBytes_;
+	std::string bakeBricksFile_;
+	const int brickSize_ = 16;
+
+	// Irradiance probes, cone traced from the voxel texture into L1 spherical harmonics.
+	// After a voxelization a few slices of the grid are updated every frame until all are done.
+	enum { NUM_PROBE_TEXTURES = 4 }; // Red, green, blue and occlusion
+	int probeGridSize_ = 0;
+	GLuint probeShader_;
+	GLuint probeFramebuffer_;
+	GLuint probeTextures_[NUM_PROBE_TEXTURES];
+	int nextProbeSlice_ = 0;
+	int probeSlicesLeft_ = 0;
+	const int probeSlicesPerFrame_ = 4;
+
+	// GPU cluster culling, needs GL 4.3. clusterCullShader_ is 0 when disabled.
+	bool clusterCulling_ = false;
+	GLuint clusterCullShader_;
+	GLuint clusterStatsBuffer_; // Clusters drawn per ClusterPass
+	unsigned long long clustersTested_[NUM_CLUSTER_PASSES];
+
+	// Depth prepass and the hierarchical Z pyramid built from it. Each pyramid texel
+	// holds the farthest depth below it. It is only built when clusters are culled.
+	bool depthPrepass_ = true;
+	GLuint depthPrepassShader_;
+	GLuint hiZShader_;
+	GLuint hiZDepthTexture_;    // Single sample resolve of the output framebuffer's depth
+	GLuint hiZTexture_;         // R32F pyramid
+	GLuint hiZFramebuffer_;
+	GLuint hiZDepthFramebuffer_; // Blit target holding hiZDepthTexture_
+	int hiZLevels_;
+	bool hiZValid_;
+	glm::mat4 hiZViewProjection_; // Camera the pyramid was built from
+
+	// Material table read by the main, depth prepass and voxelization shaders, NULL when disabled
+	bool useMaterialTable_ = false;
+	bool bindlessTextures_ = true;
+	MaterialTable* materialTable_ = NULL;
+
+	// Point and spot lights, NULL when there are none
+	std::string lightsFile_;
+	int numRandomLights_ = 0;
+	LightGrid* lightGrid_ = NULL;
+	GLuint lightAssignShader_ = 0;
+
+	// Voxel debug view. The occupied voxels of one mip level are compacted into an
+	// instance list once per voxelization, frustum culled every frame and drawn as
+	// instanced cubes. Needs GL 4.3, voxelCompactShader_ is 0 otherwise.
+	bool showVoxels_ = false;
+	int voxelViewLevel_ = 0;
+	bool voxelViewCulling_ = true;
+	bool voxelViewDirty_ = true;
 	GLuint renderVoxelsShader_;
-	GLuint texture3DVertexArray_;
+	GLuint voxelCompactShader_;
+	GLuint voxelCullShader_;
+	GLuint voxelViewVertexArray_;
+	GLuint voxelCounterBuffer_;
+	GLuint voxelInstanceBuffer_;  // Packed position and color per occupied voxel
+	GLuint visibleVoxelBuffer_;   // The instances that passed culling
+	GLuint voxelCommandBuffer_;   // Indirect draw of the visible instances
+	GLuint numVoxelInstances_;
+	GLuint voxelInstanceCapacity_;
 
 	// Render texture debug
 	GLuint quadShader_;
@@ -71,7 +288,7 @@ protected:
 	GLuint quadVBO_;
 
 	// Inputs
-	bool press1_ = false, press2_ = false, press3_ = false, press4_ = false;
+	bool press1_ = false, press2_ = false, press3_ = false, press4_ = false, press5_ = false, press6_ = false;
 	bool showDiffuse_ = true, showIndirectDiffuse_ = true, showIndirectSpecular_ = true, showAmbientOcculision_ = true;
 };
 
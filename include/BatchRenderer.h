@@ -0,0 +1,77 @@
+#ifndef BATCHRENDERER_H
+#define BATCHRENDERER_H
+
+#include "GLCapture.h"
+
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "CameraPath.h"
+#include "JobSystem.h"
+
+class Application; // Forward declaration
+
+// Renders a list of camera poses without interaction and writes every frame as a PNG.
+// The frames are drawn into a framebuffer object with the window's size and sample
+// count, since what a hidden window's own framebuffer holds is undefined. They are
+// resolved and read back into a ring of pixel pack buffers. A buffer is only mapped once
+// the fence behind its glReadPixels has passed, so the CPU keeps drawing the next
+// frames instead of waiting for the GPU. Encoding runs on the job system's workers.
+//
+// With a shard only every count-th pose starting at the shard index is rendered, so
+// several processes can split one list.
+class BatchRenderer {
+public:
+	BatchRenderer(Application* app, JobSystem* jobSystem);
+	~BatchRenderer();
+
+	// Poses in the CameraPath format, the first column numbers the frames
+	bool loadPoses(std::string filename, int shardIndex, int shardCount);
+	// Waits for the scene to load, then writes every pose of the shard to <outputPrefix><frame>.png
+	bool run(std::string outputPrefix);
+	// Frames per second end to end and the time spent in each stage
+	void printStats(std::ostream& out);
+
+protected:
+	// run() with the frames drawn into the framebuffer object
+	bool drawPoses(std::string outputPrefix);
+
+	struct Slot {
+		GLuint buffer;
+		GLsync fence; // NULL when the slot is free
+		std::string filename;
+	};
+
+	// Copies the pixels out of a slot and hands them to an encode job. Blocks until the
+	// fence has passed if wait is set, otherwise only retires a finished slot.
+	bool retire(Slot& slot, bool wait);
+	void encode(std::shared_ptr<std::vector<unsigned char> > pixels, std::string filename);
+
+	enum { RING_SIZE = 3 };
+	enum { RENDER_FRAMEBUFFER, RESOLVE_FRAMEBUFFER, NUM_FRAMEBUFFERS };
+	enum { RENDER_COLOR, RENDER_DEPTH, RESOLVE_COLOR, NUM_RENDERBUFFERS };
+
+	Application* app_;
+	JobSystem* jobSystem_;
+	std::vector<CameraPath::Keyframe> poses_;
+	std::vector<int> frameNumbers_;
+	int shardIndex_, shardCount_;
+	int width_, height_;
+	Slot ring_[RING_SIZE];
+	GLuint framebuffers_[NUM_FRAMEBUFFERS];
+	GLuint renderbuffers_[NUM_RENDERBUFFERS];
+
+	// Encode jobs still running, the oldest is waited for when too many are in flight
+	std::vector<JobSystem::Job*> encodeJobs_;
+	size_t maxEncodesInFlight_;
+
+	// Seconds per stage, summed over all frames. Encoding is summed over the workers.
+	std::mutex statsMutex_;
+	int numFrames_, numFailed_;
+	double loadSeconds_, drawSeconds_, readSeconds_, fenceWaitSeconds_, copySeconds_, encodeSeconds_, encodeWaitSeconds_, totalSeconds_;
+};
+
+#endif // BATCHRENDERER_H
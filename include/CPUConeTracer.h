@@ -0,0 +1,77 @@
+#ifndef CPUCONETRACER_H
+#define CPUCONETRACER_H
+
+#include <glm/glm.hpp>
+
+#include <atomic>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "JobSystem.h"
+#include "SimdFloat.h"
+
+// CPU port of the shading in voxel-trace.frag, as a reference to check the GPU image
+// against and as an offline renderer for machines without a usable GPU. The surfaces
+// come from a G-buffer and the voxels from a copy of the mip pyramid of the voxel
+// texture, sampled like textureLod() does. Pixels are traced in packets of
+// SimdFloat::WIDTH lanes and the image is split into tiles run on a JobSystem.
+//
+// Bricks and irradiance probes aren't ported, every cone is traced through the
+// dense volume.
+class CPUConeTracer {
+public:
+	// One entry per pixel, rows from the bottom like glReadPixels
+	struct GBuffer {
+		int width, height;
+		std::vector<glm::vec4> positionVisibility; // World position and shadow visibility, w < 0 for background
+		std::vector<glm::vec4> normal;             // World space bump normal
+		std::vector<glm::vec4> geometricNormal;    // Interpolated vertex normal, the cones start one voxel out along it
+		std::vector<glm::vec4> albedo;
+		std::vector<glm::vec4> specular;           // With grayscale specular maps already expanded
+	};
+
+	struct Settings {
+		glm::vec3 cameraPosition;
+		glm::vec3 lightDirection;
+		bool direct;   // ShowDiffuse
+		bool indirect; // ShowIndirectSpecular, which gates the whole indirect term in voxel-trace.frag
+	};
+
+	CPUConeTracer();
+
+	// levels[i] holds the RGBA8 texels of mip level i, (dimensions >> i)^3 of them. Takes the data.
+	void setVoxels(std::vector<std::vector<unsigned char> >& levels, int dimensions, float gridWorldSize);
+	// Linear RGB per pixel, in the G-buffer's layout
+	void render(const GBuffer& gbuffer, const Settings& settings, JobSystem* jobSystem, std::vector<glm::vec3>& image);
+
+	// Cones, voxel samples and throughput of the last render()
+	void printStats(std::ostream& out, unsigned int numThreads);
+
+	// RMSE, PSNR and largest difference per channel, both quantized to 8 bits
+	static void printDifference(std::ostream& out, const std::vector<glm::vec3>& reference, const std::vector<glm::vec3>& image);
+	// Binary PPM, rows flipped so the first one is the top of the image
+	static bool writePPM(const std::string& filename, int width, int height, const std::vector<glm::vec3>& image);
+
+protected:
+	// count pixels starting at pixel, all in one row
+	void tracePacket(const GBuffer& gbuffer, const Settings& settings, int pixel, int count, std::vector<glm::vec3>& image,
+		size_t& cones, size_t& samples);
+	// ConeTrace() for the active lanes, RGBA in color
+	void coneTrace(const SimdVec3& start, const SimdVec3& direction, float tanHalf, SimdMask active, SimdFloat color[4],
+		size_t& cones, size_t& samples);
+	SimdVec3 brdf(const SimdVec3& L, const SimdVec3& N, const SimdVec3& V, const SimdVec3& ka, const SimdVec3& ks, const SimdFloat& ksAlpha);
+	// Same as SampleVoxelTexutre() and textureLod() with GL_LINEAR_MIPMAP_LINEAR and GL_REPEAT
+	glm::vec4 sampleVoxels(glm::vec3 worldPosition, float mipLevel);
+	glm::vec4 sampleLevel(int level, glm::vec3 uv);
+
+	std::vector<std::vector<unsigned char> > levels_;
+	int dimensions_;
+	float gridWorldSize_;
+
+	std::atomic<size_t> numCones_, numSamples_;
+	int width_, height_;
+	double seconds_;
+};
+
+#endif // CPUCONETRACER_H
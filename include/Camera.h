@@ -15,9 +15,14 @@ public:
 	glm::mat4 getProjectionMatrix();
 	glm::vec3 getPosition();
 	glm::vec3 getDirection();
+	float getYaw();
+	float getPitch();
+	float getNear();
+	float getFar();
 
 	void setPosition(glm::vec3 pos);
 	void setDirection(glm::vec3 dir);
+	void setYawPitch(float yaw, float pitch);
 	void moveForward(float delta);
 	void moveBackward(float delta);
 	void moveRight(float delta);
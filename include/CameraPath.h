@@ -0,0 +1,38 @@
+#ifndef CAMERAPATH_H
+#define CAMERAPATH_H
+
+#include <glm/glm.hpp>
+
+#include <string>
+#include <vector>
+
+// A recorded camera flight. Stored as CSV with one keyframe per line:
+// time,x,y,z,yaw,pitch
+// Playback interpolates between keyframes with a Catmull-Rom spline, so a path
+// can be played back at another rate than it was recorded at.
+class CameraPath {
+public:
+	struct Keyframe {
+		double time;
+		glm::vec3 position;
+		float yaw;
+		float pitch;
+	};
+
+	CameraPath();
+	~CameraPath();
+
+	void addKeyframe(double time, glm::vec3 position, float yaw, float pitch);
+	Keyframe sample(double time);
+	double getDuration();
+	bool empty();
+	const std::vector<Keyframe>& getKeyframes();
+
+	bool load(std::string filename);
+	bool save(std::string filename);
+
+protected:
+	std::vector<Keyframe> keyframes_;
+};
+
+#endif // CAMERAPATH_H
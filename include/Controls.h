@@ -4,6 +4,10 @@
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
 
+#include <string>
+
+#include "CameraPath.h"
+
 class Application; // Forward declaration
 
 class Controls {
@@ -13,7 +17,26 @@ public:
 
 	void updateFromInputs(Application* app, float deltaTime);
 
+	// Records the camera after every update, written to file by saveRecording()
+	void startRecording(std::string filename);
+	bool saveRecording();
+	// Replaces the inputs with a recorded path. Time only advances once the scene is fully loaded.
+	bool startPlayback(std::string filename);
+	bool isPlaying();
+	bool isPlaybackFinished();
+
 protected:
+	enum Mode {
+		INTERACTIVE,
+		RECORDING,
+		PLAYBACK
+	};
+
+	Mode mode_;
+	CameraPath path_;
+	std::string recordingFile_;
+	double pathTime_;
+
 	// Settings
 	float speed_;
 	float mouseSensitivity_;
@@ -0,0 +1,43 @@
+#ifndef FRAMESTATS_H
+#define FRAMESTATS_H
+
+#include <ostream>
+#include <vector>
+
+// Collects frame times. Percentiles are computed over a rolling window of the
+// most recent frames, the histogram and the hitch counter cover the whole run.
+// A hitch is a frame taking more than hitchFactor times the recent average.
+class FrameStats {
+public:
+	FrameStats(size_t windowSize = 1024, double hitchFactor = 2.0);
+	~FrameStats();
+
+	void addFrame(double seconds);
+
+	// In milliseconds, over the rolling window
+	double getPercentile(double percentile);
+	double getMax();
+	double getAverage();
+	unsigned long long getFrameCount();
+	unsigned int getHitchCount();
+
+	void printSummary(std::ostream& out);
+	void writeJSON(std::ostream& out);
+
+	static const int HISTOGRAM_BUCKETS = 100; // 1 ms each, the last one also counts everything slower
+
+protected:
+	std::vector<double> window_; // milliseconds
+	size_t windowSize_;
+	size_t next_;
+
+	unsigned int histogram_[HISTOGRAM_BUCKETS];
+	unsigned long long frameCount_;
+	unsigned int hitchCount_;
+	double hitchFactor_;
+	double averageFrameTime_; // Exponential moving average used for hitch detection
+	double totalTime_;
+	double maxFrameTime_;
+};
+
+#endif // FRAMESTATS_H
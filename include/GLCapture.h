@@ -0,0 +1,468 @@
+#ifndef GLCAPTURE_H
+#define GLCAPTURE_H
+
+#include <GL/glew.h>
+
+#include <fstream>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Optional interception of the GL calls the application makes. Built with the CMake
+// option VCT_GL_CAPTURE, every gl* call below is redirected to a wrapper that forwards
+// it to the driver. While a capture runs the wrapper also counts the call for the
+// current frame and profiler GPU zone, and writes it with the data it points at to a
+// file. VCT_replay issues that stream again without any of the application around it.
+// Without the option this header only includes GLEW and nothing is intercepted.
+//
+// Capture file: the header "VCTGLCAP", version, width and height as uint32, then one
+// record per call: uint16 command, uint16 argument count, uint32 blob size, the
+// arguments widened to uint64 (floats keep their bit pattern) and the blob. GL names
+// are stored as the application saw them, the replay maps them to its own.
+//
+// Only the GL thread may make GL calls, so none of this is locked.
+//
+// Bindless texture handles can't be captured, the driver picks their values and they
+// are stored in buffers the replay can't remap. The application doesn't use bindless
+// textures while capturing, so glGetTextureHandleARB and the residency calls aren't
+// wrapped.
+
+#define GL_CAPTURE_COMMANDS(X) \
+	X(ActiveTexture) X(AttachShader) X(BeginQuery) X(BindBuffer) X(BindBufferBase) X(BindFramebuffer) \
+	X(BindImageTexture) X(BindRenderbuffer) X(BindTexture) X(BindVertexArray) X(BlitFramebuffer) X(BufferData) \
+	X(BufferSubData) X(CheckFramebufferStatus) X(Clear) X(ClearBufferData) X(ClearBufferfv) X(ClearColor) \
+	X(ClientWaitSync) X(ColorMask) X(CompileShader) X(CopyImageSubData) X(CopyTexSubImage2D) X(CreateProgram) \
+	X(CreateShader) X(CullFace) \
+	X(DeleteBuffers) X(DeleteFramebuffers) X(DeleteProgram) X(DeleteQueries) X(DeleteRenderbuffers) X(DeleteShader) \
+	X(DeleteSync) X(DeleteTextures) X(DeleteVertexArrays) X(DepthFunc) X(DepthMask) X(Disable) \
+	X(DisableVertexAttribArray) X(DispatchCompute) X(DispatchComputeIndirect) X(DrawArrays) X(DrawArraysIndirect) \
+	X(DrawArraysInstanced) X(DrawBuffer) X(DrawBuffers) X(DrawElements) X(DrawElementsInstanced) X(Enable) \
+	X(EnableVertexAttribArray) X(EndQuery) X(FenceSync) X(Flush) X(FramebufferRenderbuffer) X(FramebufferTexture) \
+	X(FramebufferTexture2D) X(FramebufferTextureLayer) X(GenBuffers) X(GenFramebuffers) X(GenQueries) X(GenRenderbuffers) X(GenTextures) \
+	X(GenVertexArrays) X(GenerateMipmap) X(GetBufferSubData) X(GetError) X(GetInteger64v) X(GetIntegerv) \
+	X(GetProgramInfoLog) X(GetProgramiv) X(GetQueryObjectiv) X(GetQueryObjectui64v) X(GetQueryObjectuiv) \
+	X(GetShaderInfoLog) X(GetShaderiv) X(GetString) X(GetTexImage) X(GetUniformLocation) X(LinkProgram) \
+	X(MapBufferRange) X(MemoryBarrier) X(MultiDrawElementsIndirect) X(MultiDrawElementsIndirectCountARB) \
+	X(PixelStorei) X(QueryCounter) X(ReadBuffer) X(ReadPixels) X(RenderbufferStorage) X(RenderbufferStorageMultisample) \
+	X(ShaderSource) X(TexImage2D) X(TexImage3D) X(TexParameteri) X(TexSubImage3D) X(Uniform1f) X(Uniform1fv) X(Uniform1i) \
+	X(Uniform1iv) X(Uniform1ui) X(Uniform2f) X(Uniform2i) X(Uniform3f) X(Uniform3i) X(Uniform4fv) X(UniformMatrix4fv) \
+	X(UnmapBuffer) X(UseProgram) X(VertexAttribDivisor) X(VertexAttribIPointer) X(VertexAttribPointer) X(Viewport)
+
+class GLCapture {
+public:
+	#define GL_CAPTURE_ENUM(name) CMD_##name,
+	enum Command {
+		GL_CAPTURE_COMMANDS(GL_CAPTURE_ENUM)
+		NUM_GL_COMMANDS,
+		// Markers that aren't GL calls
+		CMD_END_FRAME = NUM_GL_COMMANDS,
+		CMD_BEGIN_PASS, // Blob is the pass name
+		CMD_END_PASS,
+		NUM_COMMANDS
+	};
+	#undef GL_CAPTURE_ENUM
+
+	static const unsigned int FILE_VERSION = 4;
+
+	// False without VCT_GL_CAPTURE
+	static bool isAvailable();
+	// Records every call from now on, call right after glewInit() so the replay creates all objects
+	static bool start(const std::string& filename, int width, int height);
+	static void stop();
+	static bool isCapturing();
+	static int getNumFrames();
+
+	// Called after every buffer swap and by the profiler GPU zones
+	static void endFrame();
+	static void beginPass(const char* name);
+	static void endPass();
+
+	// Calls per frame and per pass of the capture
+	static void printStats(std::ostream& out);
+
+	static const char* getCommandName(int command);
+
+	// Per pass call histograms and CPU time, shared with the replay
+	class CallStats {
+	public:
+		CallStats();
+		void beginPass(const std::string& name);
+		void endPass();
+		void addCall(int command);
+		// Time spent in the innermost pass since the last call
+		void addTime(double seconds);
+		void endFrame();
+		void print(std::ostream& out, bool withTimes);
+
+	protected:
+		struct Pass {
+			std::vector<unsigned long long> calls;
+			unsigned long long totalCalls;
+			double seconds;
+		};
+		Pass& current();
+
+		std::map<std::string, Pass> passes_;
+		std::vector<std::string> stack_;
+		std::vector<unsigned long long> frameCalls_; // Calls per finished frame
+		unsigned long long callsThisFrame_;
+		// The first frame holds the initialization and is counted apart
+		bool inSetup_;
+		unsigned long long setupCalls_;
+	};
+
+	// Writes one call and counts it, public for the wrappers
+	static void record(Command command, const unsigned long long* args, int numArgs, const void* blob = NULL, size_t blobSize = 0);
+
+	// Bytes of an image in client memory with the current pack or unpack alignment
+	static size_t getImageBytes(int width, int height, int depth, GLenum format, GLenum type, int alignment);
+	static size_t getPixelBytes(GLenum format, GLenum type);
+
+protected:
+	static std::ofstream file_;
+	static bool capturing_;
+	static int numFrames_;
+	static CallStats stats_;
+};
+
+// The wrappers, same signatures as the GL functions
+void vctCaptureActiveTexture(GLenum texture);
+void vctCaptureAttachShader(GLuint program, GLuint shader);
+void vctCaptureBeginQuery(GLenum target, GLuint id);
+void vctCaptureBindBuffer(GLenum target, GLuint buffer);
+void vctCaptureBindBufferBase(GLenum target, GLuint index, GLuint buffer);
+void vctCaptureBindFramebuffer(GLenum target, GLuint framebuffer);
+void vctCaptureBindImageTexture(GLuint unit, GLuint texture, GLint level, GLboolean layered, GLint layer, GLenum access, GLenum format);
+void vctCaptureBindRenderbuffer(GLenum target, GLuint renderbuffer);
+void vctCaptureBindTexture(GLenum target, GLuint texture);
+void vctCaptureBindVertexArray(GLuint array);
+void vctCaptureBlitFramebuffer(GLint srcX0, GLint srcY0, GLint srcX1, GLint srcY1, GLint dstX0, GLint dstY0, GLint dstX1, GLint dstY1, GLbitfield mask, GLenum filter);
+void vctCaptureBufferData(GLenum target, GLsizeiptr size, const void* data, GLenum usage);
+void vctCaptureBufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const void* data);
+GLenum vctCaptureCheckFramebufferStatus(GLenum target);
+void vctCaptureClear(GLbitfield mask);
+void vctCaptureClearBufferData(GLenum target, GLenum internalformat, GLenum format, GLenum type, const void* data);
+void vctCaptureClearBufferfv(GLenum buffer, GLint drawbuffer, const GLfloat* value);
+void vctCaptureClearColor(GLfloat red, GLfloat green, GLfloat blue, GLfloat alpha);
+GLenum vctCaptureClientWaitSync(GLsync sync, GLbitfield flags, GLuint64 timeout);
+void vctCaptureColorMask(GLboolean red, GLboolean green, GLboolean blue, GLboolean alpha);
+void vctCaptureCompileShader(GLuint shader);
+void vctCaptureCopyImageSubData(GLuint srcName, GLenum srcTarget, GLint srcLevel, GLint srcX, GLint srcY, GLint srcZ, GLuint dstName, GLenum dstTarget, GLint dstLevel, GLint dstX, GLint dstY, GLint dstZ, GLsizei srcWidth, GLsizei srcHeight, GLsizei srcDepth);
+void vctCaptureCopyTexSubImage2D(GLenum target, GLint level, GLint xoffset, GLint yoffset, GLint x, GLint y, GLsizei width, GLsizei height);
+GLuint vctCaptureCreateProgram();
+GLuint vctCaptureCreateShader(GLenum type);
+void vctCaptureCullFace(GLenum mode);
+void vctCaptureDeleteBuffers(GLsizei n, const GLuint* buffers);
+void vctCaptureDeleteFramebuffers(GLsizei n, const GLuint* framebuffers);
+void vctCaptureDeleteProgram(GLuint program);
+void vctCaptureDeleteQueries(GLsizei n, const GLuint* ids);
+void vctCaptureDeleteRenderbuffers(GLsizei n, const GLuint* renderbuffers);
+void vctCaptureDeleteShader(GLuint shader);
+void vctCaptureDeleteSync(GLsync sync);
+void vctCaptureDeleteTextures(GLsizei n, const GLuint* textures);
+void vctCaptureDeleteVertexArrays(GLsizei n, const GLuint* arrays);
+void vctCaptureDepthFunc(GLenum func);
+void vctCaptureDepthMask(GLboolean flag);
+void vctCaptureDisable(GLenum cap);
+void vctCaptureDisableVertexAttribArray(GLuint index);
+void vctCaptureDispatchCompute(GLuint x, GLuint y, GLuint z);
+void vctCaptureDispatchComputeIndirect(GLintptr indirect);
+void vctCaptureDrawArrays(GLenum mode, GLint first, GLsizei count);
+void vctCaptureDrawArraysIndirect(GLenum mode, const void* indirect);
+void vctCaptureDrawArraysInstanced(GLenum mode, GLint first, GLsizei count, GLsizei instancecount);
+void vctCaptureDrawBuffer(GLenum buf);
+void vctCaptureDrawBuffers(GLsizei n, const GLenum* bufs);
+void vctCaptureDrawElements(GLenum mode, GLsizei count, GLenum type, const void* indices);
+void vctCaptureDrawElementsInstanced(GLenum mode, GLsizei count, GLenum type, const void* indices, GLsizei instancecount);
+void vctCaptureEnable(GLenum cap);
+void vctCaptureEnableVertexAttribArray(GLuint index);
+void vctCaptureEndQuery(GLenum target);
+GLsync vctCaptureFenceSync(GLenum condition, GLbitfield flags);
+void vctCaptureFlush();
+void vctCaptureFramebufferRenderbuffer(GLenum target, GLenum attachment, GLenum renderbuffertarget, GLuint renderbuffer);
+void vctCaptureFramebufferTexture(GLenum target, GLenum attachment, GLuint texture, GLint level);
+void vctCaptureFramebufferTexture2D(GLenum target, GLenum attachment, GLenum textarget, GLuint texture, GLint level);
+void vctCaptureFramebufferTextureLayer(GLenum target, GLenum attachment, GLuint texture, GLint level, GLint layer);
+void vctCaptureGenBuffers(GLsizei n, GLuint* buffers);
+void vctCaptureGenFramebuffers(GLsizei n, GLuint* framebuffers);
+void vctCaptureGenQueries(GLsizei n, GLuint* ids);
+void vctCaptureGenRenderbuffers(GLsizei n, GLuint* renderbuffers);
+void vctCaptureGenTextures(GLsizei n, GLuint* textures);
+void vctCaptureGenVertexArrays(GLsizei n, GLuint* arrays);
+void vctCaptureGenerateMipmap(GLenum target);
+void vctCaptureGetBufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, void* data);
+GLenum vctCaptureGetError();
+void vctCaptureGetInteger64v(GLenum pname, GLint64* data);
+void vctCaptureGetIntegerv(GLenum pname, GLint* data);
+void vctCaptureGetProgramInfoLog(GLuint program, GLsizei bufSize, GLsizei* length, GLchar* infoLog);
+void vctCaptureGetProgramiv(GLuint program, GLenum pname, GLint* params);
+void vctCaptureGetQueryObjectiv(GLuint id, GLenum pname, GLint* params);
+void vctCaptureGetQueryObjectui64v(GLuint id, GLenum pname, GLuint64* params);
+void vctCaptureGetQueryObjectuiv(GLuint id, GLenum pname, GLuint* params);
+void vctCaptureGetShaderInfoLog(GLuint shader, GLsizei bufSize, GLsizei* length, GLchar* infoLog);
+void vctCaptureGetShaderiv(GLuint shader, GLenum pname, GLint* params);
+const GLubyte* vctCaptureGetString(GLenum name);
+void vctCaptureGetTexImage(GLenum target, GLint level, GLenum format, GLenum type, void* pixels);
+GLint vctCaptureGetUniformLocation(GLuint program, const GLchar* name);
+void vctCaptureLinkProgram(GLuint program);
+void* vctCaptureMapBufferRange(GLenum target, GLintptr offset, GLsizeiptr length, GLbitfield access);
+void vctCaptureMemoryBarrier(GLbitfield barriers);
+void vctCaptureMultiDrawElementsIndirect(GLenum mode, GLenum type, const void* indirect, GLsizei drawcount, GLsizei stride);
+void vctCaptureMultiDrawElementsIndirectCountARB(GLenum mode, GLenum type, const void* indirect, GLintptr drawcount, GLsizei maxdrawcount, GLsizei stride);
+void vctCapturePixelStorei(GLenum pname, GLint param);
+void vctCaptureQueryCounter(GLuint id, GLenum target);
+void vctCaptureReadBuffer(GLenum src);
+void vctCaptureReadPixels(GLint x, GLint y, GLsizei width, GLsizei height, GLenum format, GLenum type, void* pixels);
+void vctCaptureRenderbufferStorage(GLenum target, GLenum internalformat, GLsizei width, GLsizei height);
+void vctCaptureRenderbufferStorageMultisample(GLenum target, GLsizei samples, GLenum internalformat, GLsizei width, GLsizei height);
+void vctCaptureShaderSource(GLuint shader, GLsizei count, const GLchar* const* string, const GLint* length);
+void vctCaptureTexImage2D(GLenum target, GLint level, GLint internalformat, GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, const void* pixels);
+void vctCaptureTexImage3D(GLenum target, GLint level, GLint internalformat, GLsizei width, GLsizei height, GLsizei depth, GLint border, GLenum format, GLenum type, const void* pixels);
+void vctCaptureTexParameteri(GLenum target, GLenum pname, GLint param);
+void vctCaptureTexSubImage3D(GLenum target, GLint level, GLint xoffset, GLint yoffset, GLint zoffset, GLsizei width, GLsizei height, GLsizei depth, GLenum format, GLenum type, const void* pixels);
+void vctCaptureUniform1f(GLint location, GLfloat v0);
+void vctCaptureUniform1fv(GLint location, GLsizei count, const GLfloat* value);
+void vctCaptureUniform1i(GLint location, GLint v0);
+void vctCaptureUniform1iv(GLint location, GLsizei count, const GLint* value);
+void vctCaptureUniform1ui(GLint location, GLuint v0);
+void vctCaptureUniform2f(GLint location, GLfloat v0, GLfloat v1);
+void vctCaptureUniform2i(GLint location, GLint v0, GLint v1);
+void vctCaptureUniform3f(GLint location, GLfloat v0, GLfloat v1, GLfloat v2);
+void vctCaptureUniform3i(GLint location, GLint v0, GLint v1, GLint v2);
+void vctCaptureUniform4fv(GLint location, GLsizei count, const GLfloat* value);
+void vctCaptureUniformMatrix4fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat* value);
+GLboolean vctCaptureUnmapBuffer(GLenum target);
+void vctCaptureUseProgram(GLuint program);
+void vctCaptureVertexAttribDivisor(GLuint index, GLuint divisor);
+void vctCaptureVertexAttribIPointer(GLuint index, GLint size, GLenum type, GLsizei stride, const void* pointer);
+void vctCaptureVertexAttribPointer(GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride, const void* pointer);
+void vctCaptureViewport(GLint x, GLint y, GLsizei width, GLsizei height);
+
+// GLCapture.cpp and the replay call the real functions
+#if defined(VCT_GL_CAPTURE) && !defined(GL_CAPTURE_IMPLEMENTATION)
+#undef glActiveTexture
+#define glActiveTexture vctCaptureActiveTexture
+#undef glAttachShader
+#define glAttachShader vctCaptureAttachShader
+#undef glBeginQuery
+#define glBeginQuery vctCaptureBeginQuery
+#undef glBindBuffer
+#define glBindBuffer vctCaptureBindBuffer
+#undef glBindBufferBase
+#define glBindBufferBase vctCaptureBindBufferBase
+#undef glBindFramebuffer
+#define glBindFramebuffer vctCaptureBindFramebuffer
+#undef glBindImageTexture
+#define glBindImageTexture vctCaptureBindImageTexture
+#undef glBindRenderbuffer
+#define glBindRenderbuffer vctCaptureBindRenderbuffer
+#undef glBindTexture
+#define glBindTexture vctCaptureBindTexture
+#undef glBindVertexArray
+#define glBindVertexArray vctCaptureBindVertexArray
+#undef glBlitFramebuffer
+#define glBlitFramebuffer vctCaptureBlitFramebuffer
+#undef glBufferData
+#define glBufferData vctCaptureBufferData
+#undef glBufferSubData
+#define glBufferSubData vctCaptureBufferSubData
+#undef glCheckFramebufferStatus
+#define glCheckFramebufferStatus vctCaptureCheckFramebufferStatus
+#undef glClear
+#define glClear vctCaptureClear
+#undef glClearBufferData
+#define glClearBufferData vctCaptureClearBufferData
+#undef glClearBufferfv
+#define glClearBufferfv vctCaptureClearBufferfv
+#undef glClearColor
+#define glClearColor vctCaptureClearColor
+#undef glClientWaitSync
+#define glClientWaitSync vctCaptureClientWaitSync
+#undef glColorMask
+#define glColorMask vctCaptureColorMask
+#undef glCompileShader
+#define glCompileShader vctCaptureCompileShader
+#undef glCopyImageSubData
+#define glCopyImageSubData vctCaptureCopyImageSubData
+#undef glCopyTexSubImage2D
+#define glCopyTexSubImage2D vctCaptureCopyTexSubImage2D
+#undef glCreateProgram
+#define glCreateProgram vctCaptureCreateProgram
+#undef glCreateShader
+#define glCreateShader vctCaptureCreateShader
+#undef glCullFace
+#define glCullFace vctCaptureCullFace
+#undef glDeleteBuffers
+#define glDeleteBuffers vctCaptureDeleteBuffers
+#undef glDeleteFramebuffers
+#define glDeleteFramebuffers vctCaptureDeleteFramebuffers
+#undef glDeleteProgram
+#define glDeleteProgram vctCaptureDeleteProgram
+#undef glDeleteQueries
+#define glDeleteQueries vctCaptureDeleteQueries
+#undef glDeleteRenderbuffers
+#define glDeleteRenderbuffers vctCaptureDeleteRenderbuffers
+#undef glDeleteShader
+#define glDeleteShader vctCaptureDeleteShader
+#undef glDeleteSync
+#define glDeleteSync vctCaptureDeleteSync
+#undef glDeleteTextures
+#define glDeleteTextures vctCaptureDeleteTextures
+#undef glDeleteVertexArrays
+#define glDeleteVertexArrays vctCaptureDeleteVertexArrays
+#undef glDepthFunc
+#define glDepthFunc vctCaptureDepthFunc
+#undef glDepthMask
+#define glDepthMask vctCaptureDepthMask
+#undef glDisable
+#define glDisable vctCaptureDisable
+#undef glDisableVertexAttribArray
+#define glDisableVertexAttribArray vctCaptureDisableVertexAttribArray
+#undef glDispatchCompute
+#define glDispatchCompute vctCaptureDispatchCompute
+#undef glDispatchComputeIndirect
+#define glDispatchComputeIndirect vctCaptureDispatchComputeIndirect
+#undef glDrawArrays
+#define glDrawArrays vctCaptureDrawArrays
+#undef glDrawArraysIndirect
+#define glDrawArraysIndirect vctCaptureDrawArraysIndirect
+#undef glDrawArraysInstanced
+#define glDrawArraysInstanced vctCaptureDrawArraysInstanced
+#undef glDrawBuffer
+#define glDrawBuffer vctCaptureDrawBuffer
+#undef glDrawBuffers
+#define glDrawBuffers vctCaptureDrawBuffers
+#undef glDrawElements
+#define glDrawElements vctCaptureDrawElements
+#undef glDrawElementsInstanced
+#define glDrawElementsInstanced vctCaptureDrawElementsInstanced
+#undef glEnable
+#define glEnable vctCaptureEnable
+#undef glEnableVertexAttribArray
+#define glEnableVertexAttribArray vctCaptureEnableVertexAttribArray
+#undef glEndQuery
+#define glEndQuery vctCaptureEndQuery
+#undef glFenceSync
+#define glFenceSync vctCaptureFenceSync
+#undef glFlush
+#define glFlush vctCaptureFlush
+#undef glFramebufferRenderbuffer
+#define glFramebufferRenderbuffer vctCaptureFramebufferRenderbuffer
+#undef glFramebufferTexture
+#define glFramebufferTexture vctCaptureFramebufferTexture
+#undef glFramebufferTexture2D
+#define glFramebufferTexture2D vctCaptureFramebufferTexture2D
+#undef glFramebufferTextureLayer
+#define glFramebufferTextureLayer vctCaptureFramebufferTextureLayer
+#undef glGenBuffers
+#define glGenBuffers vctCaptureGenBuffers
+#undef glGenFramebuffers
+#define glGenFramebuffers vctCaptureGenFramebuffers
+#undef glGenQueries
+#define glGenQueries vctCaptureGenQueries
+#undef glGenRenderbuffers
+#define glGenRenderbuffers vctCaptureGenRenderbuffers
+#undef glGenTextures
+#define glGenTextures vctCaptureGenTextures
+#undef glGenVertexArrays
+#define glGenVertexArrays vctCaptureGenVertexArrays
+#undef glGenerateMipmap
+#define glGenerateMipmap vctCaptureGenerateMipmap
+#undef glGetBufferSubData
+#define glGetBufferSubData vctCaptureGetBufferSubData
+#undef glGetError
+#define glGetError vctCaptureGetError
+#undef glGetInteger64v
+#define glGetInteger64v vctCaptureGetInteger64v
+#undef glGetIntegerv
+#define glGetIntegerv vctCaptureGetIntegerv
+#undef glGetProgramInfoLog
+#define glGetProgramInfoLog vctCaptureGetProgramInfoLog
+#undef glGetProgramiv
+#define glGetProgramiv vctCaptureGetProgramiv
+#undef glGetQueryObjectiv
+#define glGetQueryObjectiv vctCaptureGetQueryObjectiv
+#undef glGetQueryObjectui64v
+#define glGetQueryObjectui64v vctCaptureGetQueryObjectui64v
+#undef glGetQueryObjectuiv
+#define glGetQueryObjectuiv vctCaptureGetQueryObjectuiv
+#undef glGetShaderInfoLog
+#define glGetShaderInfoLog vctCaptureGetShaderInfoLog
+#undef glGetShaderiv
+#define glGetShaderiv vctCaptureGetShaderiv
+#undef glGetString
+#define glGetString vctCaptureGetString
+#undef glGetTexImage
+#define glGetTexImage vctCaptureGetTexImage
+#undef glGetUniformLocation
+#define glGetUniformLocation vctCaptureGetUniformLocation
+#undef glLinkProgram
+#define glLinkProgram vctCaptureLinkProgram
+#undef glMapBufferRange
+#define glMapBufferRange vctCaptureMapBufferRange
+#undef glMemoryBarrier
+#define glMemoryBarrier vctCaptureMemoryBarrier
+#undef glMultiDrawElementsIndirect
+#define glMultiDrawElementsIndirect vctCaptureMultiDrawElementsIndirect
+#undef glMultiDrawElementsIndirectCountARB
+#define glMultiDrawElementsIndirectCountARB vctCaptureMultiDrawElementsIndirectCountARB
+#undef glPixelStorei
+#define glPixelStorei vctCapturePixelStorei
+#undef glQueryCounter
+#define glQueryCounter vctCaptureQueryCounter
+#undef glReadBuffer
+#define glReadBuffer vctCaptureReadBuffer
+#undef glReadPixels
+#define glReadPixels vctCaptureReadPixels
+#undef glRenderbufferStorage
+#define glRenderbufferStorage vctCaptureRenderbufferStorage
+#undef glRenderbufferStorageMultisample
+#define glRenderbufferStorageMultisample vctCaptureRenderbufferStorageMultisample
+#undef glShaderSource
+#define glShaderSource vctCaptureShaderSource
+#undef glTexImage2D
+#define glTexImage2D vctCaptureTexImage2D
+#undef glTexImage3D
+#define glTexImage3D vctCaptureTexImage3D
+#undef glTexParameteri
+#define glTexParameteri vctCaptureTexParameteri
+#undef glTexSubImage3D
+#define glTexSubImage3D vctCaptureTexSubImage3D
+#undef glUniform1f
+#define glUniform1f vctCaptureUniform1f
+#undef glUniform1fv
+#define glUniform1fv vctCaptureUniform1fv
+#undef glUniform1i
+#define glUniform1i vctCaptureUniform1i
+#undef glUniform1iv
+#define glUniform1iv vctCaptureUniform1iv
+#undef glUniform1ui
+#define glUniform1ui vctCaptureUniform1ui
+#undef glUniform2f
+#define glUniform2f vctCaptureUniform2f
+#undef glUniform2i
+#define glUniform2i vctCaptureUniform2i
+#undef glUniform3f
+#define glUniform3f vctCaptureUniform3f
+#undef glUniform3i
+#define glUniform3i vctCaptureUniform3i
+#undef glUniform4fv
+#define glUniform4fv vctCaptureUniform4fv
+#undef glUniformMatrix4fv
+#define glUniformMatrix4fv vctCaptureUniformMatrix4fv
+#undef glUnmapBuffer
+#define glUnmapBuffer vctCaptureUnmapBuffer
+#undef glUseProgram
+#define glUseProgram vctCaptureUseProgram
+#undef glVertexAttribDivisor
+#define glVertexAttribDivisor vctCaptureVertexAttribDivisor
+#undef glVertexAttribIPointer
+#define glVertexAttribIPointer vctCaptureVertexAttribIPointer
+#undef glVertexAttribPointer
+#define glVertexAttribPointer vctCaptureVertexAttribPointer
+#undef glViewport
+#define glViewport vctCaptureViewport
+#endif
+
+#endif // GLCAPTURE_H
@@ -0,0 +1,102 @@
+#ifndef JOBSYSTEM_H
+#define JOBSYSTEM_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include <vector>
+
+#include "HighResClock.h"
+
+// Small work-stealing task scheduler. Every worker thread has its own queue of ready
+// jobs. It runs the newest one first and steals the oldest ones from the other
+// workers when its queue is empty. A job becomes ready once all of its dependencies
+// have finished. Jobs that call OpenGL are marked as main thread jobs and only run on
+// the thread owning the context, inside wait() or runMainThreadJobs().
+//
+// Every job is timed, so the total work, the critical path through the dependency
+// graph and the parallelism can be reported with printStats(). Jobs also show up in
+// the profiler. Job names must be string literals.
+//
+// Usage:
+//     JobSystem::Job* decode = jobs.add("decodeTexture", [&]() { image = Material::decodeTexture(path); });
+//     JobSystem::Job* upload = jobs.create("uploadTexture", [&]() { texture = Material::uploadTexture(image, path); }, true);
+//     jobs.addDependency(upload, decode);
+//     jobs.submit(upload);
+//     jobs.wait(upload);
+class JobSystem {
+public:
+	struct Job;
+
+	// numWorkers 0 uses one worker per core, minus one for the main thread
+	JobSystem(unsigned int numWorkers = 0);
+	// Jobs that haven't run yet are dropped, so wait for everything that matters first
+	~JobSystem();
+
+	// The job doesn't start before submit(), so dependencies can be added first.
+	// Jobs can be created from inside other jobs, the running job then counts as a
+	// dependency for the critical path.
+	Job* create(const char* name, std::function<void()> function, bool mainThread = false);
+	// Only valid before the job is submitted, or while it still waits for another dependency
+	void addDependency(Job* job, Job* dependency);
+	void submit(Job* job);
+	// create(), addDependency() and submit() in one step
+	Job* add(const char* name, std::function<void()> function, bool mainThread = false);
+	Job* add(const char* name, std::function<void()> function, const std::vector<Job*>& dependencies, bool mainThread = false);
+
+	// Called by the main thread. Runs main thread jobs until the job has finished.
+	void wait(Job* job);
+	void wait(const std::vector<Job*>& jobs);
+	bool isFinished(Job* job);
+	// Runs ready main thread jobs until there are none left or the time is up. At least one is run.
+	void runMainThreadJobs(double timeBudgetSeconds);
+
+	// Work, critical path and parallelism of the jobs since the last clear()
+	void printStats(std::ostream& out);
+	// Deletes the finished jobs and resets the statistics. Their handles can't be used afterwards.
+	void clear();
+
+	unsigned int getNumWorkers();
+
+protected:
+	struct WorkerQueue {
+		std::mutex mutex;
+		std::deque<Job*> jobs;
+	};
+
+	void workerLoop(unsigned int index);
+	void schedule(Job* job);
+	Job* getWorkerJob(int worker);
+	Job* getMainThreadJob();
+	void run(Job* job);
+	double getTime();
+
+	std::vector<std::thread> workers_;
+	std::vector<WorkerQueue*> queues_;
+	std::atomic<unsigned int> nextQueue_;
+	std::atomic<int> numReady_;
+
+	std::mutex mainMutex_;
+	std::deque<Job*> mainQueue_;
+	std::atomic<int> numMainReady_;
+
+	// Sleeping workers and the waiting main thread are woken on new jobs and finished jobs
+	std::mutex sleepMutex_;
+	std::condition_variable sleepCondition_;
+	bool quit_;
+
+	// Dependencies, finished flags and statistics, protected by graphMutex_
+	std::mutex graphMutex_;
+	std::vector<Job*> jobs_;
+	timer::HighResClock::time_point epoch_;
+	size_t numJobsRun_, numMainThreadJobs_;
+	std::atomic<size_t> numSteals_;
+	double totalWork_, firstStart_, lastFinish_;
+	Job* criticalJob_; // Finishes the longest chain
+};
+
+#endif // JOBSYSTEM_H
@@ -0,0 +1,77 @@
+#ifndef LIGHTGRID_H
+#define LIGHTGRID_H
+
+#include "GLCapture.h"
+#include <glm/glm.hpp>
+
+#include <string>
+#include <vector>
+
+// Point and spot lights besides the directional light. They are kept in a shader
+// storage buffer and light-assign.comp lists the lights reaching each cell of two
+// grids, so a shader only evaluates the lights of its cell instead of all of them:
+//  - clusters, screen tiles split into exponential depth slices, for the direct
+//    light in voxel-trace.frag. Assigned again every frame for the camera.
+//  - bricks of the voxel volume, for injecting the lights into the voxels while
+//    voxelizing. Assigned again only when the lights change.
+// A cell lists at most MAX_CLUSTER_LIGHTS or MAX_BRICK_LIGHTS lights, the rest is dropped.
+//
+// Needs OpenGL 4.3.
+class LightGrid {
+public:
+	// std430 layout of one light, see voxel-trace.frag
+	struct Light {
+		glm::vec4 positionRange;      // World position, distance where the light falls off to 0
+		glm::vec4 colorSpotInner;     // Color times intensity, cosine of the inner spot angle
+		glm::vec4 directionSpotOuter; // Spot direction, cosine of the outer spot angle or -1 for point lights
+	};
+
+	static const int CLUSTERS_X = 16;
+	static const int CLUSTERS_Y = 9;
+	static const int CLUSTERS_Z = 24;
+	static const int MAX_CLUSTER_LIGHTS = 64;
+	static const int BRICK_SIZE = 16;
+	static const int MAX_BRICK_LIGHTS = 32;
+	static const GLuint LIGHT_BINDING = 4;
+	static const GLuint CELL_BINDING = 5;
+
+	LightGrid();
+	~LightGrid();
+
+	// One "x,y,z,r,g,b,range" line per point light. Spot lights add ",dx,dy,dz,inner,outer"
+	// with the angles in degrees.
+	bool load(std::string filename);
+	// Point lights with random colors inside the box, the same ones every run
+	void addRandomLights(int count, glm::vec3 boundsMin, glm::vec3 boundsMax, float range);
+	size_t getNumLights();
+	// Defines for the shaders, after their #version line
+	std::string getShaderDefines();
+
+	// Creates the buffers, without voxels (0) there are no bricks
+	void initialize(int voxelDimensions);
+	// Uploads the lights and bins them by brick if they changed. shader is light-assign.comp.
+	void update(GLuint shader, float voxelGridWorldSize);
+	// Lists the lights of every cluster of the camera
+	void assignClusters(GLuint shader, const glm::mat4& viewMatrix, const glm::mat4& projectionMatrix, float nearPlane, float farPlane);
+	// Binds the lights and cluster lists for voxel-trace.frag, after glUseProgram
+	void bindClusters(GLuint shader, int width, int height);
+	// Binds the lights and brick lists for the voxelization shaders, after glUseProgram.
+	// The lights are shadowed by cones through the mips of occlusionTexture.
+	void bindBricks(GLuint shader, GLuint occlusionTexture, GLuint occlusionUnit, float voxelGridWorldSize);
+
+protected:
+	void assign(GLuint shader, GLuint cells, glm::ivec3 gridSize, GLuint maxCellLights);
+
+	std::vector<Light> lights_;
+	bool dirty_;
+
+	GLuint lightBuffer_;
+	size_t lightBufferSize_;
+	// Light count, then the light indices, for every cell
+	GLuint clusterBuffer_;
+	GLuint brickBuffer_;
+	int bricksPerAxis_;
+	float clusterNear_, clusterFar_;
+};
+
+#endif // LIGHTGRID_H
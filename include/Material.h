@@ -1,8 +1,9 @@
 #ifndef MATERIAL_H
 #define MATERIAL_H
 
-#include <GL/glew.h>
+#include "GLCapture.h"
 #include <glm/glm.hpp>
+#include <assimp/scene.h>
 
 #include <string>
 
@@ -18,15 +19,36 @@ public:
 		NUM_TEXTURES
 	};
 
+	// Decoded image waiting to be uploaded to the GPU
+	struct ImageData {
+		unsigned char* data;
+		int width, height, componentsPerPixel;
+	};
+
 	Material();
 	~Material();
 
+	// Reads the material properties and texture paths, doesn't touch OpenGL
 	void loadAssimpMaterial(const aiMaterial* material, std::string path);
+	// Decodes and uploads all textures of the material
+	void loadTextures();
 	Texture2D loadTexture(std::string filenameString);
+	static ImageData decodeTexture(std::string filenameString);
+	static Texture2D uploadTexture(ImageData& image, std::string filenameString);
+	static void freeImage(ImageData& image);
+	void setTexture(TEXTURES_TYPES type, Texture2D texture);
+	std::string getTexturePath(TEXTURES_TYPES type);
+	// The texture bindMaterial() binds for type, a placeholder while it is streamed in
+	Texture2D getBoundTexture(TEXTURES_TYPES type);
+	float getShininess();
+	float getOpacity();
+	// Only sets MaterialID for shaders built with a MaterialTable
 	void bindMaterial(GLuint shader);
 
 	bool hasAlpha_; // Has an alpha channel in the diffuseTexture_ 
 	std::string name_;
+	// Index in the MaterialTable, -1 without one
+	int materialID_;
 
 protected:
 	// Material properties
@@ -42,6 +64,12 @@ protected:
 	Texture2D maskTexture_;
 	Texture2D heightTexture_;
 
+	std::string texturePaths_[NUM_TEXTURES];
+
+	// Bound in place of textures that are still being loaded
+	static GLuint placeholderTextures_[NUM_TEXTURES];
+	GLuint getBoundTexture(TEXTURES_TYPES type, const Texture2D& texture);
+
 	// Not used
 	// int illuminationModel_;
 	//float refractionIndex_;
@@ -0,0 +1,79 @@
+#ifndef MATERIALTABLE_H
+#define MATERIALTABLE_H
+
+#include "GLCapture.h"
+
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "Material.h"
+
+// Properties and textures of all materials in one shader storage buffer, so a
+// shader built with getShaderHeader() switches materials with the MaterialID
+// uniform instead of four texture binds and eight uniforms per draw.
+//
+// Textures are referenced by GL_ARB_bindless_texture handles. Without bindless
+// textures they are scaled into texture arrays, one per power of two size from
+// MIN_BUCKET_SIZE up, and referenced by array and layer.
+class MaterialTable {
+public:
+	// std430 layout of one material, see sampleMaterial() in voxel-trace.frag
+	struct Entry {
+		GLuint textures[Material::NUM_TEXTURES][2];      // Bindless handle, or bucket and layer
+		GLfloat textureSizes[Material::NUM_TEXTURES][2]; // As sampled, so the bucket size for arrays
+		GLfloat shininess;
+		GLfloat opacity;
+		GLfloat padding[2];
+	};
+
+	static const int NUM_BUCKETS = 4;
+	static const int MIN_BUCKET_SIZE = 256;
+	static const GLuint BUFFER_BINDING = 3;
+	// The buckets take the units from here on, past everything voxel-trace.frag binds
+	static const GLuint FIRST_BUCKET_UNIT = 14;
+
+	// Needs OpenGL 4.3, bindless is only used when the driver has it
+	explicit MaterialTable(bool bindless);
+	~MaterialTable();
+
+	// Adds new materials and rebuilds the buffer when textures were streamed in
+	void update(const std::map<int, Material*>& materials);
+	// Binds the buffer, and the arrays without bindless textures. After glUseProgram.
+	void bind(GLuint shader);
+
+	bool isBindless();
+	// Replaces the #version line of the shaders reading the table
+	const char* getShaderHeader();
+	size_t getNumMaterials();
+
+protected:
+	bool bindless_;
+	std::vector<Material*> materials_;
+	// Texture per material and type the buffer was built with, to notice streamed textures
+	std::vector<GLuint> builtTextures_;
+	GLuint buffer_;
+	size_t bufferSize_;
+	// Sampled for textures a material doesn't have, like an unbound unit
+	GLuint missingTexture_;
+
+	// Bindless handles, made resident when created
+	std::map<GLuint, GLuint64> handles_;
+
+	struct Bucket {
+		GLuint texture; // GL_TEXTURE_2D_ARRAY, RGBA8 with mipmaps
+		int size;
+		int numLayers;
+		int capacity;
+		bool mipmapsDirty;
+	};
+	Bucket buckets_[NUM_BUCKETS];
+	std::map<GLuint, std::pair<int, int> > layers_; // Bucket and layer of every texture
+	GLuint framebuffers_[2]; // Read and draw framebuffer of the blits into the arrays
+
+	void getReference(const Texture2D& texture, GLuint reference[2], GLfloat size[2]);
+	std::pair<int, int> addLayer(const Texture2D& texture);
+	void growBucket(Bucket& bucket);
+};
+
+#endif // MATERIALTABLE_H
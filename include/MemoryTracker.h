@@ -0,0 +1,45 @@
+#ifndef MEMORYTRACKER_H
+#define MEMORYTRACKER_H
+
+#include "GLCapture.h"
+
+#include <atomic>
+#include <cstddef>
+#include <ostream>
+
+// Keeps count of the bytes allocated by each subsystem, on the GPU and on the CPU.
+// Every buffer and texture allocation calls allocate() and its deletion calls
+// release(). Safe to use from the loader threads.
+class MemoryTracker {
+public:
+	enum Category {
+		VOXELS,
+		SHADOW,
+		GEOMETRY,
+		TEXTURES,
+		CPU_MIRRORS,
+		NUM_CATEGORIES
+	};
+
+	static void allocate(Category category, size_t bytes);
+	static void release(Category category, size_t bytes);
+
+	static size_t getBytes(Category category);
+	static size_t getPeakBytes(Category category);
+	static size_t getTotalBytes();
+	static size_t getTotalGPUBytes();
+	static const char* getCategoryName(Category category);
+
+	// Size of a texture with the given format, including the mip chain if mipmapped
+	static size_t getTextureBytes(GLenum internalFormat, int width, int height, int depth, bool mipmapped);
+
+	// One line with the current usage per category
+	static void printSummary(std::ostream& out);
+	static void writeJSON(std::ostream& out);
+
+protected:
+	static std::atomic<size_t> bytes_[NUM_CATEGORIES];
+	static std::atomic<size_t> peakBytes_[NUM_CATEGORIES];
+};
+
+#endif // MEMORYTRACKER_H
@@ -1,7 +1,7 @@
 #ifndef MESH_H
 #define MESH_H
 
-#include <GL/glew.h>
+#include "GLCapture.h"
 #include <string>
 #include <vector>
 #include <glm/glm.hpp>
@@ -9,11 +9,88 @@
 
 class Mesh {
 public:
+	// Byte layout of one interleaved vertex. Positions are either floats or
+	// unorm16 relative to the mesh AABB, UVs are half floats, normals and
+	// tangents are octahedral encoded snorm16 pairs and the bitangent is
+	// stored as a sign.
+	struct VertexLayout {
+		GLsizei stride;
+		GLenum positionType;
+		GLboolean positionNormalized;
+		size_t positionOffset;
+		size_t bitangentSignOffset;
+		size_t uvOffset;
+		size_t normalOffset;
+		size_t tangentOffset;
+	};
+
+	// Meshlet of consecutive triangles in the index buffer, culled on the GPU by
+	// cluster-cull.comp. Same layout as the std430 struct in the shader.
+	struct Cluster {
+		glm::vec4 sphere;  // Model space center and radius
+		glm::vec4 cone;    // Axis of the triangle normals and sine of the cone's half angle, 1 if it can't be backface culled
+		GLuint firstIndex;
+		GLuint indexCount;
+		GLuint padding[2];
+	};
+
+	static const unsigned int MAX_CLUSTER_VERTICES = 64;
+	static const unsigned int MAX_CLUSTER_TRIANGLES = 124;
+	// Levels of detail including the full mesh, each with about half the triangles of the one before
+	static const unsigned int MAX_LODS = 5;
+
 	Mesh();
 	~Mesh();
 
-	void draw();
-	void loadAssimpMesh(const aiMesh* mesh);
+	// More than one instance draws with glDrawElementsInstanced, the model matrices
+	// then come from the buffer given to setInstanceBuffer()
+	void draw(GLuint shader, GLsizei numInstances = 1, unsigned int lod = 0);
+	void loadAssimpMesh(const aiMesh* mesh, bool quantizePositions = true, bool keepCPUCopies = false);
+	// With buildLODs simplified versions of the mesh are added, see MeshSimplifier
+	void buildVertexData(const aiMesh* mesh, bool quantizePositions = true, bool keepCPUCopies = false, bool buildLODs = false);
+	// One mesh out of the CPU copies of several, transformed by their model matrices.
+	// Attributes only some of the meshes have get the defaults of buildVertexData.
+	void buildMergedVertexData(const std::vector<Mesh*>& meshes, const std::vector<glm::mat4>& modelMatrices, bool quantizePositions = true, bool keepCPUCopies = false, bool buildLODs = false);
+	void upload();
+	// Per instance model matrices for attributes 5 to 8, one mat4 per instance
+	void setInstanceBuffer(GLuint buffer);
+	void bindStorageBuffers(GLuint shader, GLuint vertexBinding, GLuint indexBinding, unsigned int lod = 0);
+	// Runs both passes of voxelization.comp. The tile job buffer must be bound to
+	// binding 2 and GL_DISPATCH_INDIRECT_BUFFER.
+	void voxelize(GLuint shader, unsigned int lod = 0);
+	// Writes the clusters that pass cluster-cull.comp to the indirect draw list in
+	// drawCommands, a buffer of getDrawCommandBytes(). The list belongs to whoever placed
+	// the mesh, since every placement culls differently. The caller sets the culling
+	// uniforms and issues a command barrier before drawClusters().
+	void cullClusters(GLuint shader, GLuint drawCommands, unsigned int lod = 0);
+	// Draws the list written by the last cullClusters(), which must have had the same lod
+	void drawClusters(GLuint shader, GLuint drawCommands, unsigned int lod = 0);
+	// Draw count, padding, then one DrawElementsIndirectCommand per cluster of any level
+	size_t getDrawCommandBytes();
+	// Coarsest level of detail whose error, in model space, is at most maxError
+	unsigned int selectLOD(float maxError);
+	unsigned int getNumLODs();
+	float getLODError(unsigned int lod);
+
+	static VertexLayout getVertexLayout(bool quantizePositions);
+	static glm::vec2 encodeOctahedral(glm::vec3 n);
+	static glm::vec3 decodeOctahedral(glm::vec2 e);
+
+	// Memory used by the old layout (five float streams + 32 bit indices) and by the
+	// packed layout actually uploaded. Used for the memory report after loading.
+	size_t getSeparateLayoutBytes();
+	size_t getPackedLayoutBytes();
+	size_t getCPUCopyBytes();
+	// Only filled when built with keepCPUCopies
+	bool hasCPUCopies();
+	const std::vector<glm::vec3>& getCPUPositions();
+	const std::vector<unsigned int>& getCPUIndices();
+	unsigned int getNumVertices();
+	unsigned int getNumTriangles(unsigned int lod = 0);
+	unsigned int getNumClusters(unsigned int lod = 0);
+	// Bounding box of the positions in model space
+	glm::vec3 getBoundsMin();
+	glm::vec3 getBoundsMax();
 
 protected:
 	std::vector<glm::vec3> vertices_;
@@ -23,18 +100,48 @@ protected:
 	std::vector<glm::vec3> bitangents_;
 	std::vector<unsigned int> indices_;
 
+	// Packed data waiting for upload()
+	std::vector<unsigned char> vertexData_;
+	std::vector<unsigned char> indexData_;
+
 	GLuint vertexArray_;
 	GLuint vboIndices_;
 	GLuint numIndices_;
+	GLenum indexType_;
 	GLuint vboVertices_;
-	GLuint vboNormals_;
-	GLuint vboTangents_;
-	GLuint vboBitangents_;
-	GLuint vboTexCoords_;
+	VertexLayout layout_;
+	unsigned int numVertices_;
 	bool hasNormals_;
 	bool hasTangentsAndBitangents_;
 	bool hasTexCoords_;
 	unsigned int materialIndex_;
+
+	// Dequantization of positions: position = positionOffset_ + positionScale_ * stored
+	glm::vec3 positionOffset_;
+	glm::vec3 positionScale_;
+
+	glm::vec3 aabbMin_;
+	glm::vec3 aabbMax_;
+
+	// Range of the index buffer and of the clusters of one level of detail. The simplified
+	// levels reuse the vertices of the full mesh, only their indices are added.
+	struct LOD {
+		GLuint firstIndex;
+		GLuint numIndices;
+		GLuint firstCluster;
+		GLuint numClusters;
+		float error; // Largest distance of the simplified surface from the full one, in model space
+	};
+	std::vector<LOD> lods_;
+
+	void buildLODs(const aiMesh* mesh, const std::vector<unsigned int>& indices, std::vector<unsigned int>& lodIndices);
+	// Appends the clusters of the triangles in indices[firstIndex, firstIndex + numIndices)
+	void buildClusters(const aiMesh* mesh, const std::vector<unsigned int>& indices, size_t firstIndex, size_t numIndices);
+
+	// Clusters of all levels waiting for upload(), then only their count is kept
+	std::vector<Cluster> clusters_;
+	unsigned int numClusters_;
+	GLuint clusterBuffer_;
 };
 
-#endif // MESH_H
\ No newline at end of file
+#endif // MESH_H
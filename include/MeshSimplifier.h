@@ -0,0 +1,69 @@
+#ifndef MESHSIMPLIFIER_H
+#define MESHSIMPLIFIER_H
+
+#include <set>
+#include <vector>
+#include <glm/glm.hpp>
+
+// Quadric error edge collapse. A vertex is only ever moved onto one of its neighbours,
+// so the simplified triangles still index the vertex buffer of the full mesh and keep
+// its attributes. Vertices sharing a position with another vertex sit on a UV or
+// normal seam and are never moved, so the seams stay where they are. Vertices on an
+// open border only move along the border.
+//
+// The error of a collapse is the square root of the quadric, which bounds the distance
+// of the moved vertex to each plane of the original triangles it has absorbed. Doesn't
+// touch OpenGL so it can run on a loader thread.
+class MeshSimplifier {
+public:
+	MeshSimplifier(const std::vector<glm::vec3>& positions, const std::vector<unsigned int>& indices);
+
+	// Collapses edges of the current triangles, cheapest first, until at most
+	// targetTriangles are left or every collapse would cost more than maxError.
+	// Can be called again with a lower target to continue from the result.
+	void simplify(size_t targetTriangles, float maxError);
+	const std::vector<unsigned int>& getIndices();
+	size_t getNumTriangles();
+	// Largest error of the collapses done so far, in the units of the positions
+	float getError();
+
+protected:
+	enum VertexKind {
+		MANIFOLD, // Moves onto any neighbour
+		BORDER,   // On exactly two open edges, moves along them
+		LOCKED    // Seams, corners and non-manifold vertices
+	};
+
+	// Symmetric 4x4 matrix of the plane equations, upper triangle only
+	struct Quadric {
+		double a00, a01, a02, a03, a11, a12, a13, a22, a23, a33;
+	};
+
+	struct Collapse {
+		float error;
+		unsigned int from;
+		unsigned int to;
+		bool operator<(const Collapse& other) const { return error < other.error; }
+	};
+
+	static void addPlane(Quadric& q, glm::vec3 normal, float distance);
+	static void addQuadric(Quadric& q, const Quadric& other);
+	static float evaluate(const Quadric& q, glm::vec3 p);
+	static unsigned long long edgeKey(unsigned int a, unsigned int b);
+
+	void classifyVertices();
+	bool isBorderEdge(unsigned int a, unsigned int b);
+	// Whether moving from onto to turns over any of from's triangles that stay
+	bool flipsTriangles(unsigned int from, unsigned int to, const std::vector<unsigned int>& firstTriangle, const std::vector<unsigned int>& vertexTriangles);
+	// One round of collapses that don't share a triangle, returns false if none was possible
+	bool collapseRound(size_t targetTriangles, float maxError);
+
+	const std::vector<glm::vec3>& positions_;
+	std::vector<unsigned int> indices_;
+	std::vector<VertexKind> kinds_;
+	std::vector<Quadric> quadrics_;
+	std::set<unsigned long long> borderEdges_; // Edge keys, extended as border vertices collapse
+	float error_;
+};
+
+#endif // MESHSIMPLIFIER_H
@@ -3,6 +3,7 @@
 
 #include <glm/glm.hpp>
 #include <string>
+#include <vector>
 #include <iostream>
 
 class Application; // Forward declaration
@@ -10,6 +11,7 @@ class Application; // Forward declaration
 #include "Texture.h"
 #include "Mesh.h"
 #include "Material.h"
+#include "SceneGraph.h"
 
 class Object {
 public:
@@ -17,11 +19,40 @@ public:
 	~Object();
 
 	bool loadMeshFromFile(const std::string &path);
+	// Transform of an object that isn't in a scene graph
 	void setPosition(glm::vec3 pos);
 	void setScale(float scale);
-	void draw(glm::mat4 &viewMatrix, glm::mat4 &projectionMatrix, glm::mat4 &depthModelViewProjectionMatrix, GLuint shader);
-	void drawToDepth(glm::mat4 &depthViewProjectionMatrix, GLuint shader);
-    void drawTo3DTexture(GLuint shader, glm::mat4 &depthViewProjectionMatrix);
+	// Takes the transform from a scene graph node instead
+	void setNode(SceneGraph* sceneGraph, int node);
+	// Draws the object again at another node of the same scene graph. All instances
+	// share the mesh and are drawn by one instanced draw call per pass.
+	void addInstance(int node);
+	int getNode();
+	unsigned int getNumInstances();
+	bool isInstanced();
+	// Uploads the world matrices of the instances if any of their nodes changed in
+	// the last SceneGraph::update()
+	void updateInstanceBuffer();
+	// Bounding box of all instances in world space
+	glm::vec3 getWorldBoundsMin();
+	glm::vec3 getWorldBoundsMax();
+	// The world matrix of the (first) node, or scale after translate without one
+	glm::mat4 getModelMatrix();
+	// matrix * model matrix, cached by the scene graph for its views
+	glm::mat4 getViewModelMatrix(SceneGraph::CachedView view, const glm::mat4& matrix);
+	// The matrices draw() sets for the object and its material
+	void setUniforms(glm::mat4 &viewMatrix, glm::mat4 &projectionMatrix, glm::mat4 &depthViewProjectionMatrix, GLuint shader);
+	// Coarsest level of detail of the mesh whose error stays below maxError in world
+	// space, for the largest scale of the instances
+	unsigned int selectLOD(float maxError);
+	// With culledClusters only the clusters kept by the last cullClusters() are drawn.
+	// The passes that can't resolve the full detail draw the level selectLOD(maxError)
+	// picks, cullClusters() has to be given the same maxError.
+	void draw(glm::mat4 &viewMatrix, glm::mat4 &projectionMatrix, glm::mat4 &depthModelViewProjectionMatrix, GLuint shader, bool culledClusters = false);
+	void drawToDepth(glm::mat4 &depthViewProjectionMatrix, GLuint shader, bool culledClusters = false, float maxError = 0.0f);
+    void drawTo3DTexture(GLuint shader, glm::mat4 &depthViewProjectionMatrix, bool culledClusters = false, float maxError = 0.0f);
+    void voxelizeCompute(GLuint shader, glm::mat4 &depthViewProjectionMatrix, float maxError = 0.0f);
+    void cullClusters(GLuint shader, float maxError = 0.0f);
 
 	Mesh* mesh_;
 	Material* material_;
@@ -29,6 +60,23 @@ public:
 protected:
 	glm::vec3 position_;
 	float scale_;
+	SceneGraph* sceneGraph_;
+	std::vector<int> nodes_; // One per instance
+
+	// World matrices of the instances for the instanced draws, only with more than one
+	GLuint instanceBuffer_;
+	size_t instanceBufferSize_;
+	bool instancesDirty_;
+
+	// Indirect draw list written by cullClusters(), see Mesh::cullClusters(). Created by
+	// the first cullClusters().
+	GLuint drawCommandBuffer_;
+	size_t drawCommandBufferSize_;
+
+	// Sets the Instanced uniform, the instance matrices are bound with the mesh
+	void bindInstances(GLuint shader);
+	// Whether the last cullClusters() left a draw list to draw instead of the whole mesh
+	bool hasCulledClusters();
 };
 
 inline bool compareObjects(Object* obj1, Object* obj2) {
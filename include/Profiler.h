@@ -0,0 +1,104 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include "GLCapture.h"
+
+#include <atomic>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "HighResClock.h"
+
+// Hot path instrumentation. CPU zones are timed with timer::HighResClock and written
+// to a ring buffer owned by the calling thread, so zones on loader threads don't
+// contend. GPU zones use GL timestamp queries that are read back two frames later,
+// so they never stall the pipeline. Zone names must be string literals.
+//
+// Usage:
+//     PROFILE_ZONE("voxelizeScene");       // CPU only
+//     PROFILE_GPU_ZONE("voxelizeScene");   // CPU and GPU, GL thread only
+class Profiler {
+public:
+	struct Event {
+		const char* name;
+		long long startNs;
+		long long durationNs;
+	};
+
+	// Collects finished GPU queries and starts a new query set. Call once per frame on the GL thread.
+	static void beginFrame();
+
+	static void recordCPU(const char* name, timer::HighResClock::time_point start, timer::HighResClock::time_point end);
+	static void beginGPUZone(const char* name);
+	static void endGPUZone();
+
+	// Min/mean/p99/max per zone over the events still in the ring buffers
+	static void printSummary(std::ostream& out);
+	// Chrome about:tracing / Perfetto JSON
+	static bool writeChromeTrace(const std::string& filename);
+
+	static const size_t RING_CAPACITY = 1 << 16;
+
+protected:
+	struct ThreadRing {
+		std::vector<Event> events;
+		std::atomic<size_t> count;
+		int threadIndex;
+	};
+
+	struct GPUQuery {
+		const char* name;
+		GLuint startQuery;
+		GLuint endQuery;
+	};
+
+	struct GPUQuerySet {
+		std::vector<GPUQuery> queries;
+		long long cpuMinusGpuNs;
+	};
+
+	static ThreadRing* getThreadRing();
+	static long long toNanoseconds(timer::HighResClock::time_point time);
+	static void pushEvent(ThreadRing* ring, const char* name, long long startNs, long long durationNs);
+	static GLuint getQuery();
+	static std::vector<Event> collectEvents(std::vector<int>* threadIndices);
+
+	// GPU queries are double buffered, the set used two frames ago is read back in beginFrame()
+	static GPUQuerySet gpuSets_[2];
+	static int gpuSet_;
+	static std::vector<size_t> gpuZoneStack_;
+	static std::vector<GLuint> freeQueries_;
+	static ThreadRing gpuRing_;
+	static std::vector<ThreadRing*> threadRings_;
+	static std::mutex threadRingsMutex_;
+};
+
+// Times the enclosing scope on the CPU
+class ProfileZone {
+public:
+	ProfileZone(const char* name);
+	~ProfileZone();
+
+protected:
+	const char* name_;
+	timer::HighResClock::time_point start_;
+};
+
+// Times the enclosing scope on the CPU and on the GPU
+class GPUProfileZone {
+public:
+	GPUProfileZone(const char* name);
+	~GPUProfileZone();
+
+protected:
+	ProfileZone cpuZone_;
+};
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#define PROFILE_ZONE(name) ProfileZone PROFILE_CONCAT(profileZone, __LINE__)(name)
+#define PROFILE_GPU_ZONE(name) GPUProfileZone PROFILE_CONCAT(gpuProfileZone, __LINE__)(name)
+
+#endif // PROFILER_H
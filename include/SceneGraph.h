@@ -0,0 +1,83 @@
+#ifndef SCENEGRAPH_H
+#define SCENEGRAPH_H
+
+#include <glm/glm.hpp>
+#include <assimp/scene.h>
+
+#include <utility>
+#include <vector>
+
+// Transform hierarchy of the scene. Every node has a local matrix relative to its
+// parent and a cached world matrix. The matrices are kept in flat arrays indexed by
+// node, with parents always before their children, so update() is one pass over
+// the arrays that recomputes only the nodes marked dirty and everything below them.
+//
+// Besides the world matrix, the product with the camera view and with the light's
+// view projection is cached for every node, since every pass needs one of them.
+// They are recomputed for all nodes when the view changes, otherwise only for nodes
+// whose world matrix changed.
+//
+// Only the render thread may touch the graph.
+class SceneGraph {
+public:
+	enum CachedView {
+		CAMERA_VIEW,           // View * world, the ModelViewMatrix of the main passes
+		LIGHT_VIEW_PROJECTION, // Light view projection * world, the DepthModelViewProjectionMatrix
+		NUM_CACHED_VIEWS
+	};
+
+	// A flattened node hierarchy, built without touching a graph so it can be done on a loader thread
+	struct NodeList {
+		std::vector<int> parents; // Index into the list, -1 for the root
+		std::vector<glm::mat4> localMatrices;
+		// Mesh index and node of every mesh reference, a mesh can be referenced by several nodes
+		std::vector<std::pair<unsigned int, int> > meshInstances;
+	};
+
+	SceneGraph();
+
+	// parent is -1 for a root and must have been added before
+	int addNode(int parent, const glm::mat4& localMatrix);
+	// Adds all nodes of a list below parent and returns the index of its first node.
+	// The nodes of the list are then firstNode + their index in the list.
+	int addNodes(const NodeList& nodes, int parent);
+	// Marks the node and its subtree dirty
+	void setLocalMatrix(int node, const glm::mat4& localMatrix);
+
+	const glm::mat4& getLocalMatrix(int node);
+	// As of the last update()
+	const glm::mat4& getWorldMatrix(int node);
+	// matrix * world matrix of the node. Taken from the cache when matrix is the one
+	// the view was updated with, computed otherwise.
+	glm::mat4 getViewWorldMatrix(CachedView view, int node, const glm::mat4& matrix);
+	// Whether the world matrix of the node changed in the last update()
+	bool hasChanged(int node);
+
+	// Once per frame before drawing
+	void update(const glm::mat4& cameraView, const glm::mat4& lightViewProjection);
+
+	size_t getNumNodes();
+	// Nodes whose world matrix was recomputed in the last update()
+	size_t getNumUpdated();
+
+	// Nodes of an Assimp scene. Meshes not referenced by any node are put at the root.
+	static void flattenAssimpNodes(const aiScene* scene, NodeList& nodes);
+	static glm::mat4 toMatrix(const aiMatrix4x4& m);
+	// out = a * b with SSE where available, out may be a or b
+	static void multiply(const glm::mat4& a, const glm::mat4& b, glm::mat4& out);
+
+protected:
+	std::vector<int> parents_;
+	std::vector<glm::mat4> localMatrices_;
+	std::vector<glm::mat4> worldMatrices_;
+	std::vector<unsigned char> dirty_;   // Local matrix changed since the last update()
+	std::vector<unsigned char> changed_; // World matrix changed in the last update()
+
+	std::vector<glm::mat4> viewWorldMatrices_[NUM_CACHED_VIEWS];
+	glm::mat4 viewMatrices_[NUM_CACHED_VIEWS];
+	bool viewsValid_;
+
+	size_t numUpdated_;
+};
+
+#endif // SCENEGRAPH_H
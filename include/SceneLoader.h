@@ -0,0 +1,83 @@
+#ifndef SCENELOADER_H
+#define SCENELOADER_H
+
+#include <atomic>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "JobSystem.h"
+#include "Object.h"
+#include "Material.h"
+#include "SceneGraph.h"
+
+// Loads a model in the background. The Assimp import, the vertex packing of every
+// mesh and the decoding of every image are jobs on the JobSystem, while the render
+// thread keeps drawing. Everything touching OpenGL is handed back to the render
+// thread through processUploads(), which spends at most a given amount of time per frame.
+class SceneLoader {
+public:
+	SceneLoader(JobSystem* jobSystem, bool quantizePositions, bool keepMeshCPUCopies, bool buildMeshLODs);
+	~SceneLoader();
+
+	void loadAsync(std::string path, std::string name, glm::vec3 pos = glm::vec3(0.0f), float scale = 1.0f);
+
+	// Called by the render thread. New objects are appended to objects and placed at
+	// their nodes in sceneGraph, new materials are added to materials. Returns true if
+	// any object or texture became resident.
+	bool processUploads(std::vector<Object*>& objects, std::map<int, Material*>& materials, SceneGraph& sceneGraph, double timeBudgetSeconds);
+
+	// True when the jobs are finished and everything has been uploaded
+	bool isDone();
+	bool failed();
+
+protected:
+	struct DecodedTexture {
+		Material* material;
+		Material::TEXTURES_TYPES type;
+		std::string path;
+		Material::ImageData image;
+	};
+
+	// Node hierarchy of a loaded scene, added to the graph with its first object
+	struct SceneNodes {
+		SceneGraph::NodeList nodes;
+		std::vector<std::vector<int> > meshNodes; // Nodes of the list referencing each mesh
+		glm::mat4 rootMatrix;                     // Position and scale the scene was loaded with
+		int firstNode;                            // -1 until added
+	};
+
+	struct ReadyObject {
+		Object* object;
+		unsigned int meshIndex;
+		std::shared_ptr<SceneNodes> scene;
+	};
+
+	// Import job, adds a job per mesh and per texture as dependencies of doneJob_
+	void run(std::string path, std::string name, glm::vec3 pos, float scale);
+	// The first node referencing the mesh gets the object, every further one an instance of it
+	void placeObject(ReadyObject& ready, std::vector<Object*>& objects, SceneGraph& sceneGraph);
+
+	bool quantizePositions_;
+	bool keepMeshCPUCopies_;
+	bool buildMeshLODs_;
+
+	JobSystem* jobSystem_;
+	JobSystem::Job* doneJob_;
+	std::atomic<bool> workerDone_;
+	std::atomic<bool> failed_;
+	std::atomic<bool> cancel_;
+
+	// Finished CPU work waiting for the render thread, protected by mutex_
+	std::mutex mutex_;
+	std::map<int, Material*> readyMaterials_;
+	std::deque<ReadyObject> readyObjects_;
+	std::deque<DecodedTexture> readyTextures_;
+};
+
+#endif // SCENELOADER_H
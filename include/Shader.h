@@ -1,9 +1,16 @@
 #ifndef SHADER_H
 #define SHADER_H
 
-#include <GL/glew.h>
+#include "GLCapture.h"
 
+// A header replaces the #version line of every stage, for variants that need a
+// newer version, extensions or defines
 //GLuint loadShaders(const char* vert, const char* frag);
-GLuint loadShaders(const char* vert, const char* frag, const char* geom = NULL);
+GLuint loadShaders(const char* vert, const char* frag, const char* geom = NULL, const char* header = NULL);
+// Returns 0 if the shader fails to compile or link
+GLuint loadComputeShader(const char* comp, const char* header = NULL);
+// Reads a shader file ahead of time, can be called from any thread. The load
+// functions above take the source from there, so only the compilation needs GL.
+void preloadShaderSource(const char* path);
 
 #endif
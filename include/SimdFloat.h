@@ -0,0 +1,206 @@
+#ifndef SIMDFLOAT_H
+#define SIMDFLOAT_H
+
+#include <math.h>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define SIMD_AVX
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SIMD_SSE
+#endif
+
+// Packets of floats for the CPU cone tracer, one lane per pixel. Uses AVX or SSE when
+// the compiler targets them and plain arrays otherwise, so the tracer is written once.
+// Comparisons give a SimdMask, which is used to blend lanes with select().
+
+#if defined(SIMD_AVX)
+
+struct SimdMask {
+	__m256 v;
+	SimdMask() {}
+	SimdMask(__m256 m) : v(m) {}
+	static SimdMask all() { return _mm256_castsi256_ps(_mm256_set1_epi32(-1)); }
+	// Bit i is set for an active lane i
+	int bits() const { return _mm256_movemask_ps(v); }
+	bool any() const { return bits() != 0; }
+	bool lane(int i) const { return (bits() >> i) & 1; }
+	SimdMask operator&(const SimdMask& o) const { return _mm256_and_ps(v, o.v); }
+	SimdMask operator|(const SimdMask& o) const { return _mm256_or_ps(v, o.v); }
+	// This and not o
+	SimdMask andNot(const SimdMask& o) const { return _mm256_andnot_ps(o.v, v); }
+};
+
+struct SimdFloat {
+	enum { WIDTH = 8 };
+	__m256 v;
+	SimdFloat() {}
+	SimdFloat(__m256 f) : v(f) {}
+	SimdFloat(float f) : v(_mm256_set1_ps(f)) {}
+	static SimdFloat load(const float* p) { return _mm256_loadu_ps(p); }
+	void store(float* p) const { _mm256_storeu_ps(p, v); }
+
+	SimdFloat operator+(const SimdFloat& o) const { return _mm256_add_ps(v, o.v); }
+	SimdFloat operator-(const SimdFloat& o) const { return _mm256_sub_ps(v, o.v); }
+	SimdFloat operator*(const SimdFloat& o) const { return _mm256_mul_ps(v, o.v); }
+	SimdFloat operator/(const SimdFloat& o) const { return _mm256_div_ps(v, o.v); }
+	SimdFloat operator-() const { return _mm256_xor_ps(v, _mm256_set1_ps(-0.0f)); }
+	SimdMask operator<(const SimdFloat& o) const { return _mm256_cmp_ps(v, o.v, _CMP_LT_OQ); }
+	SimdMask operator<=(const SimdFloat& o) const { return _mm256_cmp_ps(v, o.v, _CMP_LE_OQ); }
+	SimdMask operator>(const SimdFloat& o) const { return _mm256_cmp_ps(v, o.v, _CMP_GT_OQ); }
+	SimdMask operator>=(const SimdFloat& o) const { return _mm256_cmp_ps(v, o.v, _CMP_GE_OQ); }
+	SimdMask operator==(const SimdFloat& o) const { return _mm256_cmp_ps(v, o.v, _CMP_EQ_OQ); }
+};
+
+inline SimdFloat min(const SimdFloat& a, const SimdFloat& b) { return _mm256_min_ps(a.v, b.v); }
+inline SimdFloat max(const SimdFloat& a, const SimdFloat& b) { return _mm256_max_ps(a.v, b.v); }
+inline SimdFloat sqrt(const SimdFloat& a) { return _mm256_sqrt_ps(a.v); }
+inline SimdFloat abs(const SimdFloat& a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v); }
+// Lanes of a where the mask is set, of b elsewhere
+inline SimdFloat select(const SimdMask& mask, const SimdFloat& a, const SimdFloat& b) { return _mm256_blendv_ps(b.v, a.v, mask.v); }
+
+#elif defined(SIMD_SSE)
+
+struct SimdMask {
+	__m128 v;
+	SimdMask() {}
+	SimdMask(__m128 m) : v(m) {}
+	static SimdMask all() { return _mm_castsi128_ps(_mm_set1_epi32(-1)); }
+	int bits() const { return _mm_movemask_ps(v); }
+	bool any() const { return bits() != 0; }
+	bool lane(int i) const { return (bits() >> i) & 1; }
+	SimdMask operator&(const SimdMask& o) const { return _mm_and_ps(v, o.v); }
+	SimdMask operator|(const SimdMask& o) const { return _mm_or_ps(v, o.v); }
+	SimdMask andNot(const SimdMask& o) const { return _mm_andnot_ps(o.v, v); }
+};
+
+struct SimdFloat {
+	enum { WIDTH = 4 };
+	__m128 v;
+	SimdFloat() {}
+	SimdFloat(__m128 f) : v(f) {}
+	SimdFloat(float f) : v(_mm_set1_ps(f)) {}
+	static SimdFloat load(const float* p) { return _mm_loadu_ps(p); }
+	void store(float* p) const { _mm_storeu_ps(p, v); }
+
+	SimdFloat operator+(const SimdFloat& o) const { return _mm_add_ps(v, o.v); }
+	SimdFloat operator-(const SimdFloat& o) const { return _mm_sub_ps(v, o.v); }
+	SimdFloat operator*(const SimdFloat& o) const { return _mm_mul_ps(v, o.v); }
+	SimdFloat operator/(const SimdFloat& o) const { return _mm_div_ps(v, o.v); }
+	SimdFloat operator-() const { return _mm_xor_ps(v, _mm_set1_ps(-0.0f)); }
+	SimdMask operator<(const SimdFloat& o) const { return _mm_cmplt_ps(v, o.v); }
+	SimdMask operator<=(const SimdFloat& o) const { return _mm_cmple_ps(v, o.v); }
+	SimdMask operator>(const SimdFloat& o) const { return _mm_cmpgt_ps(v, o.v); }
+	SimdMask operator>=(const SimdFloat& o) const { return _mm_cmpge_ps(v, o.v); }
+	SimdMask operator==(const SimdFloat& o) const { return _mm_cmpeq_ps(v, o.v); }
+};
+
+inline SimdFloat min(const SimdFloat& a, const SimdFloat& b) { return _mm_min_ps(a.v, b.v); }
+inline SimdFloat max(const SimdFloat& a, const SimdFloat& b) { return _mm_max_ps(a.v, b.v); }
+inline SimdFloat sqrt(const SimdFloat& a) { return _mm_sqrt_ps(a.v); }
+inline SimdFloat abs(const SimdFloat& a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a.v); }
+// SSE2 has no blend instruction
+inline SimdFloat select(const SimdMask& mask, const SimdFloat& a, const SimdFloat& b) {
+	return _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v));
+}
+
+#else
+
+struct SimdMask {
+	bool v[4];
+	SimdMask() {}
+	static SimdMask all() { SimdMask r; for(int i = 0; i < 4; i++) r.v[i] = true; return r; }
+	int bits() const { int r = 0; for(int i = 0; i < 4; i++) r |= (int)v[i] << i; return r; }
+	bool any() const { return bits() != 0; }
+	bool lane(int i) const { return v[i]; }
+	SimdMask operator&(const SimdMask& o) const { SimdMask r; for(int i = 0; i < 4; i++) r.v[i] = v[i] && o.v[i]; return r; }
+	SimdMask operator|(const SimdMask& o) const { SimdMask r; for(int i = 0; i < 4; i++) r.v[i] = v[i] || o.v[i]; return r; }
+	SimdMask andNot(const SimdMask& o) const { SimdMask r; for(int i = 0; i < 4; i++) r.v[i] = v[i] && !o.v[i]; return r; }
+};
+
+#define SIMD_LANES(expression) for(int i = 0; i < 4; i++) { expression; } return r
+
+struct SimdFloat {
+	enum { WIDTH = 4 };
+	float v[4];
+	SimdFloat() {}
+	SimdFloat(float f) { for(int i = 0; i < 4; i++) v[i] = f; }
+	static SimdFloat load(const float* p) { SimdFloat r; SIMD_LANES(r.v[i] = p[i]); }
+	void store(float* p) const { for(int i = 0; i < 4; i++) p[i] = v[i]; }
+
+	SimdFloat operator+(const SimdFloat& o) const { SimdFloat r; SIMD_LANES(r.v[i] = v[i] + o.v[i]); }
+	SimdFloat operator-(const SimdFloat& o) const { SimdFloat r; SIMD_LANES(r.v[i] = v[i] - o.v[i]); }
+	SimdFloat operator*(const SimdFloat& o) const { SimdFloat r; SIMD_LANES(r.v[i] = v[i] * o.v[i]); }
+	SimdFloat operator/(const SimdFloat& o) const { SimdFloat r; SIMD_LANES(r.v[i] = v[i] / o.v[i]); }
+	SimdFloat operator-() const { SimdFloat r; SIMD_LANES(r.v[i] = -v[i]); }
+	SimdMask operator<(const SimdFloat& o) const { SimdMask r; SIMD_LANES(r.v[i] = v[i] < o.v[i]); }
+	SimdMask operator<=(const SimdFloat& o) const { SimdMask r; SIMD_LANES(r.v[i] = v[i] <= o.v[i]); }
+	SimdMask operator>(const SimdFloat& o) const { SimdMask r; SIMD_LANES(r.v[i] = v[i] > o.v[i]); }
+	SimdMask operator>=(const SimdFloat& o) const { SimdMask r; SIMD_LANES(r.v[i] = v[i] >= o.v[i]); }
+	SimdMask operator==(const SimdFloat& o) const { SimdMask r; SIMD_LANES(r.v[i] = v[i] == o.v[i]); }
+};
+
+inline SimdFloat min(const SimdFloat& a, const SimdFloat& b) { SimdFloat r; SIMD_LANES(r.v[i] = a.v[i] < b.v[i] ? a.v[i] : b.v[i]); }
+inline SimdFloat max(const SimdFloat& a, const SimdFloat& b) { SimdFloat r; SIMD_LANES(r.v[i] = a.v[i] > b.v[i] ? a.v[i] : b.v[i]); }
+inline SimdFloat sqrt(const SimdFloat& a) { SimdFloat r; SIMD_LANES(r.v[i] = sqrtf(a.v[i])); }
+inline SimdFloat abs(const SimdFloat& a) { SimdFloat r; SIMD_LANES(r.v[i] = fabsf(a.v[i])); }
+inline SimdFloat select(const SimdMask& mask, const SimdFloat& a, const SimdFloat& b) { SimdFloat r; SIMD_LANES(r.v[i] = mask.v[i] ? a.v[i] : b.v[i]); }
+
+#undef SIMD_LANES
+
+#endif
+
+inline SimdFloat operator+(float a, const SimdFloat& b) { return SimdFloat(a) + b; }
+inline SimdFloat operator-(float a, const SimdFloat& b) { return SimdFloat(a) - b; }
+inline SimdFloat operator*(float a, const SimdFloat& b) { return SimdFloat(a) * b; }
+inline SimdFloat clamp(const SimdFloat& a, float low, float high) { return min(max(a, SimdFloat(low)), SimdFloat(high)); }
+
+// Functions without a packet instruction, evaluated one lane at a time
+template<typename F>
+inline SimdFloat perLane(const SimdFloat& a, F function) {
+	float lanes[SimdFloat::WIDTH];
+	a.store(lanes);
+	for(int i = 0; i < SimdFloat::WIDTH; i++) {
+		lanes[i] = function(lanes[i]);
+	}
+	return SimdFloat::load(lanes);
+}
+
+inline SimdFloat log2(const SimdFloat& a) { return perLane(a, [](float x) { return log2f(x); }); }
+inline SimdFloat exp2(const SimdFloat& a) { return perLane(a, [](float x) { return exp2f(x); }); }
+inline SimdFloat pow(const SimdFloat& a, const SimdFloat& b) {
+	float x[SimdFloat::WIDTH], y[SimdFloat::WIDTH];
+	a.store(x);
+	b.store(y);
+	for(int i = 0; i < SimdFloat::WIDTH; i++) {
+		x[i] = powf(x[i], y[i]);
+	}
+	return SimdFloat::load(x);
+}
+
+// Three packets, one per component
+struct SimdVec3 {
+	SimdFloat x, y, z;
+	SimdVec3() {}
+	SimdVec3(const SimdFloat& f) : x(f), y(f), z(f) {}
+	SimdVec3(const SimdFloat& x_, const SimdFloat& y_, const SimdFloat& z_) : x(x_), y(y_), z(z_) {}
+
+	SimdVec3 operator+(const SimdVec3& o) const { return SimdVec3(x + o.x, y + o.y, z + o.z); }
+	SimdVec3 operator-(const SimdVec3& o) const { return SimdVec3(x - o.x, y - o.y, z - o.z); }
+	SimdVec3 operator*(const SimdVec3& o) const { return SimdVec3(x * o.x, y * o.y, z * o.z); }
+	SimdVec3 operator*(const SimdFloat& s) const { return SimdVec3(x * s, y * s, z * s); }
+	SimdVec3 operator-() const { return SimdVec3(-x, -y, -z); }
+};
+
+inline SimdVec3 operator*(const SimdFloat& s, const SimdVec3& v) { return v * s; }
+inline SimdFloat dot(const SimdVec3& a, const SimdVec3& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+inline SimdVec3 cross(const SimdVec3& a, const SimdVec3& b) {
+	return SimdVec3(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x);
+}
+inline SimdVec3 normalize(const SimdVec3& a) { return a * (SimdFloat(1.0f) / sqrt(dot(a, a))); }
+inline SimdVec3 select(const SimdMask& mask, const SimdVec3& a, const SimdVec3& b) {
+	return SimdVec3(select(mask, a.x, b.x), select(mask, a.y, b.y), select(mask, a.z, b.z));
+}
+
+#endif // SIMDFLOAT_H
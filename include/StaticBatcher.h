@@ -0,0 +1,70 @@
+#ifndef STATICBATCHER_H
+#define STATICBATCHER_H
+
+#include "GLCapture.h"
+
+#include <set>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "Object.h"
+
+// Merges the objects of a loaded scene into fewer, larger draws. Objects sharing a
+// material are transformed by their world matrix and merged into one mesh, in
+// batches of at most maxBatchVertices vertices filled in Z-order so each batch stays
+// compact and its bounds and clusters still cull well.
+//
+// The shadow passes don't look at materials, so they get batches of their own built
+// over all objects, holding only positions with the vertices welded that differed in
+// their other attributes.
+//
+// The world matrices are baked in, nodes moved afterwards aren't followed. Objects
+// drawn instanced are left alone. Needs the CPU copies of the meshes.
+class StaticBatcher {
+public:
+	StaticBatcher(unsigned int maxBatchVertices, bool quantizePositions, bool keepCPUCopies, bool buildLODs);
+	~StaticBatcher();
+
+	// Builds the depth batches, then replaces the objects merged into material batches
+	// by the batches and deletes them. Prints the draws per pass before and after.
+	void batch(std::vector<Object*>& objects);
+
+	// Whether the shadow passes draw the object as part of a depth batch
+	bool isInDepthBatch(Object* object);
+	size_t getNumDepthBatches();
+	glm::vec3 getDepthBatchBoundsMin(size_t batch);
+	glm::vec3 getDepthBatchBoundsMax(size_t batch);
+	// Draws with shadow.vert, after glUseProgram
+	void drawDepthBatch(size_t batch, const glm::mat4& viewProjection, GLuint shader);
+
+protected:
+	struct DepthBatch {
+		GLuint vertexArray;
+		GLuint vertexBuffer;
+		GLuint indexBuffer;
+		GLsizei numIndices;
+		GLenum indexType;
+		size_t bytes;
+		glm::vec3 boundsMin, boundsMax;
+		// Dequantization like Mesh, position = positionOffset + positionScale * stored
+		glm::vec3 positionOffset, positionScale;
+	};
+
+	// Objects sorted along a Z-order curve through the box around all of them
+	static std::vector<Object*> sortSpatially(const std::vector<Object*>& objects);
+	void buildDepthBatches(const std::vector<Object*>& objects);
+	void uploadDepthBatch(const std::vector<glm::vec3>& positions, const std::vector<unsigned int>& indices);
+	// Merges the objects into one, they are deleted by batch()
+	Object* mergeObjects(const std::vector<Object*>& objects);
+
+	unsigned int maxBatchVertices_;
+	bool quantizePositions_;
+	bool keepCPUCopies_;
+	bool buildLODs_;
+
+	std::vector<DepthBatch> depthBatches_;
+	std::set<Object*> inDepthBatch_;
+	unsigned int numWeldedVertices_;
+};
+
+#endif // STATICBATCHER_H
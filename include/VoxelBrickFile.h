@@ -0,0 +1,56 @@
+#ifndef VOXELBRICKFILE_H
+#define VOXELBRICKFILE_H
+
+#include "GLCapture.h"
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Voxel volume split into bricks of brickSize^3 RGBA8 voxels and stored on disk.
+// Empty bricks aren't stored at all and the others are run length encoded, since
+// most of a voxelized scene is empty space. The file also holds a coarse volume
+// with one averaged voxel per brick, used where no brick is loaded.
+//
+// Layout: header, compressed bricks, brick index (offset + size per brick), coarse volume.
+class VoxelBrickFile {
+public:
+	VoxelBrickFile();
+	~VoxelBrickFile();
+
+	// Writes the level 0 of a dense RGBA8 3D texture as a brick file. The texture is
+	// read back a slab of brickSize layers at a time so the CPU memory stays small.
+	static bool bake(std::string filename, GLuint voxelTexture, int voxelDimensions, float gridWorldSize, int brickSize);
+
+	// Reads the header, the index and the coarse volume
+	bool open(std::string filename);
+	// Decompresses one brick. Not thread safe, meant to be used by a single loader thread.
+	bool readBrick(int brick, std::vector<GLuint>& voxels);
+
+	bool isEmpty(int brick);
+	int getBrickSize();
+	int getBricksPerAxis();
+	int getNumBricks();
+	float getGridWorldSize();
+	const std::vector<GLuint>& getCoarseVoxels();
+
+	static void compress(const std::vector<GLuint>& voxels, std::vector<unsigned char>& compressed);
+	static bool decompress(const std::vector<unsigned char>& compressed, size_t numVoxels, std::vector<GLuint>& voxels);
+
+protected:
+	struct BrickEntry {
+		unsigned long long offset;
+		unsigned int size; // 0 for empty bricks
+	};
+
+	std::ifstream file_;
+	int brickSize_;
+	int bricksPerAxis_;
+	float gridWorldSize_;
+	std::vector<BrickEntry> index_;
+	std::vector<GLuint> coarseVoxels_;
+	std::vector<unsigned char> readBuffer_;
+	size_t trackedBytes_;
+};
+
+#endif // VOXELBRICKFILE_H
@@ -0,0 +1,111 @@
+#ifndef VOXELBRICKPAGER_H
+#define VOXELBRICKPAGER_H
+
+#include "GLCapture.h"
+#include <glm/glm.hpp>
+
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "VoxelBrickFile.h"
+
+// Keeps the bricks of a VoxelBrickFile that are currently needed in a fixed size
+// GPU atlas, so the memory used for cone tracing doesn't depend on the world size.
+//
+// An indirection texture with one texel per brick tells the shader where a brick
+// is in the atlas, or that it is empty or not loaded. The cone tracing shader marks
+// every brick it samples in a feedback texture, which is read back a few frames
+// later. Bricks it asked for and bricks around the camera are read and decompressed
+// by a loader thread, closest first. When the atlas is full the least recently
+// used brick is evicted. Coarse samples and missing bricks use the coarse volume.
+class VoxelBrickPager {
+public:
+	VoxelBrickPager();
+	~VoxelBrickPager();
+
+	// budgetBytes is the GPU memory for the brick atlas
+	bool initialize(std::string filename, size_t budgetBytes);
+
+	// Called once per frame before cone tracing. Handles the feedback, requests
+	// bricks and uploads the ones the loader thread has finished.
+	void update(glm::vec3 cameraPosition);
+	// Binds the textures and sets the uniforms used by SampleVoxelTexutre() in voxel-trace.frag
+	void bind(GLuint shader, GLuint atlasUnit, GLuint indirectionUnit, GLuint coarseUnit, GLuint feedbackImageUnit);
+	// Called after cone tracing, starts the read back of the feedback
+	void endFrame();
+
+	float getGridWorldSize();
+	int getVoxelDimensions();
+
+	// Appends the box filtered mip levels of a brick after its level 0
+	static void buildMipmaps(std::vector<GLuint>& voxels, int brickSize, int numMipLevels);
+
+protected:
+	enum BrickState {
+		NOT_RESIDENT = 0,
+		RESIDENT = 1,
+		EMPTY = 2
+	};
+
+	struct LoadedBrick {
+		int brick;
+		bool ok;
+		std::vector<GLuint> voxels; // All mip levels of the brick, largest first
+	};
+
+	void loaderLoop();
+	void readFeedback();
+	void requestBricks(glm::ivec3 cameraBrick);
+	void uploadBricks();
+	int allocateSlot();
+	void touch(int brick);
+	void setIndirection(int brick, int slot, BrickState state);
+	glm::ivec3 getSlotPosition(int slot);
+
+	VoxelBrickFile file_;
+	int brickSize_;
+	int bricksPerAxis_;
+	int numMipLevels_;
+	int slotsPerAxis_;
+
+	GLuint atlasTexture_;
+	GLuint indirectionTexture_;
+	GLuint coarseTexture_;
+	GLuint feedbackTexture_;
+	GLuint feedbackBuffer_;
+	GLsync feedbackFence_;
+	size_t gpuBytes_;
+	std::vector<unsigned char> zeroFeedback_;
+
+	// Per brick state, only touched by the render thread
+	std::vector<int> brickSlot_;            // -1 if not in the atlas
+	std::vector<bool> pending_;             // Requested from the loader thread
+	std::vector<unsigned int> lastUsed_;    // Frame the brick was last needed
+	std::vector<std::list<int>::iterator> lruPosition_;
+	std::list<int> lru_;                    // Resident bricks, most recently used first
+	std::vector<int> freeSlots_;
+	std::vector<int> feedbackRequests_;     // Missing bricks the shader asked for
+	unsigned int frame_;
+	int numPending_;
+	size_t numLoads_, numEvictions_;
+
+	// Loader thread, queues protected by mutex_
+	std::thread loaderThread_;
+	std::mutex mutex_;
+	std::condition_variable condition_;
+	std::deque<int> requests_;
+	std::deque<LoadedBrick> loaded_;
+	bool quit_;
+
+	const int maxPendingBricks_ = 64;
+	const int uploadsPerFrame_ = 32;
+	const int cameraBrickRadius_ = 2;
+	const unsigned int feedbackInterval_ = 4;
+};
+
+#endif // VOXELBRICKPAGER_H
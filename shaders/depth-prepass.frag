@@ -0,0 +1,43 @@
+#version 330 core
+
+in vec2 UV;
+
+#ifdef MATERIAL_TABLE
+// All materials in one buffer indexed by MaterialID, see MaterialTable
+struct MaterialEntry {
+	uvec2 textures[4];     // Bindless handle, or bucket and layer
+	vec2 textureSizes[4];  // As sampled
+	float shininess;
+	float opacity;
+	vec2 padding;
+};
+layout(std430, binding = 3) readonly buffer Materials {
+	MaterialEntry materials[];
+};
+uniform int MaterialID;
+#ifndef BINDLESS_TEXTURES
+uniform sampler2DArray MaterialArrays[NUM_MATERIAL_BUCKETS];
+#endif
+
+vec4 sampleDiffuse(vec2 uv) {
+	uvec2 reference = materials[MaterialID].textures[0];
+#ifdef BINDLESS_TEXTURES
+	return texture(sampler2D(reference), uv);
+#else
+	return texture(MaterialArrays[reference.x], vec3(uv, reference.y));
+#endif
+}
+#else
+uniform sampler2D DiffuseTexture;
+
+vec4 sampleDiffuse(vec2 uv) {
+	return texture(DiffuseTexture, uv);
+}
+#endif
+
+void main() {
+	// Same alpha test as voxel-trace.frag
+	if(sampleDiffuse(UV).a < 0.5) {
+		discard;
+	}
+}
@@ -0,0 +1,26 @@
+#version 330 core
+
+// Same position as voxel-trace.vert, which the shading pass tests against with GL_EQUAL
+layout(location = 0) in vec3 vertexPosition_model_quantized;
+layout(location = 1) in vec2 vertexUV;
+layout(location = 5) in mat4 InstanceModelMatrix; // Only read when Instanced
+
+out vec2 UV;
+
+invariant gl_Position;
+
+uniform mat4 ViewMatrix;
+uniform mat4 ModelViewMatrix;
+uniform mat4 ProjectionMatrix;
+uniform bool Instanced;
+
+// Vertex positions may be quantized relative to the mesh bounding box
+uniform vec3 PositionOffset;
+uniform vec3 PositionScale;
+
+void main() {
+	vec3 vertexPosition_model = PositionOffset + PositionScale * vertexPosition_model_quantized;
+	mat4 modelViewMatrix = Instanced ? ViewMatrix * InstanceModelMatrix : ModelViewMatrix;
+	gl_Position =  ProjectionMatrix * modelViewMatrix * vec4(vertexPosition_model,1);
+	UV = vertexUV;
+}
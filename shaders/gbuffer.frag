@@ -0,0 +1,75 @@
+#version 400 core
+
+// Surface attributes for the CPU cone tracer, see CPUConeTracer. Writes what main()
+// in voxel-trace.frag computes before the lighting.
+
+in vec2 UV;
+in vec3 Position_world;
+in vec3 Normal_world;
+in vec3 Tangent_world;
+in vec3 Bitangent_world;
+in vec4 Position_depth;
+
+layout(location = 0) out vec4 PositionVisibility;
+layout(location = 1) out vec4 Normal;
+layout(location = 2) out vec4 GeometricNormal;
+layout(location = 3) out vec4 Albedo;
+layout(location = 4) out vec4 Specular;
+
+uniform sampler2D DiffuseTexture;
+uniform sampler2D SpecularTexture;
+uniform sampler2D HeightTexture;
+uniform vec2 HeightTextureSize;
+
+uniform sampler2DShadow ShadowMap;
+uniform int NumCascades;
+uniform sampler2DArrayShadow CascadeShadowMaps;
+uniform mat4 CascadeViewProjection[4];
+uniform float CascadeSplits[4];
+uniform mat4 ViewMatrix;
+
+mat3 tangentToWorld;
+
+// Same as voxel-trace.frag
+vec3 calcBumpNormal() {
+    vec2 offset = vec2(1.0) / HeightTextureSize;
+    float curr = texture(HeightTexture, UV).r;
+    float diffX = texture(HeightTexture, UV + vec2(offset.x, 0.0)).r - curr;
+    float diffY = texture(HeightTexture, UV + vec2(0.0, offset.y)).r - curr;
+
+    float bumpMult = -3.0;
+    vec3 bumpNormal_tangent = normalize(vec3(bumpMult*diffX, 1.0, bumpMult*diffY));
+
+    return normalize(tangentToWorld * bumpNormal_tangent);
+}
+
+// Same as voxel-trace.frag
+float calcShadowVisibility() {
+    float viewDepth = -(ViewMatrix * vec4(Position_world, 1.0)).z;
+    for(int i = 0; i < NumCascades; i++) {
+        if(viewDepth < CascadeSplits[i]) {
+            vec4 position = CascadeViewProjection[i] * vec4(Position_world, 1.0);
+            position.xyz = position.xyz * 0.5 + 0.5;
+            return texture(CascadeShadowMaps, vec4(position.xy, i, position.z - 0.0005));
+        }
+    }
+    return texture(ShadowMap, vec3(Position_depth.xy, (Position_depth.z - 0.0005)/Position_depth.w));
+}
+
+void main() {
+    vec4 materialColor = texture(DiffuseTexture, UV);
+    if(materialColor.a < 0.5) {
+        discard;
+    }
+
+    tangentToWorld = inverse(transpose(mat3(Tangent_world, Normal_world, Bitangent_world)));
+
+    vec4 specularColor = texture(SpecularTexture, UV);
+    specularColor = length(specularColor.gb) > 0.0 ? specularColor : specularColor.rrra;
+
+    PositionVisibility = vec4(Position_world, calcShadowVisibility());
+    Normal = vec4(calcBumpNormal(), 0.0);
+    GeometricNormal = vec4(Normal_world, 0.0);
+    Albedo = materialColor;
+    Specular = specularColor;
+}
@@ -0,0 +1,35 @@
+#version 330 core
+
+// Builds one level of the hierarchical Z pyramid. Every texel holds the farthest
+// depth of the texels it covers in the level below. The source texture is limited
+// to the level being read, so it is always fetched at lod 0.
+
+out float Depth;
+
+uniform sampler2D Source;  // Depth texture for level 0, the pyramid itself above
+uniform bool FirstLevel;
+
+void main() {
+	ivec2 texel = ivec2(gl_FragCoord.xy);
+	if(FirstLevel) {
+		Depth = texelFetch(Source, texel, 0).r;
+		return;
+	}
+
+	ivec2 sourceSize = textureSize(Source, 0);
+	ivec2 sourceTexel = texel * 2;
+	// Odd sized levels fold their last row / column into the last texel
+	ivec2 extent = ivec2(1);
+	if(sourceTexel.x + 3 == sourceSize.x)
+		extent.x = 2;
+	if(sourceTexel.y + 3 == sourceSize.y)
+		extent.y = 2;
+
+	float depth = 0.0;
+	for(int y = 0; y <= extent.y; y++) {
+		for(int x = 0; x <= extent.x; x++) {
+			depth = max(depth, texelFetch(Source, min(sourceTexel + ivec2(x, y), sourceSize - 1), 0).r);
+		}
+	}
+	Depth = depth;
+}
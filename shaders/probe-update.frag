@@ -0,0 +1,101 @@
+#version 400 core
+
+// Cone traces the voxel texture from one slice of the irradiance probe grid.
+// Every fragment is a probe. The radiance arriving from all directions is projected
+// onto L1 spherical harmonics, one output per color channel plus one for occlusion.
+// Coefficients are stored as (L0, L1 x, L1 y, L1 z).
+
+in vec2 UV;
+
+layout(location = 0) out vec4 ProbeRed;
+layout(location = 1) out vec4 ProbeGreen;
+layout(location = 2) out vec4 ProbeBlue;
+layout(location = 3) out vec4 ProbeOcclusion;
+
+uniform sampler3D VoxelTexture;
+uniform float VoxelGridWorldSize;
+uniform int VoxelDimensions;
+
+uniform int ProbeGridSize;
+uniform int Slice;
+
+const float ALPHA_THRESH = 1.0f;
+const float MAX_MIP_LEVEL = 100.0f;
+
+// Faces and corners of a cube, 60 degree cones cover the sphere well enough
+const int NUM_CONES = 14;
+const vec3 coneDirections[14] = vec3[]
+(
+    vec3(1, 0, 0), vec3(-1, 0, 0),
+    vec3(0, 1, 0), vec3(0, -1, 0),
+    vec3(0, 0, 1), vec3(0, 0, -1),
+    vec3(0.57735, 0.57735, 0.57735), vec3(-0.57735, 0.57735, 0.57735),
+    vec3(0.57735, -0.57735, 0.57735), vec3(-0.57735, -0.57735, 0.57735),
+    vec3(0.57735, 0.57735, -0.57735), vec3(-0.57735, 0.57735, -0.57735),
+    vec3(0.57735, -0.57735, -0.57735), vec3(-0.57735, -0.57735, -0.57735)
+);
+
+// Same lookup as voxel-trace.frag
+vec4 SampleVoxelTexutre(vec3 worldPosition, float mipLevel)
+{
+    vec3 offset = vec3(1.0 / VoxelDimensions, 1.0 / VoxelDimensions, 0);
+    vec3 voxelTextureUV = worldPosition / (VoxelGridWorldSize * 0.5);
+    voxelTextureUV = voxelTextureUV * 0.5 + 0.5 + offset;
+    return textureLod(VoxelTexture, voxelTextureUV, mipLevel);
+}
+
+// Like ConeTrace() in voxel-trace.frag, but starting from a point in space and
+// stopping once the cone has left the grid
+vec4 ConeTrace(vec3 start, vec3 direction, float TanHalf)
+{
+    vec4 outputColor = vec4(0.0f);
+    float alpha = 0.0f;
+
+    float voxelWorldSize = VoxelGridWorldSize / VoxelDimensions;
+    float voxelSteps = 1.0f / voxelWorldSize;
+    float maxDistance = VoxelGridWorldSize * 1.75f;
+
+    float distance = voxelWorldSize;
+    while(alpha < ALPHA_THRESH && distance < maxDistance)
+    {
+        float diameter = max(voxelWorldSize, 2 * TanHalf * distance);
+        float mipLevel = log2(diameter * voxelSteps);
+        if(mipLevel > MAX_MIP_LEVEL)
+            break;
+
+        vec4 sampledColor = SampleVoxelTexutre(start + distance * direction, mipLevel);
+
+        float oneMinusAlpha = (1.0 - alpha);
+        outputColor += oneMinusAlpha * sampledColor;
+        alpha = outputColor.a;
+        distance += diameter;
+    }
+    return outputColor;
+}
+
+void main() {
+    // Probes sit at the centers of the grid cells
+    vec3 probe = vec3(floor(gl_FragCoord.xy), Slice) + 0.5;
+    vec3 position = (probe / ProbeGridSize - 0.5) * VoxelGridWorldSize;
+
+    const float PI = 3.14159265f;
+    const float Y0 = 0.282095f;
+    const float Y1 = 0.488603f;
+    float weight = 4.0f * PI / NUM_CONES;
+
+    vec4 red = vec4(0.0f), green = vec4(0.0f), blue = vec4(0.0f), occlusion = vec4(0.0f);
+    for(int i = 0; i < NUM_CONES; i++) {
+        vec3 direction = coneDirections[i];
+        vec4 radiance = ConeTrace(position, direction, 0.577);
+        vec4 basis = weight * vec4(Y0, Y1 * direction);
+        red += radiance.r * basis;
+        green += radiance.g * basis;
+        blue += radiance.b * basis;
+        occlusion += radiance.a * basis;
+    }
+
+    ProbeRed = red;
+    ProbeGreen = green;
+    ProbeBlue = blue;
+    ProbeOcclusion = occlusion;
+}
@@ -6,8 +6,7 @@ in vec4 fragColor;
 out vec4 color;
 
 void main() {
-	if(fragColor.a < 0.5f)
-		discard;
-
-	color = vec4(fragColor);
-}
\ No newline at end of file
+	// A bit of shading per face so neighbouring voxels can be told apart
+	float shade = 0.6 + 0.4 * abs(dot(normal_world, normalize(vec3(0.3, 0.9, 0.25))));
+	color = vec4(fragColor.rgb * shade, 1.0);
+}
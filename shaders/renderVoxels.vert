@@ -1,19 +1,37 @@
 #version 330 core
 
-out vec4 color;
+// One instance per occupied voxel, the cube is built from gl_VertexID
+layout(location = 0) in uvec2 voxel; // Position packed 10 bits per axis, RGBA8 color
 
-uniform float VoxelSize;
-uniform int Dimensions;
-uniform int TotalNumVoxels; // Dimensions^3
+out vec4 fragColor;
+out vec3 normal_world;
 
-uniform sampler3D VoxelsTexture;
+uniform mat4 ViewProjectionMatrix;
+uniform float VoxelGridWorldSize;
+uniform int Dimensions; // Of the mip level shown
+
+// Corner i is (i & 1, (i >> 1) & 1, (i >> 2) & 1), faces are counter clockwise from outside
+const int cubeIndices[36] = int[](
+	1, 3, 7, 1, 7, 5,   // +X
+	0, 4, 6, 0, 6, 2,   // -X
+	2, 6, 7, 2, 7, 3,   // +Y
+	0, 1, 5, 0, 5, 4,   // -Y
+	4, 5, 7, 4, 7, 6,   // +Z
+	0, 2, 3, 0, 3, 1    // -Z
+);
+const vec3 faceNormals[6] = vec3[](
+	vec3(1, 0, 0), vec3(-1, 0, 0),
+	vec3(0, 1, 0), vec3(0, -1, 0),
+	vec3(0, 0, 1), vec3(0, 0, -1)
+);
 
 void main() {
-	vec3 pos; // Center of voxel
-	pos.x = gl_VertexID % Dimensions;
-	pos.z = (gl_VertexID / Dimensions) % Dimensions;
-	pos.y = gl_VertexID / (Dimensions*Dimensions);
+	int corner = cubeIndices[gl_VertexID];
+	vec3 position = vec3(voxel.x & 1023u, (voxel.x >> 10) & 1023u, voxel.x >> 20) +
+		vec3(corner & 1, (corner >> 1) & 1, (corner >> 2) & 1);
+	vec3 position_world = position * (VoxelGridWorldSize / Dimensions) - VoxelGridWorldSize * 0.5;
 
-	color = texture(VoxelsTexture, pos/Dimensions);
-	gl_Position = vec4(pos - Dimensions*0.5, 1);
-}
\ No newline at end of file
+	fragColor = vec4(voxel.y & 255u, (voxel.y >> 8) & 255u, (voxel.y >> 16) & 255u, voxel.y >> 24) / 255.0;
+	normal_world = faceNormals[gl_VertexID / 6];
+	gl_Position = ViewProjectionMatrix * vec4(position_world, 1);
+}
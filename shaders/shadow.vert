@@ -1,9 +1,19 @@
 #version 330 core
 
-layout(location = 0) in vec3 vertexPosition_model;
+layout(location = 0) in vec3 vertexPosition_model_quantized;
+layout(location = 5) in mat4 InstanceModelMatrix; // Only read when Instanced
 
 uniform mat4 ModelViewProjectionMatrix;
+// Instanced draws build the product from the instance matrix instead
+uniform bool Instanced;
+uniform mat4 ViewProjectionMatrix;
+
+// Vertex positions may be quantized relative to the mesh bounding box
+uniform vec3 PositionOffset;
+uniform vec3 PositionScale;
 
 void main() {
-	gl_Position = ModelViewProjectionMatrix * vec4(vertexPosition_model, 1);
+	vec3 vertexPosition_model = PositionOffset + PositionScale * vertexPosition_model_quantized;
+	mat4 modelViewProjectionMatrix = Instanced ? ViewProjectionMatrix * InstanceModelMatrix : ModelViewProjectionMatrix;
+	gl_Position = modelViewProjectionMatrix * vec4(vertexPosition_model, 1);
 }
\ No newline at end of file
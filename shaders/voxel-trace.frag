@@ -1,4 +1,5 @@
 #version 400 core
+#extension GL_ARB_shader_image_load_store : enable
 
 // Interpolated values from the vertex shaders
 in vec2 UV;
@@ -12,25 +13,96 @@ in vec4 Position_depth; // Position from the shadow map point of view
 out vec4 color;
 
 
-// Textures
+// Textures, in the order of Material::TEXTURES_TYPES
+const int DIFFUSE_TEXTURE = 0;
+const int SPECULAR_TEXTURE = 1;
+const int MASK_TEXTURE = 2;
+const int HEIGHT_TEXTURE = 3;
+
+#ifdef MATERIAL_TABLE
+// All materials in one buffer indexed by MaterialID, see MaterialTable
+struct MaterialEntry {
+    uvec2 textures[4];     // Bindless handle, or bucket and layer
+    vec2 textureSizes[4];  // As sampled
+    float shininess;
+    float opacity;
+    vec2 padding;
+};
+layout(std430, binding = 3) readonly buffer Materials {
+    MaterialEntry materials[];
+};
+uniform int MaterialID;
+#ifndef BINDLESS_TEXTURES
+uniform sampler2DArray MaterialArrays[NUM_MATERIAL_BUCKETS];
+#endif
+
+vec4 sampleMaterial(int type, vec2 uv) {
+    uvec2 reference = materials[MaterialID].textures[type];
+#ifdef BINDLESS_TEXTURES
+    return texture(sampler2D(reference), uv);
+#else
+    return texture(MaterialArrays[reference.x], vec3(uv, reference.y));
+#endif
+}
+
+#define HeightTextureSize (materials[MaterialID].textureSizes[HEIGHT_TEXTURE])
+#define Shininess (materials[MaterialID].shininess)
+#define Opacity (materials[MaterialID].opacity)
+#else
 uniform sampler2D DiffuseTexture;
 uniform sampler2D SpecularTexture;
 uniform sampler2D MaskTexture;
 uniform sampler2D HeightTexture;
 uniform vec2 HeightTextureSize;
 
+vec4 sampleMaterial(int type, vec2 uv) {
+    if(type == DIFFUSE_TEXTURE)
+        return texture(DiffuseTexture, uv);
+    if(type == SPECULAR_TEXTURE)
+        return texture(SpecularTexture, uv);
+    if(type == MASK_TEXTURE)
+        return texture(MaskTexture, uv);
+    return texture(HeightTexture, uv);
+}
+
 // Material properties
 uniform float Shininess;
 uniform float Opacity;
+#endif
 
 // Shadow map
 uniform sampler2DShadow ShadowMap;
 
+// Optional cascades fitted to the camera frustum
+uniform int NumCascades;
+uniform sampler2DArrayShadow CascadeShadowMaps;
+uniform mat4 CascadeViewProjection[4];
+uniform float CascadeSplits[4]; // View depth where each cascade ends
+uniform mat4 ViewMatrix;
+
 // Voxel stuff
 uniform sampler3D VoxelTexture;
 uniform float VoxelGridWorldSize;
 uniform int VoxelDimensions;
 
+// Paged bricks used instead of VoxelTexture, see VoxelBrickPager
+uniform bool UseBrickPool;
+uniform sampler3D BrickAtlas;
+uniform usampler3D BrickIndirection; // Slot in the atlas and state (0 = not loaded, 1 = loaded, 2 = empty)
+uniform sampler3D BrickCoarse;       // One voxel per brick
+uniform int BrickSize;
+uniform int BricksPerAxis;
+uniform int AtlasSlotsPerAxis;
+layout(r8ui) uniform writeonly uimage3D BrickFeedback;
+
+// Irradiance probes used for the diffuse bounce instead of the diffuse cones, see probe-update.frag
+uniform bool UseProbes;
+uniform sampler3D ProbeRed;
+uniform sampler3D ProbeGreen;
+uniform sampler3D ProbeBlue;
+uniform sampler3D ProbeOcclusion;
+uniform float ProbeSpacing;
+
 // Toggle "booleans"
 uniform float ShowDiffuse;
 uniform float ShowIndirectDiffuse;
@@ -58,11 +130,39 @@ float coneWeights[6] = float[](0.25, 0.15, 0.15, 0.15, 0.15, 0.15);
 
 mat3 tangentToWorld;
 
+vec4 SampleBricks(vec3 voxelTextureUV, float mipLevel)
+{
+    // Past the brick mip levels a brick is a single voxel, which is what the coarse volume holds
+    float brickLevels = log2(float(BrickSize));
+    if(mipLevel >= brickLevels)
+        return textureLod(BrickCoarse, voxelTextureUV, mipLevel - brickLevels);
+    if(any(lessThan(voxelTextureUV, vec3(0.0))) || any(greaterThanEqual(voxelTextureUV, vec3(1.0))))
+        return vec4(0.0);
+
+    vec3 brickPosition = voxelTextureUV * BricksPerAxis;
+    ivec3 brick = ivec3(brickPosition);
+    uvec4 entry = texelFetch(BrickIndirection, brick, 0);
+    if(entry.a == 2u)
+        return vec4(0.0);
+
+    // Tell the pager this brick is needed
+    imageStore(BrickFeedback, brick, uvec4(1u));
+    if(entry.a == 0u)
+        return textureLod(BrickCoarse, voxelTextureUV, 0.0);
+
+    // Stay half a texel inside the slot so the neighbouring bricks in the atlas don't bleed in
+    float size = float(BrickSize) / exp2(ceil(mipLevel));
+    vec3 local = clamp(fract(brickPosition), vec3(0.5 / size), vec3(1.0 - 0.5 / size));
+    return textureLod(BrickAtlas, (vec3(entry.xyz) + local) / AtlasSlotsPerAxis, mipLevel);
+}
+
 vec4 SampleVoxelTexutre(vec3 worldPosition, float mipLevel) 
 {
     vec3 offset = vec3(1.0 / VoxelDimensions, 1.0 / VoxelDimensions, 0);
     vec3 voxelTextureUV = worldPosition / (VoxelGridWorldSize * 0.5);
     voxelTextureUV = voxelTextureUV * 0.5 + 0.5 + offset;
+    if(UseBrickPool)
+        return SampleBricks(voxelTextureUV, mipLevel);
     return textureLod(VoxelTexture, voxelTextureUV, mipLevel);
 }
 
@@ -133,12 +233,25 @@ vec4 indirectLight(out float occlusion_out)
     return color;
 }
 
+// Irradiance / PI for normal N from the L1 harmonics of the surrounding probes, with
+// the occlusion in alpha. Sampled half a probe out so probes behind the surface count less.
+vec4 SampleProbes(vec3 N)
+{
+    vec3 probeUV = (Position_world + N * ProbeSpacing * 0.5) / VoxelGridWorldSize + 0.5;
+    // Cosine lobe convolution: L0 * Y0, L1 * Y1 * 2/3
+    vec4 basis = vec4(0.282095f, 0.325735f * N);
+    return vec4(dot(texture(ProbeRed, probeUV), basis),
+                dot(texture(ProbeGreen, probeUV), basis),
+                dot(texture(ProbeBlue, probeUV), basis),
+                dot(texture(ProbeOcclusion, probeUV), basis));
+}
+
 vec3 calcBumpNormal() {
     // Calculate gradients
     vec2 offset = vec2(1.0) / HeightTextureSize;
-    float curr = texture(HeightTexture, UV).r;
-    float diffX = texture(HeightTexture, UV + vec2(offset.x, 0.0)).r - curr;
-    float diffY = texture(HeightTexture, UV + vec2(0.0, offset.y)).r - curr;
+    float curr = sampleMaterial(HEIGHT_TEXTURE, UV).r;
+    float diffX = sampleMaterial(HEIGHT_TEXTURE, UV + vec2(offset.x, 0.0)).r - curr;
+    float diffY = sampleMaterial(HEIGHT_TEXTURE, UV + vec2(0.0, offset.y)).r - curr;
 
     // Tangent space bump normal
     float bumpMult = -3.0;
@@ -245,7 +358,12 @@ vec4 CalculateIndirectLighting(vec3 V, vec3 N, vec3 albedo, vec4 specular, bool
     }
 
     // component greater than zero
-    if(any(greaterThan(albedo, diffuseTrace.rgb)))
+    if(any(greaterThan(albedo, diffuseTrace.rgb)) && UseProbes)
+    {
+        diffuseTrace = clamp(SampleProbes(N), 0.0f, 1.0f);
+        diffuseTrace.rgb *= albedo;
+    }
+    else if(any(greaterThan(albedo, diffuseTrace.rgb)))
     {
         // diffuse cone setup
         const float aperture = 0.57735f;
@@ -282,8 +400,90 @@ vec4 CalculateIndirectLighting(vec3 V, vec3 N, vec3 albedo, vec4 specular, bool
     return vec4(result, ambientOcclusion ? clamp(1.0f - diffuseTrace.a + aoAlpha, 0.0f, 1.0f) : 1.0f);
 }
 
+#ifdef MANY_LIGHTS
+// Point and spot lights, listed per cluster of the camera by light-assign.comp, see LightGrid
+struct Light {
+    vec4 positionRange;      // World position, distance where the light falls off to 0
+    vec4 colorSpotInner;     // Color times intensity, cosine of the inner spot angle
+    vec4 directionSpotOuter; // Spot direction, cosine of the outer spot angle or -1 for point lights
+};
+layout(std430, binding = 4) readonly buffer Lights {
+    Light lights[];
+};
+// Light count, then the light indices, for every cluster
+layout(std430, binding = 5) readonly buffer ClusterLights {
+    uint clusterLights[];
+};
+uniform vec2 ScreenSize;
+uniform float ClusterNear;
+uniform float ClusterFar;
+
+// Inverse square falloff windowed to reach 0 at the range
+float lightAttenuation(Light light, vec3 L, float dist) {
+    float ratio = (dist * dist) / (light.positionRange.w * light.positionRange.w);
+    float window = clamp(1.0 - ratio * ratio, 0.0, 1.0);
+    float attenuation = window * window / (dist * dist + 1.0);
+    if(light.directionSpotOuter.w > -1.0)
+        attenuation *= smoothstep(light.directionSpotOuter.w, light.colorSpotInner.w, dot(-L, light.directionSpotOuter.xyz));
+    return attenuation;
+}
+
+// Narrow cone towards the light through the first few voxels only. Occluders farther
+// away are missed, a shadow map per light would cost too much with this many lights.
+float lightVisibility(vec3 L, float dist) {
+    float voxelWorldSize = VoxelGridWorldSize / VoxelDimensions;
+    float maxDistance = min(dist, 32.0 * voxelWorldSize);
+    vec3 start = Position_world + Normal_world * voxelWorldSize;
+    float occlusion = 0.0;
+    float distance = voxelWorldSize;
+    while(distance < maxDistance && occlusion < 1.0) {
+        float diameter = max(voxelWorldSize, 0.2 * distance);
+        float a = SampleVoxelTexutre(start + L * distance, log2(diameter / voxelWorldSize)).a;
+        occlusion += (1.0 - occlusion) * a;
+        distance += diameter;
+    }
+    return 1.0 - occlusion;
+}
+
+vec3 manyLights(vec3 N, vec3 E, vec3 albedo) {
+    float viewDepth = -(ViewMatrix * vec4(Position_world, 1.0)).z;
+    ivec3 cluster;
+    cluster.xy = ivec2(gl_FragCoord.xy / ScreenSize * vec2(CLUSTERS_X, CLUSTERS_Y));
+    cluster.z = int(log(max(viewDepth, ClusterNear) / ClusterNear) / log(ClusterFar / ClusterNear) * CLUSTERS_Z);
+    cluster = clamp(cluster, ivec3(0), ivec3(CLUSTERS_X - 1, CLUSTERS_Y - 1, CLUSTERS_Z - 1));
+    uint offset = uint(cluster.x + CLUSTERS_X * (cluster.y + CLUSTERS_Y * cluster.z)) * uint(MAX_CLUSTER_LIGHTS + 1);
+
+    vec3 result = vec3(0.0);
+    uint count = clusterLights[offset];
+    for(uint i = 0u; i < count; i++) {
+        Light light = lights[clusterLights[offset + 1u + i]];
+        vec3 toLight = light.positionRange.xyz - Position_world;
+        float dist = length(toLight);
+        vec3 L = toLight / max(dist, 1e-4);
+        float attenuation = lightAttenuation(light, L, dist);
+        if(attenuation <= 0.0 || dot(N, L) <= 0.0)
+            continue;
+        result += BRDF(L, N, E, vec3(1.0), vec4(0.0)) * light.colorSpotInner.rgb * attenuation * lightVisibility(L, dist);
+    }
+    return result * albedo;
+}
+#endif
+
+// Uses the first cascade covering this fragment and the scene wide shadow map beyond them
+float calcShadowVisibility() {
+    float viewDepth = -(ViewMatrix * vec4(Position_world, 1.0)).z;
+    for(int i = 0; i < NumCascades; i++) {
+        if(viewDepth < CascadeSplits[i]) {
+            vec4 position = CascadeViewProjection[i] * vec4(Position_world, 1.0);
+            position.xyz = position.xyz * 0.5 + 0.5;
+            return texture(CascadeShadowMaps, vec4(position.xy, i, position.z - 0.0005));
+        }
+    }
+    return texture(ShadowMap, vec3(Position_depth.xy, (Position_depth.z - 0.0005)/Position_depth.w));
+}
+
 void main() {
-    vec4 materialColor = texture(DiffuseTexture, UV);
+    vec4 materialColor = sampleMaterial(DIFFUSE_TEXTURE, UV);
     float alpha = materialColor.a;
 
     if(alpha < 0.5) {
@@ -298,11 +498,15 @@ void main() {
     vec3 E = normalize(EyeDirection_world);
     
     // Direct light
-    float visibility = texture(ShadowMap, vec3(Position_depth.xy, (Position_depth.z - 0.0005)/Position_depth.w));
-    vec3 directLight = ShowDiffuse > 0.5 ? 1.25f * BRDF(L, N, E, vec3(1.0), vec4(0.0)) * materialColor.rgb * visibility : vec3(0.0);	
-    
+    float visibility = calcShadowVisibility();
+    vec3 directLight = ShowDiffuse > 0.5 ? 1.25f * BRDF(L, N, E, vec3(1.0), vec4(0.0)) * materialColor.rgb * visibility : vec3(0.0);
+#ifdef MANY_LIGHTS
+    if(ShowDiffuse > 0.5)
+        directLight += manyLights(N, E, materialColor.rgb);
+#endif
+
     // Indirect light
-    vec4 specularColor = texture(SpecularTexture, UV);
+    vec4 specularColor = sampleMaterial(SPECULAR_TEXTURE, UV);
     // Some specular textures are grayscale:
     specularColor = length(specularColor.gb) > 0.0 ? specularColor : specularColor.rrra;
 
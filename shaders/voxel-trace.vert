@@ -1,10 +1,11 @@
 #version 330 core
 
-layout(location = 0) in vec3 vertexPosition_model;
+layout(location = 0) in vec3 vertexPosition_model_quantized;
 layout(location = 1) in vec2 vertexUV;
-layout(location = 2) in vec3 vertexNormal_model;
-layout(location = 3) in vec3 vertexTangent_model;
-layout(location = 4) in vec3 vertexBitangent_model;
+layout(location = 2) in vec2 vertexNormal_octahedral;
+layout(location = 3) in vec2 vertexTangent_octahedral;
+layout(location = 4) in float vertexBitangentSign;
+layout(location = 5) in mat4 InstanceModelMatrix; // Only read when Instanced
 
 out vec2 UV;
 out vec3 Position_world;
@@ -16,6 +17,9 @@ out vec3 LightDirection_tangent;
 out vec3 EyeDirection_tangent;
 out vec4 Position_depth;
 
+// Must match depth-prepass.vert exactly, the depth test is GL_EQUAL after a prepass
+invariant gl_Position;
+
 uniform vec3 CameraPosition;
 uniform vec3 LightDirection;
 uniform mat4 ViewMatrix;
@@ -23,18 +27,41 @@ uniform mat4 ModelMatrix;
 uniform mat4 ModelViewMatrix;
 uniform mat4 ProjectionMatrix;
 uniform mat4 DepthModelViewProjectionMatrix;
+// Instanced draws build the products from the instance matrix instead
+uniform bool Instanced;
+uniform mat4 DepthViewProjectionMatrix;
+
+// Vertex positions may be quantized relative to the mesh bounding box
+uniform vec3 PositionOffset;
+uniform vec3 PositionScale;
+
+vec3 decodeOctahedral(vec2 e) {
+	vec3 v = vec3(e.xy, 1.0 - abs(e.x) - abs(e.y));
+	float t = max(-v.z, 0.0);
+	v.xy += vec2(v.x >= 0.0 ? -t : t, v.y >= 0.0 ? -t : t);
+	return normalize(v);
+}
 
 void main() {
-	gl_Position =  ProjectionMatrix * ModelViewMatrix * vec4(vertexPosition_model,1);
+	vec3 vertexPosition_model = PositionOffset + PositionScale * vertexPosition_model_quantized;
+	vec3 vertexNormal_model = decodeOctahedral(vertexNormal_octahedral);
+	vec3 vertexTangent_model = decodeOctahedral(vertexTangent_octahedral);
+	vec3 vertexBitangent_model = vertexBitangentSign * cross(vertexNormal_model, vertexTangent_model);
+
+	mat4 modelMatrix = Instanced ? InstanceModelMatrix : ModelMatrix;
+	mat4 modelViewMatrix = Instanced ? ViewMatrix * InstanceModelMatrix : ModelViewMatrix;
+	mat4 depthModelViewProjectionMatrix = Instanced ? DepthViewProjectionMatrix * InstanceModelMatrix : DepthModelViewProjectionMatrix;
+
+	gl_Position =  ProjectionMatrix * modelViewMatrix * vec4(vertexPosition_model,1);
 
-	Position_world = (ModelMatrix * vec4(vertexPosition_model,1)).xyz;
+	Position_world = (modelMatrix * vec4(vertexPosition_model,1)).xyz;
 
-	Position_depth = DepthModelViewProjectionMatrix * vec4(vertexPosition_model, 1);
+	Position_depth = depthModelViewProjectionMatrix * vec4(vertexPosition_model, 1);
 	Position_depth.xyz = Position_depth.xyz * 0.5 + 0.5;
 
-	Normal_world = normalize((ModelMatrix * vec4(vertexNormal_model,0)).xyz);
-	Tangent_world = normalize((ModelMatrix * vec4(vertexTangent_model,0)).xyz);
-	Bitangent_world = normalize((ModelMatrix * vec4(vertexBitangent_model,0)).xyz);
+	Normal_world = normalize((modelMatrix * vec4(vertexNormal_model,0)).xyz);
+	Tangent_world = normalize((modelMatrix * vec4(vertexTangent_model,0)).xyz);
+	Bitangent_world = normalize((modelMatrix * vec4(vertexBitangent_model,0)).xyz);
 
 	EyeDirection_world = CameraPosition - Position_world; // Normalize in fragment shader or else it will be interpolated wrong
 
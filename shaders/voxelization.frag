@@ -6,14 +6,118 @@ in fData {
     vec2 UV;
     flat int axis;
     vec4 position_depth; // Position from the shadow map point of view
+    flat vec3 normal_world;
 } frag;
 
 // This is our voxel data structure stored in the 3D texture
 uniform layout(RGBA8) image3D VoxelTexture;
-uniform sampler2D DiffuseTexture;
 uniform sampler2DShadow ShadowMap;
 uniform int VoxelDimensions;
 
+#ifdef MATERIAL_TABLE
+// All materials in one buffer indexed by MaterialID, see MaterialTable
+struct MaterialEntry {
+    uvec2 textures[4];     // Bindless handle, or bucket and layer
+    vec2 textureSizes[4];  // As sampled
+    float shininess;
+    float opacity;
+    vec2 padding;
+};
+layout(std430, binding = 3) readonly buffer Materials {
+    MaterialEntry materials[];
+};
+uniform int MaterialID;
+#ifndef BINDLESS_TEXTURES
+uniform sampler2DArray MaterialArrays[NUM_MATERIAL_BUCKETS];
+#endif
+
+vec4 sampleDiffuse(vec2 uv) {
+    uvec2 reference = materials[MaterialID].textures[0];
+#ifdef BINDLESS_TEXTURES
+    return texture(sampler2D(reference), uv);
+#else
+    return texture(MaterialArrays[reference.x], vec3(uv, reference.y));
+#endif
+}
+#else
+uniform sampler2D DiffuseTexture;
+
+vec4 sampleDiffuse(vec2 uv) {
+    return texture(DiffuseTexture, uv);
+}
+#endif
+
+#ifdef MANY_LIGHTS
+// Point and spot lights, listed per brick of the volume by light-assign.comp, see LightGrid
+struct Light {
+    vec4 positionRange;      // World position, distance where the light falls off to 0
+    vec4 colorSpotInner;     // Color times intensity, cosine of the inner spot angle
+    vec4 directionSpotOuter; // Spot direction, cosine of the outer spot angle or -1 for point lights
+};
+layout(std430, binding = 4) readonly buffer Lights {
+    Light lights[];
+};
+// Light count, then the light indices, for every brick
+layout(std430, binding = 5) readonly buffer BrickLights {
+    uint brickLights[];
+};
+// Mipmapped voxels of the previous voxelization, the lights are shadowed by them
+uniform sampler3D OcclusionTexture;
+uniform float VoxelGridWorldSize;
+
+// Inverse square falloff windowed to reach 0 at the range, same as voxel-trace.frag
+float lightAttenuation(Light light, vec3 L, float dist) {
+    float ratio = (dist * dist) / (light.positionRange.w * light.positionRange.w);
+    float window = clamp(1.0 - ratio * ratio, 0.0, 1.0);
+    float attenuation = window * window / (dist * dist + 1.0);
+    if(light.directionSpotOuter.w > -1.0)
+        attenuation *= smoothstep(light.directionSpotOuter.w, light.colorSpotInner.w, dot(-L, light.directionSpotOuter.xyz));
+    return attenuation;
+}
+
+// Short cone towards the light, in voxels. It starts at mip level 1 so the surface
+// being voxelized doesn't shadow itself.
+float lightVisibility(vec3 voxel, vec3 L, float dist) {
+    float maxDistance = min(dist, 32.0);
+    float occlusion = 0.0;
+    float distance = 2.0;
+    while(distance < maxDistance && occlusion < 1.0) {
+        float diameter = max(2.0, 0.2 * distance);
+        float a = textureLod(OcclusionTexture, (voxel + L * distance) / float(VoxelDimensions), log2(diameter)).a;
+        occlusion += (1.0 - occlusion) * a;
+        distance += diameter;
+    }
+    return 1.0 - occlusion;
+}
+
+// Light of the brick's lights reaching the voxel. A voxel stands for both sides of
+// a thin surface, so light from behind the normal counts too.
+vec3 injectLights(ivec3 voxel_pos, vec3 normal) {
+    int bricksPerAxis = VoxelDimensions / BRICK_SIZE;
+    if(bricksPerAxis == 0)
+        return vec3(0.0);
+    ivec3 brick = voxel_pos / BRICK_SIZE;
+    uint offset = uint(brick.x + bricksPerAxis * (brick.y + bricksPerAxis * brick.z)) * uint(MAX_BRICK_LIGHTS + 1);
+    vec3 voxel = vec3(voxel_pos) + 0.5;
+    vec3 position = (voxel / float(VoxelDimensions) - 0.5) * VoxelGridWorldSize;
+    float voxelWorldSize = VoxelGridWorldSize / float(VoxelDimensions);
+
+    vec3 result = vec3(0.0);
+    uint count = brickLights[offset];
+    for(uint i = 0u; i < count; i++) {
+        Light light = lights[brickLights[offset + 1u + i]];
+        vec3 toLight = light.positionRange.xyz - position;
+        float dist = length(toLight);
+        vec3 L = toLight / max(dist, 1e-4);
+        float attenuation = lightAttenuation(light, L, dist);
+        if(attenuation <= 0.0)
+            continue;
+        result += light.colorSpotInner.rgb * attenuation * abs(dot(normal, L)) * lightVisibility(voxel, L, dist / voxelWorldSize);
+    }
+    return result;
+}
+#endif
+
 void main() {
 	
 	// We must determine the 3D voxel position of our current voxel fragment.
@@ -48,7 +152,7 @@ void main() {
 	voxel_pos.z = VoxelDimensions - voxel_pos.z - 1;
 	
 	// Read in our diffuse texture value
-    vec4 materialColor = texture(DiffuseTexture, frag.UV);
+    vec4 materialColor = sampleDiffuse(frag.UV);
 
     // Use the shadow map we calculated a while ago to calculate the visibility for this voxel
     float visibility = texture(ShadowMap, vec3(frag.position_depth.xy, (frag.position_depth.z - 0.001)/frag.position_depth.w));
@@ -57,5 +161,9 @@ void main() {
 	// However since we are just voxelizing once at the beginning of the scene this really isnt an issue.
 	// There is a suggested solution using atomic operations if you need to dynamically voxelize (for animated objects)
     
-	imageStore(VoxelTexture, voxel_pos, vec4(materialColor.rgb * visibility, 1.0));
+    vec3 light = vec3(visibility);
+#ifdef MANY_LIGHTS
+    light += injectLights(voxel_pos, frag.normal_world);
+#endif
+	imageStore(VoxelTexture, voxel_pos, vec4(materialColor.rgb * light, 1.0));
 }
\ No newline at end of file
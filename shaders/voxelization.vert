@@ -1,10 +1,18 @@
 #version 330 core
 
-layout(location = 0) in vec3 vertex_position_modelspace;
+layout(location = 0) in vec3 vertex_position_quantized;
 layout(location = 1) in vec2 vertex_texture_UV;
+layout(location = 5) in mat4 instance_model_matrix; // Only read when Instanced
 
 uniform mat4 DepthModelViewProjectionMatrix;
 uniform mat4 ModelMatrix;
+// Instanced draws build the products from the instance matrix instead
+uniform bool Instanced;
+uniform mat4 DepthViewProjectionMatrix;
+
+// Vertex positions may be quantized relative to the mesh bounding box
+uniform vec3 PositionOffset;
+uniform vec3 PositionScale;
 
 out vertex_data {
     vec2 texture_UV;
@@ -12,15 +20,19 @@ out vertex_data {
 } vertex;
 
 void main() {
+    vec3 vertex_position_modelspace = PositionOffset + PositionScale * vertex_position_quantized;
 
     // Just initialize values from Application and prepare them to be sent over to geometry shader. Nothing special here.
 
     vertex.texture_UV = vertex_texture_UV;
 
-    vertex.position_depth = DepthModelViewProjectionMatrix * vec4(vertex_position_modelspace, 1);
+    mat4 model_matrix = Instanced ? instance_model_matrix : ModelMatrix;
+    mat4 depth_model_view_projection_matrix = Instanced ? DepthViewProjectionMatrix * instance_model_matrix : DepthModelViewProjectionMatrix;
+
+    vertex.position_depth = depth_model_view_projection_matrix * vec4(vertex_position_modelspace, 1);
 
 	vertex.position_depth.xyz = (vertex.position_depth.xyz * 0.5f) + 0.5f;
 
     // Transform position using Model Matrix
-    gl_Position = ModelMatrix * vec4(vertex_position_modelspace,1);
+    gl_Position = model_matrix * vec4(vertex_position_modelspace,1);
 }
\ No newline at end of file
@@ -1,11 +1,16 @@
 #include <iostream>
+#include <algorithm>
+#include <memory>
 
 #include <assimp/Importer.hpp>
 #include <assimp/postprocess.h>
 #include <assimp/scene.h>
 
+#include "CPUConeTracer.h"
 #include "Shader.h"
 #include "HighResClock.h"
+#include "MemoryTracker.h"
+#include "Profiler.h"
 #include "Application.h"
 
 Application::Application(const int width, const int height, GLFWwindow* window) {
@@ -14,9 +19,54 @@ Application::Application(const int width, const int height, GLFWwindow* window)
 	window_ = window;
 	camera_ = NULL;
 	controls_ = NULL;
+	sceneLoader_ = NULL;
+	jobSystem_ = NULL;
+	depthTexture_.textureID = 0;
+	voxelTexture_.textureID = 0;
+	cascadeFramebuffer_ = 0;
+	cascadeTexture_ = 0;
+	voxelizationComputeShader_ = 0;
+	tileJobBuffer_ = 0;
+	maxTileJobs_ = 0;
+	backVoxelTexture_ = 0;
+	voxelClearShader_ = voxelMipmapShader_ = 0;
+	revoxelizationNext_ = 0;
+	revoxelizationTriangles_ = 100000.0;
+	for(int i = 0; i < NUM_REVOXELIZATION_QUERIES; i++) {
+		revoxelizationQueries_[i] = 0;
+		revoxelizationQueryTriangles_[i] = 0;
+	}
+	revoxelizationFrame_ = 0;
+	brickPager_ = NULL;
+	brickBudgetBytes_ = 0;
+	probeShader_ = 0;
+	probeFramebuffer_ = 0;
+	for(int i = 0; i < NUM_PROBE_TEXTURES; i++) {
+		probeTextures_[i] = 0;
+	}
+	clusterCullShader_ = 0;
+	clusterStatsBuffer_ = 0;
+	depthPrepassShader_ = 0;
+	hiZShader_ = 0;
+	hiZDepthTexture_ = hiZTexture_ = hiZFramebuffer_ = hiZDepthFramebuffer_ = 0;
+	hiZLevels_ = 0;
+	hiZValid_ = false;
+	renderVoxelsShader_ = voxelCompactShader_ = voxelCullShader_ = 0;
+	voxelViewVertexArray_ = 0;
+	voxelCounterBuffer_ = voxelInstanceBuffer_ = visibleVoxelBuffer_ = voxelCommandBuffer_ = 0;
+	numVoxelInstances_ = voxelInstanceCapacity_ = 0;
+	for(int i = 0; i < NUM_CLUSTER_PASSES; i++) {
+		clustersTested_[i] = 0;
+	}
 }
 
 Application::~Application() {
+	if(sceneLoader_)
+		delete sceneLoader_;
+	if(jobSystem_)
+		delete jobSystem_;
+	if(brickPager_)
+		delete brickPager_;
 	if(camera_)
 		delete camera_;
 	if(controls_)
@@ -26,6 +76,69 @@ Application::~Application() {
 		delete (*obj);
    	} 
 	objects_.clear();
+	if(staticBatcher_)
+		delete staticBatcher_;
+	if(lightGrid_)
+		delete lightGrid_;
+
+	// Before the materials, the handles of their textures are made non-resident
+	if(materialTable_)
+		delete materialTable_;
+
+	for(std::map<int, Material*>::iterator mat = materials_.begin(); mat != materials_.end(); ++mat) {
+		delete mat->second;
+	}
+	materials_.clear();
+
+	if(depthTexture_.textureID) {
+		MemoryTracker::release(MemoryTracker::SHADOW, MemoryTracker::getTextureBytes(GL_DEPTH_COMPONENT24, depthTexture_.width, depthTexture_.height, 1, false));
+		glDeleteTextures(1, &depthTexture_.textureID);
+	}
+	if(cascadeTexture_) {
+		MemoryTracker::release(MemoryTracker::SHADOW, MemoryTracker::getTextureBytes(GL_DEPTH_COMPONENT24, cascadeSize_, cascadeSize_, numCascades_, false));
+		glDeleteTextures(1, &cascadeTexture_);
+		glDeleteFramebuffers(1, &cascadeFramebuffer_);
+	}
+	if(tileJobBuffer_) {
+		MemoryTracker::release(MemoryTracker::VOXELS, 16 + (size_t)maxTileJobs_ * 8);
+		glDeleteBuffers(1, &tileJobBuffer_);
+	}
+	if(backVoxelTexture_) {
+		MemoryTracker::release(MemoryTracker::VOXELS, MemoryTracker::getTextureBytes(GL_RGBA8, voxelTexture_.size, voxelTexture_.size, voxelTexture_.size, true));
+		glDeleteTextures(1, &backVoxelTexture_);
+		glDeleteQueries(NUM_REVOXELIZATION_QUERIES, revoxelizationQueries_);
+	}
+	if(voxelInstanceBuffer_) {
+		MemoryTracker::release(MemoryTracker::VOXELS, 2 * (size_t)voxelInstanceCapacity_ * 8);
+		glDeleteBuffers(1, &voxelInstanceBuffer_);
+		glDeleteBuffers(1, &visibleVoxelBuffer_);
+	}
+	if(voxelCounterBuffer_) {
+		glDeleteBuffers(1, &voxelCounterBuffer_);
+		glDeleteBuffers(1, &voxelCommandBuffer_);
+		glDeleteVertexArrays(1, &voxelViewVertexArray_);
+	}
+	if(hiZTexture_) {
+		MemoryTracker::release(MemoryTracker::TEXTURES, MemoryTracker::getTextureBytes(GL_DEPTH24_STENCIL8, width_, height_, 1, false) +
+			MemoryTracker::getTextureBytes(GL_R32F, width_, height_, 1, true));
+		glDeleteTextures(1, &hiZDepthTexture_);
+		glDeleteTextures(1, &hiZTexture_);
+		glDeleteFramebuffers(1, &hiZFramebuffer_);
+		glDeleteFramebuffers(1, &hiZDepthFramebuffer_);
+	}
+	if(clusterStatsBuffer_) {
+		MemoryTracker::release(MemoryTracker::GEOMETRY, NUM_CLUSTER_PASSES * sizeof(GLuint));
+		glDeleteBuffers(1, &clusterStatsBuffer_);
+	}
+	if(probeFramebuffer_) {
+		MemoryTracker::release(MemoryTracker::VOXELS, NUM_PROBE_TEXTURES * MemoryTracker::getTextureBytes(GL_RGBA16F, probeGridSize_, probeGridSize_, probeGridSize_, false));
+		glDeleteTextures(NUM_PROBE_TEXTURES, probeTextures_);
+		glDeleteFramebuffers(1, &probeFramebuffer_);
+	}
+	if(voxelTexture_.textureID) {
+		MemoryTracker::release(MemoryTracker::VOXELS, MemoryTracker::getTextureBytes(GL_RGBA8, voxelTexture_.size, voxelTexture_.size, voxelTexture_.size, true));
+		glDeleteTextures(1, &voxelTexture_.textureID);
+	}
 }
 
 int Application::getWindowWidth() {
@@ -40,58 +153,271 @@ GLFWwindow* Application::getWindow() {
 	return window_;
 }
 
+void Application::setOutputFramebuffer(GLuint framebuffer) {
+	outputFramebuffer_ = framebuffer;
+}
+
 Camera* Application::getCamera() {
 	return camera_;
 }
 
+Controls* Application::getControls() {
+	return controls_;
+}
+
+JobSystem* Application::getJobSystem() {
+	return jobSystem_;
+}
+
+bool Application::isLoading() {
+	return sceneLoader_ != NULL;
+}
+
+void Application::setShadowMapSize(int size) {
+	shadowMapSize_ = size;
+}
+
+void Application::setShadowCascades(int numCascades) {
+	numCascades_ = glm::clamp(numCascades, 0, (int)MAX_CASCADES);
+}
+
+void Application::setComputeVoxelization(bool enable) {
+	computeVoxelization_ = enable;
+}
+
+void Application::setBrickPool(std::string filename, size_t budgetBytes) {
+	brickPoolFile_ = filename;
+	brickBudgetBytes_ = budgetBytes;
+}
+
+void Application::setBakeBricks(std::string filename) {
+	bakeBricksFile_ = filename;
+}
+
+void Application::setProbeGridSize(int size) {
+	probeGridSize_ = glm::max(size, 0);
+}
+
+void Application::setClusterCulling(bool enable) {
+	clusterCulling_ = enable;
+}
+
+void Application::setMaterialTable(bool enable, bool bindless) {
+	useMaterialTable_ = enable;
+	bindlessTextures_ = bindless;
+}
+
+void Application::setStaticBatching(bool enable, unsigned int maxBatchVertices) {
+	staticBatching_ = enable;
+	maxBatchVertices_ = maxBatchVertices;
+}
+
+void Application::setMeshLODs(bool enable) {
+	meshLODs_ = enable;
+}
+
+void Application::setLights(std::string filename, int numRandomLights) {
+	lightsFile_ = filename;
+	numRandomLights_ = numRandomLights;
+}
+
+void Application::setDepthPrepass(bool enable) {
+	depthPrepass_ = enable;
+}
+
+void Application::setVoxelView(bool show, int level) {
+	showVoxels_ = show;
+	// Same levels the 6 key cycles through
+	int numLevels = 1 + (int)glm::log2((float)voxelDimensions_);
+	voxelViewLevel_ = glm::clamp(level, 0, numLevels - 1);
+	voxelViewDirty_ = true;
+}
+
+void Application::setRevoxelizationBudget(float milliseconds) {
+	revoxelizationBudgetMs_ = milliseconds;
+}
+
+void Application::setLightDirection(glm::vec3 direction) {
+	lightDirection_ = glm::normalize(direction);
+	shadowDirty_ = true;
+}
+
 bool Application::loadObject(std::string path, std::string name, glm::vec3 pos, float scale) {
-	Assimp::Importer importer;
+	size_t numObjects = objects_.size();
+	jobSystem_->wait(addLoadObjectJobs(path, name, pos, scale));
+	return objects_.size() > numObjects;
+}
 
-	// Read file and store as a "scene"
-	const aiScene* scene = importer.ReadFile(path + name, aiProcess_Triangulate |
-		aiProcess_CalcTangentSpace |
-		aiProcess_JoinIdenticalVertices);
-    
-	if(scene) {
-		Material* mat;
-		Object* obj;
-		Mesh* mesh;
+// The import is one job, which adds a job per mesh and per texture. Those are
+// followed by main thread jobs uploading the results.
+JobSystem::Job* Application::addLoadObjectJobs(std::string path, std::string name, glm::vec3 pos, float scale) {
+	struct LoadedScene {
+		Assimp::Importer importer;
+		std::vector<Object*> objects; // One per mesh
+		std::map<int, Material*> materials;
+		SceneGraph::NodeList nodes;
+	};
+	std::shared_ptr<LoadedScene> loaded(new LoadedScene());
+	bool quantizePositions = quantizePositions_;
+	// Static batching merges the meshes from their CPU copies
+	bool keepMeshCPUCopies = keepMeshCPUCopies_ || staticBatching_;
+	bool meshLODs = meshLODs_;
+
+	JobSystem::Job* done = jobSystem_->create("addObjects", [this, loaded, pos, scale]() {
+		materials_.insert(loaded->materials.begin(), loaded->materials.end());
+		if(loaded->objects.empty())
+			return;
+
+		// The file's nodes go below a root holding the position and scale. The first
+		// node referencing a mesh gets its object, every further one an instance of it.
+		int root = sceneGraph_.addNode(-1, glm::translate(glm::scale(glm::mat4(1.0f), glm::vec3(scale)), pos));
+		int firstNode = sceneGraph_.addNodes(loaded->nodes, root);
+		std::vector<bool> placed(loaded->objects.size(), false);
+		for(size_t i = 0; i < loaded->nodes.meshInstances.size(); i++) {
+			unsigned int mesh = loaded->nodes.meshInstances[i].first;
+			Object* obj = loaded->objects[mesh];
+			if(placed[mesh]) {
+				obj->addInstance(firstNode + loaded->nodes.meshInstances[i].second);
+			}
+			else {
+				obj->setNode(&sceneGraph_, firstNode + loaded->nodes.meshInstances[i].second);
+				objects_.push_back(obj);
+				placed[mesh] = true;
+			}
+		}
+		printVertexMemoryReport();
+	}, true);
+
+	JobSystem::Job* import = jobSystem_->create("importScene", [this, loaded, done, path, name, quantizePositions, keepMeshCPUCopies, meshLODs]() {
+		// Read file and store as a "scene"
+		const aiScene* scene = loaded->importer.ReadFile(path + name, aiProcess_Triangulate |
+			aiProcess_CalcTangentSpace |
+			aiProcess_JoinIdenticalVertices);
+		if(!scene) {
+			std::cerr << "Mesh: " << loaded->importer.GetErrorString() << std::endl;
+			return;
+		}
+		SceneGraph::flattenAssimpNodes(scene, loaded->nodes);
 
-		// Create a materials from the loaded assimp materials
+		// Create a materials from the loaded assimp materials, every texture is decoded by its own job
 		for(unsigned int m = 0; m < scene->mNumMaterials; m++) {
-			mat = new Material();
+			Material* mat = new Material();
 			mat->loadAssimpMaterial(scene->mMaterials[m], path);
-			materials_[m] = mat;
+			loaded->materials[m] = mat;
+
+			for(int t = 0; t < Material::NUM_TEXTURES; t++) {
+				Material::TEXTURES_TYPES type = (Material::TEXTURES_TYPES)t;
+				std::string texturePath = mat->getTexturePath(type);
+				if(texturePath.empty())
+					continue;
+
+				std::shared_ptr<Material::ImageData> image(new Material::ImageData());
+				JobSystem::Job* decode = jobSystem_->add("decodeImage", [image, texturePath]() {
+					*image = Material::decodeTexture(texturePath);
+				});
+				JobSystem::Job* upload = jobSystem_->add("uploadImage", [mat, type, image, texturePath]() {
+					mat->setTexture(type, Material::uploadTexture(*image, texturePath));
+				}, std::vector<JobSystem::Job*>(1, decode), true);
+				jobSystem_->addDependency(done, upload);
+			}
 		}
 
-		// Create objects and add to objects_ vector. An object has a mesh, a material and some other properties.
+		// Create objects. An object has a mesh, a material and some other properties.
+		// Each mesh is packed by its own job, the order of objects_ stays the one of the file.
+		loaded->objects.resize(scene->mNumMeshes);
 		for(unsigned int m = 0; m < scene->mNumMeshes; m++) {
-			// Create new object
-			obj = new Object();
+			Object* obj = new Object();
+			obj->mesh_ = new Mesh();
+			obj->material_ = loaded->materials[scene->mMeshes[m]->mMaterialIndex];
+			loaded->objects[m] = obj;
+
+			const aiMesh* assimpMesh = scene->mMeshes[m];
+			// Holding on to loaded keeps the importer's scene alive
+			JobSystem::Job* build = jobSystem_->add("buildVertexData", [loaded, obj, assimpMesh, quantizePositions, keepMeshCPUCopies, meshLODs]() {
+				obj->mesh_->buildVertexData(assimpMesh, quantizePositions, keepMeshCPUCopies, meshLODs);
+			});
+			JobSystem::Job* upload = jobSystem_->add("uploadMesh", [obj]() {
+				obj->mesh_->upload();
+			}, std::vector<JobSystem::Job*>(1, build), true);
+			jobSystem_->addDependency(done, upload);
+		}
+	});
+
+	jobSystem_->addDependency(done, import);
+	jobSystem_->submit(import);
+	jobSystem_->submit(done);
+	return done;
+}
+
+// Memory used by the vertex data, for comparing the old and the packed layout
+void Application::printVertexMemoryReport() {
+	size_t separateBytes = 0, packedBytes = 0, cpuBytes = 0;
+	unsigned int numVertices = 0, numInstances = 0;
+	for(std::vector<Object*>::iterator obj = objects_.begin(); obj != objects_.end(); ++obj) {
+		separateBytes += (*obj)->mesh_->getSeparateLayoutBytes();
+		packedBytes += (*obj)->mesh_->getPackedLayoutBytes();
+		cpuBytes += (*obj)->mesh_->getCPUCopyBytes();
+		numVertices += (*obj)->mesh_->getNumVertices();
+		numInstances += (*obj)->getNumInstances();
+	}
 
-			// Create a mesh from the loaded assimp mesh
-			mesh = new Mesh();
-			mesh->loadAssimpMesh(scene->mMeshes[m]);
-			// Asign the object this mesh.
-			obj->mesh_ = mesh;
+	std::cout << "Vertex memory for " << numVertices << " vertices:" << std::endl
+			  << "\tseparate float streams: " << separateBytes / 1024 << " KB (56 bytes/vertex)" << std::endl
+			  << "\tpacked interleaved: " << packedBytes / 1024 << " KB ("
+			  << Mesh::getVertexLayout(quantizePositions_).stride << " bytes/vertex)" << std::endl
+			  << "\tCPU copies: " << cpuBytes / 1024 << " KB" << std::endl
+			  << "\t" << objects_.size() << " meshes placed " << numInstances << " times" << std::endl;
+}
 
-			// Store pointer to material used
-			obj->material_ = materials_[scene->mMeshes[m]->mMaterialIndex];
+void Application::batchStaticObjects() {
+	if(!staticBatching_ || objects_.empty())
+		return;
+	staticBatcher_ = new StaticBatcher(maxBatchVertices_, quantizePositions_, keepMeshCPUCopies_, meshLODs_);
+	staticBatcher_->batch(objects_);
+}
 
-			obj->setScale(scale);
-			obj->setPosition(pos);
-			objects_.push_back(obj);
+// Uploads whatever the background loader has finished and adds the new objects
+// to the shadow map and the voxel texture
+void Application::streamAssets() {
+	if(!sceneLoader_)
+		return;
+
+	PROFILE_ZONE("streamAssets");
+
+	size_t firstNewObject = objects_.size();
+	bool changed = sceneLoader_->processUploads(objects_, materials_, sceneGraph_, uploadBudgetSeconds_);
+	// The new objects are drawn into the shadow map and voxelized below
+	if(changed && materialTable_)
+		materialTable_->update(materials_);
+
+	if(sceneLoader_->isDone()) {
+		if(!sceneLoader_->failed()) {
+			std::cout << "Loading done! " << objects_.size() << " objects loaded, " << sceneGraph_.getNumNodes() << " scene nodes" << std::endl;
+			std::cout << "Time to fully loaded: " << glfwGetTime() << " s" << std::endl;
+			batchStaticObjects();
+			printVertexMemoryReport();
+			MemoryTracker::printSummary(std::cout);
+
+			// Sort object so opaque objects are rendered first
+			std::sort(objects_.begin(), objects_.end(), compareObjects);
+
+			// Textures and shadows from objects that arrived later have changed, so do it all
+			// again with the shadow map fitted to the scene instead of the voxel grid
+			shadowDirty_ = true;
 		}
+		delete sceneLoader_;
+		sceneLoader_ = NULL;
+		jobSystem_->printStats(std::cout);
+		jobSystem_->clear();
 	}
-	else {
-		std::cerr << "Mesh: " << importer.GetErrorString() << std::endl;
-		return false;	
+	else if(changed && objects_.size() > firstNewObject) {
+		drawDepthTexture(firstNewObject);
+		voxelizeScene(firstNewObject);
 	}
-
-	return true;
 }
 
 bool Application::initialize() {
+	PROFILE_ZONE("initialize");
 	std::cout << "Initializing CSCI 580 Voxel Cone Tracing" << std::endl;
 
 	// Init camera parameters
@@ -105,25 +431,77 @@ bool Application::initialize() {
 
 	// Speed, Mouse sensitivity
 	controls_ = new Controls(10.0f, 0.0015f);
-    
-	voxelTraceShader_ = loadShaders("../shaders/voxel-trace.vert", "../shaders/voxel-trace.frag");
-    voxelizationShader_ = loadShaders("../shaders/voxelization.vert", "../shaders/voxelization.frag", "../shaders/voxelization.geom");
-    shadowShader_ = loadShaders("../shaders/shadow.vert", "../shaders/shadow.frag");
-   // quadShader_ = loadShaders("../shaders/quad.vert", "../shaders/quad.frag");
-  //  renderVoxelsShader_ = loadShaders("../shaders/renderVoxels.vert", "../shaders/renderVoxels.frag", "../shaders/renderVoxels.geom");
+
+	// Initialization is a graph of jobs. The scene import, mesh packing, image decoding,
+	// shader file reads and voxel clearing run on the workers while this thread creates
+	// the GL objects. The uploads are main thread jobs, all waited for at the end.
+	jobSystem_ = new JobSystem();
 
     // Load objects
     std::cout << "Loading objects... " << std::endl;
-    loadObject("../data/models/crytek-sponza/", "sponza.obj", glm::vec3(0.0f), sponzaScale_);
-	//loadObject("../data/models/", "suzanne.obj");
-    std::cout << "Loading done! " << objects_.size() << " objects loaded" << std::endl;
+	JobSystem::Job* sceneJob = NULL;
+	if(streamScene_) {
+		// Rendering starts right away, objects show up as they are loaded
+		sceneLoader_ = new SceneLoader(jobSystem_, quantizePositions_, keepMeshCPUCopies_ || staticBatching_, meshLODs_);
+		sceneLoader_->loadAsync("../data/models/crytek-sponza/", "sponza.obj", glm::vec3(0.0f), sponzaScale_);
+	}
+	else {
+		sceneJob = addLoadObjectJobs("../data/models/crytek-sponza/", "sponza.obj", glm::vec3(0.0f), sponzaScale_);
+		//addLoadObjectJobs("../data/models/", "suzanne.obj");
+	}
+
+	static const char* shaderFiles[] = {
+		"../shaders/voxel-trace.vert", "../shaders/voxel-trace.frag",
+		"../shaders/voxelization.vert", "../shaders/voxelization.frag", "../shaders/voxelization.geom", "../shaders/voxelization.comp",
+		"../shaders/shadow.vert", "../shaders/shadow.frag",
+		"../shaders/quad.vert", "../shaders/probe-update.frag", "../shaders/hiz-downsample.frag",
+		"../shaders/cluster-cull.comp",
+		"../shaders/renderVoxels.vert", "../shaders/renderVoxels.frag", "../shaders/voxel-compact.comp", "../shaders/voxel-cull.comp",
+		"../shaders/depth-prepass.vert", "../shaders/depth-prepass.frag",
+		"../shaders/voxel-clear.comp", "../shaders/voxel-mipmap.comp",
+		"../shaders/light-assign.comp"
+	};
+	std::vector<JobSystem::Job*> shaderJobs;
+	for(size_t i = 0; i < sizeof(shaderFiles) / sizeof(shaderFiles[0]); i++) {
+		const char* file = shaderFiles[i];
+		shaderJobs.push_back(jobSystem_->add("readShader", [file]() { preloadShaderSource(file); }));
+	}
+	jobSystem_->wait(shaderJobs);
+
+	// The shaders reading materials are built for the table when there is one
+	if(useMaterialTable_ && GLEW_VERSION_4_3) {
+		// Bindless handles are driver values, a replay of a capture couldn't use them
+		bool bindless = bindlessTextures_ && GLEW_ARB_bindless_texture && !GLCapture::isCapturing();
+		materialTable_ = new MaterialTable(bindless);
+		std::cout << "Material table with " << (bindless ? "bindless textures" : "texture arrays") << std::endl;
+	}
+	else if(useMaterialTable_) {
+		std::cout << "The material table needs OpenGL 4.3, binding textures per draw" << std::endl;
+	}
+	const char* materialHeader = materialTable_ ? materialTable_->getShaderHeader() : NULL;
+
+	// The shaders lighting with the light list get its defines after the material ones
+	if((!lightsFile_.empty() || numRandomLights_ > 0) && GLEW_VERSION_4_3) {
+		lightGrid_ = new LightGrid();
+		if(!lightsFile_.empty())
+			lightGrid_->load(lightsFile_);
+		if(numRandomLights_ > 0) {
+			glm::vec3 gridMax(0.5f * voxelGridWorldSize_);
+			lightGrid_->addRandomLights(numRandomLights_, -gridMax, gridMax, voxelGridWorldSize_ / 20.0f);
+		}
+		std::cout << lightGrid_->getNumLights() << " point and spot lights" << std::endl;
+	}
+	else if(!lightsFile_.empty() || numRandomLights_ > 0) {
+		std::cout << "The light list needs OpenGL 4.3, lighting only with the directional light" << std::endl;
+	}
+	std::string lightHeader = lightGrid_ ? std::string(materialHeader ? materialHeader : "#version 430 core") + "\n" + lightGrid_->getShaderDefines() : "";
+	const char* litHeader = lightGrid_ ? lightHeader.c_str() : materialHeader;
 
-	// Sort object so opaque objects are rendered first
-	std::sort(objects_.begin(), objects_.end(), compareObjects);
+	voxelTraceShader_ = loadShaders("../shaders/voxel-trace.vert", "../shaders/voxel-trace.frag", NULL, litHeader);
+    voxelizationShader_ = loadShaders("../shaders/voxelization.vert", "../shaders/voxelization.frag", "../shaders/voxelization.geom", litHeader);
+    shadowShader_ = loadShaders("../shaders/shadow.vert", "../shaders/shadow.frag");
+   // quadShader_ = loadShaders("../shaders/quad.vert", "../shaders/quad.frag");
  
-    // Create VAO for 3D texture. Won't really store any information but it's still needed.
-	glGenVertexArrays(1, &texture3DVertexArray_);
-    
     // ------------------------------------------------------------------- //
     // --------------------- Shadow map initialization ------------------- //
     // ------------------------------------------------------------------- //
@@ -131,16 +509,14 @@ bool Application::initialize() {
 	glGenFramebuffers(1, &depthFramebuffer_);
 	glBindFramebuffer(GL_FRAMEBUFFER, depthFramebuffer_);
 
-	// Depth texture
-	depthTexture_.width = depthTexture_.height = 4096;
-
-	glm::mat4 viewMatrix = glm::lookAt(lightDirection_, glm::vec3(0,0,0), glm::vec3(0,1,0));
-	glm::mat4 projectionMatrix = glm::ortho	<float>(-120, 120, -120, 120, -500, 500);
-	depthViewProjectionMatrix_ = projectionMatrix * viewMatrix;
+	// Depth texture. The projection is set by fitShadowMap()
+	depthTexture_.width = depthTexture_.height = shadowMapSize_;
+	fitShadowMap();
 
 	glGenTextures(1, &depthTexture_.textureID);
 	glBindTexture(GL_TEXTURE_2D, depthTexture_.textureID);
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, depthTexture_.width, depthTexture_.height, 0,GL_DEPTH_COMPONENT, GL_FLOAT, 0);
+	MemoryTracker::allocate(MemoryTracker::SHADOW, MemoryTracker::getTextureBytes(GL_DEPTH_COMPONENT24, depthTexture_.width, depthTexture_.height, 1, false));
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR); 
 	// glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
@@ -158,57 +534,280 @@ bool Application::initialize() {
 		std::cout << "Error creating framebuffer" << std::endl;
 		return false;
 	}
+
+	// Cascades, one layer each
+	if(numCascades_ > 0) {
+		glGenFramebuffers(1, &cascadeFramebuffer_);
+		glBindFramebuffer(GL_FRAMEBUFFER, cascadeFramebuffer_);
+
+		glGenTextures(1, &cascadeTexture_);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, cascadeTexture_);
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, cascadeSize_, cascadeSize_, numCascades_, 0, GL_DEPTH_COMPONENT, GL_FLOAT, 0);
+		MemoryTracker::allocate(MemoryTracker::SHADOW, MemoryTracker::getTextureBytes(GL_DEPTH_COMPONENT24, cascadeSize_, cascadeSize_, numCascades_, false));
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+
+		glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, cascadeTexture_, 0, 0);
+		glDrawBuffer(GL_NONE);
+
+		if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+			std::cout << "Error creating cascade framebuffer" << std::endl;
+			return false;
+		}
+	}
     
     // ------------------------------------------------------------------- //
     // --------------------- 3D texture initialization ------------------- //
     // ------------------------------------------------------------------- //
 
-	/* this size indicates the size of one dimension of the voxel octree. In this case its 512 (so 512 x 512 x 512 voxels) */
-    voxelTexture_.size = voxelDimensions_;  
-
-    glEnable(GL_TEXTURE_3D);
-    
-	/* We store the voxel octree in a 3D texture because 3d images act very similar to an octree. (2D image = quadtree)
-	* For example, if you get a vertex that is inbetween a few voxels, 
-	* you can simply average the values by setting your texture to use linear interpolation.
-	* To access voxel data you just do texture lookup as a result.
-	* Also it will be available on GPU easier if u do this. 
-	*/
-    glGenTextures(1, &voxelTexture_.textureID);
-    glBindTexture(GL_TEXTURE_3D, voxelTexture_.textureID);
-	/* What to do when the tree is scaled down (Minimized) */
-    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-	/* What to do when the tree is scaled up (Magnified) */
-	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-	// Fill 3D texture with empty values
-	int numVoxels = voxelTexture_.size * voxelTexture_.size * voxelTexture_.size; /* 512 x 512 x 512  */
-	/* 4 components of each voxel, 1 byte per component */
-	GLubyte* data = new GLubyte[numVoxels*4];
-	for(int i = 0; i < voxelTexture_.size ; i++) {
-		for(int j = 0; j < voxelTexture_.size ; j++) {
-			for(int k = 0; k < voxelTexture_.size ; k++) {
-				data[4*(i + j * voxelTexture_.size + k * voxelTexture_.size * voxelTexture_.size)] = 0;
-				data[4*(i + j * voxelTexture_.size + k * voxelTexture_.size * voxelTexture_.size) + 1] = 0;
-				data[4*(i + j * voxelTexture_.size + k * voxelTexture_.size * voxelTexture_.size) + 2] = 0;
-				data[4*(i + j * voxelTexture_.size + k * voxelTexture_.size * voxelTexture_.size) + 3] = 0;
-			}
+	// With a brick pool the voxels are paged in from disk and the dense texture isn't needed
+	if(!brickPoolFile_.empty()) {
+		brickPager_ = new VoxelBrickPager();
+		if(!brickPager_->initialize(brickPoolFile_, brickBudgetBytes_)) {
+			std::cout << "Couldn't load the brick pool, voxelizing the scene instead" << std::endl;
+			delete brickPager_;
+			brickPager_ = NULL;
 		}
 	}
 
-	/* Create the texture for opengl. GL_RGBA8 means it will have 4 components, 8 bits each (1 byte). Unsigned.  */
-	glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA8, voxelTexture_.size, voxelTexture_.size, voxelTexture_.size, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-	delete[] data;
+	JobSystem::Job* voxelUploadJob = NULL;
+	if(!brickPager_) {
+		/* this size indicates the size of one dimension of the voxel octree. In this case its 512 (so 512 x 512 x 512 voxels) */
+		voxelTexture_.size = voxelDimensions_;  
+
+		glEnable(GL_TEXTURE_3D);
+    
+		/* We store the voxel octree in a 3D texture because 3d images act very similar to an octree. (2D image = quadtree)
+		* For example, if you get a vertex that is inbetween a few voxels, 
+		* you can simply average the values by setting your texture to use linear interpolation.
+		* To access voxel data you just do texture lookup as a result.
+		* Also it will be available on GPU easier if u do this. 
+		*/
+		glGenTextures(1, &voxelTexture_.textureID);
+		glBindTexture(GL_TEXTURE_3D, voxelTexture_.textureID);
+		/* What to do when the tree is scaled down (Minimized) */
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		/* What to do when the tree is scaled up (Magnified) */
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+		// Fill 3D texture with empty values. Slabs of it are cleared by jobs, the upload waits for all of them.
+		int numVoxels = voxelTexture_.size * voxelTexture_.size * voxelTexture_.size; /* 512 x 512 x 512  */
+		/* 4 components of each voxel, 1 byte per component */
+		GLubyte* data = new GLubyte[numVoxels*4];
+		MemoryTracker::allocate(MemoryTracker::CPU_MIRRORS, (size_t)numVoxels*4);
+		int dimensions = voxelTexture_.size;
+		const int slabSize = 16;
+		std::vector<JobSystem::Job*> clearJobs;
+		for(int firstSlice = 0; firstSlice < dimensions; firstSlice += slabSize) {
+			clearJobs.push_back(jobSystem_->add("clearVoxels", [data, dimensions, firstSlice, slabSize]() {
+				for(int k = firstSlice; k < glm::min(firstSlice + slabSize, dimensions); k++) {
+					for(int j = 0; j < dimensions; j++) {
+						for(int i = 0; i < dimensions; i++) {
+							data[4*(i + j * dimensions + k * dimensions * dimensions)] = 0;
+							data[4*(i + j * dimensions + k * dimensions * dimensions) + 1] = 0;
+							data[4*(i + j * dimensions + k * dimensions * dimensions) + 2] = 0;
+							data[4*(i + j * dimensions + k * dimensions * dimensions) + 3] = 0;
+						}
+					}
+				}
+			}));
+		}
 
-	/* Strange step. This seems to be unuseful since we haven't put any data in yet. 
-	* I must misunderstand how/when this is calculated. Perhaps it just initializes it.
-	*/
-	glGenerateMipmap(GL_TEXTURE_3D);
+		voxelUploadJob = jobSystem_->add("uploadVoxels", [this, data, numVoxels]() {
+			glBindTexture(GL_TEXTURE_3D, voxelTexture_.textureID);
+			/* Create the texture for opengl. GL_RGBA8 means it will have 4 components, 8 bits each (1 byte). Unsigned.  */
+			glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA8, voxelTexture_.size, voxelTexture_.size, voxelTexture_.size, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
+			delete[] data;
+			MemoryTracker::release(MemoryTracker::CPU_MIRRORS, (size_t)numVoxels*4);
+
+			/* Strange step. This seems to be unuseful since we haven't put any data in yet. 
+			* I must misunderstand how/when this is calculated. Perhaps it just initializes it.
+			*/
+			glGenerateMipmap(GL_TEXTURE_3D);
+		}, clearJobs, true);
+		MemoryTracker::allocate(MemoryTracker::VOXELS, MemoryTracker::getTextureBytes(GL_RGBA8, voxelTexture_.size, voxelTexture_.size, voxelTexture_.size, true));
+	}
 
 	// Create projection matrices used to project stuff onto each axis in the voxelization step
 	float size = voxelGridWorldSize_;
     // left, right, bottom, top, zNear, zFar
-    projectionMatrix = glm::ortho(-size*0.5f, size*0.5f, -size*0.5f, size*0.5f, size*0.5f, size*1.5f);
+    // Compute voxelization needs GL 4.3, the geometry shader path is used otherwise
+    if(computeVoxelization_ && !brickPager_) {
+        if(GLEW_VERSION_4_3)
+            voxelizationComputeShader_ = loadComputeShader("../shaders/voxelization.comp", litHeader);
+        if(voxelizationComputeShader_) {
+            // Each job is one work group, so the list can't be longer than a dispatch
+            GLint maxWorkGroups = 0;
+            glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_COUNT, 0, &maxWorkGroups);
+            maxTileJobs_ = (GLuint)glm::min(maxWorkGroups, 1 << 20);
+
+            // Indirect dispatch arguments and job counter followed by the jobs
+            glGenBuffers(1, &tileJobBuffer_);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, tileJobBuffer_);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, 16 + (size_t)maxTileJobs_ * 8, NULL, GL_DYNAMIC_DRAW);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+            MemoryTracker::allocate(MemoryTracker::VOXELS, 16 + (size_t)maxTileJobs_ * 8);
+        }
+        else {
+            std::cout << "Compute voxelization not supported, using the geometry shader" << std::endl;
+        }
+    }
+
+    // Lights are only injected into voxels the scene voxelizes, not into a brick pool
+    if(lightGrid_) {
+        lightAssignShader_ = loadComputeShader("../shaders/light-assign.comp");
+        lightGrid_->initialize(voxelTexture_.textureID ? voxelTexture_.size : 0);
+    }
+
+    // Back volume for the time-sliced revoxelization, its mips are built by voxel-mipmap.comp
+    if(revoxelizationBudgetMs_ > 0.0f && voxelTexture_.textureID) {
+        if(GLEW_VERSION_4_3) {
+            voxelClearShader_ = loadComputeShader("../shaders/voxel-clear.comp");
+            voxelMipmapShader_ = loadComputeShader("../shaders/voxel-mipmap.comp");
+        }
+        if(voxelClearShader_ && voxelMipmapShader_) {
+            glGenTextures(1, &backVoxelTexture_);
+            glBindTexture(GL_TEXTURE_3D, backVoxelTexture_);
+            for(int level = 0; (voxelTexture_.size >> level) > 0; level++) {
+                int levelSize = voxelTexture_.size >> level;
+                glTexImage3D(GL_TEXTURE_3D, level, GL_RGBA8, levelSize, levelSize, levelSize, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+            }
+            glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+            glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            MemoryTracker::allocate(MemoryTracker::VOXELS, MemoryTracker::getTextureBytes(GL_RGBA8, voxelTexture_.size, voxelTexture_.size, voxelTexture_.size, true));
+            glGenQueries(NUM_REVOXELIZATION_QUERIES, revoxelizationQueries_);
+        }
+        else {
+            std::cout << "Time-sliced revoxelization needs OpenGL 4.3, voxelizing only when the scene or light changes" << std::endl;
+        }
+    }
+
+    // Probes are traced from the dense voxel texture, so they aren't available with a brick pool
+    if(probeGridSize_ > 0 && brickPager_) {
+        std::cout << "Irradiance probes need the voxel texture, using diffuse cones with the brick pool" << std::endl;
+        probeGridSize_ = 0;
+    }
+    if(probeGridSize_ > 0) {
+        probeShader_ = loadShaders("../shaders/quad.vert", "../shaders/probe-update.frag");
+
+        glGenTextures(NUM_PROBE_TEXTURES, probeTextures_);
+        for(int i = 0; i < NUM_PROBE_TEXTURES; i++) {
+            glBindTexture(GL_TEXTURE_3D, probeTextures_[i]);
+            glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA16F, probeGridSize_, probeGridSize_, probeGridSize_, 0, GL_RGBA, GL_FLOAT, NULL);
+            glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        }
+        MemoryTracker::allocate(MemoryTracker::VOXELS, NUM_PROBE_TEXTURES * MemoryTracker::getTextureBytes(GL_RGBA16F, probeGridSize_, probeGridSize_, probeGridSize_, false));
+
+        // Layers are attached per slice in updateProbes()
+        glGenFramebuffers(1, &probeFramebuffer_);
+        glBindFramebuffer(GL_FRAMEBUFFER, probeFramebuffer_);
+        GLenum drawBuffers[NUM_PROBE_TEXTURES];
+        for(int i = 0; i < NUM_PROBE_TEXTURES; i++) {
+            glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, probeTextures_[i], 0, 0);
+            drawBuffers[i] = GL_COLOR_ATTACHMENT0 + i;
+        }
+        glDrawBuffers(NUM_PROBE_TEXTURES, drawBuffers);
+        if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            std::cout << "Error creating probe framebuffer" << std::endl;
+            return false;
+        }
+    }
+
+    if(clusterCulling_) {
+        if(GLEW_VERSION_4_3)
+            clusterCullShader_ = loadComputeShader("../shaders/cluster-cull.comp");
+        if(clusterCullShader_) {
+            glGenBuffers(1, &clusterStatsBuffer_);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, clusterStatsBuffer_);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, NUM_CLUSTER_PASSES * sizeof(GLuint), NULL, GL_DYNAMIC_READ);
+            glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+            MemoryTracker::allocate(MemoryTracker::GEOMETRY, NUM_CLUSTER_PASSES * sizeof(GLuint));
+        }
+        else {
+            std::cout << "Cluster culling not supported, drawing whole meshes" << std::endl;
+        }
+    }
+
+    // Voxel debug view, the occupied voxels are compacted with compute shaders
+    if(GLEW_VERSION_4_3 && voxelTexture_.textureID) {
+        renderVoxelsShader_ = loadShaders("../shaders/renderVoxels.vert", "../shaders/renderVoxels.frag");
+        voxelCompactShader_ = loadComputeShader("../shaders/voxel-compact.comp");
+        voxelCullShader_ = loadComputeShader("../shaders/voxel-cull.comp");
+    }
+    if(voxelCompactShader_ && voxelCullShader_) {
+        glGenBuffers(1, &voxelCounterBuffer_);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, voxelCounterBuffer_);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint), NULL, GL_DYNAMIC_READ);
+        glGenBuffers(1, &voxelCommandBuffer_);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, voxelCommandBuffer_);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, 4 * sizeof(GLuint), NULL, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        glGenVertexArrays(1, &voxelViewVertexArray_);
+    }
+    else {
+        voxelCompactShader_ = 0;
+        if(showVoxels_)
+            std::cout << "The voxel view needs OpenGL 4.3 and the voxel texture" << std::endl;
+        showVoxels_ = false;
+    }
+
+    if(depthPrepass_) {
+        depthPrepassShader_ = loadShaders("../shaders/depth-prepass.vert", "../shaders/depth-prepass.frag", NULL, materialHeader);
+    }
+    // Occlusion culling is done per cluster, so the pyramid is only needed with cluster culling
+    if(depthPrepass_ && clusterCullShader_) {
+        hiZShader_ = loadShaders("../shaders/quad.vert", "../shaders/hiz-downsample.frag");
+        hiZLevels_ = 1 + (int)glm::floor(glm::log2((float)glm::max(width_, height_)));
+
+        glGenTextures(1, &hiZDepthTexture_);
+        glBindTexture(GL_TEXTURE_2D, hiZDepthTexture_);
+        // Depth blits need matching formats, this is the one the window and the batch framebuffer are created with
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH24_STENCIL8, width_, height_, 0, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, 0);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+        glGenTextures(1, &hiZTexture_);
+        glBindTexture(GL_TEXTURE_2D, hiZTexture_);
+        for(int level = 0; level < hiZLevels_; level++) {
+            glTexImage2D(GL_TEXTURE_2D, level, GL_R32F, glm::max(width_ >> level, 1), glm::max(height_ >> level, 1), 0, GL_RED, GL_FLOAT, 0);
+        }
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, hiZLevels_ - 1);
+        MemoryTracker::allocate(MemoryTracker::TEXTURES, MemoryTracker::getTextureBytes(GL_DEPTH24_STENCIL8, width_, height_, 1, false) +
+            MemoryTracker::getTextureBytes(GL_R32F, width_, height_, 1, true));
+
+        glGenFramebuffers(1, &hiZFramebuffer_);
+        glBindFramebuffer(GL_FRAMEBUFFER, hiZFramebuffer_);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, hiZTexture_, 0);
+        if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            std::cout << "Error creating Hi-Z framebuffer" << std::endl;
+            return false;
+        }
+
+        glGenFramebuffers(1, &hiZDepthFramebuffer_);
+        glBindFramebuffer(GL_FRAMEBUFFER, hiZDepthFramebuffer_);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, hiZDepthTexture_, 0);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+        if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            std::cout << "Error creating Hi-Z depth framebuffer" << std::endl;
+            return false;
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    glm::mat4 projectionMatrix = glm::ortho(-size*0.5f, size*0.5f, -size*0.5f, size*0.5f, size*0.5f, size*1.5f);
     projX_ = projectionMatrix * glm::lookAt(glm::vec3(size, 0, 0), glm::vec3(0, 0, 0), glm::vec3(0, 1, 0));
     projY_ = projectionMatrix * glm::lookAt(glm::vec3(0, size, 0), glm::vec3(0, 0, 0), glm::vec3(0, 0, -1));
     projZ_ = projectionMatrix * glm::lookAt(glm::vec3(0, 0, size), glm::vec3(0, 0, 0), glm::vec3(0, 1, 0));
@@ -216,7 +815,7 @@ bool Application::initialize() {
     // ------------------------------------------------------------------- //
     // -------------------------------- Misc ----------------------------- //
     // ------------------------------------------------------------------- //
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glBindFramebuffer(GL_FRAMEBUFFER, outputFramebuffer_);
 	
 	// Quad FBO
 	static const GLfloat quad[] = { 
@@ -231,11 +830,28 @@ bool Application::initialize() {
 	glGenBuffers(1, &quadVBO_);
 	glBindBuffer(GL_ARRAY_BUFFER, quadVBO_);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(quad), quad, GL_STATIC_DRAW);
+	MemoryTracker::allocate(MemoryTracker::GEOMETRY, sizeof(quad));
 	glGenVertexArrays(1, &quadVertexArray_);
 
-	// Draw depth for shadow mapping and voxelize scene once
-	drawDepthTexture();	
-	voxelizeScene();
+	// Shadow map and voxel texture are drawn by the first draw() since they are dirty.
+	// When streaming, objects are added to both as they arrive.
+	shadowDirty_ = true;
+
+	if(voxelUploadJob)
+		jobSystem_->wait(voxelUploadJob);
+	if(sceneJob) {
+		jobSystem_->wait(sceneJob);
+		std::cout << "Loading done! " << objects_.size() << " objects loaded, " << sceneGraph_.getNumNodes() << " scene nodes" << std::endl;
+		batchStaticObjects();
+
+		// Sort object so opaque objects are rendered first
+		std::sort(objects_.begin(), objects_.end(), compareObjects);
+	}
+	// While streaming the loading jobs are still running, they are reported once done
+	if(!sceneLoader_) {
+		jobSystem_->printStats(std::cout);
+		jobSystem_->clear();
+	}
 
 	return true;
 }
@@ -264,6 +880,16 @@ void Application::updateInput() {
         showAmbientOcculision_ = !showAmbientOcculision_;
         press4_ = true;
     }
+    if (!press5_ && glfwGetKey(window_, GLFW_KEY_5) == GLFW_PRESS) {
+        showVoxels_ = !showVoxels_ && voxelCompactShader_;
+        press5_ = true;
+    }
+    if (!press6_ && glfwGetKey(window_, GLFW_KEY_6) == GLFW_PRESS) {
+        // Next mip level of the voxel view, back to 0 after the last
+        voxelViewLevel_ = (voxelViewLevel_ + 1) % (1 + (int)glm::log2((float)voxelDimensions_));
+        voxelViewDirty_ = true;
+        press6_ = true;
+    }
 
     if (glfwGetKey(window_, GLFW_KEY_1) == GLFW_RELEASE) {
         press1_ = false;
@@ -277,18 +903,64 @@ void Application::updateInput() {
     if (glfwGetKey(window_, GLFW_KEY_4) == GLFW_RELEASE) {
         press4_ = false;
     }
+    if (glfwGetKey(window_, GLFW_KEY_5) == GLFW_RELEASE) {
+        press5_ = false;
+    }
+    if (glfwGetKey(window_, GLFW_KEY_6) == GLFW_RELEASE) {
+        press6_ = false;
+    }
 }
 
 void Application::draw() {
-	//drawDepthTexture();
+	Profiler::beginFrame();
+	PROFILE_GPU_ZONE("draw");
+
+	// Uploads are GL work, so streaming is done once per frame here and not in update()
+	streamAssets();
+
+	if(materialTable_)
+		materialTable_->update(materials_);
+
+	// Before the voxelization below, which injects the lights binned by brick
+	if(lightGrid_)
+		lightGrid_->update(lightAssignShader_, voxelGridWorldSize_);
 
-	//auto start = timer::HighResClock::now();
+	{
+		PROFILE_ZONE("updateSceneGraph");
+		sceneGraph_.update(camera_->getViewMatrix(), depthViewProjectionMatrix_);
+		if(sceneGraph_.getNumUpdated() > 0) {
+			for(std::vector<Object*>::iterator obj = objects_.begin(); obj != objects_.end(); ++obj) {
+				(*obj)->updateInstanceBuffer();
+			}
+		}
+	}
+
+	// The shadow map only changes with the light or the scene. The voxel texture is lit
+	// with it, so it has to follow. While streaming it is filled in as objects arrive.
+	if(shadowDirty_) {
+		fitShadowMap();
+		drawDepthTexture();
+		if(!sceneLoader_) {
+			voxelizeScene();
+			// A half built back volume was lit with the old shadow map
+			revoxelizationNext_ = 0;
+			if(!bakeBricksFile_.empty() && voxelTexture_.textureID) {
+				VoxelBrickFile::bake(bakeBricksFile_, voxelTexture_.textureID, voxelTexture_.size, voxelGridWorldSize_, brickSize_);
+				bakeBricksFile_.clear();
+			}
+		}
+		shadowDirty_ = false;
+	}
+
+	// Keeps the voxels up to date a slice per frame. The first voxelization above is still done at once.
+	if(backVoxelTexture_ && !sceneLoader_)
+		updateRevoxelization();
 
-	//voxelizeScene();
+	if(numCascades_ > 0)
+		drawCascades();
 
-	//auto stop = timer::HighResClock::now();
-	//auto time = std::chrono::duration_cast<std::chrono::microseconds>(stop - start).count();
-	//std::cout << "voxelize total: " << time << std::endl;
+	if(probeGridSize_ > 0)
+		updateProbes();
 
 	// ------------------------------------------------------------------- // 
 	// --------------------- Draw the scene normally --------------------- //
@@ -297,8 +969,8 @@ void Application::draw() {
     glEnable(GL_CULL_FACE);
     glEnable(GL_DEPTH_TEST);
 
-	// Draw to the screen  
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	// Draw to the screen, or the framebuffer standing in for it
+	glBindFramebuffer(GL_FRAMEBUFFER, outputFramebuffer_);
 	glViewport(0, 0, width_, height_);
 	// Set clear color and clear
     glClearColor(0, 0, 0, 1);
@@ -307,13 +979,38 @@ void Application::draw() {
     glm::mat4 viewMatrix = camera_->getViewMatrix();
     glm::mat4 projectionMatrix = camera_->getProjectionMatrix();
 
+	if(showVoxels_) {
+		drawVoxels(viewMatrix, projectionMatrix);
+		endFrame();
+		return;
+	}
+
+	if(depthPrepass_)
+		drawDepthPrepass(viewMatrix, projectionMatrix);
+	else if(clusterCullShader_)
+		cullClusters(MAIN_PASS, projectionMatrix * viewMatrix, objects_);
+
+	if(lightGrid_)
+		lightGrid_->assignClusters(lightAssignShader_, viewMatrix, projectionMatrix, camera_->getNear(), camera_->getFar());
+
     glUseProgram(voxelTraceShader_);
+	if(materialTable_)
+		materialTable_->bind(voxelTraceShader_);
+	if(lightGrid_)
+		lightGrid_->bindClusters(voxelTraceShader_, width_, height_);
 
     glm::vec3 camPos = camera_->getPosition();
     glUniform3f(glGetUniformLocation(voxelTraceShader_, "CameraPosition"), camPos.x, camPos.y, camPos.z);
     glUniform3f(glGetUniformLocation(voxelTraceShader_, "LightDirection"), lightDirection_.x, lightDirection_.y, lightDirection_.z);
-    glUniform1f(glGetUniformLocation(voxelTraceShader_, "VoxelGridWorldSize"), voxelGridWorldSize_);
-	glUniform1i(glGetUniformLocation(voxelTraceShader_, "VoxelDimensions"), voxelDimensions_);
+	if(brickPager_) {
+		brickPager_->update(camPos);
+		glUniform1f(glGetUniformLocation(voxelTraceShader_, "VoxelGridWorldSize"), brickPager_->getGridWorldSize());
+		glUniform1i(glGetUniformLocation(voxelTraceShader_, "VoxelDimensions"), brickPager_->getVoxelDimensions());
+	}
+	else {
+		glUniform1f(glGetUniformLocation(voxelTraceShader_, "VoxelGridWorldSize"), voxelGridWorldSize_);
+		glUniform1i(glGetUniformLocation(voxelTraceShader_, "VoxelDimensions"), voxelDimensions_);
+	}
 
 	glUniform1f(glGetUniformLocation(voxelTraceShader_, "ShowDiffuse"), showDiffuse_);
 	glUniform1f(glGetUniformLocation(voxelTraceShader_, "ShowIndirectDiffuse"), showIndirectDiffuse_);
@@ -328,37 +1025,484 @@ void Application::draw() {
 	glBindTexture(GL_TEXTURE_3D, voxelTexture_.textureID);
 	glUniform1i(glGetUniformLocation(voxelTraceShader_, "VoxelTexture"), 6);
 
+	// Set even without cascades, samplers of different types can't share a texture unit
+	glUniform1i(glGetUniformLocation(voxelTraceShader_, "CascadeShadowMaps"), 7);
+	glUniform1i(glGetUniformLocation(voxelTraceShader_, "NumCascades"), numCascades_);
+	if(numCascades_ > 0) {
+		glActiveTexture(GL_TEXTURE0 + 7);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, cascadeTexture_);
+		glUniformMatrix4fv(glGetUniformLocation(voxelTraceShader_, "CascadeViewProjection"), numCascades_, GL_FALSE, &cascadeViewProjection_[0][0][0]);
+		glUniform1fv(glGetUniformLocation(voxelTraceShader_, "CascadeSplits"), numCascades_, cascadeSplits_);
+	}
+
+	// The brick samplers get their own units even when unused, samplers of different types can't share one
+	if(brickPager_) {
+		brickPager_->bind(voxelTraceShader_, 8, 9, 10, 1);
+	}
+	else {
+		glUniform1i(glGetUniformLocation(voxelTraceShader_, "BrickAtlas"), 8);
+		glUniform1i(glGetUniformLocation(voxelTraceShader_, "BrickIndirection"), 9);
+		glUniform1i(glGetUniformLocation(voxelTraceShader_, "BrickCoarse"), 10);
+		glUniform1i(glGetUniformLocation(voxelTraceShader_, "UseBrickPool"), 0);
+	}
+
+	// Probe samplers get units 4 and 11-13, which nothing else uses
+	const GLuint probeUnits[NUM_PROBE_TEXTURES] = {4, 11, 12, 13};
+	const char* probeSamplers[NUM_PROBE_TEXTURES] = {"ProbeRed", "ProbeGreen", "ProbeBlue", "ProbeOcclusion"};
+	for(int i = 0; i < NUM_PROBE_TEXTURES; i++) {
+		glActiveTexture(GL_TEXTURE0 + probeUnits[i]);
+		glBindTexture(GL_TEXTURE_3D, probeTextures_[i]);
+		glUniform1i(glGetUniformLocation(voxelTraceShader_, probeSamplers[i]), probeUnits[i]);
+	}
+	glUniform1i(glGetUniformLocation(voxelTraceShader_, "UseProbes"), probeGridSize_ > 0);
+	if(probeGridSize_ > 0)
+		glUniform1f(glGetUniformLocation(voxelTraceShader_, "ProbeSpacing"), voxelGridWorldSize_ / probeGridSize_);
+
+	// After the prepass only the nearest surface passes, so voxel-trace.frag runs once per pixel
+	if(depthPrepass_) {
+		glDepthFunc(GL_EQUAL);
+		glDepthMask(GL_FALSE);
+	}
+
 	for(std::vector<Object*>::iterator obj = objects_.begin(); obj != objects_.end(); ++obj) {
-		(*obj)->draw(viewMatrix, projectionMatrix, depthViewProjectionMatrix_, voxelTraceShader_);
+		(*obj)->draw(viewMatrix, projectionMatrix, depthViewProjectionMatrix_, voxelTraceShader_, clusterCullShader_ != 0);
+	}
+
+	if(depthPrepass_) {
+		glDepthFunc(GL_LESS);
+		glDepthMask(GL_TRUE);
 	}
 
-	// Draw voxels for debugging (can't draw large voxel sets like 512^3)
-	//drawVoxels();
+	endFrame();
 
 	//drawTextureQuad(depthTexture_.textureID);
 }
 
-void Application::drawDepthTexture() {
+void Application::endFrame() {
+	if(brickPager_)
+		brickPager_->endFrame();
+}
+
+// World space size of a texel of an orthographic projection onto a square target, the
+// larger of its two axes. Clip space spans 2 units over the resolution.
+static float getTexelWorldSize(const glm::mat4& viewProjection, int resolution) {
+	float scaleX = glm::length(glm::vec3(viewProjection[0][0], viewProjection[1][0], viewProjection[2][0]));
+	float scaleY = glm::length(glm::vec3(viewProjection[0][1], viewProjection[1][1], viewProjection[2][1]));
+	return 2.0f / (glm::min(scaleX, scaleY) * resolution);
+}
+
+void Application::drawDepthTexture(size_t firstObject) {
+	PROFILE_GPU_ZONE("drawDepthTexture");
 	glEnable(GL_CULL_FACE);
     glEnable(GL_DEPTH_TEST);
 
+	// Casters have changed, so the cascades need to be redrawn too
+	cascadesDirty_ = true;
+
 	// Draw to depth frame buffer instead of screen
 	glBindFramebuffer(GL_FRAMEBUFFER, depthFramebuffer_);
 	// Set viewport of framebuffer size
 	glViewport(0,0, depthTexture_.width, depthTexture_.height);
-    // Set clear color and clear
-    glClearColor(0, 0, 0, 1);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    // Set clear color and clear, unless objects are being added to the existing shadow map
+	if(firstObject == 0) {
+		glClearColor(0, 0, 0, 1);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	}
 
-	for(std::vector<Object*>::iterator obj = objects_.begin(); obj != objects_.end(); ++obj) {
-		(*obj)->drawToDepth(depthViewProjectionMatrix_, shadowShader_);
+	// Objects in the static depth batches are drawn with them
+	std::vector<Object*> objects;
+	for(std::vector<Object*>::iterator obj = objects_.begin() + firstObject; obj != objects_.end(); ++obj) {
+		if(!staticBatcher_ || !staticBatcher_->isInDepthBatch(*obj))
+			objects.push_back(*obj);
+	}
+	// Detail finer than a texel doesn't change the shadow map
+	float texelSize = meshLODs_ ? getTexelWorldSize(depthViewProjectionMatrix_, depthTexture_.width) : 0.0f;
+	if(clusterCullShader_)
+		cullClusters(SHADOW_PASS, depthViewProjectionMatrix_, objects, false, texelSize);
+
+	if(staticBatcher_) {
+		glUseProgram(shadowShader_);
+		for(size_t batch = 0; batch < staticBatcher_->getNumDepthBatches(); batch++) {
+			staticBatcher_->drawDepthBatch(batch, depthViewProjectionMatrix_, shadowShader_);
+		}
+	}
+	for(std::vector<Object*>::iterator obj = objects.begin(); obj != objects.end(); ++obj) {
+		(*obj)->drawToDepth(depthViewProjectionMatrix_, shadowShader_, clusterCullShader_ != 0, texelSize);
 	}
 
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	if(meshLODs_ && firstObject == 0) {
+		size_t numTriangles = 0, fullTriangles = 0;
+		for(std::vector<Object*>::iterator obj = objects.begin(); obj != objects.end(); ++obj) {
+			numTriangles += (*obj)->mesh_->getNumTriangles((*obj)->selectLOD(texelSize)) * (*obj)->getNumInstances();
+			fullTriangles += (*obj)->mesh_->getNumTriangles() * (*obj)->getNumInstances();
+		}
+		std::cout << "Shadow map: " << numTriangles << " triangles (" << fullTriangles << " at full detail), texel "
+				  << texelSize << " units" << std::endl;
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, outputFramebuffer_);
 	glViewport(0, 0, width_, height_);
 }
 
-void Application::voxelizeScene() {
+// Box to fit the scene wide shadow map to. While streaming the scene bounds aren't
+// known yet, so the voxel grid is used. Only geometry inside it gets voxelized anyway.
+void Application::getShadowBounds(glm::vec3& boundsMin, glm::vec3& boundsMax) {
+	boundsMin = glm::vec3(-0.5f * voxelGridWorldSize_);
+	boundsMax = glm::vec3(0.5f * voxelGridWorldSize_);
+	if(sceneLoader_ || objects_.empty())
+		return;
+
+	boundsMin = objects_[0]->getWorldBoundsMin();
+	boundsMax = objects_[0]->getWorldBoundsMax();
+	for(std::vector<Object*>::iterator obj = objects_.begin() + 1; obj != objects_.end(); ++obj) {
+		boundsMin = glm::min(boundsMin, (*obj)->getWorldBoundsMin());
+		boundsMax = glm::max(boundsMax, (*obj)->getWorldBoundsMax());
+	}
+}
+
+glm::mat4 Application::getLightViewMatrix() {
+	glm::vec3 up = glm::abs(lightDirection_.y) > 0.99f ? glm::vec3(0, 0, 1) : glm::vec3(0, 1, 0);
+	return glm::lookAt(glm::vec3(0.0f), -lightDirection_, up);
+}
+
+// Corner i of an axis aligned box, one bit per axis
+static glm::vec3 getBoxCorner(const glm::vec3& boundsMin, const glm::vec3& boundsMax, int i) {
+	return glm::vec3((i & 1) ? boundsMax.x : boundsMin.x, (i & 2) ? boundsMax.y : boundsMin.y, (i & 4) ? boundsMax.z : boundsMin.z);
+}
+
+// Bounds of a world space box in light view space
+static void getLightSpaceBounds(const glm::mat4& lightView, const glm::vec3& boundsMin, const glm::vec3& boundsMax, glm::vec3& lightMin, glm::vec3& lightMax) {
+	lightMin = glm::vec3(1e30f);
+	lightMax = glm::vec3(-1e30f);
+	for(int i = 0; i < 8; i++) {
+		glm::vec3 corner = glm::vec3(lightView * glm::vec4(getBoxCorner(boundsMin, boundsMax, i), 1.0f));
+		lightMin = glm::min(lightMin, corner);
+		lightMax = glm::max(lightMax, corner);
+	}
+}
+
+// True if the box is completely outside one of the clip planes of an orthographic projection
+static bool isOutsideOrtho(const glm::mat4& viewProjection, const glm::vec3& boundsMin, const glm::vec3& boundsMax) {
+	glm::vec3 clipMin(1e30f), clipMax(-1e30f);
+	for(int i = 0; i < 8; i++) {
+		glm::vec3 corner = glm::vec3(viewProjection * glm::vec4(getBoxCorner(boundsMin, boundsMax, i), 1.0f));
+		clipMin = glm::min(clipMin, corner);
+		clipMax = glm::max(clipMax, corner);
+	}
+	return clipMin.x > 1.0f || clipMin.y > 1.0f || clipMax.x < -1.0f || clipMax.y < -1.0f || clipMax.z < -1.0f;
+}
+
+// Fits the orthographic light projection tightly around the shadow bounds instead of
+// a fixed box, so the resolution and depth precision aren't wasted on empty space
+void Application::fitShadowMap() {
+	glm::vec3 boundsMin, boundsMax;
+	getShadowBounds(boundsMin, boundsMax);
+
+	glm::mat4 lightView = getLightViewMatrix();
+	glm::vec3 lightMin, lightMax;
+	getLightSpaceBounds(lightView, boundsMin, boundsMax, lightMin, lightMax);
+
+	// Small margin so geometry on the border doesn't get clipped. The light looks down -z.
+	glm::vec3 margin = 0.01f * (lightMax - lightMin) + glm::vec3(0.1f);
+	lightMin -= margin;
+	lightMax += margin;
+	glm::mat4 projectionMatrix = glm::ortho(lightMin.x, lightMax.x, lightMin.y, lightMax.y, -lightMax.z, -lightMin.z);
+	depthViewProjectionMatrix_ = projectionMatrix * lightView;
+}
+
+// Splits the camera frustum up to cascadeDistance_ and fits one light projection around
+// each slice. The depth range covers the whole scene so casters outside the slice are kept.
+void Application::fitCascades() {
+	glm::mat4 cameraMatrix = camera_->getProjectionMatrix() * camera_->getViewMatrix();
+	glm::mat4 inverseCamera = glm::inverse(cameraMatrix);
+	float nearPlane = camera_->getNear();
+	float farPlane = glm::min(camera_->getFar(), cascadeDistance_);
+
+	// Frustum corners on the near and far plane
+	glm::vec3 nearCorners[4], farCorners[4];
+	for(int i = 0; i < 4; i++) {
+		glm::vec4 ndc((i & 1) ? 1.0f : -1.0f, (i & 2) ? 1.0f : -1.0f, -1.0f, 1.0f);
+		glm::vec4 nearCorner = inverseCamera * ndc;
+		ndc.z = 1.0f;
+		glm::vec4 farCorner = inverseCamera * ndc;
+		nearCorners[i] = glm::vec3(nearCorner) / nearCorner.w;
+		farCorners[i] = glm::vec3(farCorner) / farCorner.w;
+	}
+
+	glm::vec3 boundsMin, boundsMax;
+	getShadowBounds(boundsMin, boundsMax);
+	glm::mat4 lightView = getLightViewMatrix();
+	glm::vec3 sceneMin, sceneMax;
+	getLightSpaceBounds(lightView, boundsMin, boundsMax, sceneMin, sceneMax);
+
+	float splitNear = nearPlane;
+	for(int c = 0; c < numCascades_; c++) {
+		// Mix of logarithmic and uniform splits
+		float t = (float)(c + 1) / numCascades_;
+		float logSplit = nearPlane * glm::pow(farPlane / nearPlane, t);
+		float uniformSplit = nearPlane + (farPlane - nearPlane) * t;
+		float splitFar = glm::mix(uniformSplit, logSplit, 0.75f);
+		cascadeSplits_[c] = splitFar;
+
+		// Corners of the slice. View depth changes linearly along the frustum edges.
+		glm::vec3 corners[8];
+		glm::vec3 center(0.0f);
+		float camFar = camera_->getFar();
+		for(int i = 0; i < 4; i++) {
+			corners[i] = glm::mix(nearCorners[i], farCorners[i], (splitNear - nearPlane) / (camFar - nearPlane));
+			corners[i + 4] = glm::mix(nearCorners[i], farCorners[i], (splitFar - nearPlane) / (camFar - nearPlane));
+			center += corners[i] + corners[i + 4];
+		}
+		center /= 8.0f;
+
+		// A bounding sphere keeps the projection size constant when the camera rotates
+		float radius = 0.0f;
+		for(int i = 0; i < 8; i++) {
+			radius = glm::max(radius, glm::length(corners[i] - center));
+		}
+		radius = glm::ceil(radius * 16.0f) / 16.0f;
+
+		// Snap to whole texels so the shadow edges don't shimmer when the camera moves
+		glm::vec3 lightCenter = glm::vec3(lightView * glm::vec4(center, 1.0f));
+		float texelSize = 2.0f * radius / cascadeSize_;
+		lightCenter.x = glm::floor(lightCenter.x / texelSize) * texelSize;
+		lightCenter.y = glm::floor(lightCenter.y / texelSize) * texelSize;
+
+		glm::mat4 projectionMatrix = glm::ortho(lightCenter.x - radius, lightCenter.x + radius, lightCenter.y - radius, lightCenter.y + radius,
+												-sceneMax.z - 0.1f, -sceneMin.z + 0.1f);
+		cascadeViewProjection_[c] = projectionMatrix * lightView;
+		splitNear = splitFar;
+	}
+
+	cascadeCameraMatrix_ = cameraMatrix;
+}
+
+// Redraws the cascades when the camera or the shadows have changed
+void Application::drawCascades() {
+	glm::mat4 cameraMatrix = camera_->getProjectionMatrix() * camera_->getViewMatrix();
+	if(cameraMatrix == cascadeCameraMatrix_ && !cascadesDirty_)
+		return;
+	cascadesDirty_ = false;
+
+	PROFILE_GPU_ZONE("drawCascades");
+	fitCascades();
+
+	glEnable(GL_CULL_FACE);
+	glEnable(GL_DEPTH_TEST);
+	glBindFramebuffer(GL_FRAMEBUFFER, cascadeFramebuffer_);
+	glViewport(0, 0, cascadeSize_, cascadeSize_);
+
+	for(int c = 0; c < numCascades_; c++) {
+		glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, cascadeTexture_, 0, c);
+		glClear(GL_DEPTH_BUFFER_BIT);
+		float texelSize = meshLODs_ ? getTexelWorldSize(cascadeViewProjection_[c], cascadeSize_) : 0.0f;
+
+		if(staticBatcher_) {
+			glUseProgram(shadowShader_);
+			for(size_t batch = 0; batch < staticBatcher_->getNumDepthBatches(); batch++) {
+				if(isOutsideOrtho(cascadeViewProjection_[c], staticBatcher_->getDepthBatchBoundsMin(batch), staticBatcher_->getDepthBatchBoundsMax(batch)))
+					continue;
+				staticBatcher_->drawDepthBatch(batch, cascadeViewProjection_[c], shadowShader_);
+			}
+		}
+		for(std::vector<Object*>::iterator obj = objects_.begin(); obj != objects_.end(); ++obj) {
+			if(staticBatcher_ && staticBatcher_->isInDepthBatch(*obj))
+				continue;
+			if(isOutsideOrtho(cascadeViewProjection_[c], (*obj)->getWorldBoundsMin(), (*obj)->getWorldBoundsMax()))
+				continue;
+			(*obj)->drawToDepth(cascadeViewProjection_[c], shadowShader_, false, texelSize);
+		}
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, outputFramebuffer_);
+	glViewport(0, 0, width_, height_);
+}
+
+// Full voxelizations are timed and reported in triangles/ms, so the two paths can be
+// compared on a scene. Waiting for the query stalls, but only happens after loading.
+void Application::voxelizeScene(size_t firstObject) {
+	// Nothing to voxelize into when the voxels are paged in from a brick file
+	if(!voxelTexture_.textureID)
+		return;
+
+	PROFILE_GPU_ZONE("voxelizeScene");
+
+	GLuint timerQuery = 0;
+	if(firstObject == 0) {
+		glGenQueries(1, &timerQuery);
+		glBeginQuery(GL_TIME_ELAPSED, timerQuery);
+	}
+
+	std::vector<Object*> objects(objects_.begin() + firstObject, objects_.end());
+	if(voxelizationComputeShader_)
+		voxelizeSceneCompute(voxelTexture_.textureID, objects);
+	else
+		voxelizeSceneRaster(voxelTexture_.textureID, objects);
+
+    glActiveTexture(GL_TEXTURE6);
+	glBindTexture(GL_TEXTURE_3D, voxelTexture_.textureID);
+    glGenerateMipmap(GL_TEXTURE_3D);
+
+	// Every probe may see the new voxels
+	probeSlicesLeft_ = probeGridSize_;
+	voxelViewDirty_ = true;
+
+	if(timerQuery) {
+		glEndQuery(GL_TIME_ELAPSED);
+		GLuint64 nanoseconds = 0;
+		glGetQueryObjectui64v(timerQuery, GL_QUERY_RESULT, &nanoseconds);
+		glDeleteQueries(1, &timerQuery);
+
+		size_t numTriangles = 0, fullTriangles = 0;
+		for(std::vector<Object*>::iterator obj = objects_.begin(); obj != objects_.end(); ++obj) {
+			numTriangles += (*obj)->mesh_->getNumTriangles((*obj)->selectLOD(getVoxelLODError())) * (*obj)->getNumInstances();
+			fullTriangles += (*obj)->mesh_->getNumTriangles() * (*obj)->getNumInstances();
+		}
+		double milliseconds = nanoseconds / 1e6;
+		std::cout << "Voxelization (" << (voxelizationComputeShader_ ? "compute" : "geometry shader") << "): "
+				  << numTriangles << " triangles";
+		if(meshLODs_)
+			std::cout << " (" << fullTriangles << " at full detail)";
+		std::cout << " in " << milliseconds << " ms, "
+				  << (milliseconds > 0.0 ? numTriangles / milliseconds : 0.0) << " triangles/ms" << std::endl;
+	}
+}
+
+// Position of a point in the voxel grid along a Z-order curve, 10 bits per axis
+static unsigned int getMortonCode(glm::vec3 position, float gridWorldSize) {
+	glm::vec3 uvw = glm::clamp(position / gridWorldSize + 0.5f, 0.0f, 1.0f);
+	unsigned int code = 0;
+	for(int bit = 9; bit >= 0; bit--) {
+		for(int axis = 0; axis < 3; axis++) {
+			unsigned int coordinate = std::min((unsigned int)(uvw[axis] * 1024.0f), 1023u);
+			code = (code << 1) | ((coordinate >> bit) & 1u);
+		}
+	}
+	return code;
+}
+
+// One slice of the time-sliced revoxelization, see revoxelizationBudgetMs_
+void Application::updateRevoxelization() {
+	if(objects_.empty())
+		return;
+
+	PROFILE_GPU_ZONE("revoxelize");
+
+	// Size the slices after the GPU time of earlier ones. The results are a few frames old
+	// by now, so reading them doesn't stall.
+	for(int i = 0; i < NUM_REVOXELIZATION_QUERIES; i++) {
+		if(revoxelizationQueryTriangles_[i] == 0)
+			continue;
+		GLuint available = GL_FALSE;
+		glGetQueryObjectuiv(revoxelizationQueries_[i], GL_QUERY_RESULT_AVAILABLE, &available);
+		if(!available)
+			continue;
+		GLuint64 nanoseconds = 0;
+		glGetQueryObjectui64v(revoxelizationQueries_[i], GL_QUERY_RESULT, &nanoseconds);
+		double milliseconds = std::max(nanoseconds / 1e6, 0.01);
+		double scale = std::min(std::max(revoxelizationBudgetMs_ / milliseconds, 0.5), 2.0);
+		revoxelizationTriangles_ = std::max(revoxelizationQueryTriangles_[i] * scale, 1000.0);
+		revoxelizationQueryTriangles_[i] = 0;
+	}
+
+	// Frames whose query slot is still in flight aren't measured
+	int slot = revoxelizationFrame_++ % NUM_REVOXELIZATION_QUERIES;
+	bool timed = revoxelizationQueryTriangles_[slot] == 0;
+	if(timed)
+		glBeginQuery(GL_TIME_ELAPSED, revoxelizationQueries_[slot]);
+
+	int dimensions = voxelTexture_.size;
+	if(revoxelizationNext_ == 0) {
+		// Objects are taken in Z-order so every slice covers a compact region of the grid
+		std::vector<std::pair<unsigned int, Object*> > keys;
+		for(std::vector<Object*>::iterator obj = objects_.begin(); obj != objects_.end(); ++obj) {
+			glm::vec3 center = 0.5f * ((*obj)->getWorldBoundsMin() + (*obj)->getWorldBoundsMax());
+			keys.push_back(std::make_pair(getMortonCode(center, voxelGridWorldSize_), *obj));
+		}
+		std::sort(keys.begin(), keys.end());
+		revoxelizationOrder_.clear();
+		for(size_t i = 0; i < keys.size(); i++) {
+			revoxelizationOrder_.push_back(keys[i].second);
+		}
+
+		// Every level is cleared, regions nothing is voxelized into again would keep stale mips
+		glUseProgram(voxelClearShader_);
+		glUniform1i(glGetUniformLocation(voxelClearShader_, "VoxelTexture"), 2);
+		for(int level = 0; (dimensions >> level) > 0; level++) {
+			GLuint numGroups = ((dimensions >> level) + 3) / 4;
+			glBindImageTexture(2, backVoxelTexture_, level, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA8);
+			glDispatchCompute(numGroups, numGroups, numGroups);
+		}
+		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+	}
+
+	std::vector<Object*> slice;
+	size_t numTriangles = 0;
+	glm::vec3 boundsMin(voxelGridWorldSize_), boundsMax(-voxelGridWorldSize_);
+	while(revoxelizationNext_ < revoxelizationOrder_.size() && (slice.empty() || numTriangles < revoxelizationTriangles_)) {
+		Object* obj = revoxelizationOrder_[revoxelizationNext_++];
+		slice.push_back(obj);
+		numTriangles += obj->mesh_->getNumTriangles(obj->selectLOD(getVoxelLODError()));
+		boundsMin = glm::min(boundsMin, obj->getWorldBoundsMin());
+		boundsMax = glm::max(boundsMax, obj->getWorldBoundsMax());
+	}
+
+	if(voxelizationComputeShader_)
+		voxelizeSceneCompute(backVoxelTexture_, slice);
+	else
+		voxelizeSceneRaster(backVoxelTexture_, slice);
+
+	// Voxels of the slice with a voxel of margin, see voxel-trace.frag for the mapping
+	glm::ivec3 regionMin = glm::clamp(glm::ivec3(glm::floor((boundsMin / voxelGridWorldSize_ + 0.5f) * (float)dimensions)) - 1, 0, dimensions - 1);
+	glm::ivec3 regionMax = glm::clamp(glm::ivec3(glm::floor((boundsMax / voxelGridWorldSize_ + 0.5f) * (float)dimensions)) + 2, 1, dimensions);
+	glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+	downsampleVoxels(backVoxelTexture_, regionMin, regionMax);
+
+	if(timed) {
+		glEndQuery(GL_TIME_ELAPSED);
+		revoxelizationQueryTriangles_[slot] = std::max(numTriangles, (size_t)1);
+	}
+
+	// The back volume is complete, cone tracing switches to it
+	if(revoxelizationNext_ == revoxelizationOrder_.size()) {
+		std::swap(voxelTexture_.textureID, backVoxelTexture_);
+		revoxelizationNext_ = 0;
+		probeSlicesLeft_ = probeGridSize_;
+		voxelViewDirty_ = true;
+	}
+}
+
+void Application::downsampleVoxels(GLuint texture, glm::ivec3 regionMin, glm::ivec3 regionMax) {
+	PROFILE_GPU_ZONE("downsampleVoxels");
+
+	glUseProgram(voxelMipmapShader_);
+	glUniform1i(glGetUniformLocation(voxelMipmapShader_, "Source"), 2);
+	glUniform1i(glGetUniformLocation(voxelMipmapShader_, "Destination"), 3);
+
+	for(int level = 1; (voxelTexture_.size >> level) > 0; level++) {
+		// Texels of this level covering the region of the level below
+		regionMin = regionMin / 2;
+		regionMax = (regionMax + 1) / 2;
+		glm::ivec3 numGroups = (regionMax - regionMin + 3) / 4;
+
+		glBindImageTexture(2, texture, level - 1, GL_TRUE, 0, GL_READ_ONLY, GL_RGBA8);
+		glBindImageTexture(3, texture, level, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA8);
+		glUniform3i(glGetUniformLocation(voxelMipmapShader_, "RegionMin"), regionMin.x, regionMin.y, regionMin.z);
+		glUniform3i(glGetUniformLocation(voxelMipmapShader_, "RegionMax"), regionMax.x, regionMax.y, regionMax.z);
+		glDispatchCompute(numGroups.x, numGroups.y, numGroups.z);
+		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+	}
+
+	// The cone tracing samples the result
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+}
+
+// Detail finer than a voxel doesn't change which voxels are filled
+float Application::getVoxelLODError() {
+	return meshLODs_ && voxelTexture_.size > 0 ? voxelGridWorldSize_ / voxelTexture_.size : 0.0f;
+}
+
+void Application::voxelizeSceneRaster(GLuint texture, const std::vector<Object*>& objects) {
 	/* Disable any sort of discarding since we arent actually rendering a scene and are instead trying to voxelize everything in the scene*/
 	glDisable(GL_CULL_FACE);
     glDisable(GL_DEPTH_TEST);
@@ -368,8 +1512,14 @@ void Application::voxelizeScene() {
     glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
+	// The projections along each axis all cover the grid, so any of them can be used to cull
+	if(clusterCullShader_)
+		cullClusters(VOXEL_PASS, projZ_, objects, false, getVoxelLODError());
+
 	/* Load in our voxelization shaders*/
     glUseProgram(voxelizationShader_);
+	if(materialTable_)
+		materialTable_->bind(voxelizationShader_);
 
     // Set uniforms
 	/* Pass the voxel dimension size */
@@ -386,24 +1536,220 @@ void Application::voxelizeScene() {
 	glUniform1i(glGetUniformLocation(voxelizationShader_, "ShadowMap"), 5);
 
 	// Bind single level of texture to image unit so we can write to it from shaders
-    glBindImageTexture(6, voxelTexture_.textureID, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA8);
+    glBindImageTexture(6, texture, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA8);
     glUniform1i(glGetUniformLocation(voxelizationShader_, "VoxelTexture"), 6);
 
-    for(std::vector<Object*>::iterator obj = objects_.begin(); obj != objects_.end(); ++obj) {
-        (*obj)->drawTo3DTexture(voxelizationShader_, depthViewProjectionMatrix_);
-    }
+	// The lights are shadowed by the mips of the last full voxelization
+	if(lightGrid_)
+		lightGrid_->bindBricks(voxelizationShader_, voxelTexture_.textureID, 6, voxelGridWorldSize_);
 
-    glActiveTexture(GL_TEXTURE6);
-	glBindTexture(GL_TEXTURE_3D, voxelTexture_.textureID);
-    glGenerateMipmap(GL_TEXTURE_3D);
+    for(std::vector<Object*>::const_iterator obj = objects.begin(); obj != objects.end(); ++obj) {
+        (*obj)->drawTo3DTexture(voxelizationShader_, depthViewProjectionMatrix_, clusterCullShader_ != 0, getVoxelLODError());
+    }
 
     // Reset viewport
 	glViewport(0, 0, width_, height_);
 }
 
+void Application::voxelizeSceneCompute(GLuint texture, const std::vector<Object*>& objects) {
+	glUseProgram(voxelizationComputeShader_);
+	if(materialTable_)
+		materialTable_->bind(voxelizationComputeShader_);
+
+	glUniform1i(glGetUniformLocation(voxelizationComputeShader_, "VoxelDimensions"), voxelTexture_.size);
+	glUniform1f(glGetUniformLocation(voxelizationComputeShader_, "VoxelGridWorldSize"), voxelGridWorldSize_);
+	glUniform1ui(glGetUniformLocation(voxelizationComputeShader_, "MaxTileJobs"), maxTileJobs_);
+
+	glActiveTexture(GL_TEXTURE0 + 5);
+	glBindTexture(GL_TEXTURE_2D, depthTexture_.textureID);
+	glUniform1i(glGetUniformLocation(voxelizationComputeShader_, "ShadowMap"), 5);
+
+	glBindImageTexture(6, texture, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA8);
+	glUniform1i(glGetUniformLocation(voxelizationComputeShader_, "VoxelTexture"), 6);
+
+	if(lightGrid_)
+		lightGrid_->bindBricks(voxelizationComputeShader_, voxelTexture_.textureID, 6, voxelGridWorldSize_);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, tileJobBuffer_);
+	glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, tileJobBuffer_);
+
+	for(std::vector<Object*>::const_iterator obj = objects.begin(); obj != objects.end(); ++obj) {
+		(*obj)->voxelizeCompute(voxelizationComputeShader_, depthViewProjectionMatrix_, getVoxelLODError());
+	}
+
+	glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, 0);
+	// The image writes have to be visible to the mipmap generation and the cone tracing
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+}
+
+// World space planes of a view projection matrix, pointing inwards
+static void getFrustumPlanes(const glm::mat4& viewProjection, glm::vec4 planes[6]) {
+	glm::vec4 rows[4];
+	for(int i = 0; i < 4; i++) {
+		rows[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+	}
+	for(int i = 0; i < 3; i++) {
+		planes[i * 2] = rows[3] + rows[i];
+		planes[i * 2 + 1] = rows[3] - rows[i];
+	}
+	for(int i = 0; i < 6; i++) {
+		planes[i] /= glm::length(glm::vec3(planes[i]));
+	}
+}
+
+void Application::cullClusters(ClusterPass pass, const glm::mat4& viewProjection, const std::vector<Object*>& objects, bool occlusionCulling, float maxError) {
+	PROFILE_GPU_ZONE("cullClusters");
+
+	glm::vec4 planes[6];
+	getFrustumPlanes(viewProjection, planes);
+
+	glUseProgram(clusterCullShader_);
+	glUniform4fv(glGetUniformLocation(clusterCullShader_, "FrustumPlanes"), 6, &planes[0][0]);
+	glUniform1i(glGetUniformLocation(clusterCullShader_, "StatsSlot"), pass);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, clusterStatsBuffer_);
+
+	// Backfaces are culled by the main and shadow passes but not by the voxelization
+	if(pass == MAIN_PASS) {
+		glm::vec3 cameraPosition = camera_->getPosition();
+		glUniform1i(glGetUniformLocation(clusterCullShader_, "BackfaceCulling"), 1);
+		glUniform3f(glGetUniformLocation(clusterCullShader_, "CameraPosition"), cameraPosition.x, cameraPosition.y, cameraPosition.z);
+	}
+	else if(pass == SHADOW_PASS) {
+		glUniform1i(glGetUniformLocation(clusterCullShader_, "BackfaceCulling"), 2);
+		glUniform3f(glGetUniformLocation(clusterCullShader_, "ViewDirection"), -lightDirection_.x, -lightDirection_.y, -lightDirection_.z);
+	}
+	else {
+		glUniform1i(glGetUniformLocation(clusterCullShader_, "BackfaceCulling"), 0);
+	}
+
+	// Set even when unused, the sampler needs a unit
+	glUniform1i(glGetUniformLocation(clusterCullShader_, "HiZ"), 0);
+	glUniform1i(glGetUniformLocation(clusterCullShader_, "OcclusionCulling"), occlusionCulling);
+	if(occlusionCulling) {
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, hiZTexture_);
+		glUniformMatrix4fv(glGetUniformLocation(clusterCullShader_, "HiZViewProjection"), 1, GL_FALSE, &hiZViewProjection_[0][0]);
+		glUniform2i(glGetUniformLocation(clusterCullShader_, "HiZSize"), width_, height_);
+		glUniform1i(glGetUniformLocation(clusterCullShader_, "HiZLevels"), hiZLevels_);
+	}
+
+	// Instanced objects are drawn whole, the draw lists have no room for instances
+	for(std::vector<Object*>::const_iterator obj = objects.begin(); obj != objects.end(); ++obj) {
+		if((*obj)->isInstanced())
+			continue;
+		(*obj)->cullClusters(clusterCullShader_, maxError);
+		clustersTested_[pass] += (*obj)->mesh_->getNumClusters((*obj)->selectLOD(maxError));
+	}
+
+	// The draw lists are read as indirect commands and parameters
+	glMemoryBarrier(GL_COMMAND_BARRIER_BIT);
+}
+
+void Application::printClusterStats(std::ostream& out) {
+	if(!clusterCullShader_)
+		return;
+
+	GLuint drawn[NUM_CLUSTER_PASSES];
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, clusterStatsBuffer_);
+	glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+	glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(drawn), drawn);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	const char* names[NUM_CLUSTER_PASSES] = {"main", "shadow map", "voxelization", "depth prepass"};
+	out << "Cluster culling, drawn / tested:" << std::endl;
+	for(int i = 0; i < NUM_CLUSTER_PASSES; i++) {
+		out << "\t" << names[i] << ": " << drawn[i] << " / " << clustersTested_[i];
+		if(clustersTested_[i] > 0)
+			out << " (" << 100.0 * drawn[i] / clustersTested_[i] << "%)";
+		out << std::endl;
+	}
+}
+
+// Lays down the depth of the opaque and alpha tested surfaces. With cluster culling the
+// clusters are first tested against the pyramid of the previous frame and the pyramid
+// is rebuilt from the result. Clusters that were hidden last frame but are visible now
+// would be missing, so everything is culled again against the new pyramid and drawn
+// into the depth once more. That second list is also what the shading pass draws.
+void Application::drawDepthPrepass(glm::mat4& viewMatrix, glm::mat4& projectionMatrix) {
+	PROFILE_GPU_ZONE("depthPrepass");
+
+	glm::mat4 viewProjection = projectionMatrix * viewMatrix;
+	bool occlusionCulling = hiZTexture_ && hiZValid_;
+	if(clusterCullShader_)
+		cullClusters(occlusionCulling ? DEPTH_PREPASS : MAIN_PASS, viewProjection, objects_, occlusionCulling);
+
+	int numPasses = occlusionCulling ? 2 : 1;
+	for(int pass = 0; pass < numPasses; pass++) {
+		if(pass == 1)
+			cullClusters(MAIN_PASS, viewProjection, objects_, true);
+
+		glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+		glUseProgram(depthPrepassShader_);
+		if(materialTable_)
+			materialTable_->bind(depthPrepassShader_);
+		for(std::vector<Object*>::iterator obj = objects_.begin(); obj != objects_.end(); ++obj) {
+			(*obj)->draw(viewMatrix, projectionMatrix, depthViewProjectionMatrix_, depthPrepassShader_, clusterCullShader_ != 0);
+		}
+		glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+
+		if(pass == 0 && hiZTexture_)
+			buildHiZ(viewProjection);
+	}
+}
+
+// Resolves the depth of the prepass out of the output framebuffer and reduces it
+// to a pyramid, one fullscreen quad per level. The output framebuffer is multisampled,
+// which can't be copied to a texture, so it is blitted into a single sample one first
+void Application::buildHiZ(const glm::mat4& viewProjection) {
+	PROFILE_GPU_ZONE("buildHiZ");
+
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, outputFramebuffer_);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, hiZDepthFramebuffer_);
+	glBlitFramebuffer(0, 0, width_, height_, 0, 0, width_, height_, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, hiZFramebuffer_);
+	glActiveTexture(GL_TEXTURE0);
+	glDisable(GL_DEPTH_TEST);
+	glUseProgram(hiZShader_);
+	glUniform1i(glGetUniformLocation(hiZShader_, "Source"), 0);
+
+	glBindVertexArray(quadVertexArray_);
+	glEnableVertexAttribArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, quadVBO_);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+
+	for(int level = 0; level < hiZLevels_; level++) {
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, hiZTexture_, level);
+		glViewport(0, 0, glm::max(width_ >> level, 1), glm::max(height_ >> level, 1));
+		if(level == 0) {
+			glBindTexture(GL_TEXTURE_2D, hiZDepthTexture_);
+		}
+		else {
+			// Only the level below is readable, so it isn't the one being rendered to
+			glBindTexture(GL_TEXTURE_2D, hiZTexture_);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level - 1);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, level - 1);
+		}
+		glUniform1i(glGetUniformLocation(hiZShader_, "FirstLevel"), level == 0);
+		glDrawArrays(GL_TRIANGLES, 0, 6);
+	}
+
+	glBindTexture(GL_TEXTURE_2D, hiZTexture_);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, hiZLevels_ - 1);
+
+	glDisableVertexAttribArray(0);
+	glEnable(GL_DEPTH_TEST);
+	glBindFramebuffer(GL_FRAMEBUFFER, outputFramebuffer_);
+	glViewport(0, 0, width_, height_);
+
+	hiZViewProjection_ = viewProjection;
+	hiZValid_ = true;
+}
+
 // For debugging
 void Application::drawTextureQuad(GLuint textureID) {
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glBindFramebuffer(GL_FRAMEBUFFER, outputFramebuffer_);
 	glViewport(0,0,300,300);
 	
 	glUseProgram(quadShader_);
@@ -421,29 +1767,286 @@ void Application::drawTextureQuad(GLuint textureID) {
 	glDisableVertexAttribArray(0);
 }
 
+// Cone traces the next few slices of the probe grid, one fullscreen quad per slice
+void Application::updateProbes() {
+	if(probeSlicesLeft_ <= 0)
+		return;
+
+	PROFILE_GPU_ZONE("updateProbes");
+
+	glBindFramebuffer(GL_FRAMEBUFFER, probeFramebuffer_);
+	glViewport(0, 0, probeGridSize_, probeGridSize_);
+	glDisable(GL_DEPTH_TEST);
+	glDisable(GL_CULL_FACE);
+
+	glUseProgram(probeShader_);
+	glActiveTexture(GL_TEXTURE0 + 6);
+	glBindTexture(GL_TEXTURE_3D, voxelTexture_.textureID);
+	glUniform1i(glGetUniformLocation(probeShader_, "VoxelTexture"), 6);
+	glUniform1f(glGetUniformLocation(probeShader_, "VoxelGridWorldSize"), voxelGridWorldSize_);
+	glUniform1i(glGetUniformLocation(probeShader_, "VoxelDimensions"), voxelDimensions_);
+	glUniform1i(glGetUniformLocation(probeShader_, "ProbeGridSize"), probeGridSize_);
+
+	glBindVertexArray(quadVertexArray_);
+	glEnableVertexAttribArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, quadVBO_);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+
+	int numSlices = glm::min(probeSlicesPerFrame_, probeSlicesLeft_);
+	for(int i = 0; i < numSlices; i++) {
+		for(int t = 0; t < NUM_PROBE_TEXTURES; t++) {
+			glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + t, probeTextures_[t], 0, nextProbeSlice_);
+		}
+		glUniform1i(glGetUniformLocation(probeShader_, "Slice"), nextProbeSlice_);
+		glDrawArrays(GL_TRIANGLES, 0, 6);
+		nextProbeSlice_ = (nextProbeSlice_ + 1) % probeGridSize_;
+	}
+	probeSlicesLeft_ -= numSlices;
+
+	glDisableVertexAttribArray(0);
+	glBindFramebuffer(GL_FRAMEBUFFER, outputFramebuffer_);
+}
+
 // For debugging
-void Application::drawVoxels() {
+// Occupied voxels of the chosen level as instanced cubes, see compactVoxels()
+void Application::drawVoxels(glm::mat4& viewMatrix, glm::mat4& projectionMatrix) {
+	PROFILE_GPU_ZONE("drawVoxels");
+
+	if(voxelViewDirty_)
+		compactVoxels();
+	if(numVoxelInstances_ == 0)
+		return;
+
+	glm::mat4 viewProjection = projectionMatrix * viewMatrix;
+	int dimensions = glm::max(voxelTexture_.size >> voxelViewLevel_, 1);
+	GLuint instances = voxelInstanceBuffer_;
+
+	if(voxelViewCulling_) {
+		static const GLuint resetCommand[4] = {36, 0, 0, 0};
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, voxelCommandBuffer_);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(resetCommand), resetCommand);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+		glm::vec4 planes[6];
+		getFrustumPlanes(viewProjection, planes);
+
+		glUseProgram(voxelCullShader_);
+		glUniform1ui(glGetUniformLocation(voxelCullShader_, "NumVoxels"), numVoxelInstances_);
+		glUniform4fv(glGetUniformLocation(voxelCullShader_, "FrustumPlanes"), 6, &planes[0][0]);
+		glUniform1f(glGetUniformLocation(voxelCullShader_, "VoxelGridWorldSize"), voxelGridWorldSize_);
+		glUniform1i(glGetUniformLocation(voxelCullShader_, "Dimensions"), dimensions);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, voxelCommandBuffer_);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, voxelInstanceBuffer_);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, visibleVoxelBuffer_);
+		glDispatchCompute((numVoxelInstances_ + 63) / 64, 1, 1);
+		glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+		instances = visibleVoxelBuffer_;
+	}
+
 	glUseProgram(renderVoxelsShader_);
+	glUniformMatrix4fv(glGetUniformLocation(renderVoxelsShader_, "ViewProjectionMatrix"), 1, GL_FALSE, &viewProjection[0][0]);
+	glUniform1f(glGetUniformLocation(renderVoxelsShader_, "VoxelGridWorldSize"), voxelGridWorldSize_);
+	glUniform1i(glGetUniformLocation(renderVoxelsShader_, "Dimensions"), dimensions);
 
-	int numVoxels = voxelTexture_.size * voxelTexture_.size * voxelTexture_.size;
-	float voxelSize = voxelGridWorldSize_ / voxelTexture_.size;
-	glUniform1i(glGetUniformLocation(renderVoxelsShader_, "Dimensions"), voxelTexture_.size);
-	glUniform1i(glGetUniformLocation(renderVoxelsShader_, "TotalNumVoxels"), numVoxels);
-	glUniform1f(glGetUniformLocation(renderVoxelsShader_, "VoxelSize"), voxelSize);
-	glm::mat4 modelMatrix = glm::translate(glm::scale(glm::mat4(1.0f), glm::vec3(voxelSize)), glm::vec3(0, 0, 0));
-	glm::mat4 viewMatrix = camera_->getViewMatrix();
-	glm::mat4 modelViewMatrix = viewMatrix * modelMatrix;
-	glm::mat4 projectionMatrix = camera_->getProjectionMatrix();
-	glUniformMatrix4fv(glGetUniformLocation(renderVoxelsShader_, "ModelViewMatrix"), 1, GL_FALSE, &modelViewMatrix[0][0]);
-	glUniformMatrix4fv(glGetUniformLocation(renderVoxelsShader_, "ProjectionMatrix"), 1, GL_FALSE, &projectionMatrix[0][0]);
+	glBindVertexArray(voxelViewVertexArray_);
+	glBindBuffer(GL_ARRAY_BUFFER, instances);
+	glEnableVertexAttribArray(0);
+	glVertexAttribIPointer(0, 2, GL_UNSIGNED_INT, 0, (void*)0);
+	glVertexAttribDivisor(0, 1);
 
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_3D, voxelTexture_.textureID);
-	glUniform1i(glGetUniformLocation(renderVoxelsShader_, "VoxelsTexture"), 0);
+	if(voxelViewCulling_) {
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, voxelCommandBuffer_);
+		glDrawArraysIndirect(GL_TRIANGLES, (void*)0);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	}
+	else {
+		glDrawArraysInstanced(GL_TRIANGLES, 0, 36, numVoxelInstances_);
+	}
 
-	glBindVertexArray(texture3DVertexArray_);
-	glDrawArrays(GL_POINTS, 0, numVoxels);
-	
 	glBindVertexArray(0);
 	glUseProgram(0);
-}
\ No newline at end of file
+}
+
+// Counts the occupied voxels of the chosen level, grows the instance buffers if needed
+// and writes the instances. Only done when the voxels or the level have changed.
+void Application::compactVoxels() {
+	PROFILE_GPU_ZONE("compactVoxels");
+
+	int dimensions = glm::max(voxelTexture_.size >> voxelViewLevel_, 1);
+	GLuint numGroups = (dimensions + 3) / 4;
+	static const GLuint zero = 0;
+
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+	glUseProgram(voxelCompactShader_);
+	glActiveTexture(GL_TEXTURE0 + 6);
+	glBindTexture(GL_TEXTURE_3D, voxelTexture_.textureID);
+	glUniform1i(glGetUniformLocation(voxelCompactShader_, "VoxelTexture"), 6);
+	glUniform1i(glGetUniformLocation(voxelCompactShader_, "Level"), voxelViewLevel_);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, voxelCounterBuffer_);
+
+	// Count
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, voxelCounterBuffer_);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(zero), &zero);
+	glUniform1i(glGetUniformLocation(voxelCompactShader_, "Pass"), 0);
+	glUniform1ui(glGetUniformLocation(voxelCompactShader_, "Capacity"), 0);
+	glDispatchCompute(numGroups, numGroups, numGroups);
+	glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+	GLuint numVoxels = 0;
+	glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(numVoxels), &numVoxels);
+
+	if(numVoxels > voxelInstanceCapacity_) {
+		if(voxelInstanceBuffer_) {
+			MemoryTracker::release(MemoryTracker::VOXELS, 2 * (size_t)voxelInstanceCapacity_ * 8);
+			glDeleteBuffers(1, &voxelInstanceBuffer_);
+			glDeleteBuffers(1, &visibleVoxelBuffer_);
+		}
+		voxelInstanceCapacity_ = numVoxels;
+		glGenBuffers(1, &voxelInstanceBuffer_);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, voxelInstanceBuffer_);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, (size_t)voxelInstanceCapacity_ * 8, NULL, GL_DYNAMIC_DRAW);
+		glGenBuffers(1, &visibleVoxelBuffer_);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, visibleVoxelBuffer_);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, (size_t)voxelInstanceCapacity_ * 8, NULL, GL_DYNAMIC_DRAW);
+		MemoryTracker::allocate(MemoryTracker::VOXELS, 2 * (size_t)voxelInstanceCapacity_ * 8);
+	}
+
+	// Write
+	if(numVoxels > 0) {
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, voxelCounterBuffer_);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(zero), &zero);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, voxelInstanceBuffer_);
+		glUniform1i(glGetUniformLocation(voxelCompactShader_, "Pass"), 1);
+		glUniform1ui(glGetUniformLocation(voxelCompactShader_, "Capacity"), voxelInstanceCapacity_);
+		glDispatchCompute(numGroups, numGroups, numGroups);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+	}
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	numVoxelInstances_ = numVoxels;
+	voxelViewDirty_ = false;
+	std::cout << "Voxel view: " << numVoxels << " occupied voxels at level " << voxelViewLevel_ << std::endl;
+}
+
+bool Application::renderCPUReference(std::string prefix) {
+	PROFILE_ZONE("renderCPUReference");
+	if(!voxelTexture_.textureID) {
+		std::cout << "The CPU reference needs the dense voxel texture, it isn't available with a brick pool" << std::endl;
+		return false;
+	}
+	if(showVoxels_)
+		std::cout << "The GPU frame shows the voxel view, the comparison is meaningless" << std::endl;
+	if(probeGridSize_ > 0)
+		std::cout << "The GPU frame uses irradiance probes, the CPU reference traces diffuse cones" << std::endl;
+
+	// The frame draw() just rendered, before it is swapped. A multisampled back buffer is resolved by the read.
+	std::vector<unsigned char> pixels((size_t)width_ * height_ * 4);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glReadBuffer(GL_BACK);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(0, 0, width_, height_, GL_RGBA, GL_UNSIGNED_BYTE, &pixels[0]);
+	std::vector<glm::vec3> gpuImage((size_t)width_ * height_);
+	for(size_t i = 0; i < gpuImage.size(); i++) {
+		gpuImage[i] = glm::vec3(pixels[i * 4], pixels[i * 4 + 1], pixels[i * 4 + 2]) / 255.0f;
+	}
+
+	// G-buffer of the same view in float targets. Background keeps a negative visibility.
+	enum { NUM_TARGETS = 5 };
+	GLuint shader = loadShaders("../shaders/voxel-trace.vert", "../shaders/gbuffer.frag");
+	GLuint framebuffer, depth, targets[NUM_TARGETS];
+	GLenum drawBuffers[NUM_TARGETS];
+	glGenFramebuffers(1, &framebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	glGenTextures(NUM_TARGETS, targets);
+	for(int i = 0; i < NUM_TARGETS; i++) {
+		glBindTexture(GL_TEXTURE_2D, targets[i]);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, width_, height_, 0, GL_RGBA, GL_FLOAT, 0);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_TEXTURE_2D, targets[i], 0);
+		drawBuffers[i] = GL_COLOR_ATTACHMENT0 + i;
+	}
+	glGenRenderbuffers(1, &depth);
+	glBindRenderbuffer(GL_RENDERBUFFER, depth);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width_, height_);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth);
+	glDrawBuffers(NUM_TARGETS, drawBuffers);
+
+	glViewport(0, 0, width_, height_);
+	glEnable(GL_CULL_FACE);
+	glEnable(GL_DEPTH_TEST);
+	const GLfloat background[4] = {0.0f, 0.0f, 0.0f, -1.0f};
+	const GLfloat zero[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+	for(int i = 0; i < NUM_TARGETS; i++) {
+		glClearBufferfv(GL_COLOR, i, i == 0 ? background : zero);
+	}
+	glClear(GL_DEPTH_BUFFER_BIT);
+
+	glm::mat4 viewMatrix = camera_->getViewMatrix();
+	glm::mat4 projectionMatrix = camera_->getProjectionMatrix();
+	glm::vec3 camPos = camera_->getPosition();
+	glUseProgram(shader);
+	glUniform3f(glGetUniformLocation(shader, "CameraPosition"), camPos.x, camPos.y, camPos.z);
+	glActiveTexture(GL_TEXTURE0 + 5);
+	glBindTexture(GL_TEXTURE_2D, depthTexture_.textureID);
+	glUniform1i(glGetUniformLocation(shader, "ShadowMap"), 5);
+	glUniform1i(glGetUniformLocation(shader, "CascadeShadowMaps"), 7);
+	glUniform1i(glGetUniformLocation(shader, "NumCascades"), numCascades_);
+	if(numCascades_ > 0) {
+		glActiveTexture(GL_TEXTURE0 + 7);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, cascadeTexture_);
+		glUniformMatrix4fv(glGetUniformLocation(shader, "CascadeViewProjection"), numCascades_, GL_FALSE, &cascadeViewProjection_[0][0][0]);
+		glUniform1fv(glGetUniformLocation(shader, "CascadeSplits"), numCascades_, cascadeSplits_);
+	}
+	for(std::vector<Object*>::iterator obj = objects_.begin(); obj != objects_.end(); ++obj) {
+		(*obj)->draw(viewMatrix, projectionMatrix, depthViewProjectionMatrix_, shader);
+	}
+
+	CPUConeTracer::GBuffer gbuffer;
+	gbuffer.width = width_;
+	gbuffer.height = height_;
+	std::vector<glm::vec4>* attributes[NUM_TARGETS] = {
+		&gbuffer.positionVisibility, &gbuffer.normal, &gbuffer.geometricNormal, &gbuffer.albedo, &gbuffer.specular
+	};
+	for(int i = 0; i < NUM_TARGETS; i++) {
+		attributes[i]->resize((size_t)width_ * height_);
+		glReadBuffer(GL_COLOR_ATTACHMENT0 + i);
+		glReadPixels(0, 0, width_, height_, GL_RGBA, GL_FLOAT, &(*attributes[i])[0]);
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glReadBuffer(GL_BACK);
+	glDeleteRenderbuffers(1, &depth);
+	glDeleteTextures(NUM_TARGETS, targets);
+	glDeleteFramebuffers(1, &framebuffer);
+	glDeleteProgram(shader);
+
+	// Every mip level of the voxels, about 600 MB at 512^3
+	int numLevels = 1 + (int)glm::log2((float)voxelDimensions_);
+	std::vector<std::vector<unsigned char> > levels(numLevels);
+	glBindTexture(GL_TEXTURE_3D, voxelTexture_.textureID);
+	for(int level = 0; level < numLevels; level++) {
+		size_t size = std::max(voxelDimensions_ >> level, 1);
+		levels[level].resize(size * size * size * 4);
+		glGetTexImage(GL_TEXTURE_3D, level, GL_RGBA, GL_UNSIGNED_BYTE, &levels[level][0]);
+	}
+	glBindTexture(GL_TEXTURE_3D, 0);
+
+	CPUConeTracer tracer;
+	tracer.setVoxels(levels, voxelDimensions_, voxelGridWorldSize_);
+	CPUConeTracer::Settings settings;
+	settings.cameraPosition = camPos;
+	settings.lightDirection = lightDirection_;
+	settings.direct = showDiffuse_;
+	settings.indirect = showIndirectSpecular_;
+	std::vector<glm::vec3> cpuImage;
+	tracer.render(gbuffer, settings, jobSystem_, cpuImage);
+	jobSystem_->clear();
+
+	tracer.printStats(std::cout, jobSystem_->getNumWorkers());
+	CPUConeTracer::printDifference(std::cout, gpuImage, cpuImage);
+	bool written = CPUConeTracer::writePPM(prefix + "-gpu.ppm", width_, height_, gpuImage) &&
+		CPUConeTracer::writePPM(prefix + "-cpu.ppm", width_, height_, cpuImage);
+	if(written)
+		std::cout << "Reference images written to " << prefix << "-gpu.ppm and " << prefix << "-cpu.ppm" << std::endl;
+	return written;
+}
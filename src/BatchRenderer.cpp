@@ -0,0 +1,252 @@
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string.h>
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+
+#include "Application.h"
+#include "HighResClock.h"
+#include "Profiler.h"
+#include "BatchRenderer.h"
+
+static double secondsSince(timer::HighResClock::time_point start) {
+	return std::chrono::duration<double>(timer::now() - start).count();
+}
+
+BatchRenderer::BatchRenderer(Application* app, JobSystem* jobSystem) {
+	app_ = app;
+	jobSystem_ = jobSystem;
+	shardIndex_ = 0;
+	shardCount_ = 1;
+	width_ = app->getWindowWidth();
+	height_ = app->getWindowHeight();
+	// Enough to keep every worker busy without piling up frames in memory
+	maxEncodesInFlight_ = 2 * jobSystem->getNumWorkers() + 2;
+
+	numFrames_ = numFailed_ = 0;
+	loadSeconds_ = drawSeconds_ = readSeconds_ = fenceWaitSeconds_ = copySeconds_ = encodeSeconds_ = encodeWaitSeconds_ = totalSeconds_ = 0.0;
+
+	for(int i = 0; i < RING_SIZE; i++) {
+		glGenBuffers(1, &ring_[i].buffer);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, ring_[i].buffer);
+		glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)width_ * height_ * 4, NULL, GL_STREAM_READ);
+		ring_[i].fence = NULL;
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	// Multisampled like the window, the resolved copy is the one read back
+	GLint samples = 0;
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glGetIntegerv(GL_SAMPLES, &samples);
+	glGenFramebuffers(NUM_FRAMEBUFFERS, framebuffers_);
+	glGenRenderbuffers(NUM_RENDERBUFFERS, renderbuffers_);
+	const GLenum formats[NUM_RENDERBUFFERS] = { GL_RGBA8, GL_DEPTH24_STENCIL8, GL_RGBA8 };
+	for(int i = 0; i < NUM_RENDERBUFFERS; i++) {
+		glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers_[i]);
+		if(i != RESOLVE_COLOR && samples > 0)
+			glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples, formats[i], width_, height_);
+		else
+			glRenderbufferStorage(GL_RENDERBUFFER, formats[i], width_, height_);
+	}
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffers_[RENDER_FRAMEBUFFER]);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, renderbuffers_[RENDER_COLOR]);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, renderbuffers_[RENDER_DEPTH]);
+	if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		std::cout << "Error creating the batch framebuffer" << std::endl;
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffers_[RESOLVE_FRAMEBUFFER]);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, renderbuffers_[RESOLVE_COLOR]);
+	if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		std::cout << "Error creating the batch resolve framebuffer" << std::endl;
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+BatchRenderer::~BatchRenderer() {
+	jobSystem_->wait(encodeJobs_);
+	for(int i = 0; i < RING_SIZE; i++) {
+		if(ring_[i].fence)
+			glDeleteSync(ring_[i].fence);
+		glDeleteBuffers(1, &ring_[i].buffer);
+	}
+	glDeleteFramebuffers(NUM_FRAMEBUFFERS, framebuffers_);
+	glDeleteRenderbuffers(NUM_RENDERBUFFERS, renderbuffers_);
+}
+
+bool BatchRenderer::loadPoses(std::string filename, int shardIndex, int shardCount) {
+	CameraPath path;
+	if(!path.load(filename))
+		return false;
+
+	shardIndex_ = shardIndex;
+	shardCount_ = shardCount;
+	const std::vector<CameraPath::Keyframe>& keyframes = path.getKeyframes();
+	for(size_t i = shardIndex; i < keyframes.size(); i += shardCount) {
+		poses_.push_back(keyframes[i]);
+		frameNumbers_.push_back((int)i);
+	}
+	std::cout << "Batch: " << poses_.size() << " of " << keyframes.size() << " poses in shard " << shardIndex << "/" << shardCount << std::endl;
+	return true;
+}
+
+bool BatchRenderer::run(std::string outputPrefix) {
+	app_->setOutputFramebuffer(framebuffers_[RENDER_FRAMEBUFFER]);
+	bool finished = drawPoses(outputPrefix);
+	app_->setOutputFramebuffer(0);
+	// The encode jobs hold this, the early returns of drawPoses() leave them running
+	jobSystem_->wait(encodeJobs_);
+	encodeJobs_.clear();
+	return finished;
+}
+
+bool BatchRenderer::drawPoses(std::string outputPrefix) {
+	timer::HighResClock::time_point start = timer::now();
+	GLFWwindow* window = app_->getWindow();
+
+	// Frames before that would show a partial scene. The first frame after loading voxelizes it.
+	while(app_->isLoading() && !glfwWindowShouldClose(window)) {
+		app_->draw();
+		glfwPollEvents();
+	}
+	loadSeconds_ = secondsSince(start);
+
+	start = timer::now();
+	Camera* camera = app_->getCamera();
+	for(size_t i = 0; i < poses_.size() && !glfwWindowShouldClose(window); i++) {
+		// The slot of three frames ago must be free again
+		Slot& slot = ring_[i % RING_SIZE];
+		if(slot.fence && !retire(slot, true))
+			return false;
+
+		timer::HighResClock::time_point stageStart = timer::now();
+		camera->setPosition(poses_[i].position);
+		camera->setYawPitch(poses_[i].yaw, poses_[i].pitch);
+		camera->update();
+		app_->draw();
+		drawSeconds_ += secondsSince(stageStart);
+
+		// Only queues the copy into the buffer, nothing waits here
+		stageStart = timer::now();
+		{
+			PROFILE_GPU_ZONE("batchReadback");
+			glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffers_[RENDER_FRAMEBUFFER]);
+			glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffers_[RESOLVE_FRAMEBUFFER]);
+			glBlitFramebuffer(0, 0, width_, height_, 0, 0, width_, height_, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+			glBindFramebuffer(GL_FRAMEBUFFER, framebuffers_[RESOLVE_FRAMEBUFFER]);
+			glReadBuffer(GL_COLOR_ATTACHMENT0);
+			glPixelStorei(GL_PACK_ALIGNMENT, 1);
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+			glReadPixels(0, 0, width_, height_, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+			glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		}
+		slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		glFlush();
+		std::ostringstream filename;
+		filename << outputPrefix << std::setfill('0') << std::setw(5) << frameNumbers_[i] << ".png";
+		slot.filename = filename.str();
+		readSeconds_ += secondsSince(stageStart);
+
+		// Earlier frames the GPU has finished in the meantime
+		for(int j = 0; j < RING_SIZE; j++) {
+			if(&ring_[j] != &slot && ring_[j].fence && !retire(ring_[j], false))
+				return false;
+		}
+		glfwPollEvents();
+	}
+
+	for(int j = 0; j < RING_SIZE; j++) {
+		if(ring_[j].fence && !retire(ring_[j], true))
+			return false;
+	}
+	jobSystem_->wait(encodeJobs_);
+	encodeJobs_.clear();
+	jobSystem_->clear();
+	totalSeconds_ = secondsSince(start);
+	return numFailed_ == 0;
+}
+
+bool BatchRenderer::retire(Slot& slot, bool wait) {
+	timer::HighResClock::time_point stageStart = timer::now();
+	GLenum result = glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+	if(result == GL_TIMEOUT_EXPIRED && !wait)
+		return true;
+	while(result == GL_TIMEOUT_EXPIRED) {
+		result = glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+	}
+	fenceWaitSeconds_ += secondsSince(stageStart);
+	glDeleteSync(slot.fence);
+	slot.fence = NULL;
+	if(result == GL_WAIT_FAILED) {
+		std::cout << "Waiting for the readback of " << slot.filename << " failed" << std::endl;
+		return false;
+	}
+
+	// Bounded so a slow disk doesn't collect every frame in memory
+	stageStart = timer::now();
+	if(encodeJobs_.size() >= maxEncodesInFlight_) {
+		jobSystem_->wait(encodeJobs_.front());
+		encodeJobs_.erase(encodeJobs_.begin());
+	}
+	encodeWaitSeconds_ += secondsSince(stageStart);
+
+	stageStart = timer::now();
+	size_t size = (size_t)width_ * height_ * 4;
+	std::shared_ptr<std::vector<unsigned char> > pixels(new std::vector<unsigned char>(size));
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+	void* data = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+	if(data) {
+		memcpy(&(*pixels)[0], data, size);
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	copySeconds_ += secondsSince(stageStart);
+	if(!data) {
+		std::cout << "Couldn't map the readback of " << slot.filename << std::endl;
+		return false;
+	}
+
+	std::string filename = slot.filename;
+	encodeJobs_.push_back(jobSystem_->add("encodeFrame", [this, pixels, filename]() { encode(pixels, filename); }));
+	return true;
+}
+
+// Runs on a worker
+void BatchRenderer::encode(std::shared_ptr<std::vector<unsigned char> > pixels, std::string filename) {
+	timer::HighResClock::time_point start = timer::now();
+
+	// GL rows start at the bottom, PNG rows at the top
+	size_t stride = (size_t)width_ * 4;
+	std::vector<unsigned char> flipped(pixels->size());
+	for(int y = 0; y < height_; y++) {
+		memcpy(&flipped[y * stride], &(*pixels)[(height_ - 1 - y) * stride], stride);
+	}
+	bool written = stbi_write_png(filename.c_str(), width_, height_, 4, &flipped[0], (int)stride) != 0;
+
+	std::lock_guard<std::mutex> lock(statsMutex_);
+	encodeSeconds_ += secondsSince(start);
+	if(written) {
+		numFrames_++;
+	}
+	else {
+		numFailed_++;
+		std::cout << "Couldn't write " << filename << std::endl;
+	}
+}
+
+void BatchRenderer::printStats(std::ostream& out) {
+	std::lock_guard<std::mutex> lock(statsMutex_);
+	double perFrame = 1000.0 / std::max(numFrames_ + numFailed_, 1);
+	out << std::fixed << std::setprecision(2)
+		<< "Batch shard " << shardIndex_ << "/" << shardCount_ << ": " << numFrames_ << " frames written in " << totalSeconds_ << " s, "
+		<< numFrames_ / std::max(totalSeconds_, 1e-9) << " frames/s (loading " << loadSeconds_ << " s before)" << std::endl
+		<< "\tper frame: draw " << drawSeconds_ * perFrame << " ms, readback " << readSeconds_ * perFrame
+		<< " ms, fence wait " << fenceWaitSeconds_ * perFrame << " ms, copy " << copySeconds_ * perFrame
+		<< " ms, encode " << encodeSeconds_ * perFrame << " ms on " << jobSystem_->getNumWorkers() << " workers, waiting for encoders "
+		<< encodeWaitSeconds_ * perFrame << " ms" << std::endl;
+	if(numFailed_ > 0)
+		out << "\t" << numFailed_ << " frames couldn't be written" << std::endl;
+	out.unsetf(std::ios_base::floatfield);
+}
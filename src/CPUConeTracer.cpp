@@ -0,0 +1,360 @@
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <math.h>
+
+#include "CPUConeTracer.h"
+#include "HighResClock.h"
+
+// Constants and cones of voxel-trace.frag
+static const float MAX_MIP_LEVEL = 100.0f;
+static const int NUM_CONES = 6;
+static const glm::vec3 coneDirections[NUM_CONES] = {
+	glm::vec3(0, 1, 0),
+	glm::vec3(0, 0.5, 0.866025),
+	glm::vec3(0.823639, 0.5, 0.267617),
+	glm::vec3(0.509037, 0.5, -0.700629),
+	glm::vec3(-0.509037, 0.5, -0.700629),
+	glm::vec3(-0.823639, 0.5, 0.267617)
+};
+static const float coneWeights[NUM_CONES] = {0.25f, 0.15f, 0.15f, 0.15f, 0.15f, 0.15f};
+
+// Tiles are a few packets wide so neighbouring lanes hit the same voxels
+static const int TILE_WIDTH = 64;
+static const int TILE_HEIGHT = 16;
+
+static int countLanes(int bits) {
+	int count = 0;
+	for(; bits; bits &= bits - 1) {
+		count++;
+	}
+	return count;
+}
+
+// Texel coordinate wrapped like GL_REPEAT. Far cones sample way outside the volume,
+// so this is done in double before converting to int.
+static int wrapTexel(double t, int size) {
+	return (int)(t - size * floor(t / size));
+}
+
+CPUConeTracer::CPUConeTracer() {
+	dimensions_ = 0;
+	gridWorldSize_ = 0.0f;
+	numCones_ = 0;
+	numSamples_ = 0;
+	width_ = height_ = 0;
+	seconds_ = 0.0;
+}
+
+void CPUConeTracer::setVoxels(std::vector<std::vector<unsigned char> >& levels, int dimensions, float gridWorldSize) {
+	levels_.swap(levels);
+	dimensions_ = dimensions;
+	gridWorldSize_ = gridWorldSize;
+}
+
+void CPUConeTracer::render(const GBuffer& gbuffer, const Settings& settings, JobSystem* jobSystem, std::vector<glm::vec3>& image) {
+	image.assign(gbuffer.width * gbuffer.height, glm::vec3(0.0f));
+	numCones_ = 0;
+	numSamples_ = 0;
+	width_ = gbuffer.width;
+	height_ = gbuffer.height;
+	if(levels_.empty()) {
+		std::cout << "CPU cone tracer: no voxels" << std::endl;
+		return;
+	}
+
+	timer::HighResClock::time_point start = timer::now();
+	std::vector<JobSystem::Job*> tiles;
+	for(int tileY = 0; tileY < gbuffer.height; tileY += TILE_HEIGHT) {
+		for(int tileX = 0; tileX < gbuffer.width; tileX += TILE_WIDTH) {
+			std::function<void()> tile = [this, &gbuffer, &settings, &image, tileX, tileY]() {
+				size_t cones = 0, samples = 0;
+				int endX = std::min(tileX + TILE_WIDTH, gbuffer.width);
+				int endY = std::min(tileY + TILE_HEIGHT, gbuffer.height);
+				for(int y = tileY; y < endY; y++) {
+					for(int x = tileX; x < endX; x += SimdFloat::WIDTH) {
+						tracePacket(gbuffer, settings, y * gbuffer.width + x, std::min((int)SimdFloat::WIDTH, endX - x), image, cones, samples);
+					}
+				}
+				numCones_ += cones;
+				numSamples_ += samples;
+			};
+			if(jobSystem)
+				tiles.push_back(jobSystem->add("coneTraceTile", tile));
+			else
+				tile();
+		}
+	}
+	if(jobSystem)
+		jobSystem->wait(tiles);
+	seconds_ = std::chrono::duration<double>(timer::now() - start).count();
+}
+
+void CPUConeTracer::tracePacket(const GBuffer& gbuffer, const Settings& settings, int pixel, int count, std::vector<glm::vec3>& image,
+	size_t& cones, size_t& samples) {
+	const int W = SimdFloat::WIDTH;
+
+	// Transpose the G-buffer texels into one array per component. Lanes past the end
+	// of the row repeat its last pixel and are masked off.
+	enum { POSITION, NORMAL, GEOMETRIC_NORMAL, ALBEDO, SPECULAR, NUM_ATTRIBUTES };
+	float lanes[NUM_ATTRIBUTES * 4][W];
+	float valid[W];
+	for(int i = 0; i < W; i++) {
+		int p = pixel + std::min(i, count - 1);
+		const glm::vec4* attributes[NUM_ATTRIBUTES] = {
+			&gbuffer.positionVisibility[p], &gbuffer.normal[p], &gbuffer.geometricNormal[p], &gbuffer.albedo[p], &gbuffer.specular[p]
+		};
+		for(int a = 0; a < NUM_ATTRIBUTES; a++) {
+			for(int c = 0; c < 4; c++) {
+				lanes[a * 4 + c][i] = (*attributes[a])[c];
+			}
+		}
+		valid[i] = i < count && gbuffer.positionVisibility[p].w >= 0.0f ? 1.0f : 0.0f;
+	}
+	SimdMask active = SimdFloat::load(valid) > SimdFloat(0.0f);
+	if(!active.any())
+		return;
+
+	SimdVec3 attributes[NUM_ATTRIBUTES];
+	for(int a = 0; a < NUM_ATTRIBUTES; a++) {
+		attributes[a] = SimdVec3(SimdFloat::load(lanes[a * 4]), SimdFloat::load(lanes[a * 4 + 1]), SimdFloat::load(lanes[a * 4 + 2]));
+	}
+	SimdVec3 P = attributes[POSITION];
+	SimdVec3 N = attributes[NORMAL];
+	SimdVec3 albedo = attributes[ALBEDO];
+	SimdVec3 specular = attributes[SPECULAR];
+	SimdFloat visibility = SimdFloat::load(lanes[POSITION * 4 + 3]);
+
+	glm::vec3 camera = settings.cameraPosition;
+	glm::vec3 light = settings.lightDirection;
+	SimdVec3 E = normalize(SimdVec3(SimdFloat(camera.x), SimdFloat(camera.y), SimdFloat(camera.z)) - P);
+	SimdVec3 L(SimdFloat(light.x), SimdFloat(light.y), SimdFloat(light.z));
+
+	SimdVec3 color(0.0f);
+	if(settings.direct) {
+		SimdVec3 direct = brdf(L, N, E, SimdVec3(1.0f), SimdVec3(0.0f), SimdFloat(0.0f));
+		color = color + direct * albedo * (1.25f * visibility);
+	}
+
+	// CalculateIndirectLighting(), cones start one voxel out along the interpolated normal
+	if(settings.indirect) {
+		SimdVec3 start = P + attributes[GEOMETRIC_NORMAL] * SimdFloat(gridWorldSize_ / dimensions_);
+		SimdFloat zero(0.0f);
+
+		SimdFloat specularTrace[4] = {zero, zero, zero, zero};
+		SimdMask specularLanes = active & ((specular.x > zero) | (specular.y > zero) | (specular.z > zero));
+		if(specularLanes.any()) {
+			SimdVec3 reflectDir = normalize(-E - 2.0f * dot(-E, N) * N);
+			coneTrace(start, reflectDir, 0.07f, specularLanes, specularTrace, cones, samples);
+			specularTrace[0] = specularTrace[0] * specular.x;
+			specularTrace[1] = specularTrace[1] * specular.y;
+			specularTrace[2] = specularTrace[2] * specular.z;
+		}
+
+		SimdFloat diffuseTrace[4] = {zero, zero, zero, zero};
+		SimdMask diffuseLanes = active & ((albedo.x > zero) | (albedo.y > zero) | (albedo.z > zero));
+		if(diffuseLanes.any()) {
+			SimdMask pole = abs(N.y) == SimdFloat(1.0f);
+			SimdVec3 guide(zero, select(pole, zero, SimdFloat(1.0f)), select(pole, SimdFloat(1.0f), zero));
+			SimdVec3 right = normalize(guide - dot(N, guide) * N);
+			SimdVec3 up = cross(right, N);
+
+			for(int i = 0; i < NUM_CONES; i++) {
+				SimdVec3 direction = normalize(N + right * SimdFloat(coneDirections[i].x) + up * SimdFloat(coneDirections[i].z));
+				SimdFloat traced[4];
+				coneTrace(start, direction, 0.07f, diffuseLanes, traced, cones, samples);
+				for(int c = 0; c < 4; c++) {
+					diffuseTrace[c] = diffuseTrace[c] + traced[c] * SimdFloat(coneWeights[i]);
+				}
+			}
+			diffuseTrace[0] = diffuseTrace[0] * albedo.x;
+			diffuseTrace[1] = diffuseTrace[1] * albedo.y;
+			diffuseTrace[2] = diffuseTrace[2] * albedo.z;
+		}
+
+		SimdVec3 indirect(diffuseTrace[0] + specularTrace[0], diffuseTrace[1] + specularTrace[1], diffuseTrace[2] + specularTrace[2]);
+		color = color + indirect * SimdFloat(1.25f);
+	}
+
+	float r[W], g[W], b[W];
+	color.x.store(r);
+	color.y.store(g);
+	color.z.store(b);
+	for(int i = 0; i < count; i++) {
+		if(valid[i] > 0.0f)
+			image[pixel + i] = glm::vec3(r[i], g[i], b[i]);
+	}
+}
+
+// ConeTrace() for the active lanes. Lanes stop on their own once they are opaque or
+// too wide, the packet runs until all have stopped.
+void CPUConeTracer::coneTrace(const SimdVec3& start, const SimdVec3& direction, float tanHalf, SimdMask active, SimdFloat color[4],
+	size_t& cones, size_t& samples) {
+	const int W = SimdFloat::WIDTH;
+	float voxelWorldSize = gridWorldSize_ / dimensions_;
+	float voxelSteps = 1.0f / voxelWorldSize;
+
+	for(int c = 0; c < 4; c++) {
+		color[c] = SimdFloat(0.0f);
+	}
+	cones += countLanes(active.bits());
+
+	SimdFloat distance(voxelWorldSize);
+	while(true) {
+		SimdFloat diameter = max(SimdFloat(voxelWorldSize), 2.0f * tanHalf * distance);
+		SimdFloat mipLevel = log2(diameter * SimdFloat(voxelSteps));
+		active = active.andNot(mipLevel > SimdFloat(MAX_MIP_LEVEL));
+		int bits = active.bits();
+		if(!bits)
+			break;
+
+		// The voxel lookups are scattered, so they are done per lane
+		SimdVec3 position = start + direction * distance;
+		float x[W], y[W], z[W], mip[W];
+		float sampled[4][W] = {};
+		position.x.store(x);
+		position.y.store(y);
+		position.z.store(z);
+		mipLevel.store(mip);
+		for(int i = 0; i < W; i++) {
+			if((bits >> i) & 1) {
+				glm::vec4 value = sampleVoxels(glm::vec3(x[i], y[i], z[i]), mip[i]);
+				for(int c = 0; c < 4; c++) {
+					sampled[c][i] = value[c];
+				}
+				samples++;
+			}
+		}
+
+		// Front to back blending
+		SimdFloat oneMinusAlpha = 1.0f - color[3];
+		for(int c = 0; c < 4; c++) {
+			color[c] = select(active, color[c] + oneMinusAlpha * SimdFloat::load(sampled[c]), color[c]);
+		}
+		distance = select(active, distance + diameter, distance);
+		active = active & (color[3] < SimdFloat(1.0f));
+	}
+}
+
+SimdVec3 CPUConeTracer::brdf(const SimdVec3& L, const SimdVec3& N, const SimdVec3& V, const SimdVec3& ka, const SimdVec3& ks, const SimdFloat& ksAlpha) {
+	SimdFloat zero(0.0f);
+	SimdVec3 H = normalize(V + L);
+
+	SimdFloat dotNL = max(dot(N, L), zero);
+	SimdFloat dotNH = max(dot(N, H), zero);
+	SimdFloat dotLH = max(dot(L, H), zero);
+
+	// Fresnel with F0 = 0.04, the same for all channels
+	SimdFloat oneMinusLH = 1.0f - dotLH;
+	SimdFloat oneMinusLH2 = oneMinusLH * oneMinusLH;
+	SimdFloat fresnel = 0.04f + 0.96f * (oneMinusLH2 * oneMinusLH2 * oneMinusLH);
+
+	// Specular power and Blinn-Phong with its approximate normalization
+	SimdFloat spec = exp2(11.0f * ksAlpha + SimdFloat(1.0f));
+	SimdFloat blinnPhong = pow(dotNH, spec) * (spec * SimdFloat(0.0397f) + SimdFloat(0.3183f));
+
+	SimdVec3 specular = ks * (blinnPhong * fresnel);
+	return (ka + specular) * dotNL;
+}
+
+glm::vec4 CPUConeTracer::sampleVoxels(glm::vec3 worldPosition, float mipLevel) {
+	glm::vec3 offset(1.0f / dimensions_, 1.0f / dimensions_, 0.0f);
+	glm::vec3 uv = worldPosition / (gridWorldSize_ * 0.5f) * 0.5f + 0.5f + offset;
+
+	// Magnification is linear on level 0, minification blends the two nearest levels
+	int maxLevel = (int)levels_.size() - 1;
+	if(mipLevel <= 0.0f)
+		return sampleLevel(0, uv);
+	mipLevel = std::min(mipLevel, (float)maxLevel);
+	int level = (int)mipLevel;
+	float blend = mipLevel - level;
+	glm::vec4 result = sampleLevel(level, uv);
+	if(blend > 0.0f && level < maxLevel)
+		result = glm::mix(result, sampleLevel(level + 1, uv), blend);
+	return result;
+}
+
+glm::vec4 CPUConeTracer::sampleLevel(int level, glm::vec3 uv) {
+	int size = std::max(dimensions_ >> level, 1);
+	const unsigned char* texels = &levels_[level][0];
+
+	int texel0[3], texel1[3];
+	float weight[3];
+	for(int i = 0; i < 3; i++) {
+		double t = (double)uv[i] * size - 0.5;
+		double base = floor(t);
+		weight[i] = (float)(t - base);
+		texel0[i] = wrapTexel(base, size);
+		texel1[i] = wrapTexel(base + 1.0, size);
+	}
+
+	glm::vec4 result(0.0f);
+	for(int corner = 0; corner < 8; corner++) {
+		int x = (corner & 1) ? texel1[0] : texel0[0];
+		int y = (corner & 2) ? texel1[1] : texel0[1];
+		int z = (corner & 4) ? texel1[2] : texel0[2];
+		float w = ((corner & 1) ? weight[0] : 1.0f - weight[0]) *
+			((corner & 2) ? weight[1] : 1.0f - weight[1]) *
+			((corner & 4) ? weight[2] : 1.0f - weight[2]);
+		const unsigned char* texel = texels + 4 * (((size_t)z * size + y) * size + x);
+		result += glm::vec4(texel[0], texel[1], texel[2], texel[3]) * w;
+	}
+	return result / 255.0f;
+}
+
+void CPUConeTracer::printStats(std::ostream& out, unsigned int numThreads) {
+	double seconds = std::max(seconds_, 1e-9);
+	double conesPerSecond = numCones_ / seconds;
+	out << "CPU cone tracer: " << width_ << "x" << height_ << ", " << numCones_ << " cones, " << numSamples_
+		<< " voxel samples in " << std::fixed << std::setprecision(1) << seconds_ * 1000.0 << " ms" << std::endl;
+	out << std::setprecision(2) << "\t" << conesPerSecond / 1e6 << " Mcones/s, "
+		<< conesPerSecond / 1e6 / std::max(numThreads, 1u) << " Mcones/s per core on " << numThreads << " threads, "
+		<< (double)numSamples_ / std::max((size_t)numCones_, (size_t)1) << " samples per cone, "
+		<< SimdFloat::WIDTH << " lanes per packet" << std::endl;
+	out.unsetf(std::ios::floatfield);
+	out << std::setprecision(6);
+}
+
+void CPUConeTracer::printDifference(std::ostream& out, const std::vector<glm::vec3>& reference, const std::vector<glm::vec3>& image) {
+	// Both are compared after quantizing to 8 bits, like the window's framebuffer
+	double squaredError = 0.0;
+	int maxError = 0;
+	size_t size = std::min(reference.size(), image.size());
+	for(size_t i = 0; i < size; i++) {
+		for(int c = 0; c < 3; c++) {
+			int a = (int)(glm::clamp(reference[i][c], 0.0f, 1.0f) * 255.0f + 0.5f);
+			int b = (int)(glm::clamp(image[i][c], 0.0f, 1.0f) * 255.0f + 0.5f);
+			squaredError += (double)(a - b) * (a - b);
+			maxError = std::max(maxError, std::abs(a - b));
+		}
+	}
+	double rmse = sqrt(squaredError / std::max(size * 3, (size_t)1));
+	out << "Difference to the GPU image: RMSE " << std::fixed << std::setprecision(2) << rmse << " / 255, PSNR ";
+	if(rmse > 0.0)
+		out << 20.0 * log10(255.0 / rmse) << " dB";
+	else
+		out << "inf";
+	out << ", max " << maxError << " / 255" << std::endl;
+	out.unsetf(std::ios::floatfield);
+	out << std::setprecision(6);
+}
+
+bool CPUConeTracer::writePPM(const std::string& filename, int width, int height, const std::vector<glm::vec3>& image) {
+	std::ofstream file(filename.c_str(), std::ios::binary);
+	if(!file) {
+		std::cout << "Couldn't write " << filename << std::endl;
+		return false;
+	}
+	file << "P6\n" << width << " " << height << "\n255\n";
+	std::vector<unsigned char> row(width * 3);
+	for(int y = height - 1; y >= 0; y--) {
+		for(int x = 0; x < width; x++) {
+			for(int c = 0; c < 3; c++) {
+				row[x * 3 + c] = (unsigned char)(glm::clamp(image[y * width + x][c], 0.0f, 1.0f) * 255.0f + 0.5f);
+			}
+		}
+		file.write((const char*)&row[0], row.size());
+	}
+	return true;
+}
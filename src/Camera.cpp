@@ -52,6 +52,22 @@ glm::vec3 Camera::getDirection() {
 	return front_;
 }
 
+float Camera::getYaw() {
+	return yaw_;
+}
+
+float Camera::getPitch() {
+	return pitch_;
+}
+
+float Camera::getNear() {
+	return near_;
+}
+
+float Camera::getFar() {
+	return far_;
+}
+
 void Camera::setPosition(glm::vec3 pos) {
 	position_ = pos;
 }
@@ -60,6 +76,11 @@ void Camera::setDirection(glm::vec3 dir) {
 	front_ = dir;
 }
 
+void Camera::setYawPitch(float yaw, float pitch) {
+	yaw_ = yaw;
+	pitch_ = pitch;
+}
+
 void Camera::moveForward(float delta) {
 	position_ += front_ * delta;
 }
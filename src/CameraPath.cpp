@@ -0,0 +1,128 @@
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+
+#include "CameraPath.h"
+
+CameraPath::CameraPath() {
+
+}
+
+CameraPath::~CameraPath() {
+
+}
+
+void CameraPath::addKeyframe(double time, glm::vec3 position, float yaw, float pitch) {
+	Keyframe key;
+	key.time = time;
+	key.position = position;
+	key.yaw = yaw;
+	key.pitch = pitch;
+	keyframes_.push_back(key);
+}
+
+double CameraPath::getDuration() {
+	return keyframes_.empty() ? 0.0 : keyframes_.back().time;
+}
+
+bool CameraPath::empty() {
+	return keyframes_.empty();
+}
+
+const std::vector<CameraPath::Keyframe>& CameraPath::getKeyframes() {
+	return keyframes_;
+}
+
+template <typename T>
+static T catmullRom(const T& p0, const T& p1, const T& p2, const T& p3, float t) {
+	float t2 = t * t;
+	float t3 = t2 * t;
+	return 0.5f * ((2.0f * p1) + (p2 - p0) * t + (2.0f * p0 - 5.0f * p1 + 4.0f * p2 - p3) * t2 + (3.0f * p1 - p0 - 3.0f * p2 + p3) * t3);
+}
+
+CameraPath::Keyframe CameraPath::sample(double time) {
+	if(keyframes_.empty()) {
+		Keyframe key;
+		key.time = time;
+		key.position = glm::vec3(0.0f);
+		key.yaw = key.pitch = 0.0f;
+		return key;
+	}
+	if(time <= keyframes_.front().time)
+		return keyframes_.front();
+	if(time >= keyframes_.back().time)
+		return keyframes_.back();
+
+	// Find the segment [i, i+1] containing time
+	size_t lo = 0, hi = keyframes_.size() - 1;
+	while(hi - lo > 1) {
+		size_t mid = (lo + hi) / 2;
+		if(keyframes_[mid].time <= time)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	const Keyframe& k0 = keyframes_[lo > 0 ? lo - 1 : lo];
+	const Keyframe& k1 = keyframes_[lo];
+	const Keyframe& k2 = keyframes_[hi];
+	const Keyframe& k3 = keyframes_[hi + 1 < keyframes_.size() ? hi + 1 : hi];
+
+	float t = (float)((time - k1.time) / (k2.time - k1.time));
+
+	Keyframe key;
+	key.time = time;
+	key.position = catmullRom(k0.position, k1.position, k2.position, k3.position, t);
+	key.yaw = catmullRom(k0.yaw, k1.yaw, k2.yaw, k3.yaw, t);
+	key.pitch = catmullRom(k0.pitch, k1.pitch, k2.pitch, k3.pitch, t);
+	return key;
+}
+
+bool CameraPath::load(std::string filename) {
+	std::ifstream file(filename.c_str());
+	if(!file.is_open()) {
+		std::cout << "Couldn't open camera path " << filename << std::endl;
+		return false;
+	}
+
+	keyframes_.clear();
+	std::string line;
+	while(std::getline(file, line)) {
+		if(line.empty() || line[0] == '#')
+			continue;
+
+		// Commas are replaced so the values can be read with >>
+		for(size_t i = 0; i < line.size(); i++) {
+			if(line[i] == ',')
+				line[i] = ' ';
+		}
+		std::istringstream values(line);
+		Keyframe key;
+		if(values >> key.time >> key.position.x >> key.position.y >> key.position.z >> key.yaw >> key.pitch) {
+			// Keyframes must be strictly increasing in time for the segment search
+			if(keyframes_.empty() || key.time > keyframes_.back().time)
+				keyframes_.push_back(key);
+		}
+	}
+
+	std::cout << "Loaded camera path " << filename << " with " << keyframes_.size() << " keyframes" << std::endl;
+	return !keyframes_.empty();
+}
+
+bool CameraPath::save(std::string filename) {
+	std::ofstream file(filename.c_str());
+	if(!file.is_open()) {
+		std::cout << "Couldn't write camera path " << filename << std::endl;
+		return false;
+	}
+
+	file << "# time,x,y,z,yaw,pitch" << std::endl;
+	file << std::setprecision(9);
+	for(size_t i = 0; i < keyframes_.size(); i++) {
+		const Keyframe& key = keyframes_[i];
+		file << key.time << "," << key.position.x << "," << key.position.y << "," << key.position.z << ","
+			 << key.yaw << "," << key.pitch << std::endl;
+	}
+	return true;
+}
@@ -8,16 +8,56 @@ Controls::Controls(float speed, float mouseSensitivity) {
 	mouseSensitivity_ = mouseSensitivity;
 	frameCount_ = 0;
 	oldMousePos_ = glm::dvec2(0.0);
+	mode_ = INTERACTIVE;
+	pathTime_ = 0.0;
 }
 
 Controls::~Controls() {
 	
 }
 
+void Controls::startRecording(std::string filename) {
+	mode_ = RECORDING;
+	recordingFile_ = filename;
+	pathTime_ = 0.0;
+}
+
+bool Controls::saveRecording() {
+	if(mode_ != RECORDING)
+		return false;
+	return path_.save(recordingFile_);
+}
+
+bool Controls::startPlayback(std::string filename) {
+	if(!path_.load(filename))
+		return false;
+	mode_ = PLAYBACK;
+	pathTime_ = 0.0;
+	return true;
+}
+
+bool Controls::isPlaying() {
+	return mode_ == PLAYBACK;
+}
+
+bool Controls::isPlaybackFinished() {
+	return mode_ == PLAYBACK && pathTime_ > path_.getDuration();
+}
+
 void Controls::updateFromInputs(Application* app, float deltaTime) {
 	GLFWwindow* window = app->getWindow();
 	Camera* camera = app->getCamera();
 
+	if(mode_ == PLAYBACK) {
+		// Inputs are ignored so every run sees exactly the same views
+		CameraPath::Keyframe key = path_.sample(pathTime_);
+		camera->setPosition(key.position);
+		camera->setYawPitch(key.yaw, key.pitch);
+		if(!app->isLoading())
+			pathTime_ += deltaTime;
+		return;
+	}
+
 	glm::dvec2 mousePos;
 	glfwGetCursorPos(window, &mousePos.x, &mousePos.y);
 	glm::dvec2 mouseDelta = mousePos - oldMousePos_;
@@ -60,4 +100,9 @@ void Controls::updateFromInputs(Application* app, float deltaTime) {
 	if(glfwGetKey(window, GLFW_KEY_Q) == GLFW_PRESS) {
 		camera->moveDown(translationDelta);
 	}
+
+	if(mode_ == RECORDING) {
+		path_.addKeyframe(pathTime_, camera->getPosition(), camera->getYaw(), camera->getPitch());
+		pathTime_ += deltaTime;
+	}
 }
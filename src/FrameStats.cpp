@@ -0,0 +1,106 @@
+#include <algorithm>
+#include <iomanip>
+
+#include "FrameStats.h"
+
+FrameStats::FrameStats(size_t windowSize, double hitchFactor) {
+	windowSize_ = windowSize;
+	hitchFactor_ = hitchFactor;
+	next_ = 0;
+	frameCount_ = 0;
+	hitchCount_ = 0;
+	averageFrameTime_ = 0.0;
+	totalTime_ = 0.0;
+	maxFrameTime_ = 0.0;
+	window_.reserve(windowSize_);
+	std::fill(histogram_, histogram_ + HISTOGRAM_BUCKETS, 0);
+}
+
+FrameStats::~FrameStats() {
+
+}
+
+void FrameStats::addFrame(double seconds) {
+	double ms = seconds * 1000.0;
+
+	if(window_.size() < windowSize_) {
+		window_.push_back(ms);
+	}
+	else {
+		window_[next_] = ms;
+	}
+	next_ = (next_ + 1) % windowSize_;
+
+	histogram_[std::min((int)ms, HISTOGRAM_BUCKETS - 1)]++;
+
+	// The first frames include loading and shader compilation, let the average settle first
+	if(frameCount_ > 10 && ms > hitchFactor_ * averageFrameTime_ && ms > 1.0) {
+		hitchCount_++;
+	}
+	averageFrameTime_ = frameCount_ == 0 ? ms : 0.95 * averageFrameTime_ + 0.05 * ms;
+
+	frameCount_++;
+	totalTime_ += ms;
+	maxFrameTime_ = std::max(maxFrameTime_, ms);
+}
+
+double FrameStats::getPercentile(double percentile) {
+	if(window_.empty())
+		return 0.0;
+
+	std::vector<double> sorted(window_);
+	size_t index = std::min(sorted.size() - 1, (size_t)(percentile / 100.0 * sorted.size()));
+	std::nth_element(sorted.begin(), sorted.begin() + index, sorted.end());
+	return sorted[index];
+}
+
+double FrameStats::getMax() {
+	if(window_.empty())
+		return 0.0;
+	return *std::max_element(window_.begin(), window_.end());
+}
+
+double FrameStats::getAverage() {
+	if(window_.empty())
+		return 0.0;
+
+	double sum = 0.0;
+	for(size_t i = 0; i < window_.size(); i++) {
+		sum += window_[i];
+	}
+	return sum / window_.size();
+}
+
+unsigned long long FrameStats::getFrameCount() {
+	return frameCount_;
+}
+
+unsigned int FrameStats::getHitchCount() {
+	return hitchCount_;
+}
+
+void FrameStats::printSummary(std::ostream& out) {
+	double average = getAverage();
+	out << std::fixed << std::setprecision(2)
+		<< "FPS: " << (average > 0.0 ? 1000.0 / average : 0.0)
+		<< " | frame ms p50 " << getPercentile(50.0) << " p95 " << getPercentile(95.0)
+		<< " p99 " << getPercentile(99.0) << " max " << getMax()
+		<< " | hitches " << hitchCount_ << std::endl;
+	out.unsetf(std::ios_base::floatfield);
+}
+
+void FrameStats::writeJSON(std::ostream& out) {
+	out << "{\"frames\": " << frameCount_
+		<< ", \"total_ms\": " << totalTime_
+		<< ", \"mean_ms\": " << (frameCount_ > 0 ? totalTime_ / frameCount_ : 0.0)
+		<< ", \"p50_ms\": " << getPercentile(50.0)
+		<< ", \"p95_ms\": " << getPercentile(95.0)
+		<< ", \"p99_ms\": " << getPercentile(99.0)
+		<< ", \"max_ms\": " << maxFrameTime_
+		<< ", \"hitches\": " << hitchCount_
+		<< ", \"histogram_ms\": [";
+	for(int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+		out << (i > 0 ? ", " : "") << histogram_[i];
+	}
+	out << "]}";
+}
@@ -0,0 +1,868 @@
+#define GL_CAPTURE_IMPLEMENTATION
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <string.h>
+
+#include "GLCapture.h"
+
+typedef unsigned long long u64;
+
+std::ofstream GLCapture::file_;
+bool GLCapture::capturing_ = false;
+int GLCapture::numFrames_ = 0;
+GLCapture::CallStats GLCapture::stats_;
+
+// Bindings and pixel store state the sizes of client memory depend on, tracked even
+// when not capturing so a capture can start at any time
+static GLuint packBuffer = 0;
+static GLint packAlignment = 4;
+static GLint unpackAlignment = 4;
+
+bool GLCapture::isAvailable() {
+#ifdef VCT_GL_CAPTURE
+	return true;
+#else
+	return false;
+#endif
+}
+
+bool GLCapture::start(const std::string& filename, int width, int height) {
+	if(!isAvailable()) {
+		std::cout << "GL capture needs a build with VCT_GL_CAPTURE" << std::endl;
+		return false;
+	}
+	file_.open(filename.c_str(), std::ios::binary);
+	if(!file_) {
+		std::cout << "Couldn't write GL capture " << filename << std::endl;
+		return false;
+	}
+	unsigned int header[3] = {FILE_VERSION, (unsigned int)width, (unsigned int)height};
+	file_.write("VCTGLCAP", 8);
+	file_.write((const char*)header, sizeof(header));
+	capturing_ = true;
+	numFrames_ = 0;
+	stats_ = CallStats();
+	return true;
+}
+
+void GLCapture::stop() {
+	if(!capturing_)
+		return;
+	capturing_ = false;
+	file_.close();
+}
+
+bool GLCapture::isCapturing() {
+	return capturing_;
+}
+
+int GLCapture::getNumFrames() {
+	return numFrames_;
+}
+
+void GLCapture::endFrame() {
+	if(!capturing_)
+		return;
+	record(CMD_END_FRAME, NULL, 0);
+	stats_.endFrame();
+	numFrames_++;
+}
+
+void GLCapture::beginPass(const char* name) {
+	if(!capturing_)
+		return;
+	record(CMD_BEGIN_PASS, NULL, 0, name, strlen(name));
+	stats_.beginPass(name);
+}
+
+void GLCapture::endPass() {
+	if(!capturing_)
+		return;
+	record(CMD_END_PASS, NULL, 0);
+	stats_.endPass();
+}
+
+void GLCapture::printStats(std::ostream& out) {
+	stats_.print(out, false);
+}
+
+const char* GLCapture::getCommandName(int command) {
+	#define GL_CAPTURE_NAME(name) "gl" #name,
+	static const char* names[NUM_COMMANDS] = {
+		GL_CAPTURE_COMMANDS(GL_CAPTURE_NAME)
+		"endFrame", "beginPass", "endPass"
+	};
+	#undef GL_CAPTURE_NAME
+	return command >= 0 && command < NUM_COMMANDS ? names[command] : "unknown";
+}
+
+void GLCapture::record(Command command, const u64* args, int numArgs, const void* blob, size_t blobSize) {
+	if(!capturing_)
+		return;
+	unsigned short header[2] = {(unsigned short)command, (unsigned short)numArgs};
+	unsigned int size = (unsigned int)blobSize;
+	file_.write((const char*)header, sizeof(header));
+	file_.write((const char*)&size, sizeof(size));
+	if(numArgs > 0)
+		file_.write((const char*)args, numArgs * sizeof(u64));
+	if(blobSize > 0)
+		file_.write((const char*)blob, blobSize);
+	if(command < NUM_GL_COMMANDS)
+		stats_.addCall(command);
+}
+
+size_t GLCapture::getPixelBytes(GLenum format, GLenum type) {
+	// Packed types hold all components
+	if(type == GL_UNSIGNED_INT_24_8 || type == GL_UNSIGNED_INT_10F_11F_11F_REV || type == GL_UNSIGNED_INT_2_10_10_10_REV)
+		return 4;
+
+	size_t components = 4;
+	switch(format) {
+	case GL_RED: case GL_RED_INTEGER: case GL_DEPTH_COMPONENT: case GL_STENCIL_INDEX:
+		components = 1;
+		break;
+	case GL_RG: case GL_RG_INTEGER: case GL_DEPTH_STENCIL:
+		components = 2;
+		break;
+	case GL_RGB: case GL_BGR: case GL_RGB_INTEGER:
+		components = 3;
+		break;
+	}
+	size_t componentBytes = 4;
+	switch(type) {
+	case GL_UNSIGNED_BYTE: case GL_BYTE:
+		componentBytes = 1;
+		break;
+	case GL_UNSIGNED_SHORT: case GL_SHORT: case GL_HALF_FLOAT:
+		componentBytes = 2;
+		break;
+	}
+	return components * componentBytes;
+}
+
+size_t GLCapture::getImageBytes(int width, int height, int depth, GLenum format, GLenum type, int alignment) {
+	if(width <= 0 || height <= 0 || depth <= 0)
+		return 0;
+	// Rows are padded to the alignment, except the last one
+	size_t rowBytes = width * getPixelBytes(format, type);
+	size_t paddedRowBytes = (rowBytes + alignment - 1) / alignment * alignment;
+	return paddedRowBytes * ((size_t)height * depth - 1) + rowBytes;
+}
+
+GLCapture::CallStats::CallStats() {
+	callsThisFrame_ = 0;
+	inSetup_ = true;
+	setupCalls_ = 0;
+}
+
+GLCapture::CallStats::Pass& GLCapture::CallStats::current() {
+	Pass& pass = passes_[stack_.empty() ? std::string("(no pass)") : stack_.back()];
+	if(pass.calls.empty()) {
+		pass.calls.assign(NUM_GL_COMMANDS, 0);
+		pass.totalCalls = 0;
+		pass.seconds = 0.0;
+	}
+	return pass;
+}
+
+void GLCapture::CallStats::beginPass(const std::string& name) {
+	stack_.push_back(name);
+}
+
+void GLCapture::CallStats::endPass() {
+	if(!stack_.empty())
+		stack_.pop_back();
+}
+
+void GLCapture::CallStats::addCall(int command) {
+	Pass& pass = current();
+	pass.calls[command]++;
+	pass.totalCalls++;
+	callsThisFrame_++;
+}
+
+void GLCapture::CallStats::addTime(double seconds) {
+	current().seconds += seconds;
+}
+
+// Passes only count frames after the initialization, so it doesn't skew the averages
+void GLCapture::CallStats::endFrame() {
+	if(inSetup_) {
+		inSetup_ = false;
+		setupCalls_ = callsThisFrame_;
+		passes_.clear();
+	}
+	else {
+		frameCalls_.push_back(callsThisFrame_);
+	}
+	callsThisFrame_ = 0;
+}
+
+void GLCapture::CallStats::print(std::ostream& out, bool withTimes) {
+	double frames = (double)std::max(frameCalls_.size(), (size_t)1);
+	unsigned long long minCalls = frameCalls_.empty() ? 0 : *std::min_element(frameCalls_.begin(), frameCalls_.end());
+	unsigned long long maxCalls = frameCalls_.empty() ? 0 : *std::max_element(frameCalls_.begin(), frameCalls_.end());
+	unsigned long long totalCalls = 0;
+	for(size_t i = 0; i < frameCalls_.size(); i++) {
+		totalCalls += frameCalls_[i];
+	}
+
+	out << std::fixed << std::setprecision(1)
+		<< "GL calls: " << setupCalls_ << " during initialization, then " << frameCalls_.size() << " frames with "
+		<< totalCalls / frames << " per frame (min " << minCalls << ", max " << maxCalls << ")" << std::endl;
+
+	// Passes with the most calls first, each with its most frequent calls
+	std::vector<std::pair<unsigned long long, std::string> > order;
+	for(std::map<std::string, Pass>::iterator it = passes_.begin(); it != passes_.end(); ++it) {
+		order.push_back(std::make_pair(it->second.totalCalls, it->first));
+	}
+	std::sort(order.rbegin(), order.rend());
+	for(size_t i = 0; i < order.size(); i++) {
+		Pass& pass = passes_[order[i].second];
+		out << "\t" << order[i].second << ": " << pass.totalCalls / frames << " calls";
+		if(withTimes)
+			out << ", " << std::setprecision(3) << pass.seconds * 1000.0 / frames << " ms" << std::setprecision(1);
+		out << " per frame" << std::endl << "\t\t";
+
+		std::vector<std::pair<unsigned long long, int> > commands;
+		for(int c = 0; c < NUM_GL_COMMANDS; c++) {
+			if(pass.calls[c] > 0)
+				commands.push_back(std::make_pair(pass.calls[c], c));
+		}
+		std::sort(commands.rbegin(), commands.rend());
+		for(size_t c = 0; c < commands.size() && c < 6; c++) {
+			out << (c > 0 ? ", " : "") << getCommandName(commands[c].second) << " " << commands[c].first / frames;
+		}
+		out << std::endl;
+	}
+	out.unsetf(std::ios_base::floatfield);
+}
+
+// ------------------------------------------------------------------- //
+// ----------------------------- Wrappers ---------------------------- //
+// ------------------------------------------------------------------- //
+
+// Arguments are widened to 64 bits, floats keep their bit pattern
+static u64 arg(int v) { return (u64)(long long)v; }
+static u64 arg(unsigned int v) { return v; }
+static u64 arg(unsigned char v) { return v; }
+static u64 arg(long v) { return (u64)(long long)v; }
+static u64 arg(unsigned long v) { return v; }
+static u64 arg(long long v) { return (u64)v; }
+static u64 arg(unsigned long long v) { return v; }
+static u64 arg(float v) { unsigned int bits; memcpy(&bits, &v, sizeof(bits)); return bits; }
+static u64 arg(const void* v) { return (u64)(size_t)v; }
+static u64 arg(GLsync v) { return (u64)(size_t)v; }
+
+#define GL_RECORD(command, ...) \
+	if(GLCapture::isCapturing()) { \
+		u64 args[] = {__VA_ARGS__}; \
+		GLCapture::record(GLCapture::CMD_##command, args, sizeof(args) / sizeof(args[0])); \
+	}
+#define GL_RECORD_BLOB(command, blob, blobSize, ...) \
+	if(GLCapture::isCapturing()) { \
+		u64 args[] = {__VA_ARGS__}; \
+		GLCapture::record(GLCapture::CMD_##command, args, sizeof(args) / sizeof(args[0]), blob, blobSize); \
+	}
+#define GL_RECORD_NO_ARGS(command) GLCapture::record(GLCapture::CMD_##command, NULL, 0)
+
+void vctCaptureActiveTexture(GLenum texture) {
+	glActiveTexture(texture);
+	GL_RECORD(ActiveTexture, arg(texture));
+}
+
+void vctCaptureAttachShader(GLuint program, GLuint shader) {
+	glAttachShader(program, shader);
+	GL_RECORD(AttachShader, arg(program), arg(shader));
+}
+
+void vctCaptureBeginQuery(GLenum target, GLuint id) {
+	glBeginQuery(target, id);
+	GL_RECORD(BeginQuery, arg(target), arg(id));
+}
+
+void vctCaptureBindBuffer(GLenum target, GLuint buffer) {
+	glBindBuffer(target, buffer);
+	if(target == GL_PIXEL_PACK_BUFFER)
+		packBuffer = buffer;
+	GL_RECORD(BindBuffer, arg(target), arg(buffer));
+}
+
+void vctCaptureBindBufferBase(GLenum target, GLuint index, GLuint buffer) {
+	glBindBufferBase(target, index, buffer);
+	GL_RECORD(BindBufferBase, arg(target), arg(index), arg(buffer));
+}
+
+void vctCaptureBindFramebuffer(GLenum target, GLuint framebuffer) {
+	glBindFramebuffer(target, framebuffer);
+	GL_RECORD(BindFramebuffer, arg(target), arg(framebuffer));
+}
+
+void vctCaptureBindImageTexture(GLuint unit, GLuint texture, GLint level, GLboolean layered, GLint layer, GLenum access, GLenum format) {
+	glBindImageTexture(unit, texture, level, layered, layer, access, format);
+	GL_RECORD(BindImageTexture, arg(unit), arg(texture), arg(level), arg(layered), arg(layer), arg(access), arg(format));
+}
+
+void vctCaptureBindRenderbuffer(GLenum target, GLuint renderbuffer) {
+	glBindRenderbuffer(target, renderbuffer);
+	GL_RECORD(BindRenderbuffer, arg(target), arg(renderbuffer));
+}
+
+void vctCaptureBindTexture(GLenum target, GLuint texture) {
+	glBindTexture(target, texture);
+	GL_RECORD(BindTexture, arg(target), arg(texture));
+}
+
+void vctCaptureBindVertexArray(GLuint array) {
+	glBindVertexArray(array);
+	GL_RECORD(BindVertexArray, arg(array));
+}
+
+void vctCaptureBlitFramebuffer(GLint srcX0, GLint srcY0, GLint srcX1, GLint srcY1, GLint dstX0, GLint dstY0, GLint dstX1, GLint dstY1, GLbitfield mask, GLenum filter) {
+	glBlitFramebuffer(srcX0, srcY0, srcX1, srcY1, dstX0, dstY0, dstX1, dstY1, mask, filter);
+	GL_RECORD(BlitFramebuffer, arg(srcX0), arg(srcY0), arg(srcX1), arg(srcY1), arg(dstX0), arg(dstY0), arg(dstX1), arg(dstY1), arg(mask), arg(filter));
+}
+
+void vctCaptureBufferData(GLenum target, GLsizeiptr size, const void* data, GLenum usage) {
+	glBufferData(target, size, data, usage);
+	GL_RECORD_BLOB(BufferData, data, data ? (size_t)size : 0, arg(target), arg(size), arg(usage), arg(data != NULL));
+}
+
+void vctCaptureBufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const void* data) {
+	glBufferSubData(target, offset, size, data);
+	GL_RECORD_BLOB(BufferSubData, data, (size_t)size, arg(target), arg(offset), arg(size));
+}
+
+GLenum vctCaptureCheckFramebufferStatus(GLenum target) {
+	GLenum status = glCheckFramebufferStatus(target);
+	GL_RECORD(CheckFramebufferStatus, arg(target));
+	return status;
+}
+
+void vctCaptureClear(GLbitfield mask) {
+	glClear(mask);
+	GL_RECORD(Clear, arg(mask));
+}
+
+void vctCaptureClearBufferData(GLenum target, GLenum internalformat, GLenum format, GLenum type, const void* data) {
+	glClearBufferData(target, internalformat, format, type, data);
+	GL_RECORD_BLOB(ClearBufferData, data, data ? GLCapture::getPixelBytes(format, type) : 0,
+		arg(target), arg(internalformat), arg(format), arg(type), arg(data != NULL));
+}
+
+void vctCaptureClearBufferfv(GLenum buffer, GLint drawbuffer, const GLfloat* value) {
+	glClearBufferfv(buffer, drawbuffer, value);
+	GL_RECORD_BLOB(ClearBufferfv, value, (buffer == GL_COLOR ? 4 : 1) * sizeof(GLfloat), arg(buffer), arg(drawbuffer));
+}
+
+void vctCaptureClearColor(GLfloat red, GLfloat green, GLfloat blue, GLfloat alpha) {
+	glClearColor(red, green, blue, alpha);
+	GL_RECORD(ClearColor, arg(red), arg(green), arg(blue), arg(alpha));
+}
+
+GLenum vctCaptureClientWaitSync(GLsync sync, GLbitfield flags, GLuint64 timeout) {
+	GLenum result = glClientWaitSync(sync, flags, timeout);
+	GL_RECORD(ClientWaitSync, arg(sync), arg(flags), arg(timeout));
+	return result;
+}
+
+void vctCaptureColorMask(GLboolean red, GLboolean green, GLboolean blue, GLboolean alpha) {
+	glColorMask(red, green, blue, alpha);
+	GL_RECORD(ColorMask, arg(red), arg(green), arg(blue), arg(alpha));
+}
+
+void vctCaptureCompileShader(GLuint shader) {
+	glCompileShader(shader);
+	GL_RECORD(CompileShader, arg(shader));
+}
+
+void vctCaptureCopyImageSubData(GLuint srcName, GLenum srcTarget, GLint srcLevel, GLint srcX, GLint srcY, GLint srcZ, GLuint dstName, GLenum dstTarget, GLint dstLevel, GLint dstX, GLint dstY, GLint dstZ, GLsizei srcWidth, GLsizei srcHeight, GLsizei srcDepth) {
+	glCopyImageSubData(srcName, srcTarget, srcLevel, srcX, srcY, srcZ, dstName, dstTarget, dstLevel, dstX, dstY, dstZ, srcWidth, srcHeight, srcDepth);
+	GL_RECORD(CopyImageSubData, arg(srcName), arg(srcTarget), arg(srcLevel), arg(srcX), arg(srcY), arg(srcZ), arg(dstName), arg(dstTarget), arg(dstLevel), arg(dstX), arg(dstY), arg(dstZ), arg(srcWidth), arg(srcHeight), arg(srcDepth));
+}
+
+void vctCaptureCopyTexSubImage2D(GLenum target, GLint level, GLint xoffset, GLint yoffset, GLint x, GLint y, GLsizei width, GLsizei height) {
+	glCopyTexSubImage2D(target, level, xoffset, yoffset, x, y, width, height);
+	GL_RECORD(CopyTexSubImage2D, arg(target), arg(level), arg(xoffset), arg(yoffset), arg(x), arg(y), arg(width), arg(height));
+}
+
+GLuint vctCaptureCreateProgram() {
+	GLuint program = glCreateProgram();
+	GL_RECORD(CreateProgram, arg(program));
+	return program;
+}
+
+GLuint vctCaptureCreateShader(GLenum type) {
+	GLuint shader = glCreateShader(type);
+	GL_RECORD(CreateShader, arg(type), arg(shader));
+	return shader;
+}
+
+void vctCaptureCullFace(GLenum mode) {
+	glCullFace(mode);
+	GL_RECORD(CullFace, arg(mode));
+}
+
+void vctCaptureDeleteBuffers(GLsizei n, const GLuint* buffers) {
+	GL_RECORD_BLOB(DeleteBuffers, buffers, n * sizeof(GLuint), arg(n));
+	glDeleteBuffers(n, buffers);
+}
+
+void vctCaptureDeleteFramebuffers(GLsizei n, const GLuint* framebuffers) {
+	GL_RECORD_BLOB(DeleteFramebuffers, framebuffers, n * sizeof(GLuint), arg(n));
+	glDeleteFramebuffers(n, framebuffers);
+}
+
+void vctCaptureDeleteProgram(GLuint program) {
+	glDeleteProgram(program);
+	GL_RECORD(DeleteProgram, arg(program));
+}
+
+void vctCaptureDeleteQueries(GLsizei n, const GLuint* ids) {
+	GL_RECORD_BLOB(DeleteQueries, ids, n * sizeof(GLuint), arg(n));
+	glDeleteQueries(n, ids);
+}
+
+void vctCaptureDeleteRenderbuffers(GLsizei n, const GLuint* renderbuffers) {
+	GL_RECORD_BLOB(DeleteRenderbuffers, renderbuffers, n * sizeof(GLuint), arg(n));
+	glDeleteRenderbuffers(n, renderbuffers);
+}
+
+void vctCaptureDeleteShader(GLuint shader) {
+	glDeleteShader(shader);
+	GL_RECORD(DeleteShader, arg(shader));
+}
+
+void vctCaptureDeleteSync(GLsync sync) {
+	glDeleteSync(sync);
+	GL_RECORD(DeleteSync, arg(sync));
+}
+
+void vctCaptureDeleteTextures(GLsizei n, const GLuint* textures) {
+	GL_RECORD_BLOB(DeleteTextures, textures, n * sizeof(GLuint), arg(n));
+	glDeleteTextures(n, textures);
+}
+
+void vctCaptureDeleteVertexArrays(GLsizei n, const GLuint* arrays) {
+	GL_RECORD_BLOB(DeleteVertexArrays, arrays, n * sizeof(GLuint), arg(n));
+	glDeleteVertexArrays(n, arrays);
+}
+
+void vctCaptureDepthFunc(GLenum func) {
+	glDepthFunc(func);
+	GL_RECORD(DepthFunc, arg(func));
+}
+
+void vctCaptureDepthMask(GLboolean flag) {
+	glDepthMask(flag);
+	GL_RECORD(DepthMask, arg(flag));
+}
+
+void vctCaptureDisable(GLenum cap) {
+	glDisable(cap);
+	GL_RECORD(Disable, arg(cap));
+}
+
+void vctCaptureDisableVertexAttribArray(GLuint index) {
+	glDisableVertexAttribArray(index);
+	GL_RECORD(DisableVertexAttribArray, arg(index));
+}
+
+void vctCaptureDispatchCompute(GLuint x, GLuint y, GLuint z) {
+	glDispatchCompute(x, y, z);
+	GL_RECORD(DispatchCompute, arg(x), arg(y), arg(z));
+}
+
+void vctCaptureDispatchComputeIndirect(GLintptr indirect) {
+	glDispatchComputeIndirect(indirect);
+	GL_RECORD(DispatchComputeIndirect, arg(indirect));
+}
+
+void vctCaptureDrawArrays(GLenum mode, GLint first, GLsizei count) {
+	glDrawArrays(mode, first, count);
+	GL_RECORD(DrawArrays, arg(mode), arg(first), arg(count));
+}
+
+// Indirect commands and indices always come from a bound buffer, the pointers are offsets
+void vctCaptureDrawArraysIndirect(GLenum mode, const void* indirect) {
+	glDrawArraysIndirect(mode, indirect);
+	GL_RECORD(DrawArraysIndirect, arg(mode), arg(indirect));
+}
+
+void vctCaptureDrawArraysInstanced(GLenum mode, GLint first, GLsizei count, GLsizei instancecount) {
+	glDrawArraysInstanced(mode, first, count, instancecount);
+	GL_RECORD(DrawArraysInstanced, arg(mode), arg(first), arg(count), arg(instancecount));
+}
+
+void vctCaptureDrawBuffer(GLenum buf) {
+	glDrawBuffer(buf);
+	GL_RECORD(DrawBuffer, arg(buf));
+}
+
+void vctCaptureDrawBuffers(GLsizei n, const GLenum* bufs) {
+	glDrawBuffers(n, bufs);
+	GL_RECORD_BLOB(DrawBuffers, bufs, n * sizeof(GLenum), arg(n));
+}
+
+void vctCaptureDrawElements(GLenum mode, GLsizei count, GLenum type, const void* indices) {
+	glDrawElements(mode, count, type, indices);
+	GL_RECORD(DrawElements, arg(mode), arg(count), arg(type), arg(indices));
+}
+
+void vctCaptureDrawElementsInstanced(GLenum mode, GLsizei count, GLenum type, const void* indices, GLsizei instancecount) {
+	glDrawElementsInstanced(mode, count, type, indices, instancecount);
+	GL_RECORD(DrawElementsInstanced, arg(mode), arg(count), arg(type), arg(indices), arg(instancecount));
+}
+
+void vctCaptureEnable(GLenum cap) {
+	glEnable(cap);
+	GL_RECORD(Enable, arg(cap));
+}
+
+void vctCaptureEnableVertexAttribArray(GLuint index) {
+	glEnableVertexAttribArray(index);
+	GL_RECORD(EnableVertexAttribArray, arg(index));
+}
+
+void vctCaptureEndQuery(GLenum target) {
+	glEndQuery(target);
+	GL_RECORD(EndQuery, arg(target));
+}
+
+GLsync vctCaptureFenceSync(GLenum condition, GLbitfield flags) {
+	GLsync sync = glFenceSync(condition, flags);
+	GL_RECORD(FenceSync, arg(condition), arg(flags), arg(sync));
+	return sync;
+}
+
+void vctCaptureFlush() {
+	glFlush();
+	GL_RECORD_NO_ARGS(Flush);
+}
+
+void vctCaptureFramebufferRenderbuffer(GLenum target, GLenum attachment, GLenum renderbuffertarget, GLuint renderbuffer) {
+	glFramebufferRenderbuffer(target, attachment, renderbuffertarget, renderbuffer);
+	GL_RECORD(FramebufferRenderbuffer, arg(target), arg(attachment), arg(renderbuffertarget), arg(renderbuffer));
+}
+
+void vctCaptureFramebufferTexture(GLenum target, GLenum attachment, GLuint texture, GLint level) {
+	glFramebufferTexture(target, attachment, texture, level);
+	GL_RECORD(FramebufferTexture, arg(target), arg(attachment), arg(texture), arg(level));
+}
+
+void vctCaptureFramebufferTexture2D(GLenum target, GLenum attachment, GLenum textarget, GLuint texture, GLint level) {
+	glFramebufferTexture2D(target, attachment, textarget, texture, level);
+	GL_RECORD(FramebufferTexture2D, arg(target), arg(attachment), arg(textarget), arg(texture), arg(level));
+}
+
+void vctCaptureFramebufferTextureLayer(GLenum target, GLenum attachment, GLuint texture, GLint level, GLint layer) {
+	glFramebufferTextureLayer(target, attachment, texture, level, layer);
+	GL_RECORD(FramebufferTextureLayer, arg(target), arg(attachment), arg(texture), arg(level), arg(layer));
+}
+
+// The names the driver returned are the blob, the replay maps them to its own
+void vctCaptureGenBuffers(GLsizei n, GLuint* buffers) {
+	glGenBuffers(n, buffers);
+	GL_RECORD_BLOB(GenBuffers, buffers, n * sizeof(GLuint), arg(n));
+}
+
+void vctCaptureGenFramebuffers(GLsizei n, GLuint* framebuffers) {
+	glGenFramebuffers(n, framebuffers);
+	GL_RECORD_BLOB(GenFramebuffers, framebuffers, n * sizeof(GLuint), arg(n));
+}
+
+void vctCaptureGenQueries(GLsizei n, GLuint* ids) {
+	glGenQueries(n, ids);
+	GL_RECORD_BLOB(GenQueries, ids, n * sizeof(GLuint), arg(n));
+}
+
+void vctCaptureGenRenderbuffers(GLsizei n, GLuint* renderbuffers) {
+	glGenRenderbuffers(n, renderbuffers);
+	GL_RECORD_BLOB(GenRenderbuffers, renderbuffers, n * sizeof(GLuint), arg(n));
+}
+
+void vctCaptureGenTextures(GLsizei n, GLuint* textures) {
+	glGenTextures(n, textures);
+	GL_RECORD_BLOB(GenTextures, textures, n * sizeof(GLuint), arg(n));
+}
+
+void vctCaptureGenVertexArrays(GLsizei n, GLuint* arrays) {
+	glGenVertexArrays(n, arrays);
+	GL_RECORD_BLOB(GenVertexArrays, arrays, n * sizeof(GLuint), arg(n));
+}
+
+void vctCaptureGenerateMipmap(GLenum target) {
+	glGenerateMipmap(target);
+	GL_RECORD(GenerateMipmap, arg(target));
+}
+
+// Reads are replayed into scratch memory, only their cost matters
+void vctCaptureGetBufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, void* data) {
+	glGetBufferSubData(target, offset, size, data);
+	GL_RECORD(GetBufferSubData, arg(target), arg(offset), arg(size));
+}
+
+GLenum vctCaptureGetError() {
+	GLenum error = glGetError();
+	GL_RECORD_NO_ARGS(GetError);
+	return error;
+}
+
+void vctCaptureGetInteger64v(GLenum pname, GLint64* data) {
+	glGetInteger64v(pname, data);
+	GL_RECORD(GetInteger64v, arg(pname));
+}
+
+void vctCaptureGetIntegerv(GLenum pname, GLint* data) {
+	glGetIntegerv(pname, data);
+	GL_RECORD(GetIntegerv, arg(pname));
+}
+
+void vctCaptureGetProgramInfoLog(GLuint program, GLsizei bufSize, GLsizei* length, GLchar* infoLog) {
+	glGetProgramInfoLog(program, bufSize, length, infoLog);
+	GL_RECORD(GetProgramInfoLog, arg(program), arg(bufSize));
+}
+
+void vctCaptureGetProgramiv(GLuint program, GLenum pname, GLint* params) {
+	glGetProgramiv(program, pname, params);
+	GL_RECORD(GetProgramiv, arg(program), arg(pname));
+}
+
+void vctCaptureGetQueryObjectiv(GLuint id, GLenum pname, GLint* params) {
+	glGetQueryObjectiv(id, pname, params);
+	GL_RECORD(GetQueryObjectiv, arg(id), arg(pname));
+}
+
+void vctCaptureGetQueryObjectui64v(GLuint id, GLenum pname, GLuint64* params) {
+	glGetQueryObjectui64v(id, pname, params);
+	GL_RECORD(GetQueryObjectui64v, arg(id), arg(pname));
+}
+
+void vctCaptureGetQueryObjectuiv(GLuint id, GLenum pname, GLuint* params) {
+	glGetQueryObjectuiv(id, pname, params);
+	GL_RECORD(GetQueryObjectuiv, arg(id), arg(pname));
+}
+
+void vctCaptureGetShaderInfoLog(GLuint shader, GLsizei bufSize, GLsizei* length, GLchar* infoLog) {
+	glGetShaderInfoLog(shader, bufSize, length, infoLog);
+	GL_RECORD(GetShaderInfoLog, arg(shader), arg(bufSize));
+}
+
+void vctCaptureGetShaderiv(GLuint shader, GLenum pname, GLint* params) {
+	glGetShaderiv(shader, pname, params);
+	GL_RECORD(GetShaderiv, arg(shader), arg(pname));
+}
+
+const GLubyte* vctCaptureGetString(GLenum name) {
+	const GLubyte* string = glGetString(name);
+	GL_RECORD(GetString, arg(name));
+	return string;
+}
+
+void vctCaptureGetTexImage(GLenum target, GLint level, GLenum format, GLenum type, void* pixels) {
+	// The size isn't in the arguments, so it is recorded for the replay's scratch memory
+	size_t size = 0;
+	if(GLCapture::isCapturing() && packBuffer == 0) {
+		GLint width = 0, height = 0, depth = 0;
+		glGetTexLevelParameteriv(target, level, GL_TEXTURE_WIDTH, &width);
+		glGetTexLevelParameteriv(target, level, GL_TEXTURE_HEIGHT, &height);
+		glGetTexLevelParameteriv(target, level, GL_TEXTURE_DEPTH, &depth);
+		size = GLCapture::getImageBytes(width, height, depth, format, type, packAlignment);
+	}
+	glGetTexImage(target, level, format, type, pixels);
+	GL_RECORD(GetTexImage, arg(target), arg(level), arg(format), arg(type), arg(pixels), arg(packBuffer != 0), arg(size));
+}
+
+GLint vctCaptureGetUniformLocation(GLuint program, const GLchar* name) {
+	GLint location = glGetUniformLocation(program, name);
+	GL_RECORD_BLOB(GetUniformLocation, name, strlen(name) + 1, arg(program), arg(location));
+	return location;
+}
+
+void vctCaptureLinkProgram(GLuint program) {
+	glLinkProgram(program);
+	GL_RECORD(LinkProgram, arg(program));
+}
+
+// Only read mappings are used, what the application reads doesn't have to be stored
+void* vctCaptureMapBufferRange(GLenum target, GLintptr offset, GLsizeiptr length, GLbitfield access) {
+	void* data = glMapBufferRange(target, offset, length, access);
+	GL_RECORD(MapBufferRange, arg(target), arg(offset), arg(length), arg(access));
+	return data;
+}
+
+void vctCaptureMemoryBarrier(GLbitfield barriers) {
+	glMemoryBarrier(barriers);
+	GL_RECORD(MemoryBarrier, arg(barriers));
+}
+
+void vctCaptureMultiDrawElementsIndirect(GLenum mode, GLenum type, const void* indirect, GLsizei drawcount, GLsizei stride) {
+	glMultiDrawElementsIndirect(mode, type, indirect, drawcount, stride);
+	GL_RECORD(MultiDrawElementsIndirect, arg(mode), arg(type), arg(indirect), arg(drawcount), arg(stride));
+}
+
+void vctCaptureMultiDrawElementsIndirectCountARB(GLenum mode, GLenum type, const void* indirect, GLintptr drawcount, GLsizei maxdrawcount, GLsizei stride) {
+	glMultiDrawElementsIndirectCountARB(mode, type, indirect, drawcount, maxdrawcount, stride);
+	GL_RECORD(MultiDrawElementsIndirectCountARB, arg(mode), arg(type), arg(indirect), arg(drawcount), arg(maxdrawcount), arg(stride));
+}
+
+void vctCapturePixelStorei(GLenum pname, GLint param) {
+	glPixelStorei(pname, param);
+	if(pname == GL_PACK_ALIGNMENT)
+		packAlignment = param;
+	else if(pname == GL_UNPACK_ALIGNMENT)
+		unpackAlignment = param;
+	GL_RECORD(PixelStorei, arg(pname), arg(param));
+}
+
+void vctCaptureQueryCounter(GLuint id, GLenum target) {
+	glQueryCounter(id, target);
+	GL_RECORD(QueryCounter, arg(id), arg(target));
+}
+
+void vctCaptureReadBuffer(GLenum src) {
+	glReadBuffer(src);
+	GL_RECORD(ReadBuffer, arg(src));
+}
+
+void vctCaptureReadPixels(GLint x, GLint y, GLsizei width, GLsizei height, GLenum format, GLenum type, void* pixels) {
+	glReadPixels(x, y, width, height, format, type, pixels);
+	size_t size = packBuffer == 0 ? GLCapture::getImageBytes(width, height, 1, format, type, packAlignment) : 0;
+	GL_RECORD(ReadPixels, arg(x), arg(y), arg(width), arg(height), arg(format), arg(type), arg(pixels), arg(packBuffer != 0), arg(size));
+}
+
+void vctCaptureRenderbufferStorage(GLenum target, GLenum internalformat, GLsizei width, GLsizei height) {
+	glRenderbufferStorage(target, internalformat, width, height);
+	GL_RECORD(RenderbufferStorage, arg(target), arg(internalformat), arg(width), arg(height));
+}
+
+void vctCaptureRenderbufferStorageMultisample(GLenum target, GLsizei samples, GLenum internalformat, GLsizei width, GLsizei height) {
+	glRenderbufferStorageMultisample(target, samples, internalformat, width, height);
+	GL_RECORD(RenderbufferStorageMultisample, arg(target), arg(samples), arg(internalformat), arg(width), arg(height));
+}
+
+// All strings are joined, the replay passes them as one
+void vctCaptureShaderSource(GLuint shader, GLsizei count, const GLchar* const* string, const GLint* length) {
+	glShaderSource(shader, count, string, length);
+	if(GLCapture::isCapturing()) {
+		std::string source;
+		for(GLsizei i = 0; i < count; i++) {
+			if(length && length[i] >= 0)
+				source.append(string[i], length[i]);
+			else
+				source.append(string[i]);
+		}
+		GL_RECORD_BLOB(ShaderSource, source.data(), source.size(), arg(shader));
+	}
+}
+
+void vctCaptureTexImage2D(GLenum target, GLint level, GLint internalformat, GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, const void* pixels) {
+	glTexImage2D(target, level, internalformat, width, height, border, format, type, pixels);
+	GL_RECORD_BLOB(TexImage2D, pixels, pixels ? GLCapture::getImageBytes(width, height, 1, format, type, unpackAlignment) : 0,
+		arg(target), arg(level), arg(internalformat), arg(width), arg(height), arg(border), arg(format), arg(type), arg(pixels != NULL));
+}
+
+void vctCaptureTexImage3D(GLenum target, GLint level, GLint internalformat, GLsizei width, GLsizei height, GLsizei depth, GLint border, GLenum format, GLenum type, const void* pixels) {
+	glTexImage3D(target, level, internalformat, width, height, depth, border, format, type, pixels);
+	GL_RECORD_BLOB(TexImage3D, pixels, pixels ? GLCapture::getImageBytes(width, height, depth, format, type, unpackAlignment) : 0,
+		arg(target), arg(level), arg(internalformat), arg(width), arg(height), arg(depth), arg(border), arg(format), arg(type), arg(pixels != NULL));
+}
+
+void vctCaptureTexParameteri(GLenum target, GLenum pname, GLint param) {
+	glTexParameteri(target, pname, param);
+	GL_RECORD(TexParameteri, arg(target), arg(pname), arg(param));
+}
+
+void vctCaptureTexSubImage3D(GLenum target, GLint level, GLint xoffset, GLint yoffset, GLint zoffset, GLsizei width, GLsizei height, GLsizei depth, GLenum format, GLenum type, const void* pixels) {
+	glTexSubImage3D(target, level, xoffset, yoffset, zoffset, width, height, depth, format, type, pixels);
+	GL_RECORD_BLOB(TexSubImage3D, pixels, GLCapture::getImageBytes(width, height, depth, format, type, unpackAlignment),
+		arg(target), arg(level), arg(xoffset), arg(yoffset), arg(zoffset), arg(width), arg(height), arg(depth), arg(format), arg(type));
+}
+
+void vctCaptureUniform1f(GLint location, GLfloat v0) {
+	glUniform1f(location, v0);
+	GL_RECORD(Uniform1f, arg(location), arg(v0));
+}
+
+void vctCaptureUniform1fv(GLint location, GLsizei count, const GLfloat* value) {
+	glUniform1fv(location, count, value);
+	GL_RECORD_BLOB(Uniform1fv, value, count * sizeof(GLfloat), arg(location), arg(count));
+}
+
+void vctCaptureUniform1i(GLint location, GLint v0) {
+	glUniform1i(location, v0);
+	GL_RECORD(Uniform1i, arg(location), arg(v0));
+}
+
+void vctCaptureUniform1iv(GLint location, GLsizei count, const GLint* value) {
+	glUniform1iv(location, count, value);
+	GL_RECORD_BLOB(Uniform1iv, value, count * sizeof(GLint), arg(location), arg(count));
+}
+
+void vctCaptureUniform1ui(GLint location, GLuint v0) {
+	glUniform1ui(location, v0);
+	GL_RECORD(Uniform1ui, arg(location), arg(v0));
+}
+
+void vctCaptureUniform2f(GLint location, GLfloat v0, GLfloat v1) {
+	glUniform2f(location, v0, v1);
+	GL_RECORD(Uniform2f, arg(location), arg(v0), arg(v1));
+}
+
+void vctCaptureUniform2i(GLint location, GLint v0, GLint v1) {
+	glUniform2i(location, v0, v1);
+	GL_RECORD(Uniform2i, arg(location), arg(v0), arg(v1));
+}
+
+void vctCaptureUniform3f(GLint location, GLfloat v0, GLfloat v1, GLfloat v2) {
+	glUniform3f(location, v0, v1, v2);
+	GL_RECORD(Uniform3f, arg(location), arg(v0), arg(v1), arg(v2));
+}
+
+void vctCaptureUniform3i(GLint location, GLint v0, GLint v1, GLint v2) {
+	glUniform3i(location, v0, v1, v2);
+	GL_RECORD(Uniform3i, arg(location), arg(v0), arg(v1), arg(v2));
+}
+
+void vctCaptureUniform4fv(GLint location, GLsizei count, const GLfloat* value) {
+	glUniform4fv(location, count, value);
+	GL_RECORD_BLOB(Uniform4fv, value, count * 4 * sizeof(GLfloat), arg(location), arg(count));
+}
+
+void vctCaptureUniformMatrix4fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat* value) {
+	glUniformMatrix4fv(location, count, transpose, value);
+	GL_RECORD_BLOB(UniformMatrix4fv, value, count * 16 * sizeof(GLfloat), arg(location), arg(count), arg(transpose));
+}
+
+GLboolean vctCaptureUnmapBuffer(GLenum target) {
+	GLboolean result = glUnmapBuffer(target);
+	GL_RECORD(UnmapBuffer, arg(target));
+	return result;
+}
+
+void vctCaptureUseProgram(GLuint program) {
+	glUseProgram(program);
+	GL_RECORD(UseProgram, arg(program));
+}
+
+void vctCaptureVertexAttribDivisor(GLuint index, GLuint divisor) {
+	glVertexAttribDivisor(index, divisor);
+	GL_RECORD(VertexAttribDivisor, arg(index), arg(divisor));
+}
+
+void vctCaptureVertexAttribIPointer(GLuint index, GLint size, GLenum type, GLsizei stride, const void* pointer) {
+	glVertexAttribIPointer(index, size, type, stride, pointer);
+	GL_RECORD(VertexAttribIPointer, arg(index), arg(size), arg(type), arg(stride), arg(pointer));
+}
+
+void vctCaptureVertexAttribPointer(GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride, const void* pointer) {
+	glVertexAttribPointer(index, size, type, normalized, stride, pointer);
+	GL_RECORD(VertexAttribPointer, arg(index), arg(size), arg(type), arg(normalized), arg(stride), arg(pointer));
+}
+
+void vctCaptureViewport(GLint x, GLint y, GLsizei width, GLsizei height) {
+	glViewport(x, y, width, height);
+	GL_RECORD(Viewport, arg(x), arg(y), arg(width), arg(height));
+}
@@ -0,0 +1,360 @@
+#include <algorithm>
+#include <iomanip>
+#include <string.h>
+
+#include "JobSystem.h"
+#include "Profiler.h"
+
+struct JobSystem::Job {
+	const char* name;
+	std::function<void()> function;
+	bool mainThread;
+	std::atomic<bool> finished; // Set with graphMutex_ held
+
+	// Protected by graphMutex_
+	int unfinishedDependencies; // Plus one until submitted
+	std::vector<Job*> dependents;
+	double readyPath;           // Longest chain of jobs that had to finish before this one, in seconds
+	Job* criticalParent;        // Job at the end of that chain
+
+	double startTime;
+	double finishPath;
+};
+
+// Worker index of the calling thread, -1 for the main thread, and the job it is running
+static thread_local int currentWorker = -1;
+static thread_local JobSystem::Job* currentJob = NULL;
+
+JobSystem::JobSystem(unsigned int numWorkers) {
+	if(numWorkers == 0)
+		numWorkers = std::max(2u, std::thread::hardware_concurrency()) - 1;
+
+	nextQueue_ = 0;
+	numReady_ = 0;
+	numMainReady_ = 0;
+	quit_ = false;
+	epoch_ = timer::HighResClock::now();
+	numSteals_ = 0;
+	criticalJob_ = NULL;
+	clear();
+
+	for(unsigned int i = 0; i < numWorkers; i++) {
+		queues_.push_back(new WorkerQueue());
+	}
+	for(unsigned int i = 0; i < numWorkers; i++) {
+		workers_.push_back(std::thread(&JobSystem::workerLoop, this, i));
+	}
+}
+
+JobSystem::~JobSystem() {
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex_);
+		quit_ = true;
+	}
+	sleepCondition_.notify_all();
+	for(size_t i = 0; i < workers_.size(); i++) {
+		workers_[i].join();
+	}
+
+	for(size_t i = 0; i < queues_.size(); i++) {
+		delete queues_[i];
+	}
+	for(size_t i = 0; i < jobs_.size(); i++) {
+		delete jobs_[i];
+	}
+}
+
+JobSystem::Job* JobSystem::create(const char* name, std::function<void()> function, bool mainThread) {
+	Job* job = new Job();
+	job->name = name;
+	job->function = function;
+	job->mainThread = mainThread;
+	job->finished = false;
+	job->unfinishedDependencies = 1;
+	job->readyPath = 0.0;
+	job->criticalParent = NULL;
+	job->startTime = 0.0;
+	job->finishPath = 0.0;
+
+	// A job created by a running job can't start before that point of its parent
+	if(currentJob) {
+		job->readyPath = currentJob->readyPath + (getTime() - currentJob->startTime);
+		job->criticalParent = currentJob;
+	}
+
+	std::lock_guard<std::mutex> lock(graphMutex_);
+	jobs_.push_back(job);
+	return job;
+}
+
+void JobSystem::addDependency(Job* job, Job* dependency) {
+	std::lock_guard<std::mutex> lock(graphMutex_);
+	if(dependency->finished) {
+		if(dependency->finishPath > job->readyPath) {
+			job->readyPath = dependency->finishPath;
+			job->criticalParent = dependency;
+		}
+		return;
+	}
+	job->unfinishedDependencies++;
+	dependency->dependents.push_back(job);
+}
+
+void JobSystem::submit(Job* job) {
+	bool ready;
+	{
+		std::lock_guard<std::mutex> lock(graphMutex_);
+		ready = --job->unfinishedDependencies == 0;
+	}
+	if(ready)
+		schedule(job);
+}
+
+JobSystem::Job* JobSystem::add(const char* name, std::function<void()> function, bool mainThread) {
+	Job* job = create(name, function, mainThread);
+	submit(job);
+	return job;
+}
+
+JobSystem::Job* JobSystem::add(const char* name, std::function<void()> function, const std::vector<Job*>& dependencies, bool mainThread) {
+	Job* job = create(name, function, mainThread);
+	for(size_t i = 0; i < dependencies.size(); i++) {
+		addDependency(job, dependencies[i]);
+	}
+	submit(job);
+	return job;
+}
+
+// Workers push to their own queue, other threads spread their jobs over all queues
+void JobSystem::schedule(Job* job) {
+	if(job->mainThread) {
+		std::lock_guard<std::mutex> lock(mainMutex_);
+		mainQueue_.push_back(job);
+	}
+	else {
+		unsigned int queue = currentWorker >= 0 ? (unsigned int)currentWorker : nextQueue_++ % queues_.size();
+		std::lock_guard<std::mutex> lock(queues_[queue]->mutex);
+		queues_[queue]->jobs.push_back(job);
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex_);
+		if(job->mainThread)
+			numMainReady_++;
+		else
+			numReady_++;
+	}
+	sleepCondition_.notify_all();
+}
+
+// Newest job of the own queue, or the oldest job of another one
+JobSystem::Job* JobSystem::getWorkerJob(int worker) {
+	{
+		WorkerQueue* queue = queues_[worker];
+		std::lock_guard<std::mutex> lock(queue->mutex);
+		if(!queue->jobs.empty()) {
+			Job* job = queue->jobs.back();
+			queue->jobs.pop_back();
+			numReady_--;
+			return job;
+		}
+	}
+
+	size_t numQueues = queues_.size();
+	for(size_t i = 1; i <= numQueues; i++) {
+		WorkerQueue* queue = queues_[(worker + i) % numQueues];
+		std::lock_guard<std::mutex> lock(queue->mutex);
+		if(!queue->jobs.empty()) {
+			Job* job = queue->jobs.front();
+			queue->jobs.pop_front();
+			numReady_--;
+			numSteals_++;
+			return job;
+		}
+	}
+	return NULL;
+}
+
+JobSystem::Job* JobSystem::getMainThreadJob() {
+	std::lock_guard<std::mutex> lock(mainMutex_);
+	if(mainQueue_.empty())
+		return NULL;
+	Job* job = mainQueue_.front();
+	mainQueue_.pop_front();
+	numMainReady_--;
+	return job;
+}
+
+void JobSystem::workerLoop(unsigned int index) {
+	currentWorker = (int)index;
+	while(true) {
+		Job* job = getWorkerJob(currentWorker);
+		if(job) {
+			run(job);
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(sleepMutex_);
+		sleepCondition_.wait(lock, [this]() { return quit_ || numReady_ > 0; });
+		if(quit_)
+			break;
+	}
+}
+
+void JobSystem::run(Job* job) {
+	Job* parent = currentJob;
+	currentJob = job;
+	auto start = timer::HighResClock::now();
+	job->startTime = std::chrono::duration<double>(start - epoch_).count();
+	job->function();
+	auto end = timer::HighResClock::now();
+	double finishTime = std::chrono::duration<double>(end - epoch_).count();
+	currentJob = parent;
+	// Free whatever the function captured
+	job->function = nullptr;
+	Profiler::recordCPU(job->name, start, end);
+
+	std::vector<Job*> ready;
+	{
+		std::lock_guard<std::mutex> lock(graphMutex_);
+		double duration = finishTime - job->startTime;
+		job->finishPath = job->readyPath + duration;
+		for(size_t i = 0; i < job->dependents.size(); i++) {
+			Job* dependent = job->dependents[i];
+			if(job->finishPath > dependent->readyPath) {
+				dependent->readyPath = job->finishPath;
+				dependent->criticalParent = job;
+			}
+			if(--dependent->unfinishedDependencies == 0)
+				ready.push_back(dependent);
+		}
+		job->dependents.clear();
+		job->finished = true;
+
+		numJobsRun_++;
+		if(job->mainThread)
+			numMainThreadJobs_++;
+		totalWork_ += duration;
+		firstStart_ = std::min(firstStart_, job->startTime);
+		lastFinish_ = std::max(lastFinish_, finishTime);
+		if(!criticalJob_ || job->finishPath > criticalJob_->finishPath)
+			criticalJob_ = job;
+	}
+
+	for(size_t i = 0; i < ready.size(); i++) {
+		schedule(ready[i]);
+	}
+
+	// The main thread may be waiting for exactly this job. Taking the lock makes sure
+	// it is either already sleeping or will see the finished flag.
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex_);
+	}
+	sleepCondition_.notify_all();
+}
+
+void JobSystem::wait(Job* job) {
+	// The main thread doesn't steal, a long job would hold up the GL work queued behind it
+	while(!job->finished) {
+		Job* next = getMainThreadJob();
+		if(next) {
+			run(next);
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(sleepMutex_);
+		sleepCondition_.wait(lock, [this, job]() { return job->finished || numMainReady_ > 0; });
+	}
+}
+
+void JobSystem::wait(const std::vector<Job*>& jobs) {
+	for(size_t i = 0; i < jobs.size(); i++) {
+		wait(jobs[i]);
+	}
+}
+
+bool JobSystem::isFinished(Job* job) {
+	return job->finished;
+}
+
+void JobSystem::runMainThreadJobs(double timeBudgetSeconds) {
+	double start = getTime();
+	Job* job;
+	while((job = getMainThreadJob()) != NULL) {
+		run(job);
+		if(getTime() - start > timeBudgetSeconds)
+			break;
+	}
+}
+
+void JobSystem::printStats(std::ostream& out) {
+	std::lock_guard<std::mutex> lock(graphMutex_);
+	if(numJobsRun_ == 0 || !criticalJob_)
+		return;
+
+	double wallTime = lastFinish_ - firstStart_;
+	double criticalPath = criticalJob_->finishPath;
+	out << "Jobs: " << numJobsRun_ << " on " << workers_.size() << " workers and the main thread ("
+		<< numMainThreadJobs_ << " main thread jobs, " << numSteals_ << " steals)" << std::endl;
+	out << std::fixed << std::setprecision(1)
+		<< "\twork: " << totalWork_ * 1000.0 << " ms, wall time: " << wallTime * 1000.0 << " ms" << std::endl
+		<< "\tcritical path: " << criticalPath * 1000.0 << " ms" << std::endl
+		<< std::setprecision(2)
+		<< "\tparallelism: " << totalWork_ / std::max(criticalPath, 1e-9) << " available (work / critical path), "
+		<< totalWork_ / std::max(wallTime, 1e-9) << " achieved (work / wall time)" << std::endl;
+	out.unsetf(std::ios::floatfield);
+	out << std::setprecision(6);
+
+	// Chain of jobs making up the critical path, repeated names are folded
+	std::vector<Job*> chain;
+	for(Job* job = criticalJob_; job; job = job->criticalParent) {
+		chain.push_back(job);
+	}
+	out << "\tcritical path jobs: ";
+	for(size_t i = chain.size(); i > 0; i--) {
+		size_t repeats = 1;
+		while(i > 1 && strcmp(chain[i - 2]->name, chain[i - 1]->name) == 0) {
+			repeats++;
+			i--;
+		}
+		out << chain[i - 1]->name;
+		if(repeats > 1)
+			out << " x" << repeats;
+		if(i > 1)
+			out << " -> ";
+	}
+	out << std::endl;
+}
+
+void JobSystem::clear() {
+	std::lock_guard<std::mutex> lock(graphMutex_);
+	std::vector<Job*> kept;
+	for(size_t i = 0; i < jobs_.size(); i++) {
+		if(jobs_[i]->finished)
+			delete jobs_[i];
+		else
+			kept.push_back(jobs_[i]);
+	}
+	jobs_.swap(kept);
+
+	// Unfinished jobs may still point at the deleted ones
+	for(size_t i = 0; i < jobs_.size(); i++) {
+		jobs_[i]->criticalParent = NULL;
+	}
+
+	numJobsRun_ = 0;
+	numMainThreadJobs_ = 0;
+	numSteals_ = 0;
+	totalWork_ = 0.0;
+	firstStart_ = 1e30;
+	lastFinish_ = 0.0;
+	criticalJob_ = NULL;
+}
+
+unsigned int JobSystem::getNumWorkers() {
+	return (unsigned int)workers_.size();
+}
+
+double JobSystem::getTime() {
+	return std::chrono::duration<double>(timer::HighResClock::now() - epoch_).count();
+}
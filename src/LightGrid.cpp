@@ -0,0 +1,201 @@
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+
+#include "MemoryTracker.h"
+#include "Profiler.h"
+#include "LightGrid.h"
+
+LightGrid::LightGrid() {
+	dirty_ = true;
+	lightBuffer_ = clusterBuffer_ = brickBuffer_ = 0;
+	lightBufferSize_ = 0;
+	bricksPerAxis_ = 0;
+	clusterNear_ = 0.1f;
+	clusterFar_ = 1000.0f;
+}
+
+LightGrid::~LightGrid() {
+	size_t numClusters = CLUSTERS_X * CLUSTERS_Y * CLUSTERS_Z;
+	size_t numBricks = (size_t)bricksPerAxis_ * bricksPerAxis_ * bricksPerAxis_;
+	if(lightBuffer_) {
+		MemoryTracker::release(MemoryTracker::GEOMETRY, lightBufferSize_);
+		glDeleteBuffers(1, &lightBuffer_);
+	}
+	if(clusterBuffer_) {
+		MemoryTracker::release(MemoryTracker::GEOMETRY, numClusters * (MAX_CLUSTER_LIGHTS + 1) * sizeof(GLuint));
+		glDeleteBuffers(1, &clusterBuffer_);
+	}
+	if(brickBuffer_) {
+		MemoryTracker::release(MemoryTracker::VOXELS, numBricks * (MAX_BRICK_LIGHTS + 1) * sizeof(GLuint));
+		glDeleteBuffers(1, &brickBuffer_);
+	}
+}
+
+bool LightGrid::load(std::string filename) {
+	std::ifstream file(filename.c_str());
+	if(!file.is_open()) {
+		std::cout << "Couldn't open light list " << filename << std::endl;
+		return false;
+	}
+
+	size_t numLights = lights_.size();
+	std::string line;
+	while(std::getline(file, line)) {
+		if(line.empty() || line[0] == '#')
+			continue;
+
+		// Commas are replaced so the values can be read with >>
+		for(size_t i = 0; i < line.size(); i++) {
+			if(line[i] == ',')
+				line[i] = ' ';
+		}
+		std::istringstream values(line);
+		Light light;
+		glm::vec3 position, color;
+		float range;
+		if(!(values >> position.x >> position.y >> position.z >> color.r >> color.g >> color.b >> range))
+			continue;
+		light.positionRange = glm::vec4(position, range);
+		light.colorSpotInner = glm::vec4(color, -1.0f);
+		light.directionSpotOuter = glm::vec4(0.0f, -1.0f, 0.0f, -1.0f);
+
+		glm::vec3 direction;
+		float inner, outer;
+		if(values >> direction.x >> direction.y >> direction.z >> inner >> outer && glm::length(direction) > 0.0f) {
+			light.colorSpotInner.w = cosf(glm::radians(inner));
+			light.directionSpotOuter = glm::vec4(glm::normalize(direction), cosf(glm::radians(glm::max(outer, inner + 0.1f))));
+		}
+		lights_.push_back(light);
+	}
+
+	std::cout << "Loaded light list " << filename << " with " << lights_.size() - numLights << " lights" << std::endl;
+	dirty_ = true;
+	return lights_.size() > numLights;
+}
+
+void LightGrid::addRandomLights(int count, glm::vec3 boundsMin, glm::vec3 boundsMax, float range) {
+	std::mt19937 random(580);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	for(int i = 0; i < count; i++) {
+		Light light;
+		glm::vec3 position = boundsMin + (boundsMax - boundsMin) * glm::vec3(unit(random), unit(random), unit(random));
+		// Saturated colors, so the lights can be told apart
+		glm::vec3 color = glm::vec3(unit(random), unit(random), unit(random));
+		color /= glm::max(color.r, glm::max(color.g, color.b));
+		light.positionRange = glm::vec4(position, range);
+		light.colorSpotInner = glm::vec4(color * 4.0f, -1.0f);
+		light.directionSpotOuter = glm::vec4(0.0f, -1.0f, 0.0f, -1.0f);
+		lights_.push_back(light);
+	}
+	dirty_ = true;
+}
+
+size_t LightGrid::getNumLights() {
+	return lights_.size();
+}
+
+std::string LightGrid::getShaderDefines() {
+	std::ostringstream defines;
+	defines << "#define MANY_LIGHTS" << std::endl
+			<< "#define CLUSTERS_X " << CLUSTERS_X << std::endl
+			<< "#define CLUSTERS_Y " << CLUSTERS_Y << std::endl
+			<< "#define CLUSTERS_Z " << CLUSTERS_Z << std::endl
+			<< "#define MAX_CLUSTER_LIGHTS " << MAX_CLUSTER_LIGHTS << std::endl
+			<< "#define BRICK_SIZE " << BRICK_SIZE << std::endl
+			<< "#define MAX_BRICK_LIGHTS " << MAX_BRICK_LIGHTS;
+	return defines.str();
+}
+
+void LightGrid::initialize(int voxelDimensions) {
+	size_t numClusters = CLUSTERS_X * CLUSTERS_Y * CLUSTERS_Z;
+	glGenBuffers(1, &clusterBuffer_);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, clusterBuffer_);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, numClusters * (MAX_CLUSTER_LIGHTS + 1) * sizeof(GLuint), NULL, GL_DYNAMIC_DRAW);
+	MemoryTracker::allocate(MemoryTracker::GEOMETRY, numClusters * (MAX_CLUSTER_LIGHTS + 1) * sizeof(GLuint));
+
+	bricksPerAxis_ = voxelDimensions / BRICK_SIZE;
+	if(bricksPerAxis_ > 0) {
+		size_t numBricks = (size_t)bricksPerAxis_ * bricksPerAxis_ * bricksPerAxis_;
+		glGenBuffers(1, &brickBuffer_);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, brickBuffer_);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, numBricks * (MAX_BRICK_LIGHTS + 1) * sizeof(GLuint), NULL, GL_DYNAMIC_DRAW);
+		MemoryTracker::allocate(MemoryTracker::VOXELS, numBricks * (MAX_BRICK_LIGHTS + 1) * sizeof(GLuint));
+	}
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void LightGrid::update(GLuint shader, float voxelGridWorldSize) {
+	if(!dirty_)
+		return;
+	dirty_ = false;
+
+	PROFILE_GPU_ZONE("binLights");
+	size_t bytes = (lights_.empty() ? 1 : lights_.size()) * sizeof(Light);
+	if(!lightBuffer_)
+		glGenBuffers(1, &lightBuffer_);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, lightBuffer_);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, bytes, lights_.empty() ? NULL : &lights_[0], GL_STATIC_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	MemoryTracker::release(MemoryTracker::GEOMETRY, lightBufferSize_);
+	MemoryTracker::allocate(MemoryTracker::GEOMETRY, bytes);
+	lightBufferSize_ = bytes;
+
+	if(!brickBuffer_)
+		return;
+	glUseProgram(shader);
+	glUniform1i(glGetUniformLocation(shader, "VoxelBricks"), 1);
+	glUniform1f(glGetUniformLocation(shader, "VoxelGridWorldSize"), voxelGridWorldSize);
+	// Bricks are in world space
+	glm::mat4 identity(1.0f);
+	glUniformMatrix4fv(glGetUniformLocation(shader, "ViewMatrix"), 1, GL_FALSE, &identity[0][0]);
+	assign(shader, brickBuffer_, glm::ivec3(bricksPerAxis_), MAX_BRICK_LIGHTS);
+}
+
+void LightGrid::assignClusters(GLuint shader, const glm::mat4& viewMatrix, const glm::mat4& projectionMatrix, float nearPlane, float farPlane) {
+	PROFILE_GPU_ZONE("assignLightClusters");
+	clusterNear_ = nearPlane;
+	clusterFar_ = farPlane;
+
+	glUseProgram(shader);
+	glm::mat4 inverseProjection = glm::inverse(projectionMatrix);
+	glUniform1i(glGetUniformLocation(shader, "VoxelBricks"), 0);
+	glUniformMatrix4fv(glGetUniformLocation(shader, "ViewMatrix"), 1, GL_FALSE, &viewMatrix[0][0]);
+	glUniformMatrix4fv(glGetUniformLocation(shader, "InverseProjectionMatrix"), 1, GL_FALSE, &inverseProjection[0][0]);
+	glUniform1f(glGetUniformLocation(shader, "ClusterNear"), clusterNear_);
+	glUniform1f(glGetUniformLocation(shader, "ClusterFar"), clusterFar_);
+	assign(shader, clusterBuffer_, glm::ivec3(CLUSTERS_X, CLUSTERS_Y, CLUSTERS_Z), MAX_CLUSTER_LIGHTS);
+}
+
+// One thread per cell
+void LightGrid::assign(GLuint shader, GLuint cells, glm::ivec3 gridSize, GLuint maxCellLights) {
+	glUniform1ui(glGetUniformLocation(shader, "NumLights"), (GLuint)lights_.size());
+	glUniform3i(glGetUniformLocation(shader, "GridSize"), gridSize.x, gridSize.y, gridSize.z);
+	glUniform1ui(glGetUniformLocation(shader, "MaxCellLights"), maxCellLights);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, LIGHT_BINDING, lightBuffer_);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CELL_BINDING, cells);
+
+	GLuint numCells = (GLuint)(gridSize.x * gridSize.y * gridSize.z);
+	glDispatchCompute((numCells + 63) / 64, 1, 1);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+void LightGrid::bindClusters(GLuint shader, int width, int height) {
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, LIGHT_BINDING, lightBuffer_);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CELL_BINDING, clusterBuffer_);
+	glUniform2f(glGetUniformLocation(shader, "ScreenSize"), (float)width, (float)height);
+	glUniform1f(glGetUniformLocation(shader, "ClusterNear"), clusterNear_);
+	glUniform1f(glGetUniformLocation(shader, "ClusterFar"), clusterFar_);
+}
+
+void LightGrid::bindBricks(GLuint shader, GLuint occlusionTexture, GLuint occlusionUnit, float voxelGridWorldSize) {
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, LIGHT_BINDING, lightBuffer_);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CELL_BINDING, brickBuffer_);
+	glUniform1f(glGetUniformLocation(shader, "VoxelGridWorldSize"), voxelGridWorldSize);
+	glActiveTexture(GL_TEXTURE0 + occlusionUnit);
+	glBindTexture(GL_TEXTURE_3D, occlusionTexture);
+	glUniform1i(glGetUniformLocation(shader, "OcclusionTexture"), occlusionUnit);
+	glActiveTexture(GL_TEXTURE0);
+}
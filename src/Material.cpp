@@ -4,21 +4,65 @@
 #include "stb_image.h"
 
 #include "Shader.h"
+#include "MemoryTracker.h"
+#include "Profiler.h"
 #include "Material.h"
 
+static size_t getTextureBytes(const Texture2D& tex) {
+	// Only these are uploaded by uploadTexture
+	if(tex.componentsPerPixel != 4 && tex.componentsPerPixel != 3 && tex.componentsPerPixel != 1)
+		return 0;
+	GLenum format = tex.componentsPerPixel == 1 ? GL_RED : GL_RGBA;
+	return MemoryTracker::getTextureBytes(format, tex.width, tex.height, 1, true);
+}
+
 Material::Material() {
 	Texture2D tex;
-	tex.width = tex.height = tex.textureID = 0;
+	tex.width = tex.height = tex.textureID = tex.componentsPerPixel = 0;
 	
 	diffuseTexture_ = tex;
 	specularTexture_ = tex;
 	maskTexture_ = tex;
 	heightTexture_ = tex;
 	hasAlpha_ = true;
+	materialID_ = -1;
+	shininess_ = 0.0f;
+	opacity_ = 1.0f;
 }
 
 Material::~Material() {
-	
+	Texture2D* textures[NUM_TEXTURES] = { &diffuseTexture_, &specularTexture_, &maskTexture_, &heightTexture_ };
+	for(int t = 0; t < NUM_TEXTURES; t++) {
+		if(textures[t]->textureID) {
+			MemoryTracker::release(MemoryTracker::TEXTURES, getTextureBytes(*textures[t]));
+			glDeleteTextures(1, &textures[t]->textureID);
+		}
+	}
+}
+
+GLuint Material::placeholderTextures_[NUM_TEXTURES] = { 0, 0, 0, 0 };
+
+// Textures that exist but haven't been streamed in yet are replaced by a 1x1 placeholder
+GLuint Material::getBoundTexture(TEXTURES_TYPES type, const Texture2D& texture) {
+	if(texture.textureID || texturePaths_[type].empty())
+		return texture.textureID;
+
+	if(!placeholderTextures_[type]) {
+		// Grey diffuse, no specular, fully opaque mask and flat height
+		const GLubyte colors[NUM_TEXTURES][4] = {
+			{ 128, 128, 128, 255 },
+			{ 0, 0, 0, 0 },
+			{ 255, 255, 255, 255 },
+			{ 0, 0, 0, 255 }
+		};
+		glGenTextures(1, &placeholderTextures_[type]);
+		glBindTexture(GL_TEXTURE_2D, placeholderTextures_[type]);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, colors[type]);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		MemoryTracker::allocate(MemoryTracker::TEXTURES, 4);
+	}
+	return placeholderTextures_[type];
 }
 
 void Material::loadAssimpMaterial(const aiMaterial* mat, std::string path) {
@@ -45,55 +89,115 @@ void Material::loadAssimpMaterial(const aiMaterial* mat, std::string path) {
 
 	mat->Get(AI_MATKEY_SHININESS, shininess_);
 
-	if(mat->GetTextureCount(aiTextureType_DIFFUSE) > 0) {
-		std::cout << "\t\tdiffuseTexture_ loaded" << std::endl;
-		aiString texturePath;
-		if(mat->GetTexture(aiTextureType_DIFFUSE, 0, &texturePath) == AI_SUCCESS) {
-			std::string fullPath = path + texturePath.data;
-			std::replace( fullPath.begin(), fullPath.end(), '\\', '/'); // replace all '\' with '/'
-			diffuseTexture_ = loadTexture(fullPath);
+	// Only the paths are stored here, the textures are loaded by loadTextures()
+	// or streamed in by the SceneLoader
+	const aiTextureType assimpTypes[NUM_TEXTURES] = { aiTextureType_DIFFUSE, aiTextureType_AMBIENT, aiTextureType_OPACITY, aiTextureType_HEIGHT };
+	for(int t = 0; t < NUM_TEXTURES; t++) {
+		if(mat->GetTextureCount(assimpTypes[t]) > 0) {
+			aiString texturePath;
+			if(mat->GetTexture(assimpTypes[t], 0, &texturePath) == AI_SUCCESS) {
+				std::string fullPath = path + texturePath.data;
+				std::replace( fullPath.begin(), fullPath.end(), '\\', '/'); // replace all '\' with '/'
+				texturePaths_[t] = fullPath;
+			}
 		}
 	}
+}
 
-	if(mat->GetTextureCount(aiTextureType_AMBIENT) > 0) {
-		std::cout << "\t\tspecularTexture_ loaded" << std::endl;
-		aiString texturePath;
-		if(mat->GetTexture(aiTextureType_AMBIENT, 0, &texturePath) == AI_SUCCESS) {
-			std::string fullPath = path + texturePath.data;
-			std::replace( fullPath.begin(), fullPath.end(), '\\', '/'); // replace all '\' with '/'
-			specularTexture_ = loadTexture(fullPath);
+void Material::loadTextures() {
+	for(int t = 0; t < NUM_TEXTURES; t++) {
+		if(!texturePaths_[t].empty()) {
+			setTexture((TEXTURES_TYPES)t, loadTexture(texturePaths_[t]));
 		}
 	}
+}
 
-	if(mat->GetTextureCount(aiTextureType_HEIGHT) > 0) {
-		std::cout << "\t\theightTexture_ loaded" << std::endl;
-		aiString texturePath;
-		if(mat->GetTexture(aiTextureType_HEIGHT, 0, &texturePath) == AI_SUCCESS) {
-			std::string fullPath = path + texturePath.data;
-			std::replace( fullPath.begin(), fullPath.end(), '\\', '/'); // replace all '\' with '/'
-			heightTexture_ = loadTexture(fullPath);
-		}
+void Material::setTexture(TEXTURES_TYPES type, Texture2D texture) {
+	switch(type) {
+		case DIFFUSE_TEXTURE:
+			std::cout << "\t\tdiffuseTexture_ loaded" << std::endl;
+			diffuseTexture_ = texture;
+			break;
+		case SPECULAR_TEXTURE:
+			std::cout << "\t\tspecularTexture_ loaded" << std::endl;
+			specularTexture_ = texture;
+			break;
+		case MASK_TEXTURE:
+			std::cout << "\t\tmaskTexture_ loaded" << std::endl;
+			maskTexture_ = texture;
+			break;
+		case HEIGHT_TEXTURE:
+			std::cout << "\t\theightTexture_ loaded" << std::endl;
+			heightTexture_ = texture;
+			break;
+		default:
+			break;
 	}
+}
 
-	if(mat->GetTextureCount(aiTextureType_OPACITY) > 0) {
-		std::cout << "\t\tmaskTexture_ loaded" << std::endl;
-		aiString texturePath;
-		if(mat->GetTexture(aiTextureType_OPACITY, 0, &texturePath) == AI_SUCCESS) {
-			std::string fullPath = path + texturePath.data;
-			std::replace( fullPath.begin(), fullPath.end(), '\\', '/'); // replace all '\' with '/'
-			maskTexture_ = loadTexture(fullPath);
-		}
+std::string Material::getTexturePath(TEXTURES_TYPES type) {
+	return texturePaths_[type];
+}
+
+Texture2D Material::getBoundTexture(TEXTURES_TYPES type) {
+	const Texture2D* textures[NUM_TEXTURES] = { &diffuseTexture_, &specularTexture_, &maskTexture_, &heightTexture_ };
+	Texture2D texture = *textures[type];
+	GLuint bound = getBoundTexture(type, texture);
+	if(bound != texture.textureID) {
+		texture.textureID = bound;
+		texture.width = texture.height = 1;
+		texture.componentsPerPixel = 4;
 	}
+	return texture;
+}
+
+float Material::getShininess() {
+	return shininess_;
+}
+
+float Material::getOpacity() {
+	return opacity_;
 }
 
 Texture2D Material::loadTexture(std::string filenameString) {
-	Texture2D tex;
+	PROFILE_ZONE("loadTexture");
+	ImageData image = decodeTexture(filenameString);
+	return uploadTexture(image, filenameString);
+}
+
+// Only decodes the image file, safe to call from any thread
+Material::ImageData Material::decodeTexture(std::string filenameString) {
+	PROFILE_ZONE("decodeTexture");
+	ImageData image;
+	image.width = image.height = image.componentsPerPixel = 0;
 
     const char* filename = filenameString.c_str();
-    GLubyte* textureData = stbi_load(filename, &tex.width, &tex.height, &tex.componentsPerPixel, 0);
+    image.data = stbi_load(filename, &image.width, &image.height, &image.componentsPerPixel, 0);
 
-    if(!textureData) {
+    if(!image.data) {
     	std::cout << "Couldn't load image: " << filename << std::endl;
+    }
+
+    return image;
+}
+
+void Material::freeImage(ImageData& image) {
+	if(image.data)
+		stbi_image_free(image.data);
+	image.data = NULL;
+}
+
+// Uploads a decoded image and frees it. Must be called on the thread owning the GL context.
+Texture2D Material::uploadTexture(ImageData& image, std::string filenameString) {
+	PROFILE_ZONE("uploadTexture");
+	Texture2D tex;
+	tex.textureID = 0;
+	tex.width = image.width;
+	tex.height = image.height;
+	tex.componentsPerPixel = image.componentsPerPixel;
+	GLubyte* textureData = image.data;
+
+    if(!textureData) {
     	return tex;
     }
 
@@ -142,6 +246,7 @@ Texture2D Material::loadTexture(std::string filenameString) {
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR); 
 		glGenerateMipmap(GL_TEXTURE_2D);
+		MemoryTracker::allocate(MemoryTracker::TEXTURES, getTextureBytes(tex));
 	}
 
     // Check for OpenGL texture creation errors
@@ -167,6 +272,7 @@ Texture2D Material::loadTexture(std::string filenameString) {
     }
 
     stbi_image_free(textureData);
+    image.data = NULL;
 
     return tex;
 }
@@ -174,6 +280,13 @@ Texture2D Material::loadTexture(std::string filenameString) {
 void Material::bindMaterial(GLuint shader) {
 	glUseProgram(shader);
 
+	// Shaders built with a MaterialTable read everything from its buffer
+	GLint materialIDLocation = glGetUniformLocation(shader, "MaterialID");
+	if(materialIDLocation >= 0 && materialID_ >= 0) {
+		glUniform1i(materialIDLocation, materialID_);
+		return;
+	}
+
 	// glUniform3f(glGetUniformLocation(shader, "AmbientColor"), ambientColor_.r, ambientColor_.g, ambientColor_.b);
 	// glUniform3f(glGetUniformLocation(shader, "DiffuseColor"), diffuseColor_.r, diffuseColor_.g, diffuseColor_.b);
 	// glUniform3f(glGetUniformLocation(shader, "SpecularColor"), specularColor_.r, specularColor_.g, specularColor_.b);
@@ -182,22 +295,22 @@ void Material::bindMaterial(GLuint shader) {
 	glUniform1f(glGetUniformLocation(shader, "Opacity"), opacity_);
 
 	glActiveTexture(GL_TEXTURE0 + DIFFUSE_TEXTURE);
-	glBindTexture(GL_TEXTURE_2D, diffuseTexture_.textureID);
+	glBindTexture(GL_TEXTURE_2D, getBoundTexture(DIFFUSE_TEXTURE, diffuseTexture_));
 	glUniform1i(glGetUniformLocation(shader, "DiffuseTexture"), DIFFUSE_TEXTURE);
-	glUniform2f(glGetUniformLocation(shader, "DiffuseTextureSize"), diffuseTexture_.width, diffuseTexture_.height);
+	glUniform2f(glGetUniformLocation(shader, "DiffuseTextureSize"), glm::max(diffuseTexture_.width, 1), glm::max(diffuseTexture_.height, 1));
 
 	glActiveTexture(GL_TEXTURE0 + SPECULAR_TEXTURE);
-	glBindTexture(GL_TEXTURE_2D, specularTexture_.textureID);
+	glBindTexture(GL_TEXTURE_2D, getBoundTexture(SPECULAR_TEXTURE, specularTexture_));
 	glUniform1i(glGetUniformLocation(shader, "SpecularTexture"), SPECULAR_TEXTURE);
-	glUniform2f(glGetUniformLocation(shader, "SpecularTextureSize"), specularTexture_.width, specularTexture_.height);
+	glUniform2f(glGetUniformLocation(shader, "SpecularTextureSize"), glm::max(specularTexture_.width, 1), glm::max(specularTexture_.height, 1));
 
 	glActiveTexture(GL_TEXTURE0 + MASK_TEXTURE);
-	glBindTexture(GL_TEXTURE_2D, maskTexture_.textureID);
+	glBindTexture(GL_TEXTURE_2D, getBoundTexture(MASK_TEXTURE, maskTexture_));
 	glUniform1i(glGetUniformLocation(shader, "MaskTexture"), MASK_TEXTURE);
-	glUniform2f(glGetUniformLocation(shader, "MaskTextureSize"), maskTexture_.width, maskTexture_.height);
+	glUniform2f(glGetUniformLocation(shader, "MaskTextureSize"), glm::max(maskTexture_.width, 1), glm::max(maskTexture_.height, 1));
 
 	glActiveTexture(GL_TEXTURE0 + HEIGHT_TEXTURE);
-	glBindTexture(GL_TEXTURE_2D, heightTexture_.textureID);
+	glBindTexture(GL_TEXTURE_2D, getBoundTexture(HEIGHT_TEXTURE, heightTexture_));
 	glUniform1i(glGetUniformLocation(shader, "HeightTexture"), HEIGHT_TEXTURE);
-	glUniform2f(glGetUniformLocation(shader, "HeightTextureSize"), heightTexture_.width, heightTexture_.height);
+	glUniform2f(glGetUniformLocation(shader, "HeightTextureSize"), glm::max(heightTexture_.width, 1), glm::max(heightTexture_.height, 1));
 }
\ No newline at end of file
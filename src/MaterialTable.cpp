@@ -0,0 +1,219 @@
+#include <iostream>
+
+#include "MemoryTracker.h"
+#include "Profiler.h"
+#include "MaterialTable.h"
+
+MaterialTable::MaterialTable(bool bindless) {
+	bindless_ = bindless;
+	buffer_ = 0;
+	bufferSize_ = 0;
+
+	const GLubyte black[4] = { 0, 0, 0, 255 };
+	glGenTextures(1, &missingTexture_);
+	glBindTexture(GL_TEXTURE_2D, missingTexture_);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, black);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	MemoryTracker::allocate(MemoryTracker::TEXTURES, 4);
+
+	for(int b = 0; b < NUM_BUCKETS; b++) {
+		buckets_[b].texture = 0;
+		buckets_[b].size = MIN_BUCKET_SIZE << b;
+		buckets_[b].numLayers = buckets_[b].capacity = 0;
+		buckets_[b].mipmapsDirty = false;
+	}
+	framebuffers_[0] = framebuffers_[1] = 0;
+	if(!bindless_)
+		glGenFramebuffers(2, framebuffers_);
+}
+
+MaterialTable::~MaterialTable() {
+	for(std::map<GLuint, GLuint64>::iterator handle = handles_.begin(); handle != handles_.end(); ++handle) {
+		glMakeTextureHandleNonResidentARB(handle->second);
+	}
+	for(int b = 0; b < NUM_BUCKETS; b++) {
+		if(buckets_[b].texture) {
+			MemoryTracker::release(MemoryTracker::TEXTURES, buckets_[b].capacity * MemoryTracker::getTextureBytes(GL_RGBA8, buckets_[b].size, buckets_[b].size, 1, true));
+			glDeleteTextures(1, &buckets_[b].texture);
+		}
+	}
+	if(framebuffers_[0])
+		glDeleteFramebuffers(2, framebuffers_);
+	if(buffer_) {
+		MemoryTracker::release(MemoryTracker::GEOMETRY, bufferSize_);
+		glDeleteBuffers(1, &buffer_);
+	}
+	MemoryTracker::release(MemoryTracker::TEXTURES, 4);
+	glDeleteTextures(1, &missingTexture_);
+}
+
+bool MaterialTable::isBindless() {
+	return bindless_;
+}
+
+const char* MaterialTable::getShaderHeader() {
+	if(bindless_) {
+		return "#version 430 core\n"
+			   "#extension GL_ARB_bindless_texture : require\n"
+			   "#define MATERIAL_TABLE\n"
+			   "#define BINDLESS_TEXTURES";
+	}
+	return "#version 430 core\n"
+		   "#define MATERIAL_TABLE\n"
+		   "#define NUM_MATERIAL_BUCKETS 4";
+}
+
+size_t MaterialTable::getNumMaterials() {
+	return materials_.size();
+}
+
+void MaterialTable::update(const std::map<int, Material*>& materials) {
+	bool rebuild = false;
+	for(std::map<int, Material*>::const_iterator material = materials.begin(); material != materials.end(); ++material) {
+		if(material->second->materialID_ < 0) {
+			material->second->materialID_ = (int)materials_.size();
+			materials_.push_back(material->second);
+			builtTextures_.resize(materials_.size() * Material::NUM_TEXTURES, 0);
+			rebuild = true;
+		}
+	}
+
+	// Placeholders are replaced by the streamed textures as they come in
+	for(size_t m = 0; m < materials_.size() && !rebuild; m++) {
+		for(int t = 0; t < Material::NUM_TEXTURES; t++) {
+			if(materials_[m]->getBoundTexture((Material::TEXTURES_TYPES)t).textureID != builtTextures_[m * Material::NUM_TEXTURES + t])
+				rebuild = true;
+		}
+	}
+	if(!rebuild)
+		return;
+
+	PROFILE_ZONE("updateMaterialTable");
+	std::vector<Entry> entries(materials_.size());
+	for(size_t m = 0; m < materials_.size(); m++) {
+		Entry& entry = entries[m];
+		for(int t = 0; t < Material::NUM_TEXTURES; t++) {
+			Texture2D texture = materials_[m]->getBoundTexture((Material::TEXTURES_TYPES)t);
+			builtTextures_[m * Material::NUM_TEXTURES + t] = texture.textureID;
+			if(!texture.textureID) {
+				texture.textureID = missingTexture_;
+				texture.width = texture.height = 1;
+			}
+			getReference(texture, entry.textures[t], entry.textureSizes[t]);
+		}
+		entry.shininess = materials_[m]->getShininess();
+		entry.opacity = materials_[m]->getOpacity();
+		entry.padding[0] = entry.padding[1] = 0.0f;
+	}
+
+	for(int b = 0; b < NUM_BUCKETS; b++) {
+		if(buckets_[b].mipmapsDirty) {
+			glBindTexture(GL_TEXTURE_2D_ARRAY, buckets_[b].texture);
+			glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+			buckets_[b].mipmapsDirty = false;
+		}
+	}
+
+	size_t bytes = entries.size() * sizeof(Entry);
+	if(!buffer_)
+		glGenBuffers(1, &buffer_);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer_);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, bytes, &entries[0], GL_STATIC_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	MemoryTracker::release(MemoryTracker::GEOMETRY, bufferSize_);
+	MemoryTracker::allocate(MemoryTracker::GEOMETRY, bytes);
+	bufferSize_ = bytes;
+}
+
+void MaterialTable::bind(GLuint shader) {
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BUFFER_BINDING, buffer_);
+	if(bindless_)
+		return;
+
+	GLint units[NUM_BUCKETS];
+	for(int b = 0; b < NUM_BUCKETS; b++) {
+		units[b] = FIRST_BUCKET_UNIT + b;
+		glActiveTexture(GL_TEXTURE0 + units[b]);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, buckets_[b].texture);
+	}
+	glUniform1iv(glGetUniformLocation(shader, "MaterialArrays"), NUM_BUCKETS, units);
+	glActiveTexture(GL_TEXTURE0);
+}
+
+void MaterialTable::getReference(const Texture2D& texture, GLuint reference[2], GLfloat size[2]) {
+	if(bindless_) {
+		std::map<GLuint, GLuint64>::iterator handle = handles_.find(texture.textureID);
+		if(handle == handles_.end()) {
+			GLuint64 newHandle = glGetTextureHandleARB(texture.textureID);
+			glMakeTextureHandleResidentARB(newHandle);
+			handle = handles_.insert(std::make_pair(texture.textureID, newHandle)).first;
+		}
+		// uvec2 in the shader, low word first
+		reference[0] = (GLuint)(handle->second & 0xFFFFFFFFu);
+		reference[1] = (GLuint)(handle->second >> 32);
+		size[0] = (GLfloat)texture.width;
+		size[1] = (GLfloat)texture.height;
+		return;
+	}
+
+	std::map<GLuint, std::pair<int, int> >::iterator layer = layers_.find(texture.textureID);
+	if(layer == layers_.end())
+		layer = layers_.insert(std::make_pair(texture.textureID, addLayer(texture))).first;
+	reference[0] = layer->second.first;
+	reference[1] = layer->second.second;
+	size[0] = size[1] = (GLfloat)buckets_[layer->second.first].size;
+}
+
+// Scales the texture into the bucket of the next power of two size, clamped to the buckets
+std::pair<int, int> MaterialTable::addLayer(const Texture2D& texture) {
+	int bucketIndex = 0;
+	while(bucketIndex < NUM_BUCKETS - 1 && buckets_[bucketIndex].size < glm::max(texture.width, texture.height))
+		bucketIndex++;
+	Bucket& bucket = buckets_[bucketIndex];
+	if(bucket.numLayers == bucket.capacity)
+		growBucket(bucket);
+	int layer = bucket.numLayers++;
+
+	// The blit converts the format, single channel textures end up as (r, 0, 0, 1) like when sampled
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffers_[0]);
+	glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture.textureID, 0);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffers_[1]);
+	glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, bucket.texture, 0, layer);
+	glBlitFramebuffer(0, 0, texture.width, texture.height, 0, 0, bucket.size, bucket.size, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	bucket.mipmapsDirty = true;
+
+	return std::make_pair(bucketIndex, layer);
+}
+
+// Doubles the layers of the array, the ones already filled are copied with their mipmaps
+void MaterialTable::growBucket(Bucket& bucket) {
+	int capacity = glm::max(bucket.capacity * 2, 4);
+	int numLevels = 1 + (int)glm::log2((float)bucket.size);
+
+	GLuint texture;
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+	for(int level = 0; level < numLevels; level++) {
+		int levelSize = bucket.size >> level;
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, level, GL_RGBA8, levelSize, levelSize, capacity, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	}
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	MemoryTracker::allocate(MemoryTracker::TEXTURES, capacity * MemoryTracker::getTextureBytes(GL_RGBA8, bucket.size, bucket.size, 1, true));
+
+	if(bucket.texture) {
+		for(int level = 0; level < numLevels && bucket.numLayers > 0; level++) {
+			int levelSize = bucket.size >> level;
+			glCopyImageSubData(bucket.texture, GL_TEXTURE_2D_ARRAY, level, 0, 0, 0,
+							   texture, GL_TEXTURE_2D_ARRAY, level, 0, 0, 0, levelSize, levelSize, bucket.numLayers);
+		}
+		MemoryTracker::release(MemoryTracker::TEXTURES, bucket.capacity * MemoryTracker::getTextureBytes(GL_RGBA8, bucket.size, bucket.size, 1, true));
+		glDeleteTextures(1, &bucket.texture);
+	}
+	bucket.texture = texture;
+	bucket.capacity = capacity;
+}
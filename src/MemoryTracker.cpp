@@ -0,0 +1,102 @@
+#include <algorithm>
+
+#include "MemoryTracker.h"
+
+std::atomic<size_t> MemoryTracker::bytes_[NUM_CATEGORIES];
+std::atomic<size_t> MemoryTracker::peakBytes_[NUM_CATEGORIES];
+
+void MemoryTracker::allocate(Category category, size_t bytes) {
+	size_t current = (bytes_[category] += bytes);
+
+	// Raise the peak if needed, another thread may be doing the same
+	size_t peak = peakBytes_[category];
+	while(current > peak && !peakBytes_[category].compare_exchange_weak(peak, current)) {
+	}
+}
+
+void MemoryTracker::release(Category category, size_t bytes) {
+	bytes_[category] -= bytes;
+}
+
+size_t MemoryTracker::getBytes(Category category) {
+	return bytes_[category];
+}
+
+size_t MemoryTracker::getPeakBytes(Category category) {
+	return peakBytes_[category];
+}
+
+size_t MemoryTracker::getTotalBytes() {
+	size_t total = 0;
+	for(int c = 0; c < NUM_CATEGORIES; c++) {
+		total += bytes_[c];
+	}
+	return total;
+}
+
+size_t MemoryTracker::getTotalGPUBytes() {
+	return getTotalBytes() - bytes_[CPU_MIRRORS];
+}
+
+const char* MemoryTracker::getCategoryName(Category category) {
+	switch(category) {
+		case VOXELS: return "voxels";
+		case SHADOW: return "shadow";
+		case GEOMETRY: return "geometry";
+		case TEXTURES: return "textures";
+		case CPU_MIRRORS: return "cpu_mirrors";
+		default: return "unknown";
+	}
+}
+
+size_t MemoryTracker::getTextureBytes(GLenum internalFormat, int width, int height, int depth, bool mipmapped) {
+	// Drivers generally pad 3 component and 24 bit depth formats to 4 bytes per texel
+	size_t bytesPerTexel;
+	switch(internalFormat) {
+		case GL_RED:
+		case GL_R8:
+			bytesPerTexel = 1;
+			break;
+		case GL_RG:
+		case GL_RG8:
+		case GL_R16F:
+			bytesPerTexel = 2;
+			break;
+		case GL_RGBA16F:
+			bytesPerTexel = 8;
+			break;
+		case GL_RGBA32F:
+			bytesPerTexel = 16;
+			break;
+		default: // GL_RGB, GL_RGBA, GL_RGBA8, GL_DEPTH_COMPONENT24, GL_R32F, GL_R32UI...
+			bytesPerTexel = 4;
+			break;
+	}
+
+	size_t total = 0;
+	while(true) {
+		total += (size_t)width * height * depth * bytesPerTexel;
+		if(!mipmapped || (width == 1 && height == 1 && depth == 1))
+			break;
+		width = std::max(1, width / 2);
+		height = std::max(1, height / 2);
+		depth = std::max(1, depth / 2);
+	}
+	return total;
+}
+
+void MemoryTracker::printSummary(std::ostream& out) {
+	out << "Memory:";
+	for(int c = 0; c < NUM_CATEGORIES; c++) {
+		out << " " << getCategoryName((Category)c) << " " << bytes_[c] / (1024 * 1024) << " MB";
+	}
+	out << " | GPU total " << getTotalGPUBytes() / (1024 * 1024) << " MB" << std::endl;
+}
+
+void MemoryTracker::writeJSON(std::ostream& out) {
+	out << "{";
+	for(int c = 0; c < NUM_CATEGORIES; c++) {
+		out << "\"" << getCategoryName((Category)c) << "\": {\"bytes\": " << bytes_[c] << ", \"peak_bytes\": " << peakBytes_[c] << "}, ";
+	}
+	out << "\"gpu_total_bytes\": " << getTotalGPUBytes() << ", \"total_bytes\": " << getTotalBytes() << "}";
+}
@@ -1,5 +1,11 @@
 #include <iostream>
+#include <cstring>
+#include <limits>
 
+#include <glm/gtc/packing.hpp>
+
+#include "MemoryTracker.h"
+#include "MeshSimplifier.h"
 #include "Mesh.h"
 
 Mesh::Mesh() {
@@ -7,218 +13,662 @@ Mesh::Mesh() {
 	hasNormals_ = false;
 	hasTangentsAndBitangents_ = false;
 	numIndices_ = 0;
+	numVertices_ = 0;
+	indexType_ = GL_UNSIGNED_INT;
 	materialIndex_ = 0;
+	vertexArray_ = vboVertices_ = vboIndices_ = 0;
+	positionOffset_ = glm::vec3(0.0f);
+	positionScale_ = glm::vec3(1.0f);
+	aabbMin_ = aabbMax_ = glm::vec3(0.0f);
+	layout_ = getVertexLayout(true);
+	numClusters_ = 0;
+	clusterBuffer_ = 0;
+	LOD empty = { 0, 0, 0, 0, 0.0f };
+	lods_.assign(1, empty);
 }
 
 Mesh::~Mesh() {
+	if(vboVertices_)
+		MemoryTracker::release(MemoryTracker::GEOMETRY, getPackedLayoutBytes());
+	if(clusterBuffer_)
+		MemoryTracker::release(MemoryTracker::GEOMETRY, numClusters_ * sizeof(Cluster));
+	MemoryTracker::release(MemoryTracker::CPU_MIRRORS, getCPUCopyBytes());
+
+	if(vboVertices_)
+		glDeleteBuffers(1, &vboVertices_);
+	if(vboIndices_)
+		glDeleteBuffers(1, &vboIndices_);
+	if(vertexArray_)
+		glDeleteVertexArrays(1, &vertexArray_);
+	if(clusterBuffer_)
+		glDeleteBuffers(1, &clusterBuffer_);
+}
+
+Mesh::VertexLayout Mesh::getVertexLayout(bool quantizePositions) {
+	VertexLayout layout;
+	if(quantizePositions) {
+		// ushort3 position, short sign, half2 uv, short2 normal, short2 tangent = 20 bytes
+		layout.positionType = GL_UNSIGNED_SHORT;
+		layout.positionNormalized = GL_TRUE;
+		layout.positionOffset = 0;
+		layout.bitangentSignOffset = 6;
+		layout.uvOffset = 8;
+	}
+	else {
+		// float3 position, short sign, 2 bytes padding, half2 uv, short2 normal, short2 tangent = 28 bytes
+		layout.positionType = GL_FLOAT;
+		layout.positionNormalized = GL_FALSE;
+		layout.positionOffset = 0;
+		layout.bitangentSignOffset = 12;
+		layout.uvOffset = 16;
+	}
+	layout.normalOffset = layout.uvOffset + 4;
+	layout.tangentOffset = layout.normalOffset + 4;
+	layout.stride = layout.tangentOffset + 4;
+	return layout;
+}
+
+// Octahedral normal encoding, maps the unit sphere to [-1, 1]^2
+glm::vec2 Mesh::encodeOctahedral(glm::vec3 n) {
+	float length = glm::abs(n.x) + glm::abs(n.y) + glm::abs(n.z);
+	// Zero length (or NaN) vectors have no direction, they get +Z instead of NaNs
+	if(!(length > 0.0f))
+		return glm::vec2(0.0f);
+	n /= length;
+	glm::vec2 e(n.x, n.y);
+	if(n.z < 0.0f) {
+		e.x = (1.0f - glm::abs(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f);
+		e.y = (1.0f - glm::abs(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f);
+	}
+	return e;
+}
+
+glm::vec3 Mesh::decodeOctahedral(glm::vec2 e) {
+	glm::vec3 n(e.x, e.y, 1.0f - glm::abs(e.x) - glm::abs(e.y));
+	float t = glm::max(-n.z, 0.0f);
+	n.x += n.x >= 0.0f ? -t : t;
+	n.y += n.y >= 0.0f ? -t : t;
+	return glm::normalize(n);
+}
 
+void Mesh::loadAssimpMesh(const aiMesh* mesh, bool quantizePositions, bool keepCPUCopies) {
+	buildVertexData(mesh, quantizePositions, keepCPUCopies);
+	upload();
 }
 
-void Mesh::loadAssimpMesh(const aiMesh* mesh) {
+// Builds the packed vertex and index data on the CPU. Doesn't touch OpenGL so it can run on a loader thread.
+void Mesh::buildVertexData(const aiMesh* mesh, bool quantizePositions, bool keepCPUCopies, bool buildLODs) {
 	hasTexCoords_ = mesh->HasTextureCoords(0);
 	hasNormals_ = mesh->HasNormals();
 	hasTangentsAndBitangents_ = mesh->HasTangentsAndBitangents();
+	numVertices_ = mesh->mNumVertices;
+	layout_ = getVertexLayout(quantizePositions);
 
 	// std::cout << "   mNumVertices: " << mesh->mNumVertices << std::endl
 	// 		  << "   mNumFaces: " << mesh->mNumFaces << std::endl << std::endl;
 
-	// Load mesh info into glm vectors
-	std::vector<glm::vec3> vertices;
-	std::vector<glm::vec2> uvs;
-	std::vector<glm::vec3> normals;
-	std::vector<glm::vec3> tangents;
-	std::vector<glm::vec3> bitangents;
-	std::vector<unsigned int> indices;
+	// Bounding box used to quantize positions
+	glm::vec3 aabbMin(0.0f), aabbMax(0.0f);
+	if(mesh->mNumVertices > 0) {
+		aabbMin = aabbMax = glm::vec3(mesh->mVertices[0].x, mesh->mVertices[0].y, mesh->mVertices[0].z);
+	}
+	for(unsigned int i=1; i<mesh->mNumVertices; i++) {
+		glm::vec3 pos(mesh->mVertices[i].x, mesh->mVertices[i].y, mesh->mVertices[i].z);
+		aabbMin = glm::min(aabbMin, pos);
+		aabbMax = glm::max(aabbMax, pos);
+	}
+
+	aabbMin_ = aabbMin;
+	aabbMax_ = aabbMax;
 
-	vertices.reserve(mesh->mNumVertices);
+	if(quantizePositions) {
+		positionOffset_ = aabbMin;
+		positionScale_ = aabbMax - aabbMin;
+	}
+	else {
+		positionOffset_ = glm::vec3(0.0f);
+		positionScale_ = glm::vec3(1.0f);
+	}
+
+	// Build the interleaved vertex buffer
+	vertexData_.assign(mesh->mNumVertices * layout_.stride, 0);
 	for(unsigned int i=0; i<mesh->mNumVertices; i++) {
+		unsigned char* vertex = &vertexData_[i * layout_.stride];
 		aiVector3D pos = mesh->mVertices[i];
-		vertices.push_back(glm::vec3(pos.x, pos.y, pos.z));
-	}
 
-	if(hasTexCoords_) {
-		uvs.reserve(mesh->mNumVertices);
-		for(unsigned int i=0; i<mesh->mNumVertices; i++) {
-			aiVector3D uv = mesh->mTextureCoords[0][i];
-			uvs.push_back(glm::vec2(uv.x, -uv.y));
+		if(quantizePositions) {
+			glm::vec3 relative = glm::vec3(pos.x, pos.y, pos.z) - positionOffset_;
+			GLushort position[3];
+			for(int c = 0; c < 3; c++) {
+				position[c] = positionScale_[c] > 0.0f ? glm::packUnorm1x16(relative[c] / positionScale_[c]) : 0;
+			}
+			memcpy(vertex + layout_.positionOffset, position, sizeof(position));
 		}
-	}
-
-	if(hasNormals_) {
-		normals.reserve(mesh->mNumVertices);
-		for(unsigned int i=0; i<mesh->mNumVertices; i++) {
-			aiVector3D n = mesh->mNormals[i];
-			normals.push_back(glm::vec3(n.x, n.y, n.z));
+		else {
+			float position[3] = { pos.x, pos.y, pos.z };
+			memcpy(vertex + layout_.positionOffset, position, sizeof(position));
 		}
-	}
 
-	if(hasTangentsAndBitangents_) {
-		tangents.reserve(mesh->mNumVertices);
-		for(unsigned int i=0; i<mesh->mNumVertices; i++) {
-			aiVector3D t = mesh->mTangents[i];
-			tangents.push_back(glm::vec3(t.x, t.y, t.z));
+		if(hasTexCoords_) {
+			aiVector3D uv = mesh->mTextureCoords[0][i];
+			GLushort packedUV[2] = { glm::packHalf1x16(uv.x), glm::packHalf1x16(-uv.y) };
+			memcpy(vertex + layout_.uvOffset, packedUV, sizeof(packedUV));
 		}
 
-		bitangents.reserve(mesh->mNumVertices);
-		for(unsigned int i=0; i<mesh->mNumVertices; i++) {
-			aiVector3D b = mesh->mBitangents[i];
-			bitangents.push_back(glm::vec3(b.x, b.y, b.z));
+		glm::vec3 normal(0.0f, 1.0f, 0.0f);
+		if(hasNormals_) {
+			normal = glm::vec3(mesh->mNormals[i].x, mesh->mNormals[i].y, mesh->mNormals[i].z);
+		}
+		// Imported assets often have zero length normals on degenerate faces
+		if(glm::dot(normal, normal) <= 0.0f) {
+			normal = glm::vec3(0.0f, 1.0f, 0.0f);
+		}
+		glm::vec2 octNormal = encodeOctahedral(normal);
+		GLushort packedNormal[2] = { glm::packSnorm1x16(octNormal.x), glm::packSnorm1x16(octNormal.y) };
+		memcpy(vertex + layout_.normalOffset, packedNormal, sizeof(packedNormal));
+
+		glm::vec3 tangent(1.0f, 0.0f, 0.0f);
+		float bitangentSign = 1.0f;
+		if(hasTangentsAndBitangents_) {
+			tangent = glm::vec3(mesh->mTangents[i].x, mesh->mTangents[i].y, mesh->mTangents[i].z);
+			glm::vec3 bitangent(mesh->mBitangents[i].x, mesh->mBitangents[i].y, mesh->mBitangents[i].z);
+			bitangentSign = glm::dot(glm::cross(normal, tangent), bitangent) < 0.0f ? -1.0f : 1.0f;
 		}
+		// Degenerate tangents (zero length) can't be normalized by the encoder
+		if(glm::dot(tangent, tangent) <= 0.0f) {
+			tangent = glm::vec3(1.0f, 0.0f, 0.0f);
+		}
+		glm::vec2 octTangent = encodeOctahedral(tangent);
+		GLushort packedTangent[2] = { glm::packSnorm1x16(octTangent.x), glm::packSnorm1x16(octTangent.y) };
+		memcpy(vertex + layout_.tangentOffset, packedTangent, sizeof(packedTangent));
+
+		GLushort packedSign = glm::packSnorm1x16(bitangentSign);
+		memcpy(vertex + layout_.bitangentSignOffset, &packedSign, sizeof(packedSign));
 	}
 
+	// Use 16 bit indices when possible
+	std::vector<unsigned int> indices;
 	indices.reserve(3*mesh->mNumFaces);
 	for (unsigned int i=0; i<mesh->mNumFaces; i++) {
 		indices.push_back(mesh->mFaces[i].mIndices[0]);
 		indices.push_back(mesh->mFaces[i].mIndices[1]);
 		indices.push_back(mesh->mFaces[i].mIndices[2]);
-		//std::cout << "mesh->mFaces[i].mNumIndices: " << mesh->mFaces[i].mNumIndices << std::endl;
-		//std::cout << "indices: " << mesh->mFaces[i].mIndices[0] << "," << mesh->mFaces[i].mIndices[1] << "," << mesh->mFaces[i].mIndices[2] << std::endl;
+	}
+	indexType_ = mesh->mNumVertices <= 65536 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+
+	// The simplified levels follow the full mesh in the same index buffer
+	LOD full = { 0, (GLuint)indices.size(), 0, 0, 0.0f };
+	lods_.assign(1, full);
+	std::vector<unsigned int> lodIndices(indices);
+	if(buildLODs)
+		this->buildLODs(mesh, indices, lodIndices);
+
+	if(indexType_ == GL_UNSIGNED_SHORT) {
+		indexData_.resize(lodIndices.size() * sizeof(GLushort));
+		for(size_t i = 0; i < lodIndices.size(); i++) {
+			GLushort index = (GLushort)lodIndices[i];
+			memcpy(&indexData_[i * sizeof(GLushort)], &index, sizeof(GLushort));
+		}
+		// Padded to whole words since the compute voxelizer reads the indices as uints
+		indexData_.resize((indexData_.size() + 3) & ~(size_t)3, 0);
+	}
+	else {
+		indexData_.resize(lodIndices.size() * sizeof(unsigned int));
+		if(!lodIndices.empty())
+			memcpy(&indexData_[0], &lodIndices[0], indexData_.size());
 	}
 
-	// Create VAO
-	glGenVertexArrays(1, &vertexArray_);
-	glBindVertexArray(vertexArray_);
+	// The CPU side copies are only kept if asked for, the GPU buffers have everything needed to draw
+	if(keepCPUCopies) {
+		vertices_.resize(mesh->mNumVertices);
+		for(unsigned int i=0; i<mesh->mNumVertices; i++) {
+			vertices_[i] = glm::vec3(mesh->mVertices[i].x, mesh->mVertices[i].y, mesh->mVertices[i].z);
+		}
+		if(hasTexCoords_) {
+			uvs_.resize(mesh->mNumVertices);
+			for(unsigned int i=0; i<mesh->mNumVertices; i++) {
+				uvs_[i] = glm::vec2(mesh->mTextureCoords[0][i].x, -mesh->mTextureCoords[0][i].y);
+			}
+		}
+		if(hasNormals_) {
+			normals_.resize(mesh->mNumVertices);
+			for(unsigned int i=0; i<mesh->mNumVertices; i++) {
+				normals_[i] = glm::vec3(mesh->mNormals[i].x, mesh->mNormals[i].y, mesh->mNormals[i].z);
+			}
+		}
+		if(hasTangentsAndBitangents_) {
+			tangents_.resize(mesh->mNumVertices);
+			bitangents_.resize(mesh->mNumVertices);
+			for(unsigned int i=0; i<mesh->mNumVertices; i++) {
+				tangents_[i] = glm::vec3(mesh->mTangents[i].x, mesh->mTangents[i].y, mesh->mTangents[i].z);
+				bitangents_[i] = glm::vec3(mesh->mBitangents[i].x, mesh->mBitangents[i].y, mesh->mBitangents[i].z);
+			}
+		}
+		indices_ = indices;
+		MemoryTracker::allocate(MemoryTracker::CPU_MIRRORS, getCPUCopyBytes());
+	}
+	numIndices_ = 3*mesh->mNumFaces;
+	materialIndex_ = mesh->mMaterialIndex;
 
-	// Load VBOs
+	clusters_.clear();
+	for(size_t l = 0; l < lods_.size(); l++) {
+		lods_[l].firstCluster = (GLuint)clusters_.size();
+		buildClusters(mesh, lodIndices, lods_[l].firstIndex, lods_[l].numIndices);
+		lods_[l].numClusters = (GLuint)clusters_.size() - lods_[l].firstCluster;
+	}
+	numClusters_ = (unsigned int)clusters_.size();
+}
 
-	// Vertices
-	glGenBuffers(1, &vboVertices_);
-	glBindBuffer(GL_ARRAY_BUFFER, vboVertices_);
-	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(glm::vec3), &vertices[0], GL_STATIC_DRAW);
+// Each level is simplified further from the one before until it stops shrinking. The
+// errors only grow, so the levels can be picked by the largest error a pass can hide.
+void Mesh::buildLODs(const aiMesh* mesh, const std::vector<unsigned int>& indices, std::vector<unsigned int>& lodIndices) {
+	std::vector<glm::vec3> positions(mesh->mNumVertices);
+	for(unsigned int i = 0; i < mesh->mNumVertices; i++) {
+		positions[i] = glm::vec3(mesh->mVertices[i].x, mesh->mVertices[i].y, mesh->mVertices[i].z);
+	}
 
-	// Texture coordinates
-	if(hasTexCoords_) {
-		glGenBuffers(1, &vboTexCoords_);
-		glBindBuffer(GL_ARRAY_BUFFER, vboTexCoords_);
-		glBufferData(GL_ARRAY_BUFFER, uvs.size() * sizeof(glm::vec2), &uvs[0], GL_STATIC_DRAW);
+	MeshSimplifier simplifier(positions, indices);
+	size_t numTriangles = indices.size() / 3;
+	while(lods_.size() < MAX_LODS && numTriangles > 32) {
+		simplifier.simplify(numTriangles / 2, std::numeric_limits<float>::max());
+		// Not worth the indices if it barely got smaller
+		if(simplifier.getNumTriangles() > numTriangles * 3 / 4)
+			break;
+		numTriangles = simplifier.getNumTriangles();
+
+		LOD lod = { (GLuint)lodIndices.size(), (GLuint)(numTriangles * 3), 0, 0, simplifier.getError() };
+		lodIndices.insert(lodIndices.end(), simplifier.getIndices().begin(), simplifier.getIndices().end());
+		lods_.push_back(lod);
 	}
+}
+
+static void setVector(aiVector3D& out, const glm::vec3& v) {
+	out.x = v.x;
+	out.y = v.y;
+	out.z = v.z;
+}
 
-	// Normals
-	if(hasNormals_) {
-		glGenBuffers(1, &vboNormals_);
-		glBindBuffer(GL_ARRAY_BUFFER, vboNormals_);
-		glBufferData(GL_ARRAY_BUFFER, normals.size() * sizeof(glm::vec3), &normals[0], GL_STATIC_DRAW);
+// Goes through a temporary aiMesh, so the packing and clustering are the ones of a loaded mesh
+void Mesh::buildMergedVertexData(const std::vector<Mesh*>& meshes, const std::vector<glm::mat4>& modelMatrices, bool quantizePositions, bool keepCPUCopies, bool buildLODs) {
+	aiMesh merged;
+	bool texCoords = false, normals = false, tangents = false;
+	for(size_t m = 0; m < meshes.size(); m++) {
+		merged.mNumVertices += (unsigned int)meshes[m]->vertices_.size();
+		merged.mNumFaces += (unsigned int)meshes[m]->indices_.size() / 3;
+		texCoords = texCoords || !meshes[m]->uvs_.empty();
+		normals = normals || !meshes[m]->normals_.empty();
+		tangents = tangents || !meshes[m]->tangents_.empty();
+	}
+	merged.mPrimitiveTypes = aiPrimitiveType_TRIANGLE;
+	merged.mMaterialIndex = meshes.empty() ? 0 : meshes[0]->materialIndex_;
+	merged.mVertices = new aiVector3D[merged.mNumVertices];
+	if(texCoords) {
+		merged.mTextureCoords[0] = new aiVector3D[merged.mNumVertices];
+		merged.mNumUVComponents[0] = 2;
+	}
+	if(normals)
+		merged.mNormals = new aiVector3D[merged.mNumVertices];
+	if(tangents) {
+		merged.mTangents = new aiVector3D[merged.mNumVertices];
+		merged.mBitangents = new aiVector3D[merged.mNumVertices];
 	}
+	merged.mFaces = new aiFace[merged.mNumFaces];
+
+	unsigned int firstVertex = 0, face = 0;
+	for(size_t m = 0; m < meshes.size(); m++) {
+		const Mesh* mesh = meshes[m];
+		// Normals go through the inverse transpose, tangents and bitangents like positions
+		glm::mat3 tangentMatrix(modelMatrices[m]);
+		glm::mat3 normalMatrix = glm::transpose(glm::inverse(tangentMatrix));
+		for(size_t i = 0; i < mesh->vertices_.size(); i++) {
+			unsigned int vertex = firstVertex + (unsigned int)i;
+			setVector(merged.mVertices[vertex], glm::vec3(modelMatrices[m] * glm::vec4(mesh->vertices_[i], 1.0f)));
+			if(texCoords) {
+				// The copies hold the flipped v of the vertex data
+				glm::vec2 uv = mesh->uvs_.empty() ? glm::vec2(0.0f) : mesh->uvs_[i];
+				setVector(merged.mTextureCoords[0][vertex], glm::vec3(uv.x, -uv.y, 0.0f));
+			}
+			if(normals) {
+				glm::vec3 normal = mesh->normals_.empty() ? glm::vec3(0.0f, 1.0f, 0.0f) : normalMatrix * mesh->normals_[i];
+				setVector(merged.mNormals[vertex], glm::dot(normal, normal) > 0.0f ? glm::normalize(normal) : normal);
+			}
+			if(tangents) {
+				// Zero tangents are replaced when packing, like missing ones
+				glm::vec3 tangent(0.0f), bitangent(0.0f);
+				if(!mesh->tangents_.empty()) {
+					tangent = tangentMatrix * mesh->tangents_[i];
+					bitangent = tangentMatrix * mesh->bitangents_[i];
+				}
+				setVector(merged.mTangents[vertex], tangent);
+				setVector(merged.mBitangents[vertex], bitangent);
+			}
+		}
+		for(size_t i = 0; i + 2 < mesh->indices_.size(); i += 3, face++) {
+			merged.mFaces[face].mNumIndices = 3;
+			merged.mFaces[face].mIndices = new unsigned int[3];
+			for(int v = 0; v < 3; v++) {
+				merged.mFaces[face].mIndices[v] = firstVertex + mesh->indices_[i + v];
+			}
+		}
+		firstVertex += (unsigned int)mesh->vertices_.size();
+	}
+
+	buildVertexData(&merged, quantizePositions, keepCPUCopies, buildLODs);
+}
+
+// Splits the triangles into clusters of consecutive triangles with at most
+// MAX_CLUSTER_VERTICES unique vertices and MAX_CLUSTER_TRIANGLES triangles, so the
+// index buffer can be drawn in cluster ranges without reordering it
+void Mesh::buildClusters(const aiMesh* mesh, const std::vector<unsigned int>& lodIndices, size_t firstIndex, size_t numIndices) {
+	const unsigned int* indices = lodIndices.empty() ? NULL : &lodIndices[firstIndex];
+
+	// Cluster each vertex was last counted for, + 1
+	std::vector<unsigned int> vertexCluster(mesh->mNumVertices, 0);
+	size_t numTriangles = numIndices / 3;
+	size_t triangle = 0;
+	while(triangle < numTriangles) {
+		unsigned int clusterTag = (unsigned int)clusters_.size() + 1;
+		unsigned int numVertices = 0;
+		size_t first = triangle;
+		while(triangle < numTriangles && triangle - first < MAX_CLUSTER_TRIANGLES) {
+			unsigned int newVertices = 0;
+			for(int v = 0; v < 3; v++) {
+				// Counts a vertex repeated within the triangle twice, which only makes the cluster smaller
+				newVertices += vertexCluster[indices[triangle * 3 + v]] != clusterTag ? 1 : 0;
+			}
+			if(numVertices + newVertices > MAX_CLUSTER_VERTICES)
+				break;
+			for(int v = 0; v < 3; v++) {
+				vertexCluster[indices[triangle * 3 + v]] = clusterTag;
+			}
+			numVertices += newVertices;
+			triangle++;
+		}
 
-	// Tangents and bitangents
-	if(hasTangentsAndBitangents_) {
-		glGenBuffers(1, &vboTangents_);
-		glBindBuffer(GL_ARRAY_BUFFER,vboTangents_);
-		glBufferData(GL_ARRAY_BUFFER, tangents.size() * sizeof(glm::vec3), &tangents[0], GL_STATIC_DRAW);
+		// Bounding sphere around the box of the triangles
+		glm::vec3 boundsMin(1e30f), boundsMax(-1e30f);
+		for(size_t i = first * 3; i < triangle * 3; i++) {
+			const aiVector3D& p = mesh->mVertices[indices[i]];
+			boundsMin = glm::min(boundsMin, glm::vec3(p.x, p.y, p.z));
+			boundsMax = glm::max(boundsMax, glm::vec3(p.x, p.y, p.z));
+		}
+		glm::vec3 center = (boundsMin + boundsMax) * 0.5f;
+		float radius = 0.0f;
+		for(size_t i = first * 3; i < triangle * 3; i++) {
+			const aiVector3D& p = mesh->mVertices[indices[i]];
+			radius = glm::max(radius, glm::length(glm::vec3(p.x, p.y, p.z) - center));
+		}
+
+		// Normal cone of the face normals (counter clockwise front faces)
+		std::vector<glm::vec3> faceNormals;
+		glm::vec3 axis(0.0f);
+		for(size_t t = first; t < triangle; t++) {
+			const aiVector3D& a = mesh->mVertices[indices[t * 3]];
+			const aiVector3D& b = mesh->mVertices[indices[t * 3 + 1]];
+			const aiVector3D& c = mesh->mVertices[indices[t * 3 + 2]];
+			glm::vec3 n = glm::cross(glm::vec3(b.x - a.x, b.y - a.y, b.z - a.z), glm::vec3(c.x - a.x, c.y - a.y, c.z - a.z));
+			float length = glm::length(n);
+			if(length <= 0.0f)
+				continue; // Degenerate, never visible
+			faceNormals.push_back(n / length);
+			axis += n / length;
+		}
+		float coneSine = 1.0f;
+		if(!faceNormals.empty() && glm::length(axis) > 0.0f) {
+			axis = glm::normalize(axis);
+			float minCosine = 1.0f;
+			for(size_t n = 0; n < faceNormals.size(); n++) {
+				minCosine = glm::min(minCosine, glm::dot(axis, faceNormals[n]));
+			}
+			// Normals spread over more than a hemisphere always have a front face
+			if(minCosine > 0.0f)
+				coneSine = glm::sqrt(1.0f - minCosine * minCosine);
+		}
 
-		glGenBuffers(1, &vboBitangents_);
-		glBindBuffer(GL_ARRAY_BUFFER,vboBitangents_);
-		glBufferData(GL_ARRAY_BUFFER, bitangents.size() * sizeof(glm::vec3), &bitangents[0], GL_STATIC_DRAW);
+		Cluster cluster;
+		cluster.sphere = glm::vec4(center, radius);
+		cluster.cone = glm::vec4(axis, coneSine);
+		cluster.firstIndex = (GLuint)(firstIndex + first * 3);
+		cluster.indexCount = (GLuint)((triangle - first) * 3);
+		cluster.padding[0] = cluster.padding[1] = 0;
+		clusters_.push_back(cluster);
 	}
+}
+
+// Uploads the data prepared by buildVertexData. Must be called on the thread owning the GL context.
+void Mesh::upload() {
+	// Create VAO
+	glGenVertexArrays(1, &vertexArray_);
+	glBindVertexArray(vertexArray_);
+
+	// Load VBOs
+	glGenBuffers(1, &vboVertices_);
+	glBindBuffer(GL_ARRAY_BUFFER, vboVertices_);
+	glBufferData(GL_ARRAY_BUFFER, vertexData_.size(), vertexData_.empty() ? NULL : &vertexData_[0], GL_STATIC_DRAW);
+
+	// The attribute setup is stored in the VAO so it only has to be done once
+	// 1rst attribute: position
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 3, layout_.positionType, layout_.positionNormalized, layout_.stride, (void*)layout_.positionOffset);
+	// 2nd attribute: UVs
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(1, 2, GL_HALF_FLOAT, GL_FALSE, layout_.stride, (void*)layout_.uvOffset);
+	// 3rd attribute: octahedral normal
+	glEnableVertexAttribArray(2);
+	glVertexAttribPointer(2, 2, GL_SHORT, GL_TRUE, layout_.stride, (void*)layout_.normalOffset);
+	// 4th attribute: octahedral tangent
+	glEnableVertexAttribArray(3);
+	glVertexAttribPointer(3, 2, GL_SHORT, GL_TRUE, layout_.stride, (void*)layout_.tangentOffset);
+	// 5th attribute: bitangent sign
+	glEnableVertexAttribArray(4);
+	glVertexAttribPointer(4, 1, GL_SHORT, GL_TRUE, layout_.stride, (void*)layout_.bitangentSignOffset);
 
 	// Indices
 	glGenBuffers(1, &vboIndices_);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, vboIndices_);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0] , GL_STATIC_DRAW);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexData_.size(), indexData_.empty() ? NULL : &indexData_[0], GL_STATIC_DRAW);
 
 	// Unbind vertex array
 	glBindVertexArray(0);
 
-	vertices_ = vertices;
-	uvs_ = uvs;
-	normals_ = normals;
-	tangents_ = tangents;
-	bitangents_ = bitangents;
-	indices_ = indices;
-	numIndices_ = 3*mesh->mNumFaces;
-	materialIndex_ = mesh->mMaterialIndex;
+	MemoryTracker::allocate(MemoryTracker::GEOMETRY, vertexData_.size() + indexData_.size());
+
+	// Clusters for cluster-cull.comp, the draw lists are kept by the objects
+	if(numClusters_ > 0) {
+		glGenBuffers(1, &clusterBuffer_);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, clusterBuffer_);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, numClusters_ * sizeof(Cluster), &clusters_[0], GL_STATIC_DRAW);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+		MemoryTracker::allocate(MemoryTracker::GEOMETRY, numClusters_ * sizeof(Cluster));
+	}
+
+	// The staging data isn't needed anymore
+	std::vector<unsigned char>().swap(vertexData_);
+	std::vector<unsigned char>().swap(indexData_);
+	std::vector<Cluster>().swap(clusters_);
+}
+
+size_t Mesh::getSeparateLayoutBytes() {
+	// vec3 position, vec2 uv, vec3 normal, vec3 tangent, vec3 bitangent = 56 bytes
+	return numVertices_ * (3 + 2 + 3 + 3 + 3) * sizeof(float) + numIndices_ * sizeof(unsigned int);
+}
+
+size_t Mesh::getPackedLayoutBytes() {
+	size_t indexSize = indexType_ == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+	return numVertices_ * layout_.stride + (lods_.back().firstIndex + lods_.back().numIndices) * indexSize;
+}
+
+size_t Mesh::getCPUCopyBytes() {
+	return vertices_.size() * sizeof(glm::vec3) + uvs_.size() * sizeof(glm::vec2) +
+		(normals_.size() + tangents_.size() + bitangents_.size()) * sizeof(glm::vec3) +
+		indices_.size() * sizeof(unsigned int);
+}
+
+bool Mesh::hasCPUCopies() {
+	return !vertices_.empty();
 }
 
-void Mesh::draw() {
-	// std::cout << "Mesh::draw: " << std::endl <<
-	// 			 "   " << "vertexArray_: " << vertexArray_ << std::endl <<
-	// 			 "   " << "vboVertices_: " << vboVertices_ << std::endl <<
-	// 			 "   " << "vboTexCoords_: " << vboTexCoords_ << std::endl <<
-	// 			 "   " << "vboNormals_: " << vboNormals_ << std::endl <<
-	// 			 "   " << "vboIndices_: " << vboIndices_ << std::endl <<
-	// 			 "   " << " numIndices_: " << numIndices_ << std::endl;
+const std::vector<glm::vec3>& Mesh::getCPUPositions() {
+	return vertices_;
+}
+
+const std::vector<unsigned int>& Mesh::getCPUIndices() {
+	return indices_;
+}
+
+unsigned int Mesh::getNumVertices() {
+	return numVertices_;
+}
 
+glm::vec3 Mesh::getBoundsMin() {
+	return aabbMin_;
+}
+
+glm::vec3 Mesh::getBoundsMax() {
+	return aabbMax_;
+}
+
+void Mesh::setInstanceBuffer(GLuint buffer) {
 	glBindVertexArray(vertexArray_);
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+	// A mat4 attribute takes four locations, one per column
+	for(GLuint i = 0; i < 4; i++) {
+		glEnableVertexAttribArray(5 + i);
+		glVertexAttribPointer(5 + i, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(i * sizeof(glm::vec4)));
+		glVertexAttribDivisor(5 + i, 1);
+	}
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
 
-	// 1rst attribute buffer : vertices
-	glEnableVertexAttribArray(0);
-	glBindBuffer(GL_ARRAY_BUFFER, vboVertices_);
-	glVertexAttribPointer(
-		0,                  // attribute
-		3,                  // size
-		GL_FLOAT,           // type
-		GL_FALSE,           // normalized?
-		0,                  // stride
-		(void*)0            // array buffer offset
-	);
-
-	// TODO: dont upload stuff if they aren't in the shader
-	
-	// 2nd attribute buffer : UVs
-	glEnableVertexAttribArray(1);
-	glBindBuffer(GL_ARRAY_BUFFER, vboTexCoords_);
-	glVertexAttribPointer(
-		1,                                // attribute
-		2,                                // size
-		GL_FLOAT,                         // type
-		GL_FALSE,                         // normalized?
-		0,                                // stride
-		(void*)0                          // array buffer offset
-	);
-
-	// 3rd attribute buffer : normals
-	glEnableVertexAttribArray(2);
-	glBindBuffer(GL_ARRAY_BUFFER, vboNormals_);
-	glVertexAttribPointer(
-		2,                                // attribute
-		3,                                // size
-		GL_FLOAT,                         // type
-		GL_FALSE,                         // normalized?
-		0,                                // stride
-		(void*)0                          // array buffer offset
-	);
-
-	// 4th attribute buffer : tangents
-	glEnableVertexAttribArray(3);
-	glBindBuffer(GL_ARRAY_BUFFER, vboTangents_);
-	glVertexAttribPointer(
-		3,                                // attribute
-		3,                                // size
-		GL_FLOAT,                         // type
-		GL_FALSE,                         // normalized?
-		0,                                // stride
-		(void*)0                          // array buffer offset
-	);
-
-	// 5th attribute buffer : bitangents
-	glEnableVertexAttribArray(4);
-	glBindBuffer(GL_ARRAY_BUFFER, vboBitangents_);
-	glVertexAttribPointer(
-		4,                                // attribute
-		3,                                // size
-		GL_FLOAT,                         // type
-		GL_FALSE,                         // normalized?
-		0,                                // stride
-		(void*)0                          // array buffer offset
-	);
-
-	// Index buffer
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, vboIndices_);
+void Mesh::draw(GLuint shader, GLsizei numInstances, unsigned int lod) {
+	// Positions may be quantized, the vertex shaders expand them with these
+	glUniform3f(glGetUniformLocation(shader, "PositionOffset"), positionOffset_.x, positionOffset_.y, positionOffset_.z);
+	glUniform3f(glGetUniformLocation(shader, "PositionScale"), positionScale_.x, positionScale_.y, positionScale_.z);
+
+	glBindVertexArray(vertexArray_);
+
+	const LOD& level = lods_[lod];
+	size_t indexSize = indexType_ == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+	void* firstIndex = (void*)(level.firstIndex * indexSize);
 
 	// Draw the triangles !
-	glDrawElements(
-		GL_TRIANGLES,      // mode
-		numIndices_,    // count
-		GL_UNSIGNED_INT,   // type
-		(void*)0           // element array buffer offset
-	);
-
-	glDisableVertexAttribArray(0);
-	glDisableVertexAttribArray(1);
-	glDisableVertexAttribArray(2);
-	glDisableVertexAttribArray(3);
-	glDisableVertexAttribArray(4);
-
-	glUseProgram(0);
+	if(numInstances > 1) {
+		glDrawElementsInstanced(GL_TRIANGLES, level.numIndices, indexType_, firstIndex, numInstances);
+	}
+	else {
+		glDrawElements(
+			GL_TRIANGLES,      // mode
+			level.numIndices,  // count
+			indexType_,        // type
+			firstIndex         // element array buffer offset
+		);
+	}
+
 	glBindVertexArray(0);
-}
\ No newline at end of file
+}
+
+// Binds the vertex and index buffers as shader storage for compute shaders, with
+// the uniforms needed to decode the packed vertices
+void Mesh::bindStorageBuffers(GLuint shader, GLuint vertexBinding, GLuint indexBinding, unsigned int lod) {
+	glUniform3f(glGetUniformLocation(shader, "PositionOffset"), positionOffset_.x, positionOffset_.y, positionOffset_.z);
+	glUniform3f(glGetUniformLocation(shader, "PositionScale"), positionScale_.x, positionScale_.y, positionScale_.z);
+	glUniform1ui(glGetUniformLocation(shader, "VertexStride"), layout_.stride);
+	glUniform1ui(glGetUniformLocation(shader, "PositionByteOffset"), (GLuint)layout_.positionOffset);
+	glUniform1ui(glGetUniformLocation(shader, "UVByteOffset"), (GLuint)layout_.uvOffset);
+	glUniform1i(glGetUniformLocation(shader, "QuantizedPositions"), layout_.positionType == GL_UNSIGNED_SHORT);
+	glUniform1i(glGetUniformLocation(shader, "ShortIndices"), indexType_ == GL_UNSIGNED_SHORT);
+	glUniform1ui(glGetUniformLocation(shader, "FirstIndex"), lods_[lod].firstIndex);
+	glUniform1ui(glGetUniformLocation(shader, "NumTriangles"), lods_[lod].numIndices / 3);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, vertexBinding, vboVertices_);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, indexBinding, vboIndices_);
+}
+
+void Mesh::voxelize(GLuint shader, unsigned int lod) {
+	GLuint numTriangles = lods_[lod].numIndices / 3;
+	if(numTriangles == 0)
+		return;
+
+	bindStorageBuffers(shader, 0, 1, lod);
+
+	// Reset the indirect dispatch arguments and the job counter
+	static const GLuint resetJobs[4] = {0, 1, 1, 0};
+	glBufferSubData(GL_DISPATCH_INDIRECT_BUFFER, 0, sizeof(resetJobs), resetJobs);
+
+	// Thread per triangle, small triangles are done here
+	glUniform1i(glGetUniformLocation(shader, "Pass"), 0);
+	glDispatchCompute((numTriangles + 63) / 64, 1, 1);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+
+	// Work group per tile of the large triangles
+	glUniform1i(glGetUniformLocation(shader, "Pass"), 1);
+	glDispatchComputeIndirect(0);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+}
+
+unsigned int Mesh::getNumTriangles(unsigned int lod) {
+	return lods_[lod].numIndices / 3;
+}
+
+unsigned int Mesh::getNumClusters(unsigned int lod) {
+	return lods_[lod].numClusters;
+}
+
+size_t Mesh::getDrawCommandBytes() {
+	return 16 + numClusters_ * 5 * sizeof(GLuint);
+}
+
+unsigned int Mesh::selectLOD(float maxError) {
+	unsigned int lod = 0;
+	while(lod + 1 < lods_.size() && lods_[lod + 1].error <= maxError)
+		lod++;
+	return lod;
+}
+
+unsigned int Mesh::getNumLODs() {
+	return (unsigned int)lods_.size();
+}
+
+float Mesh::getLODError(unsigned int lod) {
+	return lods_[lod].error;
+}
+
+void Mesh::cullClusters(GLuint shader, GLuint drawCommands, unsigned int lod) {
+	if(lods_[lod].numClusters == 0)
+		return;
+
+	// Zero count and commands, so without indirect parameters the unused tail draws nothing
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, drawCommands);
+	glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
+
+	glUniform1ui(glGetUniformLocation(shader, "FirstCluster"), lods_[lod].firstCluster);
+	glUniform1ui(glGetUniformLocation(shader, "NumClusters"), lods_[lod].numClusters);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, clusterBuffer_);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, drawCommands);
+	glDispatchCompute((lods_[lod].numClusters + 63) / 64, 1, 1);
+}
+
+void Mesh::drawClusters(GLuint shader, GLuint drawCommands, unsigned int lod) {
+	if(lods_[lod].numClusters == 0)
+		return;
+
+	glUniform3f(glGetUniformLocation(shader, "PositionOffset"), positionOffset_.x, positionOffset_.y, positionOffset_.z);
+	glUniform3f(glGetUniformLocation(shader, "PositionScale"), positionScale_.x, positionScale_.y, positionScale_.z);
+
+	glBindVertexArray(vertexArray_);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, drawCommands);
+	// The commands start after the count and its padding
+	if(GLEW_ARB_indirect_parameters) {
+		glBindBuffer(GL_PARAMETER_BUFFER_ARB, drawCommands);
+		glMultiDrawElementsIndirectCountARB(GL_TRIANGLES, indexType_, (void*)16, 0, lods_[lod].numClusters, 0);
+		glBindBuffer(GL_PARAMETER_BUFFER_ARB, 0);
+	}
+	else {
+		glMultiDrawElementsIndirect(GL_TRIANGLES, indexType_, (void*)16, lods_[lod].numClusters, 0);
+	}
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+	glBindVertexArray(0);
+}
@@ -0,0 +1,258 @@
+#include <algorithm>
+#include <cmath>
+
+#include "MeshSimplifier.h"
+
+MeshSimplifier::MeshSimplifier(const std::vector<glm::vec3>& positions, const std::vector<unsigned int>& indices) : positions_(positions) {
+	error_ = 0.0f;
+
+	// Degenerate triangles have no plane and would only get in the way
+	indices_.reserve(indices.size());
+	for(size_t i = 0; i + 2 < indices.size(); i += 3) {
+		if(indices[i] == indices[i + 1] || indices[i + 1] == indices[i + 2] || indices[i] == indices[i + 2])
+			continue;
+		indices_.insert(indices_.end(), indices.begin() + i, indices.begin() + i + 3);
+	}
+
+	Quadric zero = { 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0 };
+	quadrics_.assign(positions_.size(), zero);
+	for(size_t i = 0; i < indices_.size(); i += 3) {
+		glm::vec3 p0 = positions_[indices_[i]];
+		glm::vec3 n = glm::cross(positions_[indices_[i + 1]] - p0, positions_[indices_[i + 2]] - p0);
+		float length = glm::length(n);
+		if(length <= 0.0f)
+			continue;
+		n /= length;
+		for(int v = 0; v < 3; v++) {
+			addPlane(quadrics_[indices_[i + v]], n, -glm::dot(n, p0));
+		}
+	}
+
+	classifyVertices();
+}
+
+const std::vector<unsigned int>& MeshSimplifier::getIndices() {
+	return indices_;
+}
+
+size_t MeshSimplifier::getNumTriangles() {
+	return indices_.size() / 3;
+}
+
+float MeshSimplifier::getError() {
+	return error_;
+}
+
+void MeshSimplifier::addPlane(Quadric& q, glm::vec3 normal, float distance) {
+	double a = normal.x, b = normal.y, c = normal.z, d = distance;
+	q.a00 += a * a; q.a01 += a * b; q.a02 += a * c; q.a03 += a * d;
+	q.a11 += b * b; q.a12 += b * c; q.a13 += b * d;
+	q.a22 += c * c; q.a23 += c * d;
+	q.a33 += d * d;
+}
+
+void MeshSimplifier::addQuadric(Quadric& q, const Quadric& other) {
+	q.a00 += other.a00; q.a01 += other.a01; q.a02 += other.a02; q.a03 += other.a03;
+	q.a11 += other.a11; q.a12 += other.a12; q.a13 += other.a13;
+	q.a22 += other.a22; q.a23 += other.a23;
+	q.a33 += other.a33;
+}
+
+// The sum of the squared plane distances is at least the largest one, so its root bounds every distance
+float MeshSimplifier::evaluate(const Quadric& q, glm::vec3 p) {
+	double x = p.x, y = p.y, z = p.z;
+	double e = x * x * q.a00 + 2.0 * x * y * q.a01 + 2.0 * x * z * q.a02 + 2.0 * x * q.a03 +
+			   y * y * q.a11 + 2.0 * y * z * q.a12 + 2.0 * y * q.a13 +
+			   z * z * q.a22 + 2.0 * z * q.a23 +
+			   q.a33;
+	return (float)std::sqrt(std::max(e, 0.0));
+}
+
+unsigned long long MeshSimplifier::edgeKey(unsigned int a, unsigned int b) {
+	return a < b ? ((unsigned long long)a << 32) | b : ((unsigned long long)b << 32) | a;
+}
+
+void MeshSimplifier::classifyVertices() {
+	kinds_.assign(positions_.size(), MANIFOLD);
+
+	// Vertices split by a seam have the same position
+	std::vector<unsigned int> order(positions_.size());
+	for(unsigned int v = 0; v < order.size(); v++) {
+		order[v] = v;
+	}
+	const std::vector<glm::vec3>& positions = positions_;
+	std::sort(order.begin(), order.end(), [&positions](unsigned int a, unsigned int b) {
+		const glm::vec3& p = positions[a];
+		const glm::vec3& q = positions[b];
+		return p.x != q.x ? p.x < q.x : (p.y != q.y ? p.y < q.y : p.z < q.z);
+	});
+	for(size_t i = 1; i < order.size(); i++) {
+		if(positions_[order[i]] == positions_[order[i - 1]])
+			kinds_[order[i]] = kinds_[order[i - 1]] = LOCKED;
+	}
+
+	// Edges used by one triangle are open, by more than two non-manifold
+	std::vector<unsigned long long> edges;
+	edges.reserve(indices_.size());
+	for(size_t i = 0; i < indices_.size(); i += 3) {
+		for(int e = 0; e < 3; e++) {
+			edges.push_back(edgeKey(indices_[i + e], indices_[i + (e + 1) % 3]));
+		}
+	}
+	std::sort(edges.begin(), edges.end());
+	std::vector<unsigned int> numBorderEdges(positions_.size(), 0);
+	for(size_t i = 0; i < edges.size();) {
+		size_t count = 1;
+		while(i + count < edges.size() && edges[i + count] == edges[i])
+			count++;
+		unsigned int a = (unsigned int)(edges[i] >> 32);
+		unsigned int b = (unsigned int)(edges[i] & 0xFFFFFFFFu);
+		if(count == 1) {
+			borderEdges_.insert(edges[i]);
+			numBorderEdges[a]++;
+			numBorderEdges[b]++;
+		}
+		else if(count > 2) {
+			kinds_[a] = kinds_[b] = LOCKED;
+		}
+		i += count;
+	}
+	for(size_t v = 0; v < positions_.size(); v++) {
+		if(numBorderEdges[v] > 0 && kinds_[v] != LOCKED)
+			kinds_[v] = numBorderEdges[v] == 2 ? BORDER : LOCKED;
+	}
+
+	// Planes through the open edges, perpendicular to their triangle, keep the border in place
+	for(size_t i = 0; i < indices_.size(); i += 3) {
+		glm::vec3 p0 = positions_[indices_[i]];
+		glm::vec3 n = glm::cross(positions_[indices_[i + 1]] - p0, positions_[indices_[i + 2]] - p0);
+		for(int e = 0; e < 3; e++) {
+			unsigned int a = indices_[i + e], b = indices_[i + (e + 1) % 3];
+			if(!isBorderEdge(a, b))
+				continue;
+			glm::vec3 edgeNormal = glm::cross(positions_[b] - positions_[a], n);
+			float length = glm::length(edgeNormal);
+			if(length <= 0.0f)
+				continue;
+			edgeNormal /= length;
+			addPlane(quadrics_[a], edgeNormal, -glm::dot(edgeNormal, positions_[a]));
+			addPlane(quadrics_[b], edgeNormal, -glm::dot(edgeNormal, positions_[a]));
+		}
+	}
+}
+
+bool MeshSimplifier::isBorderEdge(unsigned int a, unsigned int b) {
+	return borderEdges_.count(edgeKey(a, b)) > 0;
+}
+
+bool MeshSimplifier::flipsTriangles(unsigned int from, unsigned int to, const std::vector<unsigned int>& firstTriangle, const std::vector<unsigned int>& vertexTriangles) {
+	for(unsigned int i = firstTriangle[from]; i < firstTriangle[from + 1]; i++) {
+		const unsigned int* triangle = &indices_[vertexTriangles[i] * 3];
+		if(triangle[0] == to || triangle[1] == to || triangle[2] == to)
+			continue; // Collapses with the edge
+
+		glm::vec3 before[3], after[3];
+		for(int v = 0; v < 3; v++) {
+			before[v] = positions_[triangle[v]];
+			after[v] = positions_[triangle[v] == from ? to : triangle[v]];
+		}
+		glm::vec3 normalBefore = glm::cross(before[1] - before[0], before[2] - before[0]);
+		glm::vec3 normalAfter = glm::cross(after[1] - after[0], after[2] - after[0]);
+		// Also catches triangles that would turn by more than about 75 degrees or become degenerate
+		if(glm::dot(normalBefore, normalAfter) <= 0.25f * glm::length(normalBefore) * glm::length(normalAfter))
+			return true;
+	}
+	return false;
+}
+
+void MeshSimplifier::simplify(size_t targetTriangles, float maxError) {
+	while(getNumTriangles() > targetTriangles && collapseRound(targetTriangles, maxError));
+}
+
+bool MeshSimplifier::collapseRound(size_t targetTriangles, float maxError) {
+	size_t numTriangles = getNumTriangles();
+	unsigned int numVertices = (unsigned int)positions_.size();
+
+	// Triangles around each vertex
+	std::vector<unsigned int> firstTriangle(numVertices + 1, 0);
+	for(size_t i = 0; i < indices_.size(); i++) {
+		firstTriangle[indices_[i] + 1]++;
+	}
+	for(unsigned int v = 0; v < numVertices; v++) {
+		firstTriangle[v + 1] += firstTriangle[v];
+	}
+	std::vector<unsigned int> vertexTriangles(indices_.size());
+	std::vector<unsigned int> cursor(firstTriangle.begin(), firstTriangle.end() - 1);
+	for(size_t i = 0; i < indices_.size(); i++) {
+		vertexTriangles[cursor[indices_[i]]++] = (unsigned int)(i / 3);
+	}
+
+	// Both directions of every edge the vertex kinds allow
+	std::vector<Collapse> collapses;
+	collapses.reserve(indices_.size());
+	for(size_t i = 0; i < indices_.size(); i += 3) {
+		for(int e = 0; e < 3; e++) {
+			unsigned int a = indices_[i + e], b = indices_[i + (e + 1) % 3];
+			for(int direction = 0; direction < 2; direction++) {
+				unsigned int from = direction == 0 ? a : b;
+				unsigned int to = direction == 0 ? b : a;
+				if(kinds_[from] == LOCKED || (kinds_[from] == BORDER && !isBorderEdge(from, to)))
+					continue;
+				Quadric q = quadrics_[from];
+				addQuadric(q, quadrics_[to]);
+				Collapse collapse = { evaluate(q, positions_[to]), from, to };
+				collapses.push_back(collapse);
+			}
+		}
+	}
+	std::sort(collapses.begin(), collapses.end());
+
+	// A triangle changes at most once per round, so the flip tests see the current mesh
+	std::vector<unsigned int> remap(numVertices);
+	for(unsigned int v = 0; v < numVertices; v++) {
+		remap[v] = v;
+	}
+	std::vector<bool> touched(numVertices, false);
+	size_t removed = 0;
+	bool collapsed = false;
+	for(size_t c = 0; c < collapses.size(); c++) {
+		const Collapse& collapse = collapses[c];
+		if(collapse.error > maxError || numTriangles - removed <= targetTriangles)
+			break;
+		if(touched[collapse.from] || touched[collapse.to])
+			continue;
+		if(flipsTriangles(collapse.from, collapse.to, firstTriangle, vertexTriangles))
+			continue;
+
+		for(unsigned int i = firstTriangle[collapse.from]; i < firstTriangle[collapse.from + 1]; i++) {
+			const unsigned int* triangle = &indices_[vertexTriangles[i] * 3];
+			bool hasTo = false;
+			for(int v = 0; v < 3; v++) {
+				touched[triangle[v]] = true;
+				hasTo = hasTo || triangle[v] == collapse.to;
+				// The open edges of a border vertex now end at the vertex it moved onto
+				if(kinds_[collapse.from] == BORDER && triangle[v] != collapse.from && triangle[v] != collapse.to && isBorderEdge(collapse.from, triangle[v]))
+					borderEdges_.insert(edgeKey(collapse.to, triangle[v]));
+			}
+			removed += hasTo ? 1 : 0;
+		}
+		remap[collapse.from] = collapse.to;
+		addQuadric(quadrics_[collapse.to], quadrics_[collapse.from]);
+		error_ = glm::max(error_, collapse.error);
+		collapsed = true;
+	}
+	if(!collapsed)
+		return false;
+
+	size_t numIndices = 0;
+	for(size_t i = 0; i < indices_.size(); i += 3) {
+		unsigned int a = remap[indices_[i]], b = remap[indices_[i + 1]], c = remap[indices_[i + 2]];
+		if(a == b || b == c || a == c)
+			continue;
+		indices_[numIndices++] = a;
+		indices_[numIndices++] = b;
+		indices_[numIndices++] = c;
+	}
+	indices_.resize(numIndices);
+	return true;
+}
@@ -1,18 +1,35 @@
+#include <algorithm>
 #include <iostream>
 
 #include "Camera.h"
 #include "Application.h"
+#include "MemoryTracker.h"
 
 #include "Object.h"
 
 Object::Object() {
+	mesh_ = NULL;
 	material_ = NULL;
 	position_ = glm::vec3(0.0f);
 	scale_ = 1.0f;
+	sceneGraph_ = NULL;
+	instanceBuffer_ = 0;
+	instanceBufferSize_ = 0;
+	instancesDirty_ = false;
+	drawCommandBuffer_ = 0;
+	drawCommandBufferSize_ = 0;
 }
 
 Object::~Object() {
 	delete mesh_;
+	if(instanceBuffer_) {
+		MemoryTracker::release(MemoryTracker::GEOMETRY, instanceBufferSize_);
+		glDeleteBuffers(1, &instanceBuffer_);
+	}
+	if(drawCommandBuffer_) {
+		MemoryTracker::release(MemoryTracker::GEOMETRY, drawCommandBufferSize_);
+		glDeleteBuffers(1, &drawCommandBuffer_);
+	}
 }
 
 void Object::setPosition(glm::vec3 pos) {
@@ -23,16 +40,131 @@ void Object::setScale(float scale) {
 	scale_ = scale;
 }
 
-void Object::draw(glm::mat4 &viewMatrix, glm::mat4 &projectionMatrix, glm::mat4 &depthViewProjectionMatrix, GLuint shader) {
-	glm::mat4 modelMatrix = glm::translate(glm::scale(glm::mat4(1.0f), glm::vec3(scale_)), position_);
-	glm::mat4 modelViewMatrix = viewMatrix * modelMatrix;
-	glm::mat4 depthModelViewProjectionMatrix = depthViewProjectionMatrix * modelMatrix;
+void Object::setNode(SceneGraph* sceneGraph, int node) {
+	sceneGraph_ = sceneGraph;
+	nodes_.assign(1, node);
+	instancesDirty_ = true;
+}
+
+void Object::addInstance(int node) {
+	nodes_.push_back(node);
+	instancesDirty_ = true;
+}
+
+int Object::getNode() {
+	return nodes_.empty() ? -1 : nodes_[0];
+}
+
+unsigned int Object::getNumInstances() {
+	return nodes_.empty() ? 1 : (unsigned int)nodes_.size();
+}
+
+bool Object::isInstanced() {
+	return nodes_.size() > 1;
+}
+
+void Object::updateInstanceBuffer() {
+	if(!isInstanced())
+		return;
+	for(size_t i = 0; i < nodes_.size() && !instancesDirty_; i++) {
+		instancesDirty_ = sceneGraph_->hasChanged(nodes_[i]);
+	}
+	if(!instancesDirty_)
+		return;
+
+	std::vector<glm::mat4> matrices(nodes_.size());
+	for(size_t i = 0; i < nodes_.size(); i++) {
+		matrices[i] = sceneGraph_->getWorldMatrix(nodes_[i]);
+	}
+
+	size_t bytes = matrices.size() * sizeof(glm::mat4);
+	if(!instanceBuffer_) {
+		glGenBuffers(1, &instanceBuffer_);
+		mesh_->setInstanceBuffer(instanceBuffer_);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer_);
+	if(bytes != instanceBufferSize_) {
+		glBufferData(GL_ARRAY_BUFFER, bytes, &matrices[0], GL_DYNAMIC_DRAW);
+		MemoryTracker::release(MemoryTracker::GEOMETRY, instanceBufferSize_);
+		MemoryTracker::allocate(MemoryTracker::GEOMETRY, bytes);
+		instanceBufferSize_ = bytes;
+	}
+	else {
+		glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, &matrices[0]);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	instancesDirty_ = false;
+}
+
+void Object::bindInstances(GLuint shader) {
+	// Instances added since the last scene graph update aren't uploaded yet
+	if(instancesDirty_)
+		updateInstanceBuffer();
+	glUniform1i(glGetUniformLocation(shader, "Instanced"), isInstanced());
+}
+
+// Box around the transformed corners of the mesh bounds of every instance
+glm::vec3 Object::getWorldBoundsMin() {
+	glm::vec3 corners[2] = { mesh_->getBoundsMin(), mesh_->getBoundsMax() };
+	glm::vec3 result(0.0f);
+	for(unsigned int n = 0; n < getNumInstances(); n++) {
+		glm::mat4 modelMatrix = sceneGraph_ ? sceneGraph_->getWorldMatrix(nodes_[n]) : getModelMatrix();
+		for(int i = 0; i < 8; i++) {
+			glm::vec3 corner(modelMatrix * glm::vec4(corners[i & 1].x, corners[(i >> 1) & 1].y, corners[i >> 2].z, 1.0f));
+			result = n == 0 && i == 0 ? corner : glm::min(result, corner);
+		}
+	}
+	return result;
+}
+
+glm::vec3 Object::getWorldBoundsMax() {
+	glm::vec3 corners[2] = { mesh_->getBoundsMin(), mesh_->getBoundsMax() };
+	glm::vec3 result(0.0f);
+	for(unsigned int n = 0; n < getNumInstances(); n++) {
+		glm::mat4 modelMatrix = sceneGraph_ ? sceneGraph_->getWorldMatrix(nodes_[n]) : getModelMatrix();
+		for(int i = 0; i < 8; i++) {
+			glm::vec3 corner(modelMatrix * glm::vec4(corners[i & 1].x, corners[(i >> 1) & 1].y, corners[i >> 2].z, 1.0f));
+			result = n == 0 && i == 0 ? corner : glm::max(result, corner);
+		}
+	}
+	return result;
+}
+
+glm::mat4 Object::getModelMatrix() {
+	if(sceneGraph_)
+		return sceneGraph_->getWorldMatrix(nodes_[0]);
+	return glm::translate(glm::scale(glm::mat4(1.0f), glm::vec3(scale_)), position_);
+}
+
+glm::mat4 Object::getViewModelMatrix(SceneGraph::CachedView view, const glm::mat4& matrix) {
+	if(sceneGraph_)
+		return sceneGraph_->getViewWorldMatrix(view, nodes_[0], matrix);
+	return matrix * getModelMatrix();
+}
+
+// Instanced objects skip cluster culling, their clusters are drawn for every instance
+void Object::draw(glm::mat4 &viewMatrix, glm::mat4 &projectionMatrix, glm::mat4 &depthViewProjectionMatrix, GLuint shader, bool culledClusters) {
+	setUniforms(viewMatrix, projectionMatrix, depthViewProjectionMatrix, shader);
+
+	if(culledClusters && hasCulledClusters())
+		mesh_->drawClusters(shader, drawCommandBuffer_);
+	else
+		mesh_->draw(shader, getNumInstances());
+}
+
+void Object::setUniforms(glm::mat4 &viewMatrix, glm::mat4 &projectionMatrix, glm::mat4 &depthViewProjectionMatrix, GLuint shader) {
+	glm::mat4 modelMatrix = getModelMatrix();
+	glm::mat4 modelViewMatrix = getViewModelMatrix(SceneGraph::CAMERA_VIEW, viewMatrix);
+	glm::mat4 depthModelViewProjectionMatrix = getViewModelMatrix(SceneGraph::LIGHT_VIEW_PROJECTION, depthViewProjectionMatrix);
 
 	glUniformMatrix4fv(glGetUniformLocation(shader, "ViewMatrix"), 1, GL_FALSE, &viewMatrix[0][0]);
 	glUniformMatrix4fv(glGetUniformLocation(shader, "ModelMatrix"), 1, GL_FALSE, &modelMatrix[0][0]);
 	glUniformMatrix4fv(glGetUniformLocation(shader, "ModelViewMatrix"), 1, GL_FALSE, &modelViewMatrix[0][0]);
 	glUniformMatrix4fv(glGetUniformLocation(shader, "ProjectionMatrix"), 1, GL_FALSE, &projectionMatrix[0][0]);
 	glUniformMatrix4fv(glGetUniformLocation(shader, "DepthModelViewProjectionMatrix"), 1, GL_FALSE, &depthModelViewProjectionMatrix[0][0]);
+	// Instanced draws take the model matrix from the instance buffer and build the products in the shader
+	glUniformMatrix4fv(glGetUniformLocation(shader, "DepthViewProjectionMatrix"), 1, GL_FALSE, &depthViewProjectionMatrix[0][0]);
+	bindInstances(shader);
 
 	// Load material specific stuff
 	// If there is no material textures will still be bound from previously drawn object.
@@ -41,29 +173,105 @@ void Object::draw(glm::mat4 &viewMatrix, glm::mat4 &projectionMatrix, glm::mat4
 	if(material_) {
 		material_->bindMaterial(shader);
 	}
+}
 
-	mesh_->draw();
+unsigned int Object::selectLOD(float maxError) {
+	if(maxError <= 0.0f || mesh_->getNumLODs() == 1)
+		return 0;
+
+	float scale = 0.0f;
+	for(unsigned int n = 0; n < getNumInstances(); n++) {
+		glm::mat4 modelMatrix = sceneGraph_ ? sceneGraph_->getWorldMatrix(nodes_[n]) : getModelMatrix();
+		for(int i = 0; i < 3; i++) {
+			scale = glm::max(scale, glm::length(glm::vec3(modelMatrix[i])));
+		}
+	}
+	return scale > 0.0f ? mesh_->selectLOD(maxError / scale) : 0;
 }
 
-void Object::drawToDepth(glm::mat4 &depthViewProjectionMatrix, GLuint shader) {
+void Object::drawToDepth(glm::mat4 &depthViewProjectionMatrix, GLuint shader, bool culledClusters, float maxError) {
 	glUseProgram(shader);
 
-	glm::mat4 modelMatrix = glm::translate(glm::scale(glm::mat4(1.0f), glm::vec3(scale_)), position_);
-	glm::mat4 modelViewProjectionMatrix = depthViewProjectionMatrix * modelMatrix;
+	glm::mat4 modelViewProjectionMatrix = getViewModelMatrix(SceneGraph::LIGHT_VIEW_PROJECTION, depthViewProjectionMatrix);
 	glUniformMatrix4fv(glGetUniformLocation(shader, "ModelViewProjectionMatrix"), 1, GL_FALSE, &modelViewProjectionMatrix[0][0]);
+	glUniformMatrix4fv(glGetUniformLocation(shader, "ViewProjectionMatrix"), 1, GL_FALSE, &depthViewProjectionMatrix[0][0]);
+	bindInstances(shader);
 
-	mesh_->draw();
+	unsigned int lod = selectLOD(maxError);
+	if(culledClusters && hasCulledClusters())
+		mesh_->drawClusters(shader, drawCommandBuffer_, lod);
+	else
+		mesh_->draw(shader, getNumInstances(), lod);
 }
 
-void Object::drawTo3DTexture(GLuint shader, glm::mat4 &depthViewProjectionMatrix) {
+void Object::drawTo3DTexture(GLuint shader, glm::mat4 &depthViewProjectionMatrix, bool culledClusters, float maxError) {
     material_->bindMaterial(shader);
 
     // Matrix to transform to light position
-    glm::mat4 modelMatrix = glm::translate(glm::scale(glm::mat4(1.0f), glm::vec3(scale_)), position_);
-    glm::mat4 depthModelViewProjectionMatrix = depthViewProjectionMatrix * modelMatrix;
+    glm::mat4 modelMatrix = getModelMatrix();
+    glm::mat4 depthModelViewProjectionMatrix = getViewModelMatrix(SceneGraph::LIGHT_VIEW_PROJECTION, depthViewProjectionMatrix);
 
     glUniformMatrix4fv(glGetUniformLocation(shader, "DepthModelViewProjectionMatrix"), 1, GL_FALSE, &depthModelViewProjectionMatrix[0][0]);
     glUniformMatrix4fv(glGetUniformLocation(shader, "ModelMatrix"), 1, GL_FALSE, &modelMatrix[0][0]);
+    glUniformMatrix4fv(glGetUniformLocation(shader, "DepthViewProjectionMatrix"), 1, GL_FALSE, &depthViewProjectionMatrix[0][0]);
+    bindInstances(shader);
     
-    mesh_->draw();
-}
\ No newline at end of file
+    unsigned int lod = selectLOD(maxError);
+    if(culledClusters && hasCulledClusters())
+        mesh_->drawClusters(shader, drawCommandBuffer_, lod);
+    else
+        mesh_->draw(shader, getNumInstances(), lod);
+}
+
+void Object::voxelizeCompute(GLuint shader, glm::mat4 &depthViewProjectionMatrix, float maxError) {
+    material_->bindMaterial(shader);
+    unsigned int lod = selectLOD(maxError);
+
+    // A dispatch per instance, the compute path has no instance buffer
+    for(unsigned int i = 0; i < getNumInstances(); i++) {
+        glm::mat4 modelMatrix = sceneGraph_ ? sceneGraph_->getWorldMatrix(nodes_[i]) : getModelMatrix();
+        glm::mat4 depthModelViewProjectionMatrix = sceneGraph_ ?
+            sceneGraph_->getViewWorldMatrix(SceneGraph::LIGHT_VIEW_PROJECTION, nodes_[i], depthViewProjectionMatrix) :
+            getViewModelMatrix(SceneGraph::LIGHT_VIEW_PROJECTION, depthViewProjectionMatrix);
+
+        glUniformMatrix4fv(glGetUniformLocation(shader, "DepthModelViewProjectionMatrix"), 1, GL_FALSE, &depthModelViewProjectionMatrix[0][0]);
+        glUniformMatrix4fv(glGetUniformLocation(shader, "ModelMatrix"), 1, GL_FALSE, &modelMatrix[0][0]);
+
+        mesh_->voxelize(shader, lod);
+    }
+}
+
+void Object::cullClusters(GLuint shader, float maxError) {
+	if(isInstanced())
+		return;
+
+	glm::mat4 modelMatrix = getModelMatrix();
+	glUniformMatrix4fv(glGetUniformLocation(shader, "ModelMatrix"), 1, GL_FALSE, &modelMatrix[0][0]);
+	// Cone axes are normals, so they are transformed by the inverse transpose. A non-uniform scale
+	// also changes the angles between the normals, then the cones no longer bound them and aren't tested
+	glm::mat4 normalMatrix = glm::transpose(glm::inverse(modelMatrix));
+	glUniformMatrix4fv(glGetUniformLocation(shader, "NormalMatrix"), 1, GL_FALSE, &normalMatrix[0][0]);
+	float scaleX = glm::length(glm::vec3(modelMatrix[0]));
+	float scaleY = glm::length(glm::vec3(modelMatrix[1]));
+	float scaleZ = glm::length(glm::vec3(modelMatrix[2]));
+	float maxScale = std::max(scaleX, std::max(scaleY, scaleZ));
+	float minScale = std::min(scaleX, std::min(scaleY, scaleZ));
+	glUniform1i(glGetUniformLocation(shader, "ConeCulling"), maxScale - minScale <= 1e-3f * maxScale);
+
+	// Sized for every level of the mesh, so the list can be drawn at any of them
+	if(!drawCommandBuffer_) {
+		drawCommandBufferSize_ = mesh_->getDrawCommandBytes();
+		glGenBuffers(1, &drawCommandBuffer_);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, drawCommandBuffer_);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, drawCommandBufferSize_, NULL, GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		MemoryTracker::allocate(MemoryTracker::GEOMETRY, drawCommandBufferSize_);
+	}
+
+	mesh_->cullClusters(shader, drawCommandBuffer_, selectLOD(maxError));
+}
+
+// Each object has its own draw list, objects sharing a mesh don't overwrite each other's
+bool Object::hasCulledClusters() {
+	return drawCommandBuffer_ != 0 && !isInstanced();
+}
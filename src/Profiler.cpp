@@ -0,0 +1,222 @@
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+
+#include "GLCapture.h"
+#include "Profiler.h"
+
+Profiler::GPUQuerySet Profiler::gpuSets_[2];
+int Profiler::gpuSet_ = 0;
+std::vector<size_t> Profiler::gpuZoneStack_;
+std::vector<GLuint> Profiler::freeQueries_;
+Profiler::ThreadRing Profiler::gpuRing_;
+std::vector<Profiler::ThreadRing*> Profiler::threadRings_;
+std::mutex Profiler::threadRingsMutex_;
+
+namespace
+{
+	const timer::HighResClock::time_point g_StartTime = timer::now();
+}
+
+long long Profiler::toNanoseconds(timer::HighResClock::time_point time) {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(time - g_StartTime).count();
+}
+
+Profiler::ThreadRing* Profiler::getThreadRing() {
+	static thread_local ThreadRing* ring = NULL;
+	if(!ring) {
+		ring = new ThreadRing();
+		ring->events.resize(RING_CAPACITY);
+		ring->count = 0;
+
+		// Rings are never freed so events from finished threads can still be exported
+		std::lock_guard<std::mutex> lock(threadRingsMutex_);
+		threadRings_.push_back(ring);
+		ring->threadIndex = (int)threadRings_.size(); // 0 is the GPU
+	}
+	return ring;
+}
+
+void Profiler::pushEvent(ThreadRing* ring, const char* name, long long startNs, long long durationNs) {
+	// Only the owning thread writes, readers use count to know what is valid
+	if(ring->events.empty()) {
+		ring->events.resize(RING_CAPACITY);
+	}
+	size_t index = ring->count.load(std::memory_order_relaxed);
+	Event& event = ring->events[index % RING_CAPACITY];
+	event.name = name;
+	event.startNs = startNs;
+	event.durationNs = durationNs;
+	ring->count.store(index + 1, std::memory_order_release);
+}
+
+void Profiler::recordCPU(const char* name, timer::HighResClock::time_point start, timer::HighResClock::time_point end) {
+	long long startNs = toNanoseconds(start);
+	pushEvent(getThreadRing(), name, startNs, toNanoseconds(end) - startNs);
+}
+
+GLuint Profiler::getQuery() {
+	if(freeQueries_.empty()) {
+		GLuint query;
+		glGenQueries(1, &query);
+		return query;
+	}
+	GLuint query = freeQueries_.back();
+	freeQueries_.pop_back();
+	return query;
+}
+
+void Profiler::beginFrame() {
+	gpuSet_ = (gpuSet_ + 1) % 2;
+	GPUQuerySet& set = gpuSets_[gpuSet_];
+
+	// These queries were issued two frames ago and should be done by now. If they
+	// aren't they are dropped instead of waiting for them.
+	for(size_t i = 0; i < set.queries.size(); i++) {
+		GPUQuery& query = set.queries[i];
+		GLint available = 0;
+		glGetQueryObjectiv(query.endQuery, GL_QUERY_RESULT_AVAILABLE, &available);
+		if(available) {
+			GLuint64 start, end;
+			glGetQueryObjectui64v(query.startQuery, GL_QUERY_RESULT, &start);
+			glGetQueryObjectui64v(query.endQuery, GL_QUERY_RESULT, &end);
+			pushEvent(&gpuRing_, query.name, (long long)start + set.cpuMinusGpuNs, (long long)(end - start));
+		}
+		freeQueries_.push_back(query.startQuery);
+		freeQueries_.push_back(query.endQuery);
+	}
+	set.queries.clear();
+}
+
+void Profiler::beginGPUZone(const char* name) {
+	GPUQuerySet& set = gpuSets_[gpuSet_];
+
+	// Offset between the GPU and CPU clocks, so both end up on the same timeline
+	if(set.queries.empty()) {
+		GLint64 gpuNow;
+		glGetInteger64v(GL_TIMESTAMP, &gpuNow);
+		set.cpuMinusGpuNs = toNanoseconds(timer::now()) - gpuNow;
+	}
+
+	GPUQuery query;
+	query.name = name;
+	query.startQuery = getQuery();
+	query.endQuery = getQuery();
+	glQueryCounter(query.startQuery, GL_TIMESTAMP);
+
+	gpuZoneStack_.push_back(set.queries.size());
+	set.queries.push_back(query);
+}
+
+void Profiler::endGPUZone() {
+	GPUQuerySet& set = gpuSets_[gpuSet_];
+	glQueryCounter(set.queries[gpuZoneStack_.back()].endQuery, GL_TIMESTAMP);
+	gpuZoneStack_.pop_back();
+}
+
+std::vector<Profiler::Event> Profiler::collectEvents(std::vector<int>* threadIndices) {
+	std::vector<ThreadRing*> rings;
+	rings.push_back(&gpuRing_);
+	{
+		std::lock_guard<std::mutex> lock(threadRingsMutex_);
+		rings.insert(rings.end(), threadRings_.begin(), threadRings_.end());
+	}
+
+	std::vector<Event> events;
+	for(size_t r = 0; r < rings.size(); r++) {
+		size_t count = rings[r]->count.load(std::memory_order_acquire);
+		size_t first = count > RING_CAPACITY ? count - RING_CAPACITY : 0;
+		for(size_t i = first; i < count; i++) {
+			events.push_back(rings[r]->events[i % RING_CAPACITY]);
+			threadIndices->push_back(r == 0 ? 0 : rings[r]->threadIndex);
+		}
+	}
+	return events;
+}
+
+void Profiler::printSummary(std::ostream& out) {
+	std::vector<int> threadIndices;
+	std::vector<Event> events = collectEvents(&threadIndices);
+
+	// Durations in milliseconds per zone, GPU zones are kept apart from CPU zones
+	std::map<std::string, std::vector<double> > zones;
+	for(size_t i = 0; i < events.size(); i++) {
+		std::string key = std::string(threadIndices[i] == 0 ? "gpu " : "cpu ") + events[i].name;
+		zones[key].push_back(events[i].durationNs / 1.0e6);
+	}
+
+	out << std::left << std::setw(32) << "zone" << std::right
+		<< std::setw(8) << "count" << std::setw(12) << "min ms" << std::setw(12) << "mean ms"
+		<< std::setw(12) << "p99 ms" << std::setw(12) << "max ms" << std::endl;
+	out << std::fixed << std::setprecision(3);
+	for(std::map<std::string, std::vector<double> >::iterator zone = zones.begin(); zone != zones.end(); ++zone) {
+		std::vector<double>& durations = zone->second;
+		std::sort(durations.begin(), durations.end());
+		double sum = 0.0;
+		for(size_t i = 0; i < durations.size(); i++) {
+			sum += durations[i];
+		}
+		size_t p99 = (size_t)std::ceil(0.99 * durations.size()) - 1;
+
+		out << std::left << std::setw(32) << zone->first << std::right
+			<< std::setw(8) << durations.size() << std::setw(12) << durations.front()
+			<< std::setw(12) << sum / durations.size() << std::setw(12) << durations[p99]
+			<< std::setw(12) << durations.back() << std::endl;
+	}
+	out.unsetf(std::ios_base::floatfield);
+}
+
+bool Profiler::writeChromeTrace(const std::string& filename) {
+	std::ofstream file(filename.c_str());
+	if(!file.is_open()) {
+		std::cout << "Couldn't write trace " << filename << std::endl;
+		return false;
+	}
+
+	std::vector<int> threadIndices;
+	std::vector<Event> events = collectEvents(&threadIndices);
+
+	file << "{\"traceEvents\":[" << std::endl;
+	file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"GPU\"}}";
+	int maxThread = 0;
+	for(size_t i = 0; i < threadIndices.size(); i++) {
+		maxThread = std::max(maxThread, threadIndices[i]);
+	}
+	for(int t = 1; t <= maxThread; t++) {
+		file << "," << std::endl << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << t
+			 << ",\"args\":{\"name\":\"CPU thread " << t << "\"}}";
+	}
+
+	// Timestamps are in microseconds
+	file << std::fixed << std::setprecision(3);
+	for(size_t i = 0; i < events.size(); i++) {
+		file << "," << std::endl << "{\"name\":\"" << events[i].name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << threadIndices[i]
+			 << ",\"ts\":" << events[i].startNs / 1000.0 << ",\"dur\":" << events[i].durationNs / 1000.0 << "}";
+	}
+	file << std::endl << "]}" << std::endl;
+
+	return true;
+}
+
+ProfileZone::ProfileZone(const char* name) {
+	name_ = name;
+	start_ = timer::now();
+}
+
+ProfileZone::~ProfileZone() {
+	Profiler::recordCPU(name_, start_, timer::now());
+}
+
+// GPU zones are also the passes a GL capture counts calls in
+GPUProfileZone::GPUProfileZone(const char* name) : cpuZone_(name) {
+	GLCapture::beginPass(name);
+	Profiler::beginGPUZone(name);
+}
+
+GPUProfileZone::~GPUProfileZone() {
+	Profiler::endGPUZone();
+	GLCapture::endPass();
+}
@@ -0,0 +1,157 @@
+#include "SimdFloat.h"
+#include "SceneGraph.h"
+
+SceneGraph::SceneGraph() {
+	viewsValid_ = false;
+	numUpdated_ = 0;
+}
+
+int SceneGraph::addNode(int parent, const glm::mat4& localMatrix) {
+	parents_.push_back(parent);
+	localMatrices_.push_back(localMatrix);
+	// Valid right away, the cached view products follow in update()
+	worldMatrices_.push_back(localMatrix);
+	if(parent >= 0)
+		multiply(worldMatrices_[parent], localMatrix, worldMatrices_.back());
+	dirty_.push_back(1);
+	changed_.push_back(0);
+	for(int v = 0; v < NUM_CACHED_VIEWS; v++) {
+		viewWorldMatrices_[v].push_back(glm::mat4(1.0f));
+	}
+	return (int)parents_.size() - 1;
+}
+
+int SceneGraph::addNodes(const NodeList& nodes, int parent) {
+	int firstNode = (int)parents_.size();
+	for(size_t i = 0; i < nodes.parents.size(); i++) {
+		addNode(nodes.parents[i] < 0 ? parent : firstNode + nodes.parents[i], nodes.localMatrices[i]);
+	}
+	return firstNode;
+}
+
+// The subtree follows in update(), since children always come after their parent
+void SceneGraph::setLocalMatrix(int node, const glm::mat4& localMatrix) {
+	localMatrices_[node] = localMatrix;
+	dirty_[node] = 1;
+}
+
+const glm::mat4& SceneGraph::getLocalMatrix(int node) {
+	return localMatrices_[node];
+}
+
+const glm::mat4& SceneGraph::getWorldMatrix(int node) {
+	return worldMatrices_[node];
+}
+
+glm::mat4 SceneGraph::getViewWorldMatrix(CachedView view, int node, const glm::mat4& matrix) {
+	// Nodes added or changed since the last update() have no product yet
+	if(viewsValid_ && !dirty_[node] && matrix == viewMatrices_[view])
+		return viewWorldMatrices_[view][node];
+	glm::mat4 result;
+	multiply(matrix, worldMatrices_[node], result);
+	return result;
+}
+
+bool SceneGraph::hasChanged(int node) {
+	return changed_[node] != 0;
+}
+
+void SceneGraph::update(const glm::mat4& cameraView, const glm::mat4& lightViewProjection) {
+	numUpdated_ = 0;
+	for(size_t i = 0; i < parents_.size(); i++) {
+		int parent = parents_[i];
+		changed_[i] = dirty_[i] || (parent >= 0 && changed_[parent]);
+		if(!changed_[i])
+			continue;
+		if(parent >= 0)
+			multiply(worldMatrices_[parent], localMatrices_[i], worldMatrices_[i]);
+		else
+			worldMatrices_[i] = localMatrices_[i];
+		dirty_[i] = 0;
+		numUpdated_++;
+	}
+
+	const glm::mat4 views[NUM_CACHED_VIEWS] = { cameraView, lightViewProjection };
+	for(int v = 0; v < NUM_CACHED_VIEWS; v++) {
+		bool all = !viewsValid_ || views[v] != viewMatrices_[v];
+		viewMatrices_[v] = views[v];
+		for(size_t i = 0; i < parents_.size(); i++) {
+			if(all || changed_[i])
+				multiply(views[v], worldMatrices_[i], viewWorldMatrices_[v][i]);
+		}
+	}
+	viewsValid_ = true;
+}
+
+size_t SceneGraph::getNumNodes() {
+	return parents_.size();
+}
+
+size_t SceneGraph::getNumUpdated() {
+	return numUpdated_;
+}
+
+void SceneGraph::flattenAssimpNodes(const aiScene* scene, NodeList& nodes) {
+	nodes.parents.clear();
+	nodes.localMatrices.clear();
+	nodes.meshInstances.clear();
+	std::vector<bool> referenced(scene->mNumMeshes, false);
+
+	// Breadth first, so parents end up before their children
+	std::vector<std::pair<const aiNode*, int> > queue;
+	if(scene->mRootNode)
+		queue.push_back(std::make_pair(scene->mRootNode, -1));
+	for(size_t q = 0; q < queue.size(); q++) {
+		const aiNode* node = queue[q].first;
+		int index = (int)nodes.parents.size();
+		nodes.parents.push_back(queue[q].second);
+		nodes.localMatrices.push_back(toMatrix(node->mTransformation));
+		for(unsigned int m = 0; m < node->mNumMeshes; m++) {
+			nodes.meshInstances.push_back(std::make_pair(node->mMeshes[m], index));
+			referenced[node->mMeshes[m]] = true;
+		}
+		for(unsigned int c = 0; c < node->mNumChildren; c++) {
+			queue.push_back(std::make_pair((const aiNode*)node->mChildren[c], index));
+		}
+	}
+
+	if(nodes.parents.empty()) {
+		nodes.parents.push_back(-1);
+		nodes.localMatrices.push_back(glm::mat4(1.0f));
+	}
+	for(unsigned int m = 0; m < scene->mNumMeshes; m++) {
+		if(!referenced[m])
+			nodes.meshInstances.push_back(std::make_pair(m, 0));
+	}
+}
+
+// Assimp matrices are row major
+glm::mat4 SceneGraph::toMatrix(const aiMatrix4x4& m) {
+	return glm::mat4(glm::vec4(m.a1, m.b1, m.c1, m.d1),
+					 glm::vec4(m.a2, m.b2, m.c2, m.d2),
+					 glm::vec4(m.a3, m.b3, m.c3, m.d3),
+					 glm::vec4(m.a4, m.b4, m.c4, m.d4));
+}
+
+void SceneGraph::multiply(const glm::mat4& a, const glm::mat4& b, glm::mat4& out) {
+#if defined(SIMD_AVX) || defined(SIMD_SSE)
+	// Column j of the result is a's columns weighted by column j of b
+	const float* pa = &a[0][0];
+	const float* pb = &b[0][0];
+	__m128 a0 = _mm_loadu_ps(pa), a1 = _mm_loadu_ps(pa + 4), a2 = _mm_loadu_ps(pa + 8), a3 = _mm_loadu_ps(pa + 12);
+	__m128 columns[4];
+	for(int j = 0; j < 4; j++) {
+		__m128 column = _mm_mul_ps(a0, _mm_set1_ps(pb[4 * j]));
+		column = _mm_add_ps(column, _mm_mul_ps(a1, _mm_set1_ps(pb[4 * j + 1])));
+		column = _mm_add_ps(column, _mm_mul_ps(a2, _mm_set1_ps(pb[4 * j + 2])));
+		column = _mm_add_ps(column, _mm_mul_ps(a3, _mm_set1_ps(pb[4 * j + 3])));
+		columns[j] = column;
+	}
+	float* po = &out[0][0];
+	for(int j = 0; j < 4; j++) {
+		_mm_storeu_ps(po + 4 * j, columns[j]);
+	}
+#else
+	out = a * b;
+#endif
+}
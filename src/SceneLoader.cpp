@@ -0,0 +1,216 @@
+#include <iostream>
+#include <algorithm>
+#include <memory>
+
+#include <assimp/Importer.hpp>
+#include <assimp/postprocess.h>
+#include <assimp/scene.h>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "HighResClock.h"
+#include "Profiler.h"
+#include "SceneLoader.h"
+
+SceneLoader::SceneLoader(JobSystem* jobSystem, bool quantizePositions, bool keepMeshCPUCopies, bool buildMeshLODs) {
+	jobSystem_ = jobSystem;
+	quantizePositions_ = quantizePositions;
+	keepMeshCPUCopies_ = keepMeshCPUCopies;
+	buildMeshLODs_ = buildMeshLODs;
+	doneJob_ = NULL;
+	workerDone_ = true;
+	failed_ = false;
+	cancel_ = false;
+}
+
+SceneLoader::~SceneLoader() {
+	// Stop the jobs early if the application quits while loading
+	cancel_ = true;
+	if(doneJob_)
+		jobSystem_->wait(doneJob_);
+
+	// Delete whatever was never handed to the application
+	for(std::deque<ReadyObject>::iterator obj = readyObjects_.begin(); obj != readyObjects_.end(); ++obj) {
+		delete obj->object;
+	}
+	for(std::deque<DecodedTexture>::iterator tex = readyTextures_.begin(); tex != readyTextures_.end(); ++tex) {
+		Material::freeImage(tex->image);
+	}
+	for(std::map<int, Material*>::iterator mat = readyMaterials_.begin(); mat != readyMaterials_.end(); ++mat) {
+		delete mat->second;
+	}
+}
+
+void SceneLoader::loadAsync(std::string path, std::string name, glm::vec3 pos, float scale) {
+	if(doneJob_)
+		jobSystem_->wait(doneJob_);
+
+	workerDone_ = false;
+	failed_ = false;
+	doneJob_ = jobSystem_->create("sceneLoaded", [this]() { workerDone_ = true; });
+	JobSystem::Job* import = jobSystem_->create("importScene", [this, path, name, pos, scale]() { run(path, name, pos, scale); });
+	jobSystem_->addDependency(doneJob_, import);
+	jobSystem_->submit(import);
+	jobSystem_->submit(doneJob_);
+}
+
+void SceneLoader::run(std::string path, std::string name, glm::vec3 pos, float scale) {
+	// Shared by the mesh jobs, the scene is freed with the last of them
+	std::shared_ptr<Assimp::Importer> importer(new Assimp::Importer());
+
+	// Read file and store as a "scene"
+	const aiScene* scene = importer->ReadFile(path + name, aiProcess_Triangulate |
+		aiProcess_CalcTangentSpace |
+		aiProcess_JoinIdenticalVertices);
+
+	if(!scene) {
+		std::cerr << "Mesh: " << importer->GetErrorString() << std::endl;
+		failed_ = true;
+		return;
+	}
+
+	// Materials are created first so objects can point to them. Their textures are
+	// decoded later and placeholders are bound until then.
+	std::map<int, Material*> materials;
+	for(unsigned int m = 0; m < scene->mNumMaterials; m++) {
+		Material* mat = new Material();
+		mat->loadAssimpMaterial(scene->mMaterials[m], path);
+		materials[m] = mat;
+
+		for(int t = 0; t < Material::NUM_TEXTURES; t++) {
+			DecodedTexture job;
+			job.material = mat;
+			job.type = (Material::TEXTURES_TYPES)t;
+			job.path = mat->getTexturePath(job.type);
+			job.image.data = NULL;
+			if(job.path.empty())
+				continue;
+
+			JobSystem::Job* decode = jobSystem_->add("decodeImage", [this, job]() mutable {
+				if(cancel_)
+					return;
+				job.image = Material::decodeTexture(job.path);
+
+				std::lock_guard<std::mutex> lock(mutex_);
+				readyTextures_.push_back(job);
+			});
+			jobSystem_->addDependency(doneJob_, decode);
+		}
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		readyMaterials_.insert(materials.begin(), materials.end());
+	}
+
+	// The nodes go below a root holding the position and scale, the render thread adds them to the graph
+	std::shared_ptr<SceneNodes> nodes(new SceneNodes());
+	SceneGraph::flattenAssimpNodes(scene, nodes->nodes);
+	nodes->meshNodes.resize(scene->mNumMeshes);
+	for(size_t i = 0; i < nodes->nodes.meshInstances.size(); i++) {
+		nodes->meshNodes[nodes->nodes.meshInstances[i].first].push_back(nodes->nodes.meshInstances[i].second);
+	}
+	nodes->rootMatrix = glm::translate(glm::scale(glm::mat4(1.0f), glm::vec3(scale)), pos);
+	nodes->firstNode = -1;
+
+	for(unsigned int m = 0; m < scene->mNumMeshes; m++) {
+		const aiMesh* assimpMesh = scene->mMeshes[m];
+		Material* material = materials[assimpMesh->mMaterialIndex];
+		JobSystem::Job* build = jobSystem_->add("buildVertexData", [this, importer, assimpMesh, material, nodes, m]() {
+			if(cancel_)
+				return;
+			Mesh* mesh = new Mesh();
+			mesh->buildVertexData(assimpMesh, quantizePositions_, keepMeshCPUCopies_, buildMeshLODs_);
+
+			ReadyObject ready;
+			ready.object = new Object();
+			ready.object->mesh_ = mesh;
+			ready.object->material_ = material;
+			ready.meshIndex = m;
+			ready.scene = nodes;
+
+			std::lock_guard<std::mutex> lock(mutex_);
+			readyObjects_.push_back(ready);
+		});
+		jobSystem_->addDependency(doneJob_, build);
+	}
+}
+
+bool SceneLoader::processUploads(std::vector<Object*>& objects, std::map<int, Material*>& materials, SceneGraph& sceneGraph, double timeBudgetSeconds) {
+	auto start = timer::HighResClock::now();
+	bool changed = false;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		for(std::map<int, Material*>::iterator mat = readyMaterials_.begin(); mat != readyMaterials_.end(); ++mat) {
+			materials[mat->first] = mat->second;
+		}
+		readyMaterials_.clear();
+	}
+
+	// Geometry goes first so the scene shows up as early as possible, then textures.
+	// At least one item is uploaded per call so loading always progresses.
+	while(true) {
+		ReadyObject obj;
+		obj.object = NULL;
+		DecodedTexture tex;
+		bool hasTexture = false;
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			if(!readyObjects_.empty()) {
+				obj = readyObjects_.front();
+				readyObjects_.pop_front();
+			}
+			else if(!readyTextures_.empty()) {
+				tex = readyTextures_.front();
+				readyTextures_.pop_front();
+				hasTexture = true;
+			}
+		}
+
+		if(obj.object) {
+			obj.object->mesh_->upload();
+			placeObject(obj, objects, sceneGraph);
+		}
+		else if(hasTexture) {
+			tex.material->setTexture(tex.type, Material::uploadTexture(tex.image, tex.path));
+		}
+		else {
+			break;
+		}
+		changed = true;
+
+		double elapsed = std::chrono::duration<double>(timer::HighResClock::now() - start).count();
+		if(elapsed > timeBudgetSeconds)
+			break;
+	}
+
+	return changed;
+}
+
+void SceneLoader::placeObject(ReadyObject& ready, std::vector<Object*>& objects, SceneGraph& sceneGraph) {
+	SceneNodes& scene = *ready.scene;
+	if(scene.firstNode < 0) {
+		int root = sceneGraph.addNode(-1, scene.rootMatrix);
+		scene.firstNode = sceneGraph.addNodes(scene.nodes, root);
+	}
+
+	// One object per mesh however often it is placed, the further nodes are instances
+	const std::vector<int>& nodes = scene.meshNodes[ready.meshIndex];
+	ready.object->setNode(&sceneGraph, scene.firstNode + nodes[0]);
+	for(size_t i = 1; i < nodes.size(); i++) {
+		ready.object->addInstance(scene.firstNode + nodes[i]);
+	}
+	objects.push_back(ready.object);
+}
+
+bool SceneLoader::isDone() {
+	if(!workerDone_)
+		return false;
+
+	std::lock_guard<std::mutex> lock(mutex_);
+	return readyObjects_.empty() && readyTextures_.empty() && readyMaterials_.empty();
+}
+
+bool SceneLoader::failed() {
+	return failed_;
+}
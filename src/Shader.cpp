@@ -4,13 +4,60 @@
 #include <iostream>
 #include <fstream>
 #include <algorithm>
+#include <map>
+#include <mutex>
 
 #include <stdlib.h>
 #include <string.h>
 
 #include "Shader.h"
 
-GLuint loadShaders(const char* vert, const char* frag, const char* geom) {
+// Sources read by preloadShaderSource(), protected by shaderCacheMutex
+static std::map<std::string, std::string> shaderCache;
+static std::mutex shaderCacheMutex;
+
+static bool readShaderFile(const char* path, std::string& code) {
+    std::ifstream stream(path, std::ios::in);
+    if(!stream.is_open())
+        return false;
+    std::string Line = "";
+    while(getline(stream, Line))
+        code += "\n" + Line;
+    return true;
+}
+
+void preloadShaderSource(const char* path) {
+    std::string code;
+    if(!readShaderFile(path, code))
+        return;
+    std::lock_guard<std::mutex> lock(shaderCacheMutex);
+    shaderCache[path] = code;
+}
+
+static bool readShaderSource(const char* path, std::string& code) {
+    {
+        std::lock_guard<std::mutex> lock(shaderCacheMutex);
+        std::map<std::string, std::string>::iterator cached = shaderCache.find(path);
+        if(cached != shaderCache.end()) {
+            code = cached->second;
+            return true;
+        }
+    }
+    return readShaderFile(path, code);
+}
+
+static void replaceVersionLine(std::string& code, const char* header) {
+    if(!header)
+        return;
+    size_t start = code.find("#version");
+    if(start == std::string::npos) {
+        code = header + code;
+        return;
+    }
+    code.replace(start, code.find('\n', start) - start, header);
+}
+
+GLuint loadShaders(const char* vert, const char* frag, const char* geom, const char* header) {
     // Create the shaders
     GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
     GLuint fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
@@ -21,13 +68,7 @@ GLuint loadShaders(const char* vert, const char* frag, const char* geom) {
     
     // Read the Vertex Shader code from the file
     std::string vertexShaderCode;
-    std::ifstream vertexShaderStream(vert, std::ios::in);
-    if(vertexShaderStream.is_open()) {
-        std::string Line = "";
-        while(getline(vertexShaderStream, Line))
-            vertexShaderCode += "\n" + Line;
-        vertexShaderStream.close();
-    } else {
+    if(!readShaderSource(vert, vertexShaderCode)) {
         std::cout << "Couldn't open shader " << vert << "!" << std::endl;
         getchar();
         return 0;
@@ -35,13 +76,7 @@ GLuint loadShaders(const char* vert, const char* frag, const char* geom) {
     
     // Read the Fragment Shader code from the file
     std::string fragmentShaderCode;
-    std::ifstream fragmentShaderStream(frag, std::ios::in);
-    if(fragmentShaderStream.is_open()) {
-        std::string Line = "";
-        while(getline(fragmentShaderStream, Line))
-            fragmentShaderCode += "\n" + Line;
-        fragmentShaderStream.close();
-    } else {
+    if(!readShaderSource(frag, fragmentShaderCode)) {
         std::cout << "Couldn't open shader " << frag << "!" << std::endl;
         getchar();
         return 0;
@@ -50,19 +85,18 @@ GLuint loadShaders(const char* vert, const char* frag, const char* geom) {
     // Read the Geometry Shader code from the file
     std::string geometryShaderCode;
     if(geom) {
-        std::ifstream geometryShaderStream(geom, std::ios::in);
-        if(geometryShaderStream.is_open()){
-            std::string Line = "";
-            while(getline(geometryShaderStream, Line))
-                geometryShaderCode += "\n" + Line;
-            geometryShaderStream.close();
-        } else {
+        if(!readShaderSource(geom, geometryShaderCode)) {
             std::cout << "Couldn't open shader " << geom << "!" << std::endl;
             getchar();
             return 0;
         }
     }
     
+    replaceVersionLine(vertexShaderCode, header);
+    replaceVersionLine(fragmentShaderCode, header);
+    if(geom)
+        replaceVersionLine(geometryShaderCode, header);
+
     GLint Result = GL_FALSE;
     int infoLogLength;
     
@@ -139,4 +173,63 @@ GLuint loadShaders(const char* vert, const char* frag, const char* geom) {
     }
     
     return program;
-}
\ No newline at end of file
+}
+
+GLuint loadComputeShader(const char* comp, const char* header) {
+    GLuint computeShader = glCreateShader(GL_COMPUTE_SHADER);
+
+    // Read the Compute Shader code from the file
+    std::string computeShaderCode;
+    if(!readShaderSource(comp, computeShaderCode)) {
+        std::cout << "Couldn't open shader " << comp << "!" << std::endl;
+        glDeleteShader(computeShader);
+        return 0;
+    }
+    replaceVersionLine(computeShaderCode, header);
+
+    GLint Result = GL_FALSE;
+    int infoLogLength;
+
+    // Compile Compute Shader
+    printf("Compiling shader : %s\n", comp);
+    char const * computeSourcePointer = computeShaderCode.c_str();
+    glShaderSource(computeShader, 1, &computeSourcePointer , NULL);
+    glCompileShader(computeShader);
+
+    // Check Compute Shader
+    glGetShaderiv(computeShader, GL_COMPILE_STATUS, &Result);
+    glGetShaderiv(computeShader, GL_INFO_LOG_LENGTH, &infoLogLength);
+    if ( infoLogLength > 0 ){
+        std::vector<char> errorMessage(infoLogLength+1);
+        glGetShaderInfoLog(computeShader, infoLogLength, NULL, &errorMessage[0]);
+        printf("%s\n", &errorMessage[0]);
+    }
+    if(Result != GL_TRUE) {
+        glDeleteShader(computeShader);
+        return 0;
+    }
+
+    // Link the program
+    printf("Linking program\n");
+    GLuint program = glCreateProgram();
+    glAttachShader(program, computeShader);
+    glLinkProgram(program);
+
+    // Check the program
+    glGetProgramiv(program, GL_LINK_STATUS, &Result);
+    glGetProgramiv(program, GL_INFO_LOG_LENGTH, &infoLogLength);
+    if ( infoLogLength > 0 ){
+        std::vector<char> ProgramErrorMessage(infoLogLength+1);
+        glGetProgramInfoLog(program, infoLogLength, NULL, &ProgramErrorMessage[0]);
+        printf("%s\n", &ProgramErrorMessage[0]);
+    }
+
+    glDeleteShader(computeShader);
+
+    if(Result != GL_TRUE) {
+        glDeleteProgram(program);
+        return 0;
+    }
+
+    return program;
+}
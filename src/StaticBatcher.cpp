@@ -0,0 +1,332 @@
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <unordered_map>
+
+#include <glm/gtc/packing.hpp>
+
+#include "HighResClock.h"
+#include "MemoryTracker.h"
+#include "Profiler.h"
+#include "StaticBatcher.h"
+
+// Only vertices with bit for bit the same world position are welded
+struct PositionHash {
+	size_t operator()(const glm::vec3& p) const {
+		unsigned int bits[3];
+		memcpy(bits, &p[0], sizeof(bits));
+		return (bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^ (bits[2] * 83492791u);
+	}
+};
+
+StaticBatcher::StaticBatcher(unsigned int maxBatchVertices, bool quantizePositions, bool keepCPUCopies, bool buildLODs) {
+	maxBatchVertices_ = std::max(maxBatchVertices, 3u);
+	quantizePositions_ = quantizePositions;
+	keepCPUCopies_ = keepCPUCopies;
+	buildLODs_ = buildLODs;
+	numWeldedVertices_ = 0;
+}
+
+StaticBatcher::~StaticBatcher() {
+	for(size_t i = 0; i < depthBatches_.size(); i++) {
+		MemoryTracker::release(MemoryTracker::GEOMETRY, depthBatches_[i].bytes);
+		glDeleteBuffers(1, &depthBatches_[i].vertexBuffer);
+		glDeleteBuffers(1, &depthBatches_[i].indexBuffer);
+		glDeleteVertexArrays(1, &depthBatches_[i].vertexArray);
+	}
+}
+
+void StaticBatcher::batch(std::vector<Object*>& objects) {
+	PROFILE_ZONE("staticBatching");
+	timer::HighResClock::time_point start = timer::now();
+
+	// Instanced objects are a single draw already
+	std::vector<Object*> candidates;
+	unsigned int numVertices = 0;
+	for(std::vector<Object*>::iterator obj = objects.begin(); obj != objects.end(); ++obj) {
+		if((*obj)->isInstanced() || !(*obj)->mesh_->hasCPUCopies())
+			continue;
+		candidates.push_back(*obj);
+		numVertices += (*obj)->mesh_->getNumVertices();
+	}
+	candidates = sortSpatially(candidates);
+
+	buildDepthBatches(candidates);
+
+	// Same material, then Z-order within the material
+	std::map<Material*, std::vector<Object*> > groups;
+	for(size_t i = 0; i < candidates.size(); i++) {
+		groups[candidates[i]->material_].push_back(candidates[i]);
+	}
+
+	std::map<Object*, Object*> replacedBy;
+	size_t numBatches = 0;
+	for(std::map<Material*, std::vector<Object*> >::iterator group = groups.begin(); group != groups.end(); ++group) {
+		const std::vector<Object*>& members = group->second;
+		std::vector<Object*> batchObjects;
+		unsigned int batchVertices = 0;
+		for(size_t i = 0; i <= members.size(); i++) {
+			unsigned int objectVertices = i < members.size() ? members[i]->mesh_->getNumVertices() : 0;
+			if(i == members.size() || (!batchObjects.empty() && batchVertices + objectVertices > maxBatchVertices_)) {
+				// A batch of one stays the object it is
+				if(batchObjects.size() > 1) {
+					Object* merged = mergeObjects(batchObjects);
+					for(size_t b = 0; b < batchObjects.size(); b++) {
+						replacedBy[batchObjects[b]] = b == 0 ? merged : NULL;
+					}
+					numBatches++;
+				}
+				batchObjects.clear();
+				batchVertices = 0;
+			}
+			if(i < members.size()) {
+				batchObjects.push_back(members[i]);
+				batchVertices += objectVertices;
+			}
+		}
+	}
+
+	// A batch takes the place of its first object
+	size_t numDrawsBefore = objects.size();
+	std::vector<Object*> batched;
+	for(std::vector<Object*>::iterator obj = objects.begin(); obj != objects.end(); ++obj) {
+		std::map<Object*, Object*>::iterator replaced = replacedBy.find(*obj);
+		if(replaced == replacedBy.end()) {
+			batched.push_back(*obj);
+			continue;
+		}
+		if(replaced->second) {
+			batched.push_back(replaced->second);
+			inDepthBatch_.insert(replaced->second);
+		}
+		inDepthBatch_.erase(*obj);
+		delete *obj;
+	}
+	objects.swap(batched);
+
+	size_t numShadowDraws = depthBatches_.size();
+	for(std::vector<Object*>::iterator obj = objects.begin(); obj != objects.end(); ++obj) {
+		if(!isInDepthBatch(*obj))
+			numShadowDraws++;
+	}
+
+	std::cout << "Static batching took " << std::chrono::duration<double, std::milli>(timer::now() - start).count() << " ms, at most "
+			  << maxBatchVertices_ << " vertices per batch" << std::endl
+			  << "\tmain, depth prepass and voxelization: " << numDrawsBefore << " draws -> " << objects.size()
+			  << " (" << numBatches << " batches, " << groups.size() << " materials)" << std::endl
+			  << "\tshadow maps: " << numDrawsBefore << " draws -> " << numShadowDraws
+			  << " (" << depthBatches_.size() << " position only batches, " << numVertices << " vertices welded to " << numWeldedVertices_ << ")" << std::endl;
+}
+
+bool StaticBatcher::isInDepthBatch(Object* object) {
+	return inDepthBatch_.count(object) > 0;
+}
+
+size_t StaticBatcher::getNumDepthBatches() {
+	return depthBatches_.size();
+}
+
+glm::vec3 StaticBatcher::getDepthBatchBoundsMin(size_t batch) {
+	return depthBatches_[batch].boundsMin;
+}
+
+glm::vec3 StaticBatcher::getDepthBatchBoundsMax(size_t batch) {
+	return depthBatches_[batch].boundsMax;
+}
+
+void StaticBatcher::drawDepthBatch(size_t batch, const glm::mat4& viewProjection, GLuint shader) {
+	const DepthBatch& depthBatch = depthBatches_[batch];
+	// Positions are in world space already
+	glUniformMatrix4fv(glGetUniformLocation(shader, "ModelViewProjectionMatrix"), 1, GL_FALSE, &viewProjection[0][0]);
+	glUniform1i(glGetUniformLocation(shader, "Instanced"), 0);
+	glUniform3f(glGetUniformLocation(shader, "PositionOffset"), depthBatch.positionOffset.x, depthBatch.positionOffset.y, depthBatch.positionOffset.z);
+	glUniform3f(glGetUniformLocation(shader, "PositionScale"), depthBatch.positionScale.x, depthBatch.positionScale.y, depthBatch.positionScale.z);
+
+	glBindVertexArray(depthBatch.vertexArray);
+	glDrawElements(GL_TRIANGLES, depthBatch.numIndices, depthBatch.indexType, (void*)0);
+	glBindVertexArray(0);
+}
+
+// Position of a point in the box along a Z-order curve, 10 bits per axis
+static unsigned int getMortonCode(glm::vec3 position, glm::vec3 boundsMin, glm::vec3 boundsMax) {
+	glm::vec3 uvw = glm::clamp((position - boundsMin) / glm::max(boundsMax - boundsMin, glm::vec3(1e-6f)), 0.0f, 1.0f);
+	unsigned int code = 0;
+	for(int bit = 9; bit >= 0; bit--) {
+		for(int axis = 0; axis < 3; axis++) {
+			unsigned int coordinate = std::min((unsigned int)(uvw[axis] * 1024.0f), 1023u);
+			code = (code << 1) | ((coordinate >> bit) & 1u);
+		}
+	}
+	return code;
+}
+
+std::vector<Object*> StaticBatcher::sortSpatially(const std::vector<Object*>& objects) {
+	if(objects.empty())
+		return objects;
+
+	std::vector<glm::vec3> centers(objects.size());
+	glm::vec3 boundsMin(1e30f), boundsMax(-1e30f);
+	for(size_t i = 0; i < objects.size(); i++) {
+		glm::vec3 objectMin = objects[i]->getWorldBoundsMin();
+		glm::vec3 objectMax = objects[i]->getWorldBoundsMax();
+		centers[i] = 0.5f * (objectMin + objectMax);
+		boundsMin = glm::min(boundsMin, objectMin);
+		boundsMax = glm::max(boundsMax, objectMax);
+	}
+
+	// Ties keep the order of the scene, so the batches are the same every run
+	std::vector<std::pair<unsigned int, size_t> > keys(objects.size());
+	for(size_t i = 0; i < objects.size(); i++) {
+		keys[i] = std::make_pair(getMortonCode(centers[i], boundsMin, boundsMax), i);
+	}
+	std::sort(keys.begin(), keys.end());
+
+	std::vector<Object*> sorted(objects.size());
+	for(size_t i = 0; i < keys.size(); i++) {
+		sorted[i] = objects[keys[i].second];
+	}
+	return sorted;
+}
+
+// The objects are welded into a batch one after another. The welded vertex count is
+// only known after adding an object, so one that overflows the batch is taken out
+// again and starts the next batch.
+void StaticBatcher::buildDepthBatches(const std::vector<Object*>& objects) {
+	std::unordered_map<glm::vec3, unsigned int, PositionHash> welded;
+	std::vector<glm::vec3> positions;
+	std::vector<unsigned int> indices;
+	std::vector<unsigned int> remap;
+
+	for(size_t o = 0; o < objects.size(); o++) {
+		Object* obj = objects[o];
+		glm::mat4 modelMatrix = obj->getModelMatrix();
+		const std::vector<glm::vec3>& vertices = obj->mesh_->getCPUPositions();
+		const std::vector<unsigned int>& meshIndices = obj->mesh_->getCPUIndices();
+
+		for(int attempt = 0; attempt < 2; attempt++) {
+			size_t firstPosition = positions.size();
+			remap.resize(vertices.size());
+			for(size_t i = 0; i < vertices.size(); i++) {
+				// + 0 turns -0 into 0, which compares equal but hashes differently
+				glm::vec3 position = glm::vec3(modelMatrix * glm::vec4(vertices[i], 1.0f)) + glm::vec3(0.0f);
+				std::pair<std::unordered_map<glm::vec3, unsigned int, PositionHash>::iterator, bool> inserted =
+					welded.insert(std::make_pair(position, (unsigned int)positions.size()));
+				if(inserted.second)
+					positions.push_back(position);
+				remap[i] = inserted.first->second;
+			}
+			// An object too large for a batch of its own gets one anyway
+			if(positions.size() <= maxBatchVertices_ || firstPosition == 0)
+				break;
+
+			positions.resize(firstPosition);
+			uploadDepthBatch(positions, indices);
+			positions.clear();
+			indices.clear();
+			welded.clear();
+		}
+
+		for(size_t i = 0; i < meshIndices.size(); i++) {
+			indices.push_back(remap[meshIndices[i]]);
+		}
+		inDepthBatch_.insert(obj);
+	}
+	if(!positions.empty())
+		uploadDepthBatch(positions, indices);
+}
+
+void StaticBatcher::uploadDepthBatch(const std::vector<glm::vec3>& positions, const std::vector<unsigned int>& indices) {
+	numWeldedVertices_ += (unsigned int)positions.size();
+	if(indices.empty())
+		return;
+
+	DepthBatch batch;
+	batch.boundsMin = batch.boundsMax = positions[0];
+	for(size_t i = 1; i < positions.size(); i++) {
+		batch.boundsMin = glm::min(batch.boundsMin, positions[i]);
+		batch.boundsMax = glm::max(batch.boundsMax, positions[i]);
+	}
+
+	// unorm16 relative to the batch bounds padded to 8 bytes, or float3
+	std::vector<unsigned char> vertexData;
+	GLsizei stride;
+	if(quantizePositions_) {
+		batch.positionOffset = batch.boundsMin;
+		batch.positionScale = batch.boundsMax - batch.boundsMin;
+		stride = 4 * sizeof(GLushort);
+		vertexData.resize(positions.size() * stride);
+		for(size_t i = 0; i < positions.size(); i++) {
+			glm::vec3 relative = positions[i] - batch.positionOffset;
+			GLushort position[4] = { 0, 0, 0, 0 };
+			for(int c = 0; c < 3; c++) {
+				position[c] = batch.positionScale[c] > 0.0f ? glm::packUnorm1x16(relative[c] / batch.positionScale[c]) : 0;
+			}
+			memcpy(&vertexData[i * stride], position, sizeof(position));
+		}
+	}
+	else {
+		batch.positionOffset = glm::vec3(0.0f);
+		batch.positionScale = glm::vec3(1.0f);
+		stride = 3 * sizeof(float);
+		vertexData.resize(positions.size() * stride);
+		memcpy(&vertexData[0], &positions[0], vertexData.size());
+	}
+
+	// 16 bit indices when possible, like Mesh
+	std::vector<unsigned char> indexData;
+	batch.numIndices = (GLsizei)indices.size();
+	batch.indexType = positions.size() <= 65536 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+	if(batch.indexType == GL_UNSIGNED_SHORT) {
+		indexData.resize(indices.size() * sizeof(GLushort));
+		for(size_t i = 0; i < indices.size(); i++) {
+			GLushort index = (GLushort)indices[i];
+			memcpy(&indexData[i * sizeof(GLushort)], &index, sizeof(GLushort));
+		}
+	}
+	else {
+		indexData.resize(indices.size() * sizeof(GLuint));
+		memcpy(&indexData[0], &indices[0], indexData.size());
+	}
+
+	glGenVertexArrays(1, &batch.vertexArray);
+	glBindVertexArray(batch.vertexArray);
+
+	glGenBuffers(1, &batch.vertexBuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, batch.vertexBuffer);
+	glBufferData(GL_ARRAY_BUFFER, vertexData.size(), &vertexData[0], GL_STATIC_DRAW);
+	// Only the position, shadow.vert reads nothing else
+	glEnableVertexAttribArray(0);
+	if(quantizePositions_)
+		glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, stride, (void*)0);
+	else
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)0);
+
+	glGenBuffers(1, &batch.indexBuffer);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, batch.indexBuffer);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexData.size(), &indexData[0], GL_STATIC_DRAW);
+
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	batch.bytes = vertexData.size() + indexData.size();
+	MemoryTracker::allocate(MemoryTracker::GEOMETRY, batch.bytes);
+	depthBatches_.push_back(batch);
+}
+
+Object* StaticBatcher::mergeObjects(const std::vector<Object*>& objects) {
+	std::vector<Mesh*> meshes;
+	std::vector<glm::mat4> modelMatrices;
+	for(size_t i = 0; i < objects.size(); i++) {
+		meshes.push_back(objects[i]->mesh_);
+		modelMatrices.push_back(objects[i]->getModelMatrix());
+	}
+
+	// Without a node the model matrix is the identity, the positions are in world space
+	Object* merged = new Object();
+	merged->material_ = objects[0]->material_;
+	merged->mesh_ = new Mesh();
+	merged->mesh_->buildMergedVertexData(meshes, modelMatrices, quantizePositions_, keepCPUCopies_, buildLODs_);
+	merged->mesh_->upload();
+	return merged;
+}
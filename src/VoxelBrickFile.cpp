@@ -0,0 +1,275 @@
+#include <iostream>
+#include <string.h>
+
+#include "MemoryTracker.h"
+#include "Profiler.h"
+#include "VoxelBrickFile.h"
+
+static const char brickFileMagic[4] = {'V', 'C', 'T', 'B'};
+static const unsigned int brickFileVersion = 1;
+
+template<typename T>
+static void writeValue(std::ofstream& out, const T& value) {
+	out.write((const char*)&value, sizeof(T));
+}
+
+template<typename T>
+static bool readValue(std::ifstream& in, T& value) {
+	in.read((char*)&value, sizeof(T));
+	return in.good();
+}
+
+VoxelBrickFile::VoxelBrickFile() {
+	brickSize_ = 0;
+	bricksPerAxis_ = 0;
+	gridWorldSize_ = 0.0f;
+	trackedBytes_ = 0;
+}
+
+VoxelBrickFile::~VoxelBrickFile() {
+	MemoryTracker::release(MemoryTracker::CPU_MIRRORS, trackedBytes_);
+}
+
+bool VoxelBrickFile::bake(std::string filename, GLuint voxelTexture, int voxelDimensions, float gridWorldSize, int brickSize) {
+	PROFILE_ZONE("bakeVoxelBricks");
+	if(voxelDimensions % brickSize != 0) {
+		std::cout << "Voxel dimensions " << voxelDimensions << " aren't a multiple of the brick size " << brickSize << std::endl;
+		return false;
+	}
+
+	std::ofstream out(filename.c_str(), std::ios::out | std::ios::binary);
+	if(!out.is_open()) {
+		std::cout << "Couldn't open " << filename << " for writing" << std::endl;
+		return false;
+	}
+
+	int bricksPerAxis = voxelDimensions / brickSize;
+	size_t numBricks = (size_t)bricksPerAxis * bricksPerAxis * bricksPerAxis;
+	size_t voxelsPerBrick = (size_t)brickSize * brickSize * brickSize;
+
+	// Header, the offsets are filled in at the end
+	out.write(brickFileMagic, sizeof(brickFileMagic));
+	writeValue(out, brickFileVersion);
+	writeValue(out, brickSize);
+	writeValue(out, bricksPerAxis);
+	writeValue(out, gridWorldSize);
+	std::streampos offsetsPosition = out.tellp();
+	unsigned long long indexOffset = 0, coarseOffset = 0;
+	writeValue(out, indexOffset);
+	writeValue(out, coarseOffset);
+
+	std::vector<BrickEntry> index(numBricks);
+	std::vector<GLuint> coarseVoxels(numBricks, 0);
+
+	// Layers are read back through a framebuffer, one slab of bricks at a time
+	GLuint framebuffer;
+	glGenFramebuffers(1, &framebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	glReadBuffer(GL_COLOR_ATTACHMENT0);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+
+	std::vector<GLuint> slab((size_t)voxelDimensions * voxelDimensions * brickSize);
+	std::vector<GLuint> voxels(voxelsPerBrick);
+	std::vector<unsigned char> compressed;
+	size_t storedBricks = 0, storedBytes = 0;
+	bool ok = true;
+
+	for(int bz = 0; bz < bricksPerAxis && ok; bz++) {
+		for(int layer = 0; layer < brickSize; layer++) {
+			glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, voxelTexture, 0, bz * brickSize + layer);
+			if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+				std::cout << "Error creating framebuffer for reading back voxels" << std::endl;
+				ok = false;
+				break;
+			}
+			glReadPixels(0, 0, voxelDimensions, voxelDimensions, GL_RGBA, GL_UNSIGNED_BYTE, &slab[(size_t)layer * voxelDimensions * voxelDimensions]);
+		}
+
+		for(int by = 0; by < bricksPerAxis && ok; by++) {
+			for(int bx = 0; bx < bricksPerAxis; bx++) {
+				// Gather the brick and its average, which is what mip level log2(brickSize) would hold
+				bool empty = true;
+				unsigned int sum[4] = {0, 0, 0, 0};
+				for(int z = 0; z < brickSize; z++) {
+					for(int y = 0; y < brickSize; y++) {
+						const GLuint* row = &slab[((size_t)z * voxelDimensions + by * brickSize + y) * voxelDimensions + bx * brickSize];
+						for(int x = 0; x < brickSize; x++) {
+							GLuint voxel = row[x];
+							voxels[((size_t)z * brickSize + y) * brickSize + x] = voxel;
+							if(voxel) {
+								empty = false;
+								const unsigned char* channels = (const unsigned char*)&voxel;
+								for(int c = 0; c < 4; c++) {
+									sum[c] += channels[c];
+								}
+							}
+						}
+					}
+				}
+
+				size_t brick = ((size_t)bz * bricksPerAxis + by) * bricksPerAxis + bx;
+				unsigned char* average = (unsigned char*)&coarseVoxels[brick];
+				for(int c = 0; c < 4; c++) {
+					average[c] = (unsigned char)((sum[c] + voxelsPerBrick / 2) / voxelsPerBrick);
+				}
+
+				index[brick].offset = 0;
+				index[brick].size = 0;
+				if(empty)
+					continue;
+
+				compress(voxels, compressed);
+				index[brick].offset = (unsigned long long)out.tellp();
+				index[brick].size = (unsigned int)compressed.size();
+				out.write((const char*)&compressed[0], compressed.size());
+				storedBricks++;
+				storedBytes += compressed.size();
+			}
+		}
+	}
+
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glDeleteFramebuffers(1, &framebuffer);
+	if(!ok)
+		return false;
+
+	indexOffset = (unsigned long long)out.tellp();
+	for(size_t i = 0; i < numBricks; i++) {
+		writeValue(out, index[i].offset);
+		writeValue(out, index[i].size);
+	}
+	coarseOffset = (unsigned long long)out.tellp();
+	out.write((const char*)&coarseVoxels[0], coarseVoxels.size() * sizeof(GLuint));
+
+	out.seekp(offsetsPosition);
+	writeValue(out, indexOffset);
+	writeValue(out, coarseOffset);
+
+	if(!out.good()) {
+		std::cout << "Error writing " << filename << std::endl;
+		return false;
+	}
+
+	std::cout << "Baked " << storedBricks << " of " << numBricks << " bricks to " << filename << ", "
+			  << storedBytes / 1024 << " KB compressed ("
+			  << storedBricks * voxelsPerBrick * sizeof(GLuint) / 1024 << " KB raw)" << std::endl;
+	return true;
+}
+
+bool VoxelBrickFile::open(std::string filename) {
+	file_.open(filename.c_str(), std::ios::in | std::ios::binary);
+	if(!file_.is_open()) {
+		std::cout << "Couldn't open brick file " << filename << std::endl;
+		return false;
+	}
+
+	char magic[4];
+	unsigned int version = 0;
+	unsigned long long indexOffset = 0, coarseOffset = 0;
+	file_.read(magic, sizeof(magic));
+	if(!file_.good() || memcmp(magic, brickFileMagic, sizeof(magic)) != 0 || !readValue(file_, version) || version != brickFileVersion) {
+		std::cout << filename << " isn't a brick file" << std::endl;
+		return false;
+	}
+	if(!readValue(file_, brickSize_) || !readValue(file_, bricksPerAxis_) || !readValue(file_, gridWorldSize_) ||
+	   !readValue(file_, indexOffset) || !readValue(file_, coarseOffset) || brickSize_ <= 0 || bricksPerAxis_ <= 0) {
+		std::cout << "Invalid brick file header in " << filename << std::endl;
+		return false;
+	}
+
+	size_t numBricks = (size_t)getNumBricks();
+	index_.resize(numBricks);
+	file_.seekg(indexOffset);
+	for(size_t i = 0; i < numBricks; i++) {
+		if(!readValue(file_, index_[i].offset) || !readValue(file_, index_[i].size)) {
+			std::cout << "Brick index in " << filename << " is truncated" << std::endl;
+			return false;
+		}
+	}
+
+	coarseVoxels_.resize(numBricks);
+	file_.seekg(coarseOffset);
+	file_.read((char*)&coarseVoxels_[0], numBricks * sizeof(GLuint));
+	if(!file_.good()) {
+		std::cout << "Coarse volume in " << filename << " is truncated" << std::endl;
+		return false;
+	}
+
+	trackedBytes_ = coarseVoxels_.size() * sizeof(GLuint) + index_.size() * sizeof(BrickEntry);
+	MemoryTracker::allocate(MemoryTracker::CPU_MIRRORS, trackedBytes_);
+	return true;
+}
+
+bool VoxelBrickFile::readBrick(int brick, std::vector<GLuint>& voxels) {
+	size_t numVoxels = (size_t)brickSize_ * brickSize_ * brickSize_;
+	if(index_[brick].size == 0) {
+		voxels.assign(numVoxels, 0);
+		return true;
+	}
+
+	readBuffer_.resize(index_[brick].size);
+	file_.clear();
+	file_.seekg(index_[brick].offset);
+	file_.read((char*)&readBuffer_[0], readBuffer_.size());
+	if(!file_.good())
+		return false;
+	return decompress(readBuffer_, numVoxels, voxels);
+}
+
+bool VoxelBrickFile::isEmpty(int brick) {
+	return index_[brick].size == 0;
+}
+
+int VoxelBrickFile::getBrickSize() {
+	return brickSize_;
+}
+
+int VoxelBrickFile::getBricksPerAxis() {
+	return bricksPerAxis_;
+}
+
+int VoxelBrickFile::getNumBricks() {
+	return bricksPerAxis_ * bricksPerAxis_ * bricksPerAxis_;
+}
+
+float VoxelBrickFile::getGridWorldSize() {
+	return gridWorldSize_;
+}
+
+const std::vector<GLuint>& VoxelBrickFile::getCoarseVoxels() {
+	return coarseVoxels_;
+}
+
+// Runs of equal voxels as (count, voxel) pairs, count being one byte
+void VoxelBrickFile::compress(const std::vector<GLuint>& voxels, std::vector<unsigned char>& compressed) {
+	compressed.clear();
+	size_t i = 0;
+	while(i < voxels.size()) {
+		GLuint voxel = voxels[i];
+		size_t run = 1;
+		while(i + run < voxels.size() && voxels[i + run] == voxel && run < 255) {
+			run++;
+		}
+		compressed.push_back((unsigned char)run);
+		const unsigned char* bytes = (const unsigned char*)&voxel;
+		compressed.insert(compressed.end(), bytes, bytes + sizeof(GLuint));
+		i += run;
+	}
+}
+
+bool VoxelBrickFile::decompress(const std::vector<unsigned char>& compressed, size_t numVoxels, std::vector<GLuint>& voxels) {
+	voxels.resize(numVoxels);
+	size_t voxel = 0;
+	for(size_t i = 0; i + 1 + sizeof(GLuint) <= compressed.size(); i += 1 + sizeof(GLuint)) {
+		size_t run = compressed[i];
+		if(voxel + run > numVoxels)
+			return false;
+		GLuint value;
+		memcpy(&value, &compressed[i + 1], sizeof(GLuint));
+		for(size_t r = 0; r < run; r++) {
+			voxels[voxel++] = value;
+		}
+	}
+	return voxel == numVoxels;
+}
@@ -0,0 +1,422 @@
+#include <algorithm>
+#include <iostream>
+
+#include "MemoryTracker.h"
+#include "Profiler.h"
+#include "VoxelBrickPager.h"
+
+VoxelBrickPager::VoxelBrickPager() {
+	brickSize_ = 0;
+	bricksPerAxis_ = 0;
+	numMipLevels_ = 0;
+	slotsPerAxis_ = 0;
+	atlasTexture_ = 0;
+	indirectionTexture_ = 0;
+	coarseTexture_ = 0;
+	feedbackTexture_ = 0;
+	feedbackBuffer_ = 0;
+	feedbackFence_ = 0;
+	gpuBytes_ = 0;
+	frame_ = 0;
+	numPending_ = 0;
+	numLoads_ = 0;
+	numEvictions_ = 0;
+	quit_ = false;
+}
+
+VoxelBrickPager::~VoxelBrickPager() {
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		quit_ = true;
+	}
+	condition_.notify_all();
+	if(loaderThread_.joinable())
+		loaderThread_.join();
+
+	if(numLoads_ > 0) {
+		std::cout << "Brick pager: " << numLoads_ << " bricks loaded, " << numEvictions_ << " evicted" << std::endl;
+	}
+
+	if(feedbackFence_)
+		glDeleteSync(feedbackFence_);
+	if(atlasTexture_) {
+		GLuint textures[4] = {atlasTexture_, indirectionTexture_, coarseTexture_, feedbackTexture_};
+		glDeleteTextures(4, textures);
+		glDeleteBuffers(1, &feedbackBuffer_);
+		MemoryTracker::release(MemoryTracker::VOXELS, gpuBytes_);
+	}
+}
+
+bool VoxelBrickPager::initialize(std::string filename, size_t budgetBytes) {
+	if(!file_.open(filename))
+		return false;
+
+	brickSize_ = file_.getBrickSize();
+	bricksPerAxis_ = file_.getBricksPerAxis();
+	int numBricks = file_.getNumBricks();
+	numMipLevels_ = 1;
+	while((brickSize_ >> numMipLevels_) > 0) {
+		numMipLevels_++;
+	}
+
+	// As many slots as fit in the budget, arranged in a cube
+	size_t bytesPerSlot = 0;
+	for(int level = 0; level < numMipLevels_; level++) {
+		size_t size = brickSize_ >> level;
+		bytesPerSlot += size * size * size * 4;
+	}
+	GLint max3DTextureSize = 0;
+	glGetIntegerv(GL_MAX_3D_TEXTURE_SIZE, &max3DTextureSize);
+	slotsPerAxis_ = (int)glm::floor(glm::pow((float)(budgetBytes / bytesPerSlot), 1.0f / 3.0f));
+	slotsPerAxis_ = glm::clamp(slotsPerAxis_, 1, glm::min(255, max3DTextureSize / brickSize_));
+	int numSlots = slotsPerAxis_ * slotsPerAxis_ * slotsPerAxis_;
+
+	// Atlas, each slot has the mip levels of one brick
+	glGenTextures(1, &atlasTexture_);
+	glBindTexture(GL_TEXTURE_3D, atlasTexture_);
+	for(int level = 0; level < numMipLevels_; level++) {
+		int size = slotsPerAxis_ * (brickSize_ >> level);
+		glTexImage3D(GL_TEXTURE_3D, level, GL_RGBA8, size, size, size, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	}
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_BASE_LEVEL, 0);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAX_LEVEL, numMipLevels_ - 1);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	gpuBytes_ += (size_t)numSlots * bytesPerSlot;
+
+	// Indirection: slot position in rgb and the BrickState in a
+	std::vector<unsigned char> indirection((size_t)numBricks * 4, 0);
+	for(int brick = 0; brick < numBricks; brick++) {
+		indirection[brick * 4 + 3] = file_.isEmpty(brick) ? EMPTY : NOT_RESIDENT;
+	}
+	glGenTextures(1, &indirectionTexture_);
+	glBindTexture(GL_TEXTURE_3D, indirectionTexture_);
+	glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA8UI, bricksPerAxis_, bricksPerAxis_, bricksPerAxis_, 0, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, &indirection[0]);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	gpuBytes_ += (size_t)numBricks * 4;
+
+	// Coarse volume, one voxel per brick. Its mip levels continue where the bricks end.
+	glGenTextures(1, &coarseTexture_);
+	glBindTexture(GL_TEXTURE_3D, coarseTexture_);
+	glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA8, bricksPerAxis_, bricksPerAxis_, bricksPerAxis_, 0, GL_RGBA, GL_UNSIGNED_BYTE, &file_.getCoarseVoxels()[0]);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glGenerateMipmap(GL_TEXTURE_3D);
+	gpuBytes_ += MemoryTracker::getTextureBytes(GL_RGBA8, bricksPerAxis_, bricksPerAxis_, bricksPerAxis_, true);
+
+	// Feedback written by the shader and the buffer it is read back to
+	zeroFeedback_.assign(numBricks, 0);
+	glGenTextures(1, &feedbackTexture_);
+	glBindTexture(GL_TEXTURE_3D, feedbackTexture_);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage3D(GL_TEXTURE_3D, 0, GL_R8UI, bricksPerAxis_, bricksPerAxis_, bricksPerAxis_, 0, GL_RED_INTEGER, GL_UNSIGNED_BYTE, &zeroFeedback_[0]);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glGenBuffers(1, &feedbackBuffer_);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, feedbackBuffer_);
+	glBufferData(GL_PIXEL_PACK_BUFFER, numBricks, NULL, GL_STREAM_READ);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	gpuBytes_ += (size_t)numBricks * 2;
+
+	glBindTexture(GL_TEXTURE_3D, 0);
+	MemoryTracker::allocate(MemoryTracker::VOXELS, gpuBytes_);
+
+	brickSlot_.assign(numBricks, -1);
+	pending_.assign(numBricks, false);
+	lastUsed_.assign(numBricks, 0);
+	lruPosition_.assign(numBricks, lru_.end());
+	for(int slot = numSlots - 1; slot >= 0; slot--) {
+		freeSlots_.push_back(slot);
+	}
+
+	std::cout << "Brick pool: " << numSlots << " slots of " << brickSize_ << "^3 for " << numBricks << " bricks, "
+			  << gpuBytes_ / (1024 * 1024) << " MB on the GPU" << std::endl;
+
+	loaderThread_ = std::thread(&VoxelBrickPager::loaderLoop, this);
+	return true;
+}
+
+void VoxelBrickPager::update(glm::vec3 cameraPosition) {
+	PROFILE_ZONE("brickPager");
+	frame_++;
+
+	readFeedback();
+
+	glm::vec3 gridPosition = (cameraPosition / file_.getGridWorldSize() + 0.5f) * (float)bricksPerAxis_;
+	requestBricks(glm::ivec3(glm::floor(gridPosition)));
+
+	uploadBricks();
+}
+
+void VoxelBrickPager::bind(GLuint shader, GLuint atlasUnit, GLuint indirectionUnit, GLuint coarseUnit, GLuint feedbackImageUnit) {
+	glActiveTexture(GL_TEXTURE0 + atlasUnit);
+	glBindTexture(GL_TEXTURE_3D, atlasTexture_);
+	glActiveTexture(GL_TEXTURE0 + indirectionUnit);
+	glBindTexture(GL_TEXTURE_3D, indirectionTexture_);
+	glActiveTexture(GL_TEXTURE0 + coarseUnit);
+	glBindTexture(GL_TEXTURE_3D, coarseTexture_);
+	glBindImageTexture(feedbackImageUnit, feedbackTexture_, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_R8UI);
+
+	glUniform1i(glGetUniformLocation(shader, "BrickAtlas"), atlasUnit);
+	glUniform1i(glGetUniformLocation(shader, "BrickIndirection"), indirectionUnit);
+	glUniform1i(glGetUniformLocation(shader, "BrickCoarse"), coarseUnit);
+	glUniform1i(glGetUniformLocation(shader, "BrickFeedback"), feedbackImageUnit);
+	glUniform1i(glGetUniformLocation(shader, "BrickSize"), brickSize_);
+	glUniform1i(glGetUniformLocation(shader, "BricksPerAxis"), bricksPerAxis_);
+	glUniform1i(glGetUniformLocation(shader, "AtlasSlotsPerAxis"), slotsPerAxis_);
+	glUniform1i(glGetUniformLocation(shader, "UseBrickPool"), 1);
+}
+
+void VoxelBrickPager::endFrame() {
+	if(feedbackFence_ || frame_ % feedbackInterval_ != 0)
+		return;
+
+	// The feedback of the last few frames is copied to the buffer and read once it's done
+	glMemoryBarrier(GL_PIXEL_BUFFER_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, feedbackBuffer_);
+	glBindTexture(GL_TEXTURE_3D, feedbackTexture_);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glGetTexImage(GL_TEXTURE_3D, 0, GL_RED_INTEGER, GL_UNSIGNED_BYTE, (void*)0);
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	feedbackFence_ = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, bricksPerAxis_, bricksPerAxis_, bricksPerAxis_, GL_RED_INTEGER, GL_UNSIGNED_BYTE, &zeroFeedback_[0]);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glBindTexture(GL_TEXTURE_3D, 0);
+}
+
+float VoxelBrickPager::getGridWorldSize() {
+	return file_.getGridWorldSize();
+}
+
+int VoxelBrickPager::getVoxelDimensions() {
+	return bricksPerAxis_ * brickSize_;
+}
+
+void VoxelBrickPager::loaderLoop() {
+	while(true) {
+		int brick;
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			condition_.wait(lock, [this] { return quit_ || !requests_.empty(); });
+			if(quit_)
+				return;
+			brick = requests_.front();
+			requests_.pop_front();
+		}
+
+		LoadedBrick loaded;
+		loaded.brick = brick;
+		loaded.ok = file_.readBrick(brick, loaded.voxels);
+		if(loaded.ok)
+			buildMipmaps(loaded.voxels, brickSize_, numMipLevels_);
+
+		std::lock_guard<std::mutex> lock(mutex_);
+		loaded_.push_back(LoadedBrick());
+		loaded_.back().brick = loaded.brick;
+		loaded_.back().ok = loaded.ok;
+		loaded_.back().voxels.swap(loaded.voxels);
+	}
+}
+
+// Box filtered mip levels appended after level 0, like glGenerateMipmap would make them
+void VoxelBrickPager::buildMipmaps(std::vector<GLuint>& voxels, int brickSize, int numMipLevels) {
+	size_t levelStart = 0;
+	for(int level = 1; level < numMipLevels; level++) {
+		int size = brickSize >> level;
+		int parentSize = size * 2;
+		size_t parentStart = levelStart;
+		levelStart = voxels.size();
+		voxels.resize(levelStart + (size_t)size * size * size);
+
+		for(int z = 0; z < size; z++) {
+			for(int y = 0; y < size; y++) {
+				for(int x = 0; x < size; x++) {
+					unsigned int sum[4] = {0, 0, 0, 0};
+					for(int i = 0; i < 8; i++) {
+						int px = 2 * x + (i & 1), py = 2 * y + ((i >> 1) & 1), pz = 2 * z + (i >> 2);
+						GLuint voxel = voxels[parentStart + ((size_t)pz * parentSize + py) * parentSize + px];
+						const unsigned char* channels = (const unsigned char*)&voxel;
+						for(int c = 0; c < 4; c++) {
+							sum[c] += channels[c];
+						}
+					}
+					GLuint average;
+					unsigned char* channels = (unsigned char*)&average;
+					for(int c = 0; c < 4; c++) {
+						channels[c] = (unsigned char)((sum[c] + 4) / 8);
+					}
+					voxels[levelStart + ((size_t)z * size + y) * size + x] = average;
+				}
+			}
+		}
+	}
+}
+
+// Bricks the shader sampled are marked as used, the missing ones are requested
+void VoxelBrickPager::readFeedback() {
+	if(!feedbackFence_)
+		return;
+	GLenum status = glClientWaitSync(feedbackFence_, 0, 0);
+	if(status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+		return;
+	glDeleteSync(feedbackFence_);
+	feedbackFence_ = 0;
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, feedbackBuffer_);
+	const unsigned char* feedback = (const unsigned char*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, brickSlot_.size(), GL_MAP_READ_BIT);
+	if(feedback) {
+		feedbackRequests_.clear();
+		for(size_t brick = 0; brick < brickSlot_.size(); brick++) {
+			if(!feedback[brick])
+				continue;
+			if(brickSlot_[brick] >= 0)
+				touch((int)brick);
+			else if(!file_.isEmpty((int)brick))
+				feedbackRequests_.push_back((int)brick);
+		}
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+// Requests the missing bricks around the camera and from the feedback, closest first
+void VoxelBrickPager::requestBricks(glm::ivec3 cameraBrick) {
+	std::vector<std::pair<int, int> > candidates; // Squared distance in bricks, brick
+
+	for(int z = cameraBrick.z - cameraBrickRadius_; z <= cameraBrick.z + cameraBrickRadius_; z++) {
+		for(int y = cameraBrick.y - cameraBrickRadius_; y <= cameraBrick.y + cameraBrickRadius_; y++) {
+			for(int x = cameraBrick.x - cameraBrickRadius_; x <= cameraBrick.x + cameraBrickRadius_; x++) {
+				if(x < 0 || y < 0 || z < 0 || x >= bricksPerAxis_ || y >= bricksPerAxis_ || z >= bricksPerAxis_)
+					continue;
+				int brick = (z * bricksPerAxis_ + y) * bricksPerAxis_ + x;
+				if(file_.isEmpty(brick))
+					continue;
+				if(brickSlot_[brick] >= 0) {
+					touch(brick);
+					continue;
+				}
+				glm::ivec3 d = glm::ivec3(x, y, z) - cameraBrick;
+				candidates.push_back(std::make_pair(d.x * d.x + d.y * d.y + d.z * d.z, brick));
+			}
+		}
+	}
+
+	for(std::vector<int>::iterator it = feedbackRequests_.begin(); it != feedbackRequests_.end(); ++it) {
+		int brick = *it;
+		if(brickSlot_[brick] >= 0)
+			continue;
+		glm::ivec3 position(brick % bricksPerAxis_, (brick / bricksPerAxis_) % bricksPerAxis_, brick / (bricksPerAxis_ * bricksPerAxis_));
+		glm::ivec3 d = position - cameraBrick;
+		candidates.push_back(std::make_pair(d.x * d.x + d.y * d.y + d.z * d.z, brick));
+	}
+
+	if(candidates.empty() || numPending_ >= maxPendingBricks_)
+		return;
+	std::sort(candidates.begin(), candidates.end());
+
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		for(size_t i = 0; i < candidates.size() && numPending_ < maxPendingBricks_; i++) {
+			int brick = candidates[i].second;
+			if(pending_[brick])
+				continue;
+			pending_[brick] = true;
+			numPending_++;
+			requests_.push_back(brick);
+		}
+	}
+	condition_.notify_one();
+}
+
+void VoxelBrickPager::uploadBricks() {
+	for(int uploads = 0; uploads < uploadsPerFrame_; uploads++) {
+		LoadedBrick loaded;
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			if(loaded_.empty())
+				break;
+			loaded.brick = loaded_.front().brick;
+			loaded.ok = loaded_.front().ok;
+			loaded.voxels.swap(loaded_.front().voxels);
+			loaded_.pop_front();
+		}
+		pending_[loaded.brick] = false;
+		numPending_--;
+
+		if(!loaded.ok) {
+			std::cout << "Couldn't read brick " << loaded.brick << std::endl;
+			continue;
+		}
+
+		int slot = allocateSlot();
+		if(slot < 0)
+			continue; // Everything in the atlas is in use, it will be requested again
+
+		glm::ivec3 position = getSlotPosition(slot);
+		glBindTexture(GL_TEXTURE_3D, atlasTexture_);
+		size_t offset = 0;
+		for(int level = 0; level < numMipLevels_; level++) {
+			int size = brickSize_ >> level;
+			glTexSubImage3D(GL_TEXTURE_3D, level, position.x * size, position.y * size, position.z * size, size, size, size,
+							GL_RGBA, GL_UNSIGNED_BYTE, &loaded.voxels[offset]);
+			offset += (size_t)size * size * size;
+		}
+
+		brickSlot_[loaded.brick] = slot;
+		lru_.push_front(loaded.brick);
+		lruPosition_[loaded.brick] = lru_.begin();
+		lastUsed_[loaded.brick] = frame_;
+		setIndirection(loaded.brick, slot, RESIDENT);
+		numLoads_++;
+	}
+	glBindTexture(GL_TEXTURE_3D, 0);
+}
+
+// A free slot, or the one of the least recently used brick. Bricks used since the
+// last feedback aren't evicted, or bricks in view would keep replacing each other.
+int VoxelBrickPager::allocateSlot() {
+	if(!freeSlots_.empty()) {
+		int slot = freeSlots_.back();
+		freeSlots_.pop_back();
+		return slot;
+	}
+	if(lru_.empty())
+		return -1;
+
+	int victim = lru_.back();
+	if(frame_ - lastUsed_[victim] <= 2 * feedbackInterval_)
+		return -1;
+
+	int slot = brickSlot_[victim];
+	lru_.pop_back();
+	lruPosition_[victim] = lru_.end();
+	brickSlot_[victim] = -1;
+	setIndirection(victim, 0, NOT_RESIDENT);
+	numEvictions_++;
+	return slot;
+}
+
+void VoxelBrickPager::touch(int brick) {
+	lastUsed_[brick] = frame_;
+	lru_.splice(lru_.begin(), lru_, lruPosition_[brick]);
+}
+
+void VoxelBrickPager::setIndirection(int brick, int slot, BrickState state) {
+	glm::ivec3 position = getSlotPosition(slot);
+	unsigned char entry[4] = {(unsigned char)position.x, (unsigned char)position.y, (unsigned char)position.z, (unsigned char)state};
+	glBindTexture(GL_TEXTURE_3D, indirectionTexture_);
+	glTexSubImage3D(GL_TEXTURE_3D, 0, brick % bricksPerAxis_, (brick / bricksPerAxis_) % bricksPerAxis_, brick / (bricksPerAxis_ * bricksPerAxis_),
+					1, 1, 1, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, entry);
+}
+
+glm::ivec3 VoxelBrickPager::getSlotPosition(int slot) {
+	return glm::ivec3(slot % slotsPerAxis_, (slot / slotsPerAxis_) % slotsPerAxis_, slot / (slotsPerAxis_ * slotsPerAxis_));
+}
@@ -3,17 +3,46 @@
 #include <stdlib.h>
 
 // System Headers
-#include <GL/glew.h>
+#include "GLCapture.h"
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
 //#include <stb_image.h>
 #include <iostream>
 
+#include <fstream>
+#include <string>
+#include <string.h>
+#include <thread>
+
 #include "Application.h"
+#include "BatchRenderer.h"
+#include "Controls.h"
+#include "FrameStats.h"
+#include "HighResClock.h"
+#include "MemoryTracker.h"
+#include "Profiler.h"
 
 const int width_ = 1280;
 const int height_ = 720;
-float timer = 0.0;
+float fpsTimer = 0.0;
+
+// How the main loop paces frames
+enum PacingMode {
+    PACING_VSYNC,     // Wait for vertical blank in glfwSwapBuffers
+    PACING_LIMITED,   // No vsync, sleep to hold a fixed frame rate
+    PACING_UNCAPPED   // No vsync, no limit
+};
+
+// Waits until the target frame end. Sleeps for most of it and spins the last
+// millisecond since sleeping isn't precise enough.
+void waitUntil(timer::HighResClock::time_point target) {
+    timer::HighResClock::time_point now = timer::now();
+    if(target - now > std::chrono::milliseconds(2)) {
+        std::this_thread::sleep_for(target - now - std::chrono::milliseconds(1));
+    }
+    while(timer::now() < target) {
+    }
+}
 
 void dumpGLInfo() {
     printf ("Vendor: %s\n", glGetString(GL_VENDOR));
@@ -44,7 +73,153 @@ void dumpGLErrors() {
     }
 }
 
-int main(void) {
+int main(int argc, char** argv) {
+    // Command line options
+    std::string traceFile;
+    std::string statsFile = "stats.json";
+    PacingMode pacing = PACING_VSYNC;
+    double frameRateLimit = 60.0;
+    double updateRate = 120.0;
+    std::string recordPathFile;
+    std::string playPathFile;
+    double playbackRate = 60.0;
+    int shadowMapSize = 2048;
+    int shadowCascades = 0;
+    bool computeVoxelization = false;
+    std::string brickPoolFile;
+    std::string bakeBricksFile;
+    double brickBudgetMB = 64.0;
+    int probeGridSize = 0;
+    bool clusterCulling = false;
+    bool materialTable = false;
+    bool bindlessTextures = true;
+    bool depthPrepass = true;
+    bool staticBatching = false;
+    unsigned int maxBatchVertices = 65536;
+    std::string lightsFile;
+    int numRandomLights = 0;
+    bool meshLODs = false;
+    int voxelViewLevel = -1;
+    float revoxelizationBudget = 0.0f;
+    std::string cpuReferencePrefix;
+    std::string batchPoseFile;
+    std::string batchOutputPrefix = "frame-";
+    int shardIndex = 0, shardCount = 1;
+    std::string glCaptureFile;
+    int glCaptureFrames = 100;
+    for(int i = 1; i < argc; i++) {
+        if(strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            traceFile = argv[++i];
+        }
+        else if(strcmp(argv[i], "--stats") == 0 && i + 1 < argc) {
+            statsFile = argv[++i];
+        }
+        else if(strcmp(argv[i], "--vsync") == 0) {
+            pacing = PACING_VSYNC;
+        }
+        else if(strcmp(argv[i], "--uncapped") == 0) {
+            pacing = PACING_UNCAPPED;
+        }
+        else if(strcmp(argv[i], "--fps-limit") == 0 && i + 1 < argc) {
+            pacing = PACING_LIMITED;
+            frameRateLimit = atof(argv[++i]);
+            if(frameRateLimit <= 0.0) {
+                fprintf(stderr, "Invalid frame rate limit %s, expected frames per second above 0\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+        }
+        else if(strcmp(argv[i], "--update-rate") == 0 && i + 1 < argc) {
+            updateRate = atof(argv[++i]);
+            if(updateRate <= 0.0) {
+                fprintf(stderr, "Invalid update rate %s, expected updates per second above 0\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+        }
+        else if(strcmp(argv[i], "--record-path") == 0 && i + 1 < argc) {
+            recordPathFile = argv[++i];
+        }
+        else if(strcmp(argv[i], "--play-path") == 0 && i + 1 < argc) {
+            playPathFile = argv[++i];
+        }
+        else if(strcmp(argv[i], "--playback-rate") == 0 && i + 1 < argc) {
+            playbackRate = atof(argv[++i]);
+        }
+        else if(strcmp(argv[i], "--shadow-size") == 0 && i + 1 < argc) {
+            shadowMapSize = atoi(argv[++i]);
+        }
+        else if(strcmp(argv[i], "--shadow-cascades") == 0 && i + 1 < argc) {
+            shadowCascades = atoi(argv[++i]);
+        }
+        else if(strcmp(argv[i], "--voxelizer") == 0 && i + 1 < argc) {
+            computeVoxelization = strcmp(argv[++i], "compute") == 0;
+        }
+        else if(strcmp(argv[i], "--brick-pool") == 0 && i + 1 < argc) {
+            brickPoolFile = argv[++i];
+        }
+        else if(strcmp(argv[i], "--brick-budget") == 0 && i + 1 < argc) {
+            brickBudgetMB = atof(argv[++i]);
+        }
+        else if(strcmp(argv[i], "--bake-bricks") == 0 && i + 1 < argc) {
+            bakeBricksFile = argv[++i];
+        }
+        else if(strcmp(argv[i], "--gi-probes") == 0 && i + 1 < argc) {
+            probeGridSize = atoi(argv[++i]);
+        }
+        else if(strcmp(argv[i], "--cluster-culling") == 0) {
+            clusterCulling = true;
+        }
+        else if(strcmp(argv[i], "--material-table") == 0) {
+            materialTable = true;
+        }
+        else if(strcmp(argv[i], "--no-bindless") == 0) {
+            bindlessTextures = false;
+        }
+        else if(strcmp(argv[i], "--static-batching") == 0) {
+            staticBatching = true;
+        }
+        else if(strcmp(argv[i], "--batch-max-vertices") == 0 && i + 1 < argc) {
+            maxBatchVertices = (unsigned int)atoi(argv[++i]);
+        }
+        else if(strcmp(argv[i], "--lights") == 0 && i + 1 < argc) {
+            lightsFile = argv[++i];
+        }
+        else if(strcmp(argv[i], "--random-lights") == 0 && i + 1 < argc) {
+            numRandomLights = atoi(argv[++i]);
+        }
+        else if(strcmp(argv[i], "--mesh-lods") == 0) {
+            meshLODs = true;
+        }
+        else if(strcmp(argv[i], "--no-depth-prepass") == 0) {
+            depthPrepass = false;
+        }
+        else if(strcmp(argv[i], "--show-voxels") == 0 && i + 1 < argc) {
+            voxelViewLevel = atoi(argv[++i]);
+        }
+        else if(strcmp(argv[i], "--revoxelize") == 0 && i + 1 < argc) {
+            revoxelizationBudget = (float)atof(argv[++i]);
+        }
+        else if(strcmp(argv[i], "--cpu-reference") == 0 && i + 1 < argc) {
+            cpuReferencePrefix = argv[++i];
+        }
+        else if(strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+            batchPoseFile = argv[++i];
+        }
+        else if(strcmp(argv[i], "--batch-output") == 0 && i + 1 < argc) {
+            batchOutputPrefix = argv[++i];
+        }
+        else if(strcmp(argv[i], "--gl-capture") == 0 && i + 1 < argc) {
+            glCaptureFile = argv[++i];
+        }
+        else if(strcmp(argv[i], "--gl-capture-frames") == 0 && i + 1 < argc) {
+            glCaptureFrames = atoi(argv[++i]);
+        }
+        else if(strcmp(argv[i], "--shard") == 0 && i + 1 < argc) {
+            if(sscanf(argv[++i], "%d/%d", &shardIndex, &shardCount) != 2 || shardCount < 1 || shardIndex < 0 || shardIndex >= shardCount) {
+                fprintf(stderr, "Invalid shard %s, expected <index>/<count>\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+        }
+    }
 
     // Load GLFW and create a window
     if(!glfwInit()) {
@@ -53,11 +228,17 @@ int main(void) {
     }
 
     glfwWindowHint(GLFW_SAMPLES, 4);
+    // The Hi-Z pyramid blits depth out of the window, which needs to match its GL_DEPTH24_STENCIL8 copy
+    glfwWindowHint(GLFW_DEPTH_BITS, 24);
+    glfwWindowHint(GLFW_STENCIL_BITS, 8);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
     glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
     glfwWindowHint(GLFW_RESIZABLE, GL_FALSE);
+    // Batch frames are drawn into a framebuffer object, the window is never shown and only holds the context
+    if(!batchPoseFile.empty())
+        glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
     GLFWwindow* window = glfwCreateWindow(width_, height_, "CSCI 580 Voxel Cone Tracing", NULL, NULL);
 
     // Check for Valid Context
@@ -78,6 +259,12 @@ int main(void) {
         fprintf(stderr, "Failed to initialize GLEW\n");
         return EXIT_FAILURE;
     }
+
+    // From the first call on, so a replay creates every object itself
+    if(!glCaptureFile.empty() && !GLCapture::start(glCaptureFile, width_, height_)) {
+        glfwTerminate();
+        return EXIT_FAILURE;
+    }
     
     dumpGLInfo();
     dumpGLErrors(); // Invalid enum here. Why?
@@ -91,38 +278,172 @@ int main(void) {
     // glEnable (GL_BLEND);
     // glBlendFunc (GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-    double previousTime, currentTime;
-    previousTime = glfwGetTime();
+    glfwSwapInterval(pacing == PACING_VSYNC ? 1 : 0);
 
-    Application app(width_, height_, window);
-    if (!app.initialize()) {
+    // Deleted before glfwTerminate so its GL objects are freed while the context still exists
+    Application* app = new Application(width_, height_, window);
+    app->setShadowMapSize(shadowMapSize);
+    app->setShadowCascades(shadowCascades);
+    app->setComputeVoxelization(computeVoxelization);
+    if(!brickPoolFile.empty())
+        app->setBrickPool(brickPoolFile, (size_t)(brickBudgetMB * 1024 * 1024));
+    if(!bakeBricksFile.empty())
+        app->setBakeBricks(bakeBricksFile);
+    app->setProbeGridSize(probeGridSize);
+    app->setClusterCulling(clusterCulling);
+    app->setMaterialTable(materialTable, bindlessTextures);
+    app->setStaticBatching(staticBatching, maxBatchVertices);
+    app->setLights(lightsFile, numRandomLights);
+    app->setMeshLODs(meshLODs);
+    app->setDepthPrepass(depthPrepass);
+    if(voxelViewLevel >= 0)
+        app->setVoxelView(true, voxelViewLevel);
+    app->setRevoxelizationBudget(revoxelizationBudget);
+    if (!app->initialize()) {
         fprintf(stderr, "Failed to initialize TestApplication\n");
         return EXIT_FAILURE;
     }
+    // Everything before the loop counts as the initialization
+    GLCapture::endFrame();
+
+    // Renders the poses instead of running the interactive loop
+    if(!batchPoseFile.empty()) {
+        BatchRenderer* batch = new BatchRenderer(app, app->getJobSystem());
+        bool finished = batch->loadPoses(batchPoseFile, shardIndex, shardCount) && batch->run(batchOutputPrefix);
+        batch->printStats(std::cout);
+        delete batch;
+        delete app;
+        Profiler::printSummary(std::cout);
+        if(!traceFile.empty()) {
+            Profiler::writeChromeTrace(traceFile);
+        }
+        glfwTerminate();
+        return finished ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    Controls* controls = app->getControls();
+    if(!playPathFile.empty()) {
+        if(!controls->startPlayback(playPathFile)) {
+            fprintf(stderr, "Failed to load camera path %s\n", playPathFile.c_str());
+            return EXIT_FAILURE;
+        }
+    }
+    else if(!recordPathFile.empty()) {
+        controls->startRecording(recordPathFile);
+    }
  
+    bool firstFrame = true;
+    int framesLoaded = 0;
+    FrameStats frameStats;
+
+    // The simulation runs at a fixed rate independent of the frame rate
+    const double updateStep = 1.0 / updateRate;
+    double updateAccumulator = 0.0;
+    const timer::HighResClock::duration frameBudget = std::chrono::duration_cast<timer::HighResClock::duration>(
+        std::chrono::duration<double>(1.0 / frameRateLimit));
+
+    timer::HighResClock::time_point previousTime = timer::now();
+    timer::HighResClock::time_point frameEnd = previousTime;
+
     // Rendering Loop
     while (glfwWindowShouldClose(window) == false) {
         if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
             glfwSetWindowShouldClose(window, true);
 
         // Update timer
-        currentTime = glfwGetTime();
-        float deltaTime = float(currentTime - previousTime);
+        timer::HighResClock::time_point currentTime = timer::now();
+        double deltaTime = std::chrono::duration<double>(currentTime - previousTime).count();
         previousTime = currentTime;
 
-		if (timer > 2.0) {
-			std::cout << "FPS: " << 1.0 / deltaTime << std::endl;
-			timer = 0.0;
+        if(!firstFrame) {
+            frameStats.addFrame(deltaTime);
+        }
+
+		if (fpsTimer > 2.0) {
+			frameStats.printSummary(std::cout);
+			MemoryTracker::printSummary(std::cout);
+			fpsTimer = 0.0;
 		}
 		else {
-			timer += deltaTime;
+			fpsTimer += deltaTime;
 		}
-        
-        app.update(deltaTime);
-        app.draw();
+
+        if(controls->isPlaying()) {
+            // One fixed step per frame so a playback renders the same frames on every run
+            app->update((float)(1.0 / playbackRate));
+            if(controls->isPlaybackFinished())
+                glfwSetWindowShouldClose(window, true);
+        }
+        else {
+            // Don't try to catch up after long stalls (loading, window moves)
+            updateAccumulator += std::min(deltaTime, 0.25);
+            while(updateAccumulator >= updateStep) {
+                app->update((float)updateStep);
+                updateAccumulator -= updateStep;
+            }
+        }
+        app->draw();
+
+        // The first frame after loading voxelizes the whole scene, the second one is compared and ends the run
+        if(!cpuReferencePrefix.empty() && !app->isLoading() && ++framesLoaded == 2) {
+            app->renderCPUReference(cpuReferencePrefix);
+            glfwSetWindowShouldClose(window, true);
+        }
+
+        if(pacing == PACING_LIMITED) {
+            frameEnd += frameBudget;
+            // Fell too far behind, start over from now instead of rushing frames
+            if(timer::now() > frameEnd + frameBudget)
+                frameEnd = timer::now();
+            waitUntil(frameEnd);
+        }
 
         glfwSwapBuffers(window);
         glfwPollEvents();
+
+        if(GLCapture::isCapturing()) {
+            GLCapture::endFrame();
+            if(GLCapture::getNumFrames() > glCaptureFrames) {
+                GLCapture::stop();
+                std::cout << "GL capture of " << glCaptureFrames << " frames written to " << glCaptureFile << std::endl;
+                GLCapture::printStats(std::cout);
+                glfwSetWindowShouldClose(window, true);
+            }
+        }
+
+        if(firstFrame) {
+            std::cout << "Time to first frame: " << glfwGetTime() << " s" << std::endl;
+            firstFrame = false;
+        }
+    }
+
+    // Closed before the capture had all its frames
+    if(GLCapture::isCapturing()) {
+        GLCapture::stop();
+        std::cout << "GL capture of " << GLCapture::getNumFrames() - 1 << " frames written to " << glCaptureFile << std::endl;
+        GLCapture::printStats(std::cout);
+    }
+
+    // Frame times and memory usage at exit, for comparing runs
+    frameStats.printSummary(std::cout);
+    app->printClusterStats(std::cout);
+    std::ofstream stats(statsFile.c_str());
+    stats << "{\"frame_times\": ";
+    frameStats.writeJSON(stats);
+    stats << ", \"memory\": ";
+    MemoryTracker::writeJSON(stats);
+    stats << "}" << std::endl;
+
+    if(!recordPathFile.empty() && controls->saveRecording()) {
+        std::cout << "Camera path saved to " << recordPathFile << std::endl;
+    }
+
+    delete app;
+
+    // Profiling results
+    Profiler::printSummary(std::cout);
+    if(!traceFile.empty()) {
+        Profiler::writeChromeTrace(traceFile);
     }
 
     glfwTerminate();
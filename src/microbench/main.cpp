@@ -0,0 +1,547 @@
+// Times the CPU side hot paths on fixed inputs and writes the results as JSON, so
+// runs can be diffed between commits.
+//
+//     VCT_microbench [--json <file>] [--filter <text>] [--min-time <s>] [--source <dir>]
+//
+// Each benchmark is calibrated until one sample takes at least min-time, then five
+// samples are taken and the median, fastest and slowest time per operation reported.
+// Inputs are either synthetic or read from the repository's data/models, models that
+// aren't there are skipped. Benchmarks that need GL run in a hidden window and are
+// skipped when no context can be created.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "GLCapture.h"
+#include <GLFW/glfw3.h>
+#include <glm/glm.hpp>
+#include <assimp/Importer.hpp>
+#include <assimp/postprocess.h>
+#include <assimp/scene.h>
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <string.h>
+#include <vector>
+
+#include "stb_image_write.h"
+
+#include "Camera.h"
+#include "CPUConeTracer.h"
+#include "HighResClock.h"
+#include "Material.h"
+#include "Mesh.h"
+#include "Object.h"
+#include "Shader.h"
+#include "VoxelBrickFile.h"
+#include "VoxelBrickPager.h"
+
+// Results are written here so the work can't be optimized away
+static volatile float sink;
+
+class Benchmarks {
+public:
+	Benchmarks(double minTime, std::string filter) {
+		minTime_ = minTime;
+		filter_ = filter;
+	}
+
+	bool isSelected(const std::string& name) {
+		return filter_.empty() || name.find(filter_) != std::string::npos;
+	}
+
+	// body runs the operation the given number of times. items is the work one
+	// operation does, e.g. the vertices of a mesh.
+	void run(const std::string& name, double items, const char* itemName, std::function<void(unsigned long long)> body) {
+		if(!isSelected(name))
+			return;
+
+		// Also warms up the caches
+		unsigned long long iterations = 1;
+		double seconds = time(body, iterations);
+		while(seconds < minTime_) {
+			double scale = std::min(std::max(1.2 * minTime_ / std::max(seconds, 1e-9), 2.0), 10.0);
+			iterations = (unsigned long long)(iterations * scale);
+			seconds = time(body, iterations);
+		}
+
+		Result result;
+		result.name = name;
+		result.iterations = iterations;
+		result.items = items;
+		result.itemName = itemName;
+		for(int i = 0; i < NUM_SAMPLES; i++) {
+			result.nsPerOp.push_back(time(body, iterations) * 1e9 / iterations);
+		}
+		std::sort(result.nsPerOp.begin(), result.nsPerOp.end());
+		results_.push_back(result);
+
+		double median = result.nsPerOp[NUM_SAMPLES / 2];
+		std::cout << std::left << std::setw(44) << name << std::right << std::fixed << std::setprecision(1)
+			<< std::setw(14) << median << " ns/op " << std::setw(14) << items * 1e9 / median << " " << itemName << "/s"
+			<< "  (" << result.nsPerOp.front() << " - " << result.nsPerOp.back() << ")" << std::endl;
+		std::cout.unsetf(std::ios_base::floatfield);
+	}
+
+	void skip(const std::string& name, const std::string& reason) {
+		if(isSelected(name))
+			std::cout << std::left << std::setw(44) << name << std::right << " skipped, " << reason << std::endl;
+	}
+
+	void writeJSON(std::ostream& out) {
+		out << "{\"min_time_s\": " << minTime_ << ", \"samples\": " << NUM_SAMPLES << ", \"benchmarks\": [";
+		for(size_t i = 0; i < results_.size(); i++) {
+			const Result& r = results_[i];
+			double median = r.nsPerOp[NUM_SAMPLES / 2];
+			out << (i > 0 ? "," : "") << std::endl
+				<< "  {\"name\": \"" << r.name << "\""
+				<< ", \"iterations\": " << r.iterations
+				<< ", \"median_ns\": " << median
+				<< ", \"min_ns\": " << r.nsPerOp.front()
+				<< ", \"max_ns\": " << r.nsPerOp.back()
+				<< ", \"items_per_op\": " << r.items
+				<< ", \"item\": \"" << r.itemName << "\""
+				<< ", \"items_per_s\": " << r.items * 1e9 / median << "}";
+		}
+		out << std::endl << "]}" << std::endl;
+	}
+
+protected:
+	static const int NUM_SAMPLES = 5;
+
+	struct Result {
+		std::string name;
+		unsigned long long iterations; // Per sample
+		double items;
+		std::string itemName;
+		std::vector<double> nsPerOp; // Sorted
+	};
+
+	double time(std::function<void(unsigned long long)>& body, unsigned long long iterations) {
+		timer::HighResClock::time_point start = timer::now();
+		body(iterations);
+		return std::chrono::duration<double>(timer::now() - start).count();
+	}
+
+	double minTime_;
+	std::string filter_;
+	std::vector<Result> results_;
+};
+
+static bool fileExists(const std::string& filename) {
+	std::ifstream file(filename.c_str());
+	return file.good();
+}
+
+// Deterministic values in [0, 1)
+static float random01(unsigned int& state) {
+	state = state * 1664525u + 1013904223u;
+	return (state >> 8) * (1.0f / 16777216.0f);
+}
+
+// ------------------------------------------------------------------- //
+// -------------------------- Synthetic inputs ------------------------ //
+// ------------------------------------------------------------------- //
+
+// Wavy grid of size^2 vertices with everything loadAssimpMesh reads
+static aiMesh* createGridMesh(int size) {
+	aiMesh* mesh = new aiMesh();
+	mesh->mPrimitiveTypes = aiPrimitiveType_TRIANGLE;
+	mesh->mNumVertices = size * size;
+	mesh->mVertices = new aiVector3D[mesh->mNumVertices];
+	mesh->mNormals = new aiVector3D[mesh->mNumVertices];
+	mesh->mTangents = new aiVector3D[mesh->mNumVertices];
+	mesh->mBitangents = new aiVector3D[mesh->mNumVertices];
+	mesh->mTextureCoords[0] = new aiVector3D[mesh->mNumVertices];
+	mesh->mNumUVComponents[0] = 2;
+	for(int z = 0; z < size; z++) {
+		for(int x = 0; x < size; x++) {
+			int i = z * size + x;
+			float fx = (float)x / (size - 1), fz = (float)z / (size - 1);
+			float height = 0.1f * sinf(20.0f * fx) * cosf(20.0f * fz);
+			glm::vec3 tangent = glm::normalize(glm::vec3(1.0f, 2.0f * cosf(20.0f * fx) * cosf(20.0f * fz), 0.0f));
+			glm::vec3 bitangent = glm::normalize(glm::vec3(0.0f, -2.0f * sinf(20.0f * fx) * sinf(20.0f * fz), 1.0f));
+			glm::vec3 normal = glm::normalize(glm::cross(bitangent, tangent));
+			mesh->mVertices[i].x = fx; mesh->mVertices[i].y = height; mesh->mVertices[i].z = fz;
+			mesh->mNormals[i].x = normal.x; mesh->mNormals[i].y = normal.y; mesh->mNormals[i].z = normal.z;
+			mesh->mTangents[i].x = tangent.x; mesh->mTangents[i].y = tangent.y; mesh->mTangents[i].z = tangent.z;
+			mesh->mBitangents[i].x = bitangent.x; mesh->mBitangents[i].y = bitangent.y; mesh->mBitangents[i].z = bitangent.z;
+			mesh->mTextureCoords[0][i].x = 4.0f * fx; mesh->mTextureCoords[0][i].y = 4.0f * fz; mesh->mTextureCoords[0][i].z = 0.0f;
+		}
+	}
+
+	mesh->mNumFaces = 2 * (size - 1) * (size - 1);
+	mesh->mFaces = new aiFace[mesh->mNumFaces];
+	unsigned int face = 0;
+	for(int z = 0; z < size - 1; z++) {
+		for(int x = 0; x < size - 1; x++) {
+			unsigned int corner = z * size + x;
+			unsigned int quad[2][3] = { { corner, corner + size, corner + 1 }, { corner + 1, corner + size, corner + size + 1 } };
+			for(int t = 0; t < 2; t++, face++) {
+				mesh->mFaces[face].mNumIndices = 3;
+				mesh->mFaces[face].mIndices = new unsigned int[3];
+				memcpy(mesh->mFaces[face].mIndices, quad[t], sizeof(quad[t]));
+			}
+		}
+	}
+	return mesh;
+}
+
+// RGBA8 voxels of a cube of the given size: a lit floor, a box and a sphere shell, empty elsewhere
+static std::vector<GLuint> createVoxels(int size) {
+	std::vector<GLuint> voxels((size_t)size * size * size, 0);
+	float center = size * 0.5f, radius = size * 0.3f;
+	for(int z = 0; z < size; z++) {
+		for(int y = 0; y < size; y++) {
+			for(int x = 0; x < size; x++) {
+				unsigned char color[4] = { 0, 0, 0, 0 };
+				float distance = glm::length(glm::vec3(x, y, z) + 0.5f - center);
+				if(y < size / 8) {
+					color[0] = 200; color[1] = 200; color[2] = 180; color[3] = 255;
+				}
+				else if(x > size / 8 && x < size / 4 && z > size / 8 && z < size / 4 && y < size / 2) {
+					color[0] = 220; color[1] = 40; color[2] = 40; color[3] = 255;
+				}
+				else if(fabsf(distance - radius) < 1.0f) {
+					color[0] = 40; color[1] = 60; color[2] = 220; color[3] = 255;
+				}
+				memcpy(&voxels[((size_t)z * size + y) * size + x], color, 4);
+			}
+		}
+	}
+	return voxels;
+}
+
+static int getNumMipLevels(int size) {
+	int levels = 1;
+	while((size >> levels) > 0) {
+		levels++;
+	}
+	return levels;
+}
+
+// ------------------------------------------------------------------- //
+// ----------------------------- Benchmarks --------------------------- //
+// ------------------------------------------------------------------- //
+
+static void benchmarkCamera(Benchmarks& benchmarks) {
+	Camera camera(glm::vec3(0.0f, 10.0f, 0.0f), 0.0f, 0.0f, glm::vec3(0.0f, 1.0f, 0.0f), 45.0f, 16.0f / 9.0f, 0.1f, 1000.0f);
+	benchmarks.run("camera/update", 1, "updates", [&](unsigned long long n) {
+		for(unsigned long long i = 0; i < n; i++) {
+			camera.addYaw(0.01f);
+			camera.moveForward(0.01f);
+			camera.update();
+			sink = camera.getViewMatrix()[3][0];
+		}
+	});
+}
+
+static void benchmarkObjects(Benchmarks& benchmarks) {
+	const int numObjects = 1024;
+	std::vector<Object> objects(numObjects);
+	unsigned int state = 1;
+	for(int i = 0; i < numObjects; i++) {
+		objects[i].setPosition(glm::vec3(random01(state), random01(state), random01(state)) * 100.0f);
+		objects[i].setScale(0.5f + random01(state));
+	}
+	benchmarks.run("object/modelMatrix", numObjects, "objects", [&](unsigned long long n) {
+		for(unsigned long long i = 0; i < n; i++) {
+			float sum = 0.0f;
+			for(int o = 0; o < numObjects; o++) {
+				sum += objects[o].getModelMatrix()[3][0];
+			}
+			sink = sum;
+		}
+	});
+}
+
+static void benchmarkMeshes(Benchmarks& benchmarks, const std::string& modelDir) {
+	aiMesh* grid = createGridMesh(256);
+	benchmarks.run("mesh/buildVertexData/grid256", grid->mNumVertices, "vertices", [&](unsigned long long n) {
+		for(unsigned long long i = 0; i < n; i++) {
+			Mesh mesh;
+			mesh.buildVertexData(grid);
+			sink = (float)mesh.getNumClusters();
+		}
+	});
+	benchmarks.run("mesh/buildVertexData/grid256-float", grid->mNumVertices, "vertices", [&](unsigned long long n) {
+		for(unsigned long long i = 0; i < n; i++) {
+			Mesh mesh;
+			mesh.buildVertexData(grid, false);
+			sink = (float)mesh.getNumClusters();
+		}
+	});
+	delete grid;
+
+	// Every mesh of a model, as the scene loader builds them
+	const char* models[][2] = {
+		{ "cube", "cube/cube.obj" },
+		{ "suzanne", "suzanne.obj" },
+		{ "teapot", "teapot/teapot.obj" },
+		{ "sponza", "crytek-sponza/sponza.obj" }
+	};
+	for(size_t m = 0; m < sizeof(models) / sizeof(models[0]); m++) {
+		std::string name = std::string("mesh/buildVertexData/") + models[m][0];
+		if(!benchmarks.isSelected(name))
+			continue;
+		std::string filename = modelDir + models[m][1];
+		if(!fileExists(filename)) {
+			benchmarks.skip(name, filename + " is missing");
+			continue;
+		}
+
+		Assimp::Importer importer;
+		const aiScene* scene = importer.ReadFile(filename, aiProcess_Triangulate |
+			aiProcess_CalcTangentSpace |
+			aiProcess_JoinIdenticalVertices);
+		if(!scene) {
+			benchmarks.skip(name, importer.GetErrorString());
+			continue;
+		}
+		double vertices = 0.0;
+		for(unsigned int i = 0; i < scene->mNumMeshes; i++) {
+			vertices += scene->mMeshes[i]->mNumVertices;
+		}
+		benchmarks.run(name, vertices, "vertices", [&](unsigned long long n) {
+			for(unsigned long long i = 0; i < n; i++) {
+				for(unsigned int j = 0; j < scene->mNumMeshes; j++) {
+					Mesh mesh;
+					mesh.buildVertexData(scene->mMeshes[j]);
+					sink = (float)mesh.getNumClusters();
+				}
+			}
+		});
+	}
+}
+
+static void benchmarkTextures(Benchmarks& benchmarks, const std::string& modelDir) {
+	std::vector<std::pair<std::string, std::string> > textures;
+
+	// Noise compresses badly, so this is about the worst case for the PNG decoder
+	const int size = 1024;
+	std::string syntheticFile = "microbench-synthetic.png";
+	if(benchmarks.isSelected("material/decodeTexture/synthetic1024")) {
+		std::vector<unsigned char> pixels((size_t)size * size * 4);
+		unsigned int state = 7;
+		for(int y = 0; y < size; y++) {
+			for(int x = 0; x < size; x++) {
+				unsigned char* pixel = &pixels[((size_t)y * size + x) * 4];
+				pixel[0] = (unsigned char)(x ^ y);
+				pixel[1] = (unsigned char)(random01(state) * 64.0f + y / 8);
+				pixel[2] = (unsigned char)(x / 4);
+				pixel[3] = 255;
+			}
+		}
+		if(stbi_write_png(syntheticFile.c_str(), size, size, 4, &pixels[0], size * 4))
+			textures.push_back(std::make_pair(std::string("synthetic1024"), syntheticFile));
+		else
+			benchmarks.skip("material/decodeTexture/synthetic1024", "couldn't write " + syntheticFile);
+	}
+
+	const char* files[][2] = {
+		{ "cube", "cube/default.png" },
+		{ "teapot", "teapot/default.png" },
+		{ "sponza-tga", "crytek-sponza/textures/background.tga" },
+		{ "sponza-png", "crytek-sponza/textures/background_bump.png" }
+	};
+	for(size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++) {
+		std::string filename = modelDir + files[i][1];
+		if(fileExists(filename))
+			textures.push_back(std::make_pair(std::string(files[i][0]), filename));
+		else
+			benchmarks.skip(std::string("material/decodeTexture/") + files[i][0], filename + " is missing");
+	}
+
+	for(size_t i = 0; i < textures.size(); i++) {
+		std::string filename = textures[i].second;
+		Material::ImageData image = Material::decodeTexture(filename);
+		double pixels = (double)image.width * image.height;
+		Material::freeImage(image);
+		benchmarks.run("material/decodeTexture/" + textures[i].first, pixels, "pixels", [&](unsigned long long n) {
+			for(unsigned long long j = 0; j < n; j++) {
+				Material::ImageData image = Material::decodeTexture(filename);
+				sink = (float)image.width;
+				Material::freeImage(image);
+			}
+		});
+	}
+	remove(syntheticFile.c_str());
+}
+
+static void benchmarkVoxels(Benchmarks& benchmarks) {
+	// One brick of the size the application bakes
+	const int brickSize = 16;
+	std::vector<GLuint> brick = createVoxels(brickSize);
+	size_t brickVoxels = brick.size();
+	int brickLevels = getNumMipLevels(brickSize);
+	benchmarks.run("voxels/buildMipmaps/brick16", (double)brickVoxels, "voxels", [&](unsigned long long n) {
+		for(unsigned long long i = 0; i < n; i++) {
+			brick.resize(brickVoxels);
+			VoxelBrickPager::buildMipmaps(brick, brickSize, brickLevels);
+			sink = (float)brick.back();
+		}
+	});
+	brick.resize(brickVoxels);
+
+	std::vector<unsigned char> compressed;
+	VoxelBrickFile::compress(brick, compressed);
+	benchmarks.run("voxels/compress/brick16", (double)brickVoxels, "voxels", [&](unsigned long long n) {
+		std::vector<unsigned char> out;
+		for(unsigned long long i = 0; i < n; i++) {
+			VoxelBrickFile::compress(brick, out);
+			sink = (float)out.size();
+		}
+	});
+	benchmarks.run("voxels/decompress/brick16", (double)brickVoxels, "voxels", [&](unsigned long long n) {
+		std::vector<GLuint> out;
+		for(unsigned long long i = 0; i < n; i++) {
+			VoxelBrickFile::decompress(compressed, brickVoxels, out);
+			sink = (float)out.back();
+		}
+	});
+
+	// Single threaded, a G-buffer of the floor seen from above the volume
+	if(!benchmarks.isSelected("voxels/coneTrace/64x64"))
+		return;
+	const int dimensions = 64;
+	const float gridWorldSize = 64.0f;
+	std::vector<GLuint> volume = createVoxels(dimensions);
+	VoxelBrickPager::buildMipmaps(volume, dimensions, getNumMipLevels(dimensions));
+	std::vector<std::vector<unsigned char> > levels;
+	size_t offset = 0;
+	for(int size = dimensions; size > 0; size /= 2) {
+		size_t count = (size_t)size * size * size;
+		levels.push_back(std::vector<unsigned char>((const unsigned char*)&volume[offset], (const unsigned char*)&volume[offset + count]));
+		offset += count;
+	}
+	CPUConeTracer tracer;
+	tracer.setVoxels(levels, dimensions, gridWorldSize);
+
+	CPUConeTracer::GBuffer gbuffer;
+	gbuffer.width = gbuffer.height = 64;
+	size_t numPixels = (size_t)gbuffer.width * gbuffer.height;
+	float floorHeight = -gridWorldSize * 0.5f + gridWorldSize / 8.0f;
+	for(int y = 0; y < gbuffer.height; y++) {
+		for(int x = 0; x < gbuffer.width; x++) {
+			glm::vec3 position((x + 0.5f) / gbuffer.width - 0.5f, 0.0f, (y + 0.5f) / gbuffer.height - 0.5f);
+			position *= gridWorldSize * 0.9f;
+			position.y = floorHeight;
+			gbuffer.positionVisibility.push_back(glm::vec4(position, 1.0f));
+			gbuffer.normal.push_back(glm::vec4(0.0f, 1.0f, 0.0f, 0.0f));
+			gbuffer.geometricNormal.push_back(glm::vec4(0.0f, 1.0f, 0.0f, 0.0f));
+			gbuffer.albedo.push_back(glm::vec4(0.8f, 0.8f, 0.7f, 1.0f));
+			gbuffer.specular.push_back(glm::vec4(0.2f, 0.2f, 0.2f, 1.0f));
+		}
+	}
+	CPUConeTracer::Settings settings;
+	settings.cameraPosition = glm::vec3(0.0f, 20.0f, -30.0f);
+	settings.lightDirection = glm::normalize(glm::vec3(0.3f, 1.0f, 0.2f));
+	settings.direct = true;
+	settings.indirect = true;
+
+	std::vector<glm::vec3> image;
+	benchmarks.run("voxels/coneTrace/64x64", (double)numPixels, "pixels", [&](unsigned long long n) {
+		for(unsigned long long i = 0; i < n; i++) {
+			tracer.render(gbuffer, settings, NULL, image);
+			sink = image[0].x;
+		}
+	});
+}
+
+// Only what the CPU spends submitting, nothing is drawn
+static void benchmarkUniforms(Benchmarks& benchmarks, const std::string& shaderDir) {
+	if(!benchmarks.isSelected("gl/objectUniforms"))
+		return;
+
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+	glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
+	GLFWwindow* window = glfwCreateWindow(64, 64, "VCT microbench", NULL, NULL);
+	if(window == NULL) {
+		benchmarks.skip("gl/objectUniforms", "no GL context");
+		return;
+	}
+	glfwMakeContextCurrent(window);
+	glewExperimental = true;
+	if(glewInit() != GLEW_OK) {
+		benchmarks.skip("gl/objectUniforms", "GLEW failed");
+		glfwDestroyWindow(window);
+		return;
+	}
+
+	GLuint shader = loadShaders((shaderDir + "voxel-trace.vert").c_str(), (shaderDir + "voxel-trace.frag").c_str());
+	const int numObjects = 256;
+	Material material;
+	std::vector<Object> objects(numObjects);
+	for(int i = 0; i < numObjects; i++) {
+		objects[i].setPosition(glm::vec3((float)i, 0.0f, 0.0f));
+		objects[i].material_ = &material;
+	}
+	glm::mat4 viewMatrix(1.0f), projectionMatrix(1.0f), depthViewProjectionMatrix(1.0f);
+	glUseProgram(shader);
+	benchmarks.run("gl/objectUniforms", numObjects, "objects", [&](unsigned long long n) {
+		for(unsigned long long i = 0; i < n; i++) {
+			for(int o = 0; o < numObjects; o++) {
+				objects[o].setUniforms(viewMatrix, projectionMatrix, depthViewProjectionMatrix, shader);
+			}
+		}
+		// Keeps the driver's command queue from growing without bound
+		glFinish();
+	});
+	for(int i = 0; i < numObjects; i++) {
+		objects[i].material_ = NULL;
+	}
+	glDeleteProgram(shader);
+	glfwDestroyWindow(window);
+}
+
+int main(int argc, char** argv) {
+	std::string jsonFile = "microbench.json";
+	std::string filter;
+	double minTime = 0.1;
+	std::string sourceDir = PROJECT_SOURCE_DIR;
+	for(int i = 1; i < argc; i++) {
+		if(strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+			jsonFile = argv[++i];
+		}
+		else if(strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+			filter = argv[++i];
+		}
+		else if(strcmp(argv[i], "--min-time") == 0 && i + 1 < argc) {
+			minTime = atof(argv[++i]);
+		}
+		else if(strcmp(argv[i], "--source") == 0 && i + 1 < argc) {
+			sourceDir = argv[++i];
+		}
+		else {
+			fprintf(stderr, "Usage: VCT_microbench [--json <file>] [--filter <text>] [--min-time <s>] [--source <dir>]\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	Benchmarks benchmarks(minTime, filter);
+	benchmarkCamera(benchmarks);
+	benchmarkObjects(benchmarks);
+	benchmarkMeshes(benchmarks, sourceDir + "/data/models/");
+	benchmarkTextures(benchmarks, sourceDir + "/data/models/");
+	benchmarkVoxels(benchmarks);
+	if(glfwInit()) {
+		benchmarkUniforms(benchmarks, sourceDir + "/shaders/");
+		glfwTerminate();
+	}
+	else {
+		benchmarks.skip("gl/objectUniforms", "GLFW failed");
+	}
+
+	std::ofstream json(jsonFile.c_str());
+	benchmarks.writeJSON(json);
+	std::cout << "Results written to " << jsonFile << std::endl;
+	return json.good() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
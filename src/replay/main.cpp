@@ -0,0 +1,415 @@
+// Issues a GL capture written by VCT --gl-capture again, without the application
+// around it, and reports what the calls cost on the CPU. See GLCapture.h for the format.
+//
+//     VCT_replay <capture> [--finish]
+//
+// With --finish every frame waits for the GPU before the next one starts, so the
+// frame times include the GPU. Without it they are what the driver costs the CPU.
+
+#define GL_CAPTURE_IMPLEMENTATION
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "GLCapture.h"
+#include <GLFW/glfw3.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <string>
+#include <string.h>
+#include <vector>
+
+#include "HighResClock.h"
+
+typedef unsigned long long u64;
+
+// Names the application saw to the ones this context created
+class NameMap {
+public:
+	GLuint operator()(u64 captured) const {
+		std::map<GLuint, GLuint>::const_iterator it = names_.find((GLuint)captured);
+		return it != names_.end() ? it->second : (GLuint)captured;
+	}
+	void add(GLuint captured, GLuint name) {
+		names_[captured] = name;
+	}
+	void remove(GLuint captured) {
+		names_.erase(captured);
+	}
+
+protected:
+	std::map<GLuint, GLuint> names_;
+};
+
+struct Record {
+	int command;
+	std::vector<u64> args;
+	std::vector<char> blob;
+};
+
+class Replay {
+public:
+	Replay() {
+		program_ = 0;
+	}
+
+	// Calls one record with the names of this context
+	void execute(const Record& r);
+
+protected:
+	static GLint I(u64 a) { return (GLint)(long long)a; }
+	static GLuint U(u64 a) { return (GLuint)a; }
+	static GLfloat F(u64 a) { GLuint bits = (GLuint)a; GLfloat v; memcpy(&v, &bits, sizeof(v)); return v; }
+	static const void* P(u64 a) { return (const void*)(size_t)a; }
+
+	// Generated names arrive as a blob of the captured ones
+	template <typename Gen>
+	void generate(const Record& r, NameMap& map, Gen gen) {
+		GLsizei n = I(r.args[0]);
+		std::vector<GLuint> names(n);
+		gen(n, &names[0]);
+		const GLuint* captured = (const GLuint*)&r.blob[0];
+		for(GLsizei i = 0; i < n; i++) {
+			map.add(captured[i], names[i]);
+		}
+	}
+	template <typename Delete>
+	void remove(const Record& r, NameMap& map, Delete del) {
+		GLsizei n = I(r.args[0]);
+		std::vector<GLuint> names(n);
+		const GLuint* captured = (const GLuint*)&r.blob[0];
+		for(GLsizei i = 0; i < n; i++) {
+			names[i] = map(captured[i]);
+			map.remove(captured[i]);
+		}
+		del(n, &names[0]);
+	}
+	GLuint texture(u64 target, u64 name) {
+		return target == GL_RENDERBUFFER ? renderbuffers_(name) : textures_(name);
+	}
+	// Locations are looked up again, a different driver may number them differently
+	GLint location(u64 captured) {
+		std::map<u64, GLint>::iterator it = locations_.find(((u64)program_ << 32) | (GLuint)captured);
+		return it != locations_.end() ? it->second : I(captured);
+	}
+	void* scratch(size_t size) {
+		if(scratch_.size() < size)
+			scratch_.resize(size);
+		return scratch_.empty() ? NULL : &scratch_[0];
+	}
+
+	NameMap textures_, buffers_, framebuffers_, renderbuffers_, vertexArrays_, queries_, shaders_, programs_;
+	std::map<u64, GLsync> syncs_;
+	std::map<u64, GLint> locations_; // Captured program << 32 | captured location
+	GLuint program_; // Captured name of the current program
+	std::vector<char> scratch_;
+};
+
+void Replay::execute(const Record& r) {
+	const std::vector<u64>& a = r.args;
+	const void* blob = r.blob.empty() ? NULL : &r.blob[0];
+
+	switch(r.command) {
+	case GLCapture::CMD_ActiveTexture: glActiveTexture(U(a[0])); break;
+	case GLCapture::CMD_AttachShader: glAttachShader(programs_(a[0]), shaders_(a[1])); break;
+	case GLCapture::CMD_BeginQuery: glBeginQuery(U(a[0]), queries_(a[1])); break;
+	case GLCapture::CMD_BindBuffer: glBindBuffer(U(a[0]), buffers_(a[1])); break;
+	case GLCapture::CMD_BindBufferBase: glBindBufferBase(U(a[0]), U(a[1]), buffers_(a[2])); break;
+	case GLCapture::CMD_BindFramebuffer: glBindFramebuffer(U(a[0]), framebuffers_(a[1])); break;
+	case GLCapture::CMD_BindImageTexture: glBindImageTexture(U(a[0]), textures_(a[1]), I(a[2]), (GLboolean)a[3], I(a[4]), U(a[5]), U(a[6])); break;
+	case GLCapture::CMD_BindRenderbuffer: glBindRenderbuffer(U(a[0]), renderbuffers_(a[1])); break;
+	case GLCapture::CMD_BindTexture: glBindTexture(U(a[0]), textures_(a[1])); break;
+	case GLCapture::CMD_BindVertexArray: glBindVertexArray(vertexArrays_(a[0])); break;
+	case GLCapture::CMD_BlitFramebuffer: glBlitFramebuffer(I(a[0]), I(a[1]), I(a[2]), I(a[3]), I(a[4]), I(a[5]), I(a[6]), I(a[7]), U(a[8]), U(a[9])); break;
+	case GLCapture::CMD_BufferData: glBufferData(U(a[0]), (GLsizeiptr)a[1], a[3] ? blob : NULL, U(a[2])); break;
+	case GLCapture::CMD_BufferSubData: glBufferSubData(U(a[0]), (GLintptr)a[1], (GLsizeiptr)a[2], blob); break;
+	case GLCapture::CMD_CheckFramebufferStatus: glCheckFramebufferStatus(U(a[0])); break;
+	case GLCapture::CMD_Clear: glClear(U(a[0])); break;
+	case GLCapture::CMD_ClearBufferData: glClearBufferData(U(a[0]), U(a[1]), U(a[2]), U(a[3]), a[4] ? blob : NULL); break;
+	case GLCapture::CMD_ClearBufferfv: glClearBufferfv(U(a[0]), I(a[1]), (const GLfloat*)blob); break;
+	case GLCapture::CMD_ClearColor: glClearColor(F(a[0]), F(a[1]), F(a[2]), F(a[3])); break;
+	case GLCapture::CMD_ClientWaitSync: glClientWaitSync(syncs_[a[0]], U(a[1]), a[2]); break;
+	case GLCapture::CMD_ColorMask: glColorMask((GLboolean)a[0], (GLboolean)a[1], (GLboolean)a[2], (GLboolean)a[3]); break;
+	case GLCapture::CMD_CompileShader: glCompileShader(shaders_(a[0])); break;
+	case GLCapture::CMD_CopyImageSubData:
+		glCopyImageSubData(textures_(a[0]), U(a[1]), I(a[2]), I(a[3]), I(a[4]), I(a[5]), textures_(a[6]), U(a[7]), I(a[8]), I(a[9]), I(a[10]), I(a[11]), I(a[12]), I(a[13]), I(a[14]));
+		break;
+	case GLCapture::CMD_CopyTexSubImage2D: glCopyTexSubImage2D(U(a[0]), I(a[1]), I(a[2]), I(a[3]), I(a[4]), I(a[5]), I(a[6]), I(a[7])); break;
+	case GLCapture::CMD_CreateProgram: programs_.add(U(a[0]), glCreateProgram()); break;
+	case GLCapture::CMD_CreateShader: shaders_.add(U(a[1]), glCreateShader(U(a[0]))); break;
+	case GLCapture::CMD_CullFace: glCullFace(U(a[0])); break;
+	case GLCapture::CMD_DeleteBuffers: remove(r, buffers_, glDeleteBuffers); break;
+	case GLCapture::CMD_DeleteFramebuffers: remove(r, framebuffers_, glDeleteFramebuffers); break;
+	case GLCapture::CMD_DeleteProgram: glDeleteProgram(programs_(a[0])); programs_.remove(U(a[0])); break;
+	case GLCapture::CMD_DeleteQueries: remove(r, queries_, glDeleteQueries); break;
+	case GLCapture::CMD_DeleteRenderbuffers: remove(r, renderbuffers_, glDeleteRenderbuffers); break;
+	case GLCapture::CMD_DeleteShader: glDeleteShader(shaders_(a[0])); shaders_.remove(U(a[0])); break;
+	case GLCapture::CMD_DeleteSync: glDeleteSync(syncs_[a[0]]); syncs_.erase(a[0]); break;
+	case GLCapture::CMD_DeleteTextures: remove(r, textures_, glDeleteTextures); break;
+	case GLCapture::CMD_DeleteVertexArrays: remove(r, vertexArrays_, glDeleteVertexArrays); break;
+	case GLCapture::CMD_DepthFunc: glDepthFunc(U(a[0])); break;
+	case GLCapture::CMD_DepthMask: glDepthMask((GLboolean)a[0]); break;
+	case GLCapture::CMD_Disable: glDisable(U(a[0])); break;
+	case GLCapture::CMD_DisableVertexAttribArray: glDisableVertexAttribArray(U(a[0])); break;
+	case GLCapture::CMD_DispatchCompute: glDispatchCompute(U(a[0]), U(a[1]), U(a[2])); break;
+	case GLCapture::CMD_DispatchComputeIndirect: glDispatchComputeIndirect((GLintptr)a[0]); break;
+	case GLCapture::CMD_DrawArrays: glDrawArrays(U(a[0]), I(a[1]), I(a[2])); break;
+	case GLCapture::CMD_DrawArraysIndirect: glDrawArraysIndirect(U(a[0]), P(a[1])); break;
+	case GLCapture::CMD_DrawArraysInstanced: glDrawArraysInstanced(U(a[0]), I(a[1]), I(a[2]), I(a[3])); break;
+	case GLCapture::CMD_DrawBuffer: glDrawBuffer(U(a[0])); break;
+	case GLCapture::CMD_DrawBuffers: glDrawBuffers(I(a[0]), (const GLenum*)blob); break;
+	case GLCapture::CMD_DrawElements: glDrawElements(U(a[0]), I(a[1]), U(a[2]), P(a[3])); break;
+	case GLCapture::CMD_DrawElementsInstanced: glDrawElementsInstanced(U(a[0]), I(a[1]), U(a[2]), P(a[3]), I(a[4])); break;
+	case GLCapture::CMD_Enable: glEnable(U(a[0])); break;
+	case GLCapture::CMD_EnableVertexAttribArray: glEnableVertexAttribArray(U(a[0])); break;
+	case GLCapture::CMD_EndQuery: glEndQuery(U(a[0])); break;
+	case GLCapture::CMD_FenceSync: syncs_[a[2]] = glFenceSync(U(a[0]), U(a[1])); break;
+	case GLCapture::CMD_Flush: glFlush(); break;
+	case GLCapture::CMD_FramebufferRenderbuffer: glFramebufferRenderbuffer(U(a[0]), U(a[1]), U(a[2]), renderbuffers_(a[3])); break;
+	case GLCapture::CMD_FramebufferTexture: glFramebufferTexture(U(a[0]), U(a[1]), textures_(a[2]), I(a[3])); break;
+	case GLCapture::CMD_FramebufferTexture2D: glFramebufferTexture2D(U(a[0]), U(a[1]), U(a[2]), textures_(a[3]), I(a[4])); break;
+	case GLCapture::CMD_FramebufferTextureLayer: glFramebufferTextureLayer(U(a[0]), U(a[1]), textures_(a[2]), I(a[3]), I(a[4])); break;
+	case GLCapture::CMD_GenBuffers: generate(r, buffers_, glGenBuffers); break;
+	case GLCapture::CMD_GenFramebuffers: generate(r, framebuffers_, glGenFramebuffers); break;
+	case GLCapture::CMD_GenQueries: generate(r, queries_, glGenQueries); break;
+	case GLCapture::CMD_GenRenderbuffers: generate(r, renderbuffers_, glGenRenderbuffers); break;
+	case GLCapture::CMD_GenTextures: generate(r, textures_, glGenTextures); break;
+	case GLCapture::CMD_GenVertexArrays: generate(r, vertexArrays_, glGenVertexArrays); break;
+	case GLCapture::CMD_GenerateMipmap: glGenerateMipmap(U(a[0])); break;
+	case GLCapture::CMD_GetBufferSubData: glGetBufferSubData(U(a[0]), (GLintptr)a[1], (GLsizeiptr)a[2], scratch((size_t)a[2])); break;
+	case GLCapture::CMD_GetError: glGetError(); break;
+	case GLCapture::CMD_GetInteger64v: glGetInteger64v(U(a[0]), (GLint64*)scratch(16 * sizeof(GLint64))); break;
+	case GLCapture::CMD_GetIntegerv: glGetIntegerv(U(a[0]), (GLint*)scratch(16 * sizeof(GLint))); break;
+	case GLCapture::CMD_GetProgramInfoLog: glGetProgramInfoLog(programs_(a[0]), I(a[1]), NULL, (GLchar*)scratch((size_t)a[1])); break;
+	case GLCapture::CMD_GetProgramiv: glGetProgramiv(programs_(a[0]), U(a[1]), (GLint*)scratch(sizeof(GLint))); break;
+	case GLCapture::CMD_GetQueryObjectiv: glGetQueryObjectiv(queries_(a[0]), U(a[1]), (GLint*)scratch(sizeof(GLint))); break;
+	case GLCapture::CMD_GetQueryObjectui64v: glGetQueryObjectui64v(queries_(a[0]), U(a[1]), (GLuint64*)scratch(sizeof(GLuint64))); break;
+	case GLCapture::CMD_GetQueryObjectuiv: glGetQueryObjectuiv(queries_(a[0]), U(a[1]), (GLuint*)scratch(sizeof(GLuint))); break;
+	case GLCapture::CMD_GetShaderInfoLog: glGetShaderInfoLog(shaders_(a[0]), I(a[1]), NULL, (GLchar*)scratch((size_t)a[1])); break;
+	case GLCapture::CMD_GetShaderiv: glGetShaderiv(shaders_(a[0]), U(a[1]), (GLint*)scratch(sizeof(GLint))); break;
+	case GLCapture::CMD_GetString: glGetString(U(a[0])); break;
+	case GLCapture::CMD_GetTexImage:
+		glGetTexImage(U(a[0]), I(a[1]), U(a[2]), U(a[3]), a[5] ? (void*)P(a[4]) : scratch((size_t)a[6]));
+		break;
+	case GLCapture::CMD_GetUniformLocation:
+		locations_[((u64)U(a[0]) << 32) | U(a[1])] = glGetUniformLocation(programs_(a[0]), (const GLchar*)blob);
+		break;
+	case GLCapture::CMD_LinkProgram: glLinkProgram(programs_(a[0])); break;
+	case GLCapture::CMD_MapBufferRange: glMapBufferRange(U(a[0]), (GLintptr)a[1], (GLsizeiptr)a[2], U(a[3])); break;
+	case GLCapture::CMD_MemoryBarrier: glMemoryBarrier(U(a[0])); break;
+	case GLCapture::CMD_MultiDrawElementsIndirect: glMultiDrawElementsIndirect(U(a[0]), U(a[1]), P(a[2]), I(a[3]), I(a[4])); break;
+	case GLCapture::CMD_MultiDrawElementsIndirectCountARB:
+		glMultiDrawElementsIndirectCountARB(U(a[0]), U(a[1]), P(a[2]), (GLintptr)a[3], I(a[4]), I(a[5]));
+		break;
+	case GLCapture::CMD_PixelStorei: glPixelStorei(U(a[0]), I(a[1])); break;
+	case GLCapture::CMD_QueryCounter: glQueryCounter(queries_(a[0]), U(a[1])); break;
+	case GLCapture::CMD_ReadBuffer: glReadBuffer(U(a[0])); break;
+	case GLCapture::CMD_ReadPixels:
+		glReadPixels(I(a[0]), I(a[1]), I(a[2]), I(a[3]), U(a[4]), U(a[5]), a[7] ? (void*)P(a[6]) : scratch((size_t)a[8]));
+		break;
+	case GLCapture::CMD_RenderbufferStorage: glRenderbufferStorage(U(a[0]), U(a[1]), I(a[2]), I(a[3])); break;
+	case GLCapture::CMD_RenderbufferStorageMultisample: glRenderbufferStorageMultisample(U(a[0]), I(a[1]), U(a[2]), I(a[3]), I(a[4])); break;
+	case GLCapture::CMD_ShaderSource: {
+		const GLchar* source = (const GLchar*)blob;
+		GLint length = (GLint)r.blob.size();
+		glShaderSource(shaders_(a[0]), 1, &source, &length);
+		break;
+	}
+	case GLCapture::CMD_TexImage2D:
+		glTexImage2D(U(a[0]), I(a[1]), I(a[2]), I(a[3]), I(a[4]), I(a[5]), U(a[6]), U(a[7]), a[8] ? blob : NULL);
+		break;
+	case GLCapture::CMD_TexImage3D:
+		glTexImage3D(U(a[0]), I(a[1]), I(a[2]), I(a[3]), I(a[4]), I(a[5]), I(a[6]), U(a[7]), U(a[8]), a[9] ? blob : NULL);
+		break;
+	case GLCapture::CMD_TexParameteri: glTexParameteri(U(a[0]), U(a[1]), I(a[2])); break;
+	case GLCapture::CMD_TexSubImage3D:
+		glTexSubImage3D(U(a[0]), I(a[1]), I(a[2]), I(a[3]), I(a[4]), I(a[5]), I(a[6]), I(a[7]), U(a[8]), U(a[9]), blob);
+		break;
+	case GLCapture::CMD_Uniform1f: glUniform1f(location(a[0]), F(a[1])); break;
+	case GLCapture::CMD_Uniform1fv: glUniform1fv(location(a[0]), I(a[1]), (const GLfloat*)blob); break;
+	case GLCapture::CMD_Uniform1i: glUniform1i(location(a[0]), I(a[1])); break;
+	case GLCapture::CMD_Uniform1iv: glUniform1iv(location(a[0]), I(a[1]), (const GLint*)blob); break;
+	case GLCapture::CMD_Uniform1ui: glUniform1ui(location(a[0]), U(a[1])); break;
+	case GLCapture::CMD_Uniform2f: glUniform2f(location(a[0]), F(a[1]), F(a[2])); break;
+	case GLCapture::CMD_Uniform2i: glUniform2i(location(a[0]), I(a[1]), I(a[2])); break;
+	case GLCapture::CMD_Uniform3f: glUniform3f(location(a[0]), F(a[1]), F(a[2]), F(a[3])); break;
+	case GLCapture::CMD_Uniform3i: glUniform3i(location(a[0]), I(a[1]), I(a[2]), I(a[3])); break;
+	case GLCapture::CMD_Uniform4fv: glUniform4fv(location(a[0]), I(a[1]), (const GLfloat*)blob); break;
+	case GLCapture::CMD_UniformMatrix4fv: glUniformMatrix4fv(location(a[0]), I(a[1]), (GLboolean)a[2], (const GLfloat*)blob); break;
+	case GLCapture::CMD_UnmapBuffer: glUnmapBuffer(U(a[0])); break;
+	case GLCapture::CMD_UseProgram: program_ = U(a[0]); glUseProgram(programs_(a[0])); break;
+	case GLCapture::CMD_VertexAttribDivisor: glVertexAttribDivisor(U(a[0]), U(a[1])); break;
+	case GLCapture::CMD_VertexAttribIPointer: glVertexAttribIPointer(U(a[0]), I(a[1]), U(a[2]), I(a[3]), P(a[4])); break;
+	case GLCapture::CMD_VertexAttribPointer: glVertexAttribPointer(U(a[0]), I(a[1]), U(a[2]), (GLboolean)a[3], I(a[4]), P(a[5])); break;
+	case GLCapture::CMD_Viewport: glViewport(I(a[0]), I(a[1]), I(a[2]), I(a[3])); break;
+	}
+}
+
+static bool readRecord(std::ifstream& file, Record& r) {
+	unsigned short header[2];
+	unsigned int blobSize;
+	if(!file.read((char*)header, sizeof(header)) || !file.read((char*)&blobSize, sizeof(blobSize)))
+		return false;
+	r.command = header[0];
+	r.args.resize(header[1]);
+	r.blob.resize(blobSize);
+	if(header[1] > 0 && !file.read((char*)&r.args[0], header[1] * sizeof(u64)))
+		return false;
+	if(blobSize > 0 && !file.read(&r.blob[0], blobSize))
+		return false;
+	return r.command < GLCapture::NUM_COMMANDS;
+}
+
+static double secondsSince(timer::HighResClock::time_point start) {
+	return std::chrono::duration<double>(timer::now() - start).count();
+}
+
+// Frame times bucketed by milliseconds, one bar per bucket
+static void printHistogram(std::ostream& out, const std::vector<double>& frameMs) {
+	if(frameMs.empty())
+		return;
+	double maxMs = *std::max_element(frameMs.begin(), frameMs.end());
+	double bucketMs = std::max(maxMs / 10.0, 0.1);
+	std::vector<int> buckets(11, 0);
+	for(size_t i = 0; i < frameMs.size(); i++) {
+		buckets[std::min((int)(frameMs[i] / bucketMs), 10)]++;
+	}
+	int maxCount = *std::max_element(buckets.begin(), buckets.end());
+	for(size_t b = 0; b < buckets.size(); b++) {
+		if(buckets[b] == 0)
+			continue;
+		out << "\t" << std::setw(7) << b * bucketMs << " ms " << std::setw(5) << buckets[b] << " "
+			<< std::string((size_t)(40.0 * buckets[b] / maxCount + 0.5), '#') << std::endl;
+	}
+}
+
+int main(int argc, char** argv) {
+	std::string captureFile;
+	bool finish = false;
+	for(int i = 1; i < argc; i++) {
+		if(strcmp(argv[i], "--finish") == 0)
+			finish = true;
+		else
+			captureFile = argv[i];
+	}
+	if(captureFile.empty()) {
+		fprintf(stderr, "Usage: VCT_replay <capture> [--finish]\n");
+		return EXIT_FAILURE;
+	}
+
+	std::ifstream file(captureFile.c_str(), std::ios::binary);
+	char magic[8];
+	unsigned int header[3];
+	if(!file.read(magic, sizeof(magic)) || memcmp(magic, "VCTGLCAP", sizeof(magic)) != 0 ||
+	   !file.read((char*)header, sizeof(header)) || header[0] != GLCapture::FILE_VERSION) {
+		fprintf(stderr, "%s isn't a GL capture of this version\n", captureFile.c_str());
+		return EXIT_FAILURE;
+	}
+
+	// The same context the application creates
+	if(!glfwInit()) {
+		fprintf(stderr, "Failed to initialize GLFW\n");
+		return EXIT_FAILURE;
+	}
+	glfwWindowHint(GLFW_SAMPLES, 4);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+	glfwWindowHint(GLFW_RESIZABLE, GL_FALSE);
+	GLFWwindow* window = glfwCreateWindow(header[1], header[2], "VCT replay", NULL, NULL);
+	if(window == NULL) {
+		fprintf(stderr, "Failed to Create OpenGL Context");
+		glfwTerminate();
+		return EXIT_FAILURE;
+	}
+	glfwMakeContextCurrent(window);
+	glfwSwapInterval(0);
+	glewExperimental = true;
+	if(glewInit() != GLEW_OK) {
+		fprintf(stderr, "Failed to initialize GLEW\n");
+		return EXIT_FAILURE;
+	}
+	glGetError(); // GLEW leaves an invalid enum behind
+
+	Replay replay;
+	Record record;
+	GLCapture::CallStats stats;
+	// Seconds and calls per command, over the frames after the initialization
+	std::vector<double> commandSeconds(GLCapture::NUM_GL_COMMANDS, 0.0);
+	std::vector<u64> commandCalls(GLCapture::NUM_GL_COMMANDS, 0);
+	std::vector<double> frameMs;
+	double setupSeconds = 0.0;
+	bool inSetup = true;
+
+	timer::HighResClock::time_point frameStart = timer::now();
+	timer::HighResClock::time_point passStart = frameStart;
+	while(readRecord(file, record) && !glfwWindowShouldClose(window)) {
+		if(record.command < GLCapture::NUM_GL_COMMANDS) {
+			timer::HighResClock::time_point start = timer::now();
+			replay.execute(record);
+			if(!inSetup) {
+				commandSeconds[record.command] += secondsSince(start);
+				commandCalls[record.command]++;
+			}
+			stats.addCall(record.command);
+			continue;
+		}
+
+		// Time since the last marker belongs to the innermost pass
+		stats.addTime(secondsSince(passStart));
+		if(record.command == GLCapture::CMD_BEGIN_PASS) {
+			stats.beginPass(std::string(record.blob.begin(), record.blob.end()));
+		}
+		else if(record.command == GLCapture::CMD_END_PASS) {
+			stats.endPass();
+		}
+		else if(record.command == GLCapture::CMD_END_FRAME) {
+			if(finish)
+				glFinish();
+			glfwSwapBuffers(window);
+			glfwPollEvents();
+			if(inSetup)
+				setupSeconds = secondsSince(frameStart);
+			else
+				frameMs.push_back(secondsSince(frameStart) * 1000.0);
+			inSetup = false;
+			stats.endFrame();
+			frameStart = timer::now();
+		}
+		passStart = timer::now();
+	}
+
+	double totalMs = 0.0;
+	for(size_t i = 0; i < frameMs.size(); i++) {
+		totalMs += frameMs[i];
+	}
+	double frames = (double)std::max(frameMs.size(), (size_t)1);
+	std::cout << std::fixed << std::setprecision(3)
+		<< "Replayed " << captureFile << ": initialization " << setupSeconds * 1000.0 << " ms, " << frameMs.size()
+		<< " frames at " << totalMs / frames << " ms per frame" << (finish ? " including the GPU" : "") << std::endl;
+	printHistogram(std::cout, frameMs);
+	stats.print(std::cout, true);
+
+	// The commands the driver spends the most time in
+	std::vector<std::pair<double, int> > order;
+	for(int c = 0; c < GLCapture::NUM_GL_COMMANDS; c++) {
+		if(commandCalls[c] > 0)
+			order.push_back(std::make_pair(commandSeconds[c], c));
+	}
+	std::sort(order.rbegin(), order.rend());
+	std::cout << "Driver time per command:" << std::endl;
+	for(size_t i = 0; i < order.size() && i < 15; i++) {
+		int c = order[i].second;
+		std::cout << "\t" << std::left << std::setw(36) << GLCapture::getCommandName(c) << std::right
+			<< std::setw(9) << order[i].first * 1000.0 / frames << " ms/frame " << std::setw(10) << commandCalls[c] / frames
+			<< " calls/frame " << std::setw(9) << order[i].first * 1e9 / commandCalls[c] << " ns/call" << std::endl;
+	}
+
+	glfwTerminate();
+	return EXIT_SUCCESS;
+}